@@ -0,0 +1,561 @@
+// mt - thread library to create C++ experiments         -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+// Contention and scalability benchmarks for the mt primitives.
+//
+// Each benchmark is run once per thread count and prints one CSV row
+// to stdout so results from two builds can be diffed or plotted:
+//
+//   benchmark,primitive,threads,params,ops,seconds,ns_per_op,ops_per_sec,fairness
+//
+// "ns_per_op" is wall time divided by the total number of operations
+// of all threads (the inverse of the throughput), and "fairness" is
+// Jain's index of the per-thread operation counts (1 = every thread
+// did the same work, 1/threads = one thread did everything). It is
+// empty for benchmarks where it doesn't make sense.
+//
+// Usage: mt_benchmark [--threads=1,2,4,8] [--duration=ms]
+//                     [--producers=list] [--consumers=list]
+//                     [--filter=name] [--no-header]
+
+#include "mt/barrier.h"
+#include "mt/channel.h"
+#include "mt/thread.h"
+#include "mt/word_lock.h"
+#include "chrono.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace mt;
+
+struct options {
+  std::vector<int> threads;
+  std::vector<int> producers;
+  std::vector<int> consumers;
+  int duration;                 // Milliseconds per run
+  std::string filter;
+  bool header;
+};
+
+options opts;
+
+//////////////////////////////////////////////////////////////////////
+// Reporting
+
+double jain_index(const std::vector<long>& ops) {
+  double sum = 0.0, sum2 = 0.0;
+  for (std::size_t i=0; i<ops.size(); ++i) {
+    sum += ops[i];
+    sum2 += double(ops[i]) * ops[i];
+  }
+  return (sum2 > 0.0 ? sum*sum / (ops.size() * sum2): 0.0);
+}
+
+void report(const char* benchmark, const char* primitive, int threads,
+            const std::string& params, long ops, double seconds,
+            const std::vector<long>* per_thread = 0) {
+  char fairness[32] = "";
+  if (per_thread)
+    std::snprintf(fairness, sizeof(fairness), "%.4f", jain_index(*per_thread));
+
+  std::printf("%s,%s,%d,%s,%ld,%.6f,%.2f,%.0f,%s\n",
+              benchmark, primitive, threads, params.c_str(), ops, seconds,
+              ops > 0 ? seconds * 1e9 / ops: 0.0,
+              seconds > 0.0 ? ops / seconds: 0.0,
+              fairness);
+  std::fflush(stdout);
+}
+
+bool enabled(const char* benchmark) {
+  return opts.filter.empty() ||
+         std::strstr(benchmark, opts.filter.c_str()) != 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Timed runs
+//
+// Worker threads wait on a barrier so all of them start at the same
+// time, loop until "stop" is set, and store their operation count in
+// ops[index] only at the end (to avoid false sharing in the loop).
+
+struct timed_run {
+  std::atomic<bool> stop;
+  barrier<> start;
+  std::vector<long> ops;
+
+  explicit timed_run(int n) : stop(false), start(n+1), ops(n, 0) { }
+
+  long total() const {
+    long sum = 0;
+    for (std::size_t i=0; i<ops.size(); ++i)
+      sum += ops[i];
+    return sum;
+  }
+};
+
+template<class Run>
+void worker_main(Run* run, int index) {
+  run->start.arrive_and_wait();
+  run->ops[index] = run->work(index);
+}
+
+// Runs Run::work() in n threads for the configured duration and
+// returns the elapsed seconds.
+template<class Run>
+double run_timed(Run& run, int n) {
+  std::vector<thread*> threads;
+  for (int i=0; i<n; ++i)
+    threads.push_back(new thread(&worker_main<Run>, &run, i));
+
+  run.start.arrive_and_wait();
+  Chrono chrono;
+  this_thread::sleep_for(opts.duration);
+  run.stop.store(true);
+
+  for (int i=0; i<n; ++i) {
+    threads[i]->join();
+    delete threads[i];
+  }
+  return chrono.elapsed();
+}
+
+// Operations done between two checks of the "stop" flag in the lock
+// loops, so the flag doesn't dominate the uncontended case.
+const int batch = 64;
+
+//////////////////////////////////////////////////////////////////////
+// Lock/unlock
+
+template<class Lock> struct lock_name;
+template<> struct lock_name<mutex> { static const char* get() { return "mutex"; } };
+template<> struct lock_name<word_lock> { static const char* get() { return "word_lock"; } };
+template<> struct lock_name<std::mutex> { static const char* get() { return "std_mutex"; } };
+
+// Keeps each lock in its own cache line(s)
+template<class Lock>
+struct padded_lock {
+  Lock lock;
+  char pad[64];
+};
+
+// Each thread locks/unlocks its own lock
+template<class Lock>
+struct uncontended_run : timed_run {
+  std::vector<padded_lock<Lock> > locks;
+
+  explicit uncontended_run(int n) : timed_run(n), locks(n) { }
+
+  long work(int index) {
+    Lock& lock = locks[index].lock;
+    long n = 0;
+    while (!stop.load(std::memory_order_relaxed)) {
+      for (int i=0; i<batch; ++i) {
+        lock.lock();
+        lock.unlock();
+      }
+      n += batch;
+    }
+    return n;
+  }
+};
+
+// All threads increment a counter protected by the same lock
+template<class Lock>
+struct contended_run : timed_run {
+  Lock lock;
+  long counter;
+
+  explicit contended_run(int n) : timed_run(n), counter(0) { }
+
+  long work(int) {
+    long n = 0;
+    while (!stop.load(std::memory_order_relaxed)) {
+      for (int i=0; i<batch; ++i) {
+        lock.lock();
+        ++counter;
+        lock.unlock();
+      }
+      n += batch;
+    }
+    return n;
+  }
+};
+
+template<class Lock>
+void bench_locks() {
+  const char* name = lock_name<Lock>::get();
+
+  if (enabled("lock_uncontended")) {
+    for (std::size_t i=0; i<opts.threads.size(); ++i) {
+      int n = opts.threads[i];
+      uncontended_run<Lock> run(n);
+      double t = run_timed(run, n);
+      report("lock_uncontended", name, n, "", run.total(), t, &run.ops);
+    }
+  }
+
+  if (enabled("lock_contended")) {
+    for (std::size_t i=0; i<opts.threads.size(); ++i) {
+      int n = opts.threads[i];
+      contended_run<Lock> run(n);
+      double t = run_timed(run, n);
+      if (run.counter != run.total())
+        std::fprintf(stderr, "lock_contended,%s: lost updates\n", name);
+      report("lock_contended", name, n, "", run.total(), t, &run.ops);
+    }
+  }
+}
+
+//////////////////////////////////////////////////////////////////////
+// Condition variable ping-pong
+//
+// Two threads pass a turn back and forth, one op is a round trip.
+
+template<class Lock, class CondVar>
+struct pingpong_run : timed_run {
+  Lock lock;
+  CondVar cv;
+  int turn;
+  bool done;
+
+  pingpong_run() : timed_run(2), turn(0), done(false) { }
+
+  long work(int index) {
+    long n = 0;
+    lock_guard<Lock> guard(lock);
+    while (true) {
+      while (turn != index && !done)
+        cv.wait(guard);
+      if (done)
+        break;
+      if (stop.load(std::memory_order_relaxed)) {
+        done = true;
+        cv.notify_one();
+        break;
+      }
+      turn = 1-index;
+      cv.notify_one();
+      if (index == 0)
+        ++n;
+    }
+    return n;
+  }
+};
+
+template<class Lock, class CondVar>
+void bench_pingpong(const char* name) {
+  pingpong_run<Lock, CondVar> run;
+  double t = run_timed(run, 2);
+  report("cv_pingpong", name, 2, "", run.total(), t);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Producer/consumer
+//
+// Producers push until the run is stopped, then the queue is closed
+// and consumers drain it. One op is one item received.
+
+class locked_queue {
+  static const std::size_t capacity = 64;
+
+  std::deque<int> m_items;
+  mutex m_mutex;
+  condition_variable m_not_full;
+  condition_variable m_not_empty;
+  bool m_closed;
+
+public:
+  locked_queue() : m_closed(false) { }
+
+  bool send(int item) {
+    lock_guard<mutex> guard(m_mutex);
+    while (m_items.size() == capacity && !m_closed)
+      m_not_full.wait(guard);
+    if (m_closed)
+      return false;
+    m_items.push_back(item);
+    m_not_empty.notify_one();
+    return true;
+  }
+
+  bool recv(int& item) {
+    lock_guard<mutex> guard(m_mutex);
+    while (m_items.empty() && !m_closed)
+      m_not_empty.wait(guard);
+    if (m_items.empty())
+      return false;
+    item = m_items.front();
+    m_items.pop_front();
+    m_not_full.notify_one();
+    return true;
+  }
+
+  void close() {
+    lock_guard<mutex> guard(m_mutex);
+    m_closed = true;
+    m_not_full.notify_all();
+    m_not_empty.notify_all();
+  }
+};
+
+template<class Queue>
+struct queue_run : timed_run {
+  Queue queue;
+  int producers;
+
+  queue_run(int p, int c) : timed_run(p+c), producers(p) { }
+
+  long work(int index) {
+    long n = 0;
+    if (index < producers) {
+      while (!stop.load(std::memory_order_relaxed) && queue.send(index))
+        ;
+      return 0;
+    }
+    int item;
+    while (queue.recv(item))
+      ++n;
+    return n;
+  }
+};
+
+struct channel_queue : channel<int> {
+  channel_queue() : channel<int>(64) { }
+};
+
+template<class Queue>
+void bench_queue(const char* name, int p, int c) {
+  int n = p+c;
+  queue_run<Queue> run(p, c);
+  std::vector<thread*> threads;
+  for (int i=0; i<n; ++i)
+    threads.push_back(new thread(&worker_main<queue_run<Queue> >, &run, i));
+
+  run.start.arrive_and_wait();
+  Chrono chrono;
+  this_thread::sleep_for(opts.duration);
+  run.stop.store(true);
+
+  for (int i=0; i<p; ++i) {
+    threads[i]->join();
+    delete threads[i];
+  }
+  run.queue.close();
+  for (int i=p; i<n; ++i) {
+    threads[i]->join();
+    delete threads[i];
+  }
+  double t = chrono.elapsed();
+
+  std::vector<long> consumed(run.ops.begin()+p, run.ops.end());
+  char params[64];
+  std::snprintf(params, sizeof(params), "p=%d;c=%d", p, c);
+  report("producer_consumer", name, n, params, run.total(), t, &consumed);
+}
+
+void bench_producer_consumer() {
+  std::vector<std::pair<int, int> > configs;
+  if (!opts.producers.empty() || !opts.consumers.empty()) {
+    std::vector<int> ps = opts.producers, cs = opts.consumers;
+    if (ps.empty()) ps.push_back(1);
+    if (cs.empty()) cs.push_back(1);
+    for (std::size_t i=0; i<ps.size(); ++i)
+      for (std::size_t j=0; j<cs.size(); ++j)
+        configs.push_back(std::make_pair(ps[i], cs[j]));
+  }
+  else {
+    // Same number of producers and consumers for each thread count
+    for (std::size_t i=0; i<opts.threads.size(); ++i) {
+      int n = opts.threads[i];
+      if (n >= 2)
+        configs.push_back(std::make_pair(n/2, n - n/2));
+    }
+  }
+
+  for (std::size_t i=0; i<configs.size(); ++i) {
+    bench_queue<locked_queue>("mutex_queue", configs[i].first, configs[i].second);
+    bench_queue<channel_queue>("channel", configs[i].first, configs[i].second);
+  }
+}
+
+//////////////////////////////////////////////////////////////////////
+// Thread create/join
+
+void empty_thread() { }
+
+void bench_thread_create() {
+  for (std::size_t i=0; i<opts.threads.size(); ++i) {
+    int n = opts.threads[i];
+    std::vector<thread*> threads(n);
+    long ops = 0;
+    Chrono chrono;
+    double t;
+    do {
+      for (int j=0; j<n; ++j)
+        threads[j] = new thread(&empty_thread);
+      for (int j=0; j<n; ++j) {
+        threads[j]->join();
+        delete threads[j];
+      }
+      ops += n;
+    } while ((t = chrono.elapsed()) * 1000.0 < opts.duration);
+    report("thread_create_join", "thread", n, "", ops, t);
+  }
+}
+
+//////////////////////////////////////////////////////////////////////
+// Dining philosophers
+//
+// One lock per fork, each philosopher takes the lower numbered fork
+// first (so there is no deadlock), eats for a while, releases both
+// forks, and thinks for a while. One op is one meal, and the fairness
+// column shows how evenly meals were distributed.
+
+const int eat_spins = 200;
+const int think_spins = 200;
+
+inline void spin(int n) {
+  for (volatile int i=0; i<n; ++i)
+    ;
+}
+
+template<class Lock>
+struct philosophers_run : timed_run {
+  std::vector<padded_lock<Lock> > forks;
+
+  explicit philosophers_run(int n) : timed_run(n), forks(n) { }
+
+  long work(int index) {
+    int n = int(forks.size());
+    int a = index, b = (index+1) % n;
+    Lock& first = forks[a < b ? a: b].lock;
+    Lock& second = forks[a < b ? b: a].lock;
+    long meals = 0;
+    while (!stop.load(std::memory_order_relaxed)) {
+      first.lock();
+      second.lock();
+      spin(eat_spins);
+      ++meals;
+      second.unlock();
+      first.unlock();
+      spin(think_spins);
+    }
+    return meals;
+  }
+};
+
+template<class Lock>
+void bench_philosophers() {
+  for (std::size_t i=0; i<opts.threads.size(); ++i) {
+    int n = opts.threads[i];
+    if (n < 2)
+      continue;
+
+    philosophers_run<Lock> run(n);
+    double t = run_timed(run, n);
+
+    long lo = run.ops[0], hi = run.ops[0];
+    for (int j=1; j<n; ++j) {
+      if (run.ops[j] < lo) lo = run.ops[j];
+      if (run.ops[j] > hi) hi = run.ops[j];
+    }
+    char params[64];
+    std::snprintf(params, sizeof(params), "min=%ld;max=%ld", lo, hi);
+    report("dining_philosophers", lock_name<Lock>::get(), n, params,
+           run.total(), t, &run.ops);
+  }
+}
+
+//////////////////////////////////////////////////////////////////////
+// Command line
+
+bool parse_list(const char* arg, const char* prefix, std::vector<int>& list) {
+  std::size_t len = std::strlen(prefix);
+  if (std::strncmp(arg, prefix, len) != 0)
+    return false;
+
+  list.clear();
+  const char* p = arg+len;
+  while (*p) {
+    char* end;
+    long n = std::strtol(p, &end, 10);
+    if (end == p || n < 1)
+      break;
+    list.push_back(int(n));
+    p = (*end == ',' ? end+1: end);
+  }
+  return true;
+}
+
+bool parse_args(int argc, char* argv[]) {
+  opts.duration = 200;
+  opts.header = true;
+
+  for (int i=1; i<argc; ++i) {
+    const char* arg = argv[i];
+    if (parse_list(arg, "--threads=", opts.threads) ||
+        parse_list(arg, "--producers=", opts.producers) ||
+        parse_list(arg, "--consumers=", opts.consumers))
+      continue;
+    else if (std::strncmp(arg, "--duration=", 11) == 0)
+      opts.duration = std::atoi(arg+11);
+    else if (std::strncmp(arg, "--filter=", 9) == 0)
+      opts.filter = arg+9;
+    else if (std::strcmp(arg, "--no-header") == 0)
+      opts.header = false;
+    else
+      return false;
+  }
+
+  if (opts.threads.empty()) {
+    opts.threads.push_back(1);
+    opts.threads.push_back(2);
+    opts.threads.push_back(4);
+    opts.threads.push_back(8);
+  }
+  return opts.duration > 0;
+}
+
+int main(int argc, char* argv[]) {
+  if (!parse_args(argc, argv)) {
+    std::fprintf(stderr,
+                 "Usage: %s [--threads=1,2,4,8] [--duration=ms]\n"
+                 "          [--producers=list] [--consumers=list]\n"
+                 "          [--filter=name] [--no-header]\n", argv[0]);
+    return 1;
+  }
+
+  if (opts.header)
+    std::printf("benchmark,primitive,threads,params,ops,seconds,ns_per_op,ops_per_sec,fairness\n");
+
+  bench_locks<mutex>();
+  bench_locks<word_lock>();
+  bench_locks<std::mutex>();
+
+  if (enabled("cv_pingpong")) {
+    bench_pingpong<mutex, condition_variable>("condition_variable");
+    bench_pingpong<word_lock, word_condition_variable>("word_condition_variable");
+  }
+
+  if (enabled("producer_consumer"))
+    bench_producer_consumer();
+
+  if (enabled("thread_create_join"))
+    bench_thread_create();
+
+  if (enabled("dining_philosophers")) {
+    bench_philosophers<mutex>();
+    bench_philosophers<word_lock>();
+  }
+  return 0;
+}
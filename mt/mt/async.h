@@ -0,0 +1,312 @@
+// mt - thread library to create C++ experiments         -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+#ifndef MT_ASYNC_HEADER_FILE_INCLUDED
+#define MT_ASYNC_HEADER_FILE_INCLUDED
+
+// C++20 coroutines are required for this header
+
+#include "mt/thread.h"
+#include "mt/scheduler.h"
+
+#include <atomic>
+#include <cassert>
+#include <coroutine>
+#include <deque>
+#include <optional>
+#include <utility>
+
+namespace mt {
+
+  namespace details {
+
+    //////////////////////////////////////////////////////////////////////
+    // async_waiter struct
+    //
+    // Node of the intrusive FIFO of suspended coroutines of each async
+    // primitive. It lives inside the awaiter (i.e. inside the coroutine
+    // frame), so suspending doesn't allocate anything.
+
+    struct async_waiter {
+      std::coroutine_handle<> handle;
+      scheduler* sched;         // Where the coroutine must be resumed
+      async_waiter* next;
+
+      // Resumes the coroutine in its scheduler (or in the current
+      // thread if it was suspended outside a scheduler worker)
+      void resume() {
+        if (sched)
+          sched->post(handle);
+        else
+          handle.resume();
+      }
+    };
+
+    class async_waiter_list {
+    public:
+      async_waiter_list() : m_head(NULL), m_tail(NULL) { }
+
+      bool empty() const { return m_head == NULL; }
+
+      void push(async_waiter* w) {
+        w->next = NULL;
+        if (m_tail)
+          m_tail->next = w;
+        else
+          m_head = w;
+        m_tail = w;
+      }
+
+      async_waiter* pop() {
+        async_waiter* w = m_head;
+        m_head = w->next;
+        if (!m_head)
+          m_tail = NULL;
+        return w;
+      }
+
+    private:
+      async_waiter* m_head;
+      async_waiter* m_tail;
+    };
+
+  } // namespace details
+
+  //////////////////////////////////////////////////////////////////////
+  // async_mutex class
+  //
+  // Mutex for coroutines: "co_await m.lock()" suspends the coroutine
+  // (not the thread) if the mutex is locked. The uncontended lock is a
+  // single CAS, the internal mt::mutex only protects the waiters list
+  // for a few instructions. unlock() hands the ownership directly to
+  // the first waiter (FIFO) and posts it to its scheduler.
+
+  class async_mutex {
+  public:
+    async_mutex() : m_locked(false) { }
+
+    ~async_mutex() {
+      assert(m_waiters.empty());
+    }
+
+    bool try_lock() {
+      bool expected = false;
+      return m_locked.compare_exchange_strong(expected, true,
+                                              std::memory_order_acquire,
+                                              std::memory_order_relaxed);
+    }
+
+    struct lock_awaiter {
+      async_mutex* m_mutex;
+      details::async_waiter m_waiter;
+
+      bool await_ready() { return m_mutex->try_lock(); }
+
+      bool await_suspend(std::coroutine_handle<> h) {
+        lock_guard<mutex> lock(m_mutex->m_monitor);
+        if (m_mutex->try_lock())
+          return false;         // Continue without suspension
+
+        m_waiter.handle = h;
+        m_waiter.sched = scheduler::current();
+        m_mutex->m_waiters.push(&m_waiter);
+        return true;
+      }
+
+      void await_resume() const noexcept { }
+    };
+
+    lock_awaiter lock() {
+      lock_awaiter a = { this, details::async_waiter() };
+      return a;
+    }
+
+    void unlock() {
+      details::async_waiter* next = NULL;
+      {
+        lock_guard<mutex> lock(m_monitor);
+        if (m_waiters.empty())
+          m_locked.store(false, std::memory_order_release);
+        else
+          next = m_waiters.pop(); // The mutex keeps locked for "next"
+      }
+      if (next)
+        next->resume();
+    }
+
+  private:
+    std::atomic<bool> m_locked;
+    mutex m_monitor;
+    details::async_waiter_list m_waiters;
+
+    // Non-copyable
+    async_mutex(const async_mutex&);
+    async_mutex& operator=(const async_mutex&);
+  };
+
+  //////////////////////////////////////////////////////////////////////
+  // async_semaphore class
+  //
+  // Counting semaphore for coroutines, "co_await sem.acquire()".
+
+  class async_semaphore {
+  public:
+    explicit async_semaphore(int desired) : m_count(desired) { }
+
+    ~async_semaphore() {
+      assert(m_waiters.empty());
+    }
+
+    bool try_acquire() {
+      int count = m_count.load(std::memory_order_relaxed);
+      while (count > 0) {
+        if (m_count.compare_exchange_weak(count, count-1,
+                                          std::memory_order_acquire,
+                                          std::memory_order_relaxed))
+          return true;
+      }
+      return false;
+    }
+
+    struct acquire_awaiter {
+      async_semaphore* m_sem;
+      details::async_waiter m_waiter;
+
+      bool await_ready() { return m_sem->try_acquire(); }
+
+      bool await_suspend(std::coroutine_handle<> h) {
+        lock_guard<mutex> lock(m_sem->m_monitor);
+        if (m_sem->try_acquire())
+          return false;
+
+        m_waiter.handle = h;
+        m_waiter.sched = scheduler::current();
+        m_sem->m_waiters.push(&m_waiter);
+        return true;
+      }
+
+      void await_resume() const noexcept { }
+    };
+
+    acquire_awaiter acquire() {
+      acquire_awaiter a = { this, details::async_waiter() };
+      return a;
+    }
+
+    void release(int update = 1) {
+      details::async_waiter_list to_resume;
+      {
+        lock_guard<mutex> lock(m_monitor);
+        // Units are given directly to waiters, the rest go to m_count
+        while (update > 0 && !m_waiters.empty()) {
+          to_resume.push(m_waiters.pop());
+          --update;
+        }
+        if (update > 0)
+          m_count.fetch_add(update, std::memory_order_release);
+      }
+      while (!to_resume.empty())
+        to_resume.pop()->resume();
+    }
+
+  private:
+    std::atomic<int> m_count;
+    mutex m_monitor;
+    details::async_waiter_list m_waiters;
+
+    // Non-copyable
+    async_semaphore(const async_semaphore&);
+    async_semaphore& operator=(const async_semaphore&);
+  };
+
+  //////////////////////////////////////////////////////////////////////
+  // async_queue class
+  //
+  // Unbounded MPMC queue where consumers are coroutines:
+  // "T item = co_await queue.pop()". A push() with waiting consumers
+  // moves the item directly into the first waiter's awaiter.
+
+  template<class T>
+  class async_queue {
+  public:
+    async_queue() { }
+
+    ~async_queue() {
+      assert(m_waiters.empty());
+    }
+
+    void push(T item) {
+      pop_awaiter* waiter = NULL;
+      {
+        lock_guard<mutex> lock(m_monitor);
+        if (m_waiters.empty()) {
+          m_items.push_back(std::move(item));
+          return;
+        }
+        waiter = static_cast<pop_awaiter*>(m_waiters.pop());
+        waiter->m_item.emplace(std::move(item));
+      }
+      waiter->resume();
+    }
+
+    bool try_pop(T& item) {
+      lock_guard<mutex> lock(m_monitor);
+      if (m_items.empty())
+        return false;
+      item = std::move(m_items.front());
+      m_items.pop_front();
+      return true;
+    }
+
+    struct pop_awaiter : public details::async_waiter {
+      async_queue* m_queue;
+      std::optional<T> m_item;
+
+      explicit pop_awaiter(async_queue* queue)
+        : details::async_waiter()
+        , m_queue(queue) {
+      }
+
+      bool await_ready() const noexcept { return false; }
+
+      bool await_suspend(std::coroutine_handle<> h) {
+        lock_guard<mutex> lock(m_queue->m_monitor);
+        if (!m_queue->m_items.empty()) {
+          m_item.emplace(std::move(m_queue->m_items.front()));
+          m_queue->m_items.pop_front();
+          return false;
+        }
+
+        handle = h;
+        sched = scheduler::current();
+        m_queue->m_waiters.push(this);
+        return true;
+      }
+
+      T await_resume() {
+        return std::move(*m_item);
+      }
+    };
+
+    pop_awaiter pop() {
+      return pop_awaiter(this);
+    }
+
+  private:
+    friend struct pop_awaiter;
+
+    mutex m_monitor;
+    std::deque<T> m_items;
+    details::async_waiter_list m_waiters;
+
+    // Non-copyable
+    async_queue(const async_queue&);
+    async_queue& operator=(const async_queue&);
+  };
+
+} // namespace mt
+
+#endif // MT_ASYNC_HEADER_FILE_INCLUDED
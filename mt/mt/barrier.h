@@ -0,0 +1,119 @@
+// mt - thread library to create C++ experiments         -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+#ifndef MT_BARRIER_HEADER_FILE_INCLUDED
+#define MT_BARRIER_HEADER_FILE_INCLUDED
+
+#include "mt/futex.h"
+
+#include <cassert>
+
+namespace mt {
+
+  //////////////////////////////////////////////////////////////////////
+  // barrier class
+  //
+  // Reusable barrier for a fixed number of threads (C++20 like). The
+  // last thread that arrives in each phase calls the completion
+  // function and then releases the others.
+  //
+  // There is no internal mutex: the arrival counter is decremented
+  // atomically and waiters spin on the phase word, and only when the
+  // spin doesn't succeed they mark the word as "has sleepers" (lower
+  // bit) and park in the futex. The last thread only does the wake
+  // system call if someone is really sleeping.
+
+  struct empty_completion {
+    void operator()() { }
+  };
+
+  template<class CompletionFunction = empty_completion>
+  class barrier {
+  public:
+    explicit barrier(int expected,
+                     CompletionFunction completion = CompletionFunction())
+      : m_completion(completion)
+      , m_expected(expected)
+      , m_remaining(expected)
+      , m_phase(0) {
+      assert(expected > 0);
+    }
+
+    // Blocks the current thread until all threads arrive
+    void arrive_and_wait() {
+      int phase = m_phase.load(std::memory_order_acquire) & ~sleepers_bit;
+      if (!arrive(1))
+        wait_phase(phase);
+    }
+
+    // Arrives to the barrier and removes the current thread from the
+    // set of expected threads of the next phases.
+    void arrive_and_drop() {
+      m_expected.fetch_sub(1, std::memory_order_relaxed);
+      arrive(1);
+    }
+
+  private:
+    static const int sleepers_bit = 1;
+    static const int phase_step = 2;
+
+    // Returns true if this was the last thread of the phase
+    bool arrive(int n) {
+      if (m_remaining.fetch_sub(n, std::memory_order_acq_rel) != n)
+        return false;
+
+      m_completion();
+
+      // Re-arm the barrier before we release the other threads, they
+      // cannot arrive again until the phase is changed.
+      m_remaining.store(m_expected.load(std::memory_order_relaxed),
+                        std::memory_order_relaxed);
+
+      int old = m_phase.load(std::memory_order_relaxed);
+      int next = static_cast<int>(static_cast<unsigned>(old & ~sleepers_bit) + phase_step);
+      old = m_phase.exchange(next, std::memory_order_acq_rel);
+      if (old & sleepers_bit)
+        futex::wake_all(m_phase);
+      return true;
+    }
+
+    void wait_phase(int phase) {
+      int cur;
+      for (int i=0; i<futex::spin_count(); ++i) {
+        cur = m_phase.load(std::memory_order_acquire);
+        if ((cur & ~sleepers_bit) != phase)
+          return;
+        futex::cpu_relax();
+      }
+
+      cur = m_phase.load(std::memory_order_acquire);
+      for (;;) {
+        if ((cur & ~sleepers_bit) != phase)
+          return;
+
+        if (!(cur & sleepers_bit) &&
+            !m_phase.compare_exchange_weak(cur, cur | sleepers_bit,
+                                           std::memory_order_acq_rel))
+          continue;             // "cur" was updated, check it again
+
+        futex::wait(m_phase, phase | sleepers_bit);
+        cur = m_phase.load(std::memory_order_acquire);
+      }
+    }
+
+    CompletionFunction m_completion;
+    std::atomic<int> m_expected;  // Threads in the next phase
+    std::atomic<int> m_remaining; // Threads that must arrive in this phase
+    futex::word m_phase;          // Phase counter | sleepers_bit
+
+    // Non-copyable
+    barrier(const barrier&);
+    barrier& operator=(const barrier&);
+  };
+
+} // namespace mt
+
+#endif // MT_BARRIER_HEADER_FILE_INCLUDED
@@ -0,0 +1,536 @@
+// mt - thread library to create C++ experiments         -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+#ifndef MT_CHANNEL_HEADER_FILE_INCLUDED
+#define MT_CHANNEL_HEADER_FILE_INCLUDED
+
+#include "mt/thread.h"
+#include "mt/futex.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <vector>
+
+namespace mt {
+
+  namespace details {
+
+    //////////////////////////////////////////////////////////////////////
+    // chan_sync struct
+    //
+    // State of one blocked operation (a send, a recv, or a select with
+    // several cases). It lives in the stack of the blocked thread. The
+    // first channel that claims it (CAS in "selected") completes the
+    // operation and wakes the thread through the "done" futex word.
+
+    struct chan_sync {
+      static const int none = -1;
+      static const int timed_out = -2;
+
+      futex::word done;
+      std::atomic<int> selected;
+
+      chan_sync() : done(0), selected(none) { }
+
+      bool claim(int index) {
+        int expected = none;
+        return selected.compare_exchange_strong(expected, index,
+                                                std::memory_order_acq_rel);
+      }
+
+      // Blocks until the operation is completed by other thread. Returns
+      // false if the timeout (milliseconds, -1 = infinite) elapsed
+      // before any case was selected.
+      bool park(int timeout) {
+        if (futex::spin_while_equal(done, 0))
+          return true;
+
+        if (timeout >= 0) {
+          std::chrono::steady_clock::time_point deadline =
+            std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+
+          while (done.load(std::memory_order_acquire) == 0) {
+            int remaining = static_cast<int>(
+              std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now()).count());
+
+            if (remaining <= 0 || !futex::wait_for(done, 0, remaining)) {
+              int expected = none;
+              if (selected.compare_exchange_strong(expected, timed_out,
+                                                   std::memory_order_acq_rel))
+                return false;
+              break;            // Claimed by a channel, wait the completion
+            }
+          }
+        }
+
+        while (done.load(std::memory_order_acquire) == 0)
+          futex::wait(done, 0);
+        return true;
+      }
+    };
+
+    // Node of the waiting queues of a channel (in the stack of the
+    // blocked thread, so parking doesn't allocate)
+    struct chan_waiter {
+      chan_sync* sync;
+      int index;                // Case index in the select
+      void* data;               // Value to send, or where to receive it
+      bool ok;                  // False if the channel was closed
+      bool queued;
+      chan_waiter* prev;
+      chan_waiter* next;
+
+      chan_waiter()
+        : sync(NULL), index(0), data(NULL), ok(false)
+        , queued(false), prev(NULL), next(NULL) {
+      }
+
+      chan_waiter(chan_sync* sync, int index, void* data)
+        : sync(sync), index(index), data(data), ok(false)
+        , queued(false), prev(NULL), next(NULL) {
+      }
+    };
+
+    class chan_waitq {
+    public:
+      chan_waitq() : m_head(NULL), m_tail(NULL) { }
+
+      bool empty() const { return m_head == NULL; }
+
+      void push(chan_waiter* w) {
+        w->prev = m_tail;
+        w->next = NULL;
+        if (m_tail)
+          m_tail->next = w;
+        else
+          m_head = w;
+        m_tail = w;
+        w->queued = true;
+      }
+
+      void remove(chan_waiter* w) {
+        if (!w->queued)
+          return;
+        if (w->prev) w->prev->next = w->next; else m_head = w->next;
+        if (w->next) w->next->prev = w->prev; else m_tail = w->prev;
+        w->queued = false;
+      }
+
+      // Returns the first waiter that we can complete (stale waiters of
+      // selects that were already completed by other case are dropped)
+      chan_waiter* pop_claimable() {
+        while (m_head) {
+          chan_waiter* w = m_head;
+          remove(w);
+          if (w->sync->claim(w->index))
+            return w;
+        }
+        return NULL;
+      }
+
+    private:
+      chan_waiter* m_head;
+      chan_waiter* m_tail;
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    // channel_base class
+    //
+    // Untyped part of a channel, used by select to work with channels
+    // of different types.
+
+    class channel_base {
+    public:
+      channel_base() : m_closed(false) { }
+      virtual ~channel_base() { }
+
+      // These functions are called with m_mutex locked. They return
+      // true if the operation was completed (ok = false if the channel
+      // is closed). "to_wake" is a futex word that must be woken up
+      // after unlocking the mutex.
+      virtual bool try_send_locked(void* value, bool& ok, futex::word*& to_wake) = 0;
+      virtual bool try_recv_locked(void* value, bool& ok, futex::word*& to_wake) = 0;
+
+      mutex m_mutex;
+      bool m_closed;
+      chan_waitq m_recvq;       // Blocked receivers
+      chan_waitq m_sendq;       // Blocked senders
+
+    protected:
+      // Completes a claimed waiter (the thread can leave as soon as it
+      // sees done=1, so "w" cannot be used after this)
+      static futex::word* complete(chan_waiter* w, bool ok) {
+        w->ok = ok;
+        futex::word* done = &w->sync->done;
+        done->store(1, std::memory_order_release);
+        return done;
+      }
+
+    private:
+      // Non-copyable
+      channel_base(const channel_base&);
+      channel_base& operator=(const channel_base&);
+    };
+
+    inline void wake(futex::word* to_wake) {
+      if (to_wake)
+        futex::wake_one(*to_wake);
+    }
+
+  } // namespace details
+
+  //////////////////////////////////////////////////////////////////////
+  // channel class
+  //
+  // Go-like typed channel between threads. With capacity 0 it's
+  // unbuffered (a send waits for a receiver and the value goes
+  // directly from the sender's stack to the receiver's), otherwise it
+  // has a fixed ring buffer allocated in the constructor.
+  //
+  // Blocked threads wait in intrusive queues and each one parks on its
+  // own futex word, so a send wakes exactly one receiver. Sending and
+  // receiving never allocate memory.
+  //
+  // close() wakes all the waiters: blocked and future sends return
+  // false, and receivers get the buffered values and then false.
+
+  template<class T>
+  class channel : public details::channel_base {
+  public:
+    explicit channel(std::size_t capacity = 0)
+      : m_buffer(capacity)
+      , m_head(0)
+      , m_count(0) {
+    }
+
+    ~channel() {
+      assert(m_recvq.empty() && m_sendq.empty());
+    }
+
+    std::size_t capacity() const {
+      return m_buffer.size();
+    }
+
+    // Returns false if the channel is closed
+    bool send(const T& value) {
+      return send_impl(value, -1);
+    }
+
+    // Returns false if the channel is closed and empty
+    bool recv(T& value) {
+      return recv_impl(value, -1);
+    }
+
+    // Returns false if the channel is closed or it's full (or there is
+    // no receiver for an unbuffered channel)
+    bool try_send(const T& value) {
+      return send_impl(value, 0);
+    }
+
+    bool try_recv(T& value) {
+      return recv_impl(value, 0);
+    }
+
+    void close() {
+      lock_guard<mutex> lock(m_mutex);
+      m_closed = true;
+
+      details::chan_waiter* w;
+      while ((w = m_recvq.pop_claimable()))
+        futex::wake_one(*complete(w, false));
+      while ((w = m_sendq.pop_claimable()))
+        futex::wake_one(*complete(w, false));
+    }
+
+    bool closed() {
+      lock_guard<mutex> lock(m_mutex);
+      return m_closed;
+    }
+
+    virtual bool try_send_locked(void* data, bool& ok, futex::word*& to_wake) {
+      const T& value = *static_cast<const T*>(data);
+      if (m_closed) {
+        ok = false;
+        return true;
+      }
+
+      // Give the value directly to a blocked receiver
+      if (details::chan_waiter* w = m_recvq.pop_claimable()) {
+        *static_cast<T*>(w->data) = value;
+        to_wake = complete(w, true);
+        ok = true;
+        return true;
+      }
+
+      if (m_count < m_buffer.size()) {
+        m_buffer[(m_head + m_count) % m_buffer.size()] = value;
+        ++m_count;
+        ok = true;
+        return true;
+      }
+      return false;
+    }
+
+    virtual bool try_recv_locked(void* data, bool& ok, futex::word*& to_wake) {
+      T& value = *static_cast<T*>(data);
+
+      if (m_count > 0) {
+        value = m_buffer[m_head];
+        m_head = (m_head+1) % m_buffer.size();
+        --m_count;
+
+        // A blocked sender can use the free space now
+        if (details::chan_waiter* w = m_sendq.pop_claimable()) {
+          m_buffer[(m_head + m_count) % m_buffer.size()] = *static_cast<const T*>(w->data);
+          ++m_count;
+          to_wake = complete(w, true);
+        }
+        ok = true;
+        return true;
+      }
+
+      // Unbuffered channel: take the value from a blocked sender
+      if (details::chan_waiter* w = m_sendq.pop_claimable()) {
+        value = *static_cast<const T*>(w->data);
+        to_wake = complete(w, true);
+        ok = true;
+        return true;
+      }
+
+      if (m_closed) {
+        ok = false;
+        return true;
+      }
+      return false;
+    }
+
+  private:
+    bool send_impl(const T& value, int timeout) {
+      details::chan_sync sync;
+      details::chan_waiter w(&sync, 0, const_cast<T*>(&value));
+      futex::word* to_wake = NULL;
+      bool ok = false;
+
+      m_mutex.lock();
+      if (try_send_locked(w.data, ok, to_wake)) {
+        m_mutex.unlock();
+        details::wake(to_wake);
+        return ok;
+      }
+      if (timeout == 0) {
+        m_mutex.unlock();
+        return false;
+      }
+      m_sendq.push(&w);
+      m_mutex.unlock();
+
+      return park(w, m_sendq, timeout);
+    }
+
+    bool recv_impl(T& value, int timeout) {
+      details::chan_sync sync;
+      details::chan_waiter w(&sync, 0, &value);
+      futex::word* to_wake = NULL;
+      bool ok = false;
+
+      m_mutex.lock();
+      if (try_recv_locked(w.data, ok, to_wake)) {
+        m_mutex.unlock();
+        details::wake(to_wake);
+        return ok;
+      }
+      if (timeout == 0) {
+        m_mutex.unlock();
+        return false;
+      }
+      m_recvq.push(&w);
+      m_mutex.unlock();
+
+      return park(w, m_recvq, timeout);
+    }
+
+    bool park(details::chan_waiter& w, details::chan_waitq& q, int timeout) {
+      if (!w.sync->park(timeout)) {
+        lock_guard<mutex> lock(m_mutex);
+        q.remove(&w);
+        return false;
+      }
+      return w.ok;
+    }
+
+    std::vector<T> m_buffer;
+    std::size_t m_head;
+    std::size_t m_count;
+  };
+
+  //////////////////////////////////////////////////////////////////////
+  // select class
+  //
+  // Waits for the first ready case of several channel operations:
+  //
+  //   int a; std::string b;
+  //   mt::select sel;
+  //   sel.recv(ch1, a).recv(ch2, b).send(ch3, 5);
+  //   switch (sel.wait_for(100)) {
+  //     case 0: ... break;  // Received "a" from ch1
+  //     case 1: ... break;  // Received "b" from ch2
+  //     case 2: ... break;  // Sent 5 to ch3
+  //     case mt::select::timeout: ... break;
+  //   }
+  //
+  // All the involved channels are locked (in address order) to check
+  // the cases atomically. If none is ready, the thread is queued in all
+  // the channels with one shared chan_sync, and the first channel that
+  // claims it completes that case.
+  //
+  // Use the qualified name (mt::select) as POSIX also declares a
+  // select() function.
+
+  class select {
+  public:
+    static const int timeout = -1;
+    static const int max_cases = 16;
+
+    select() : m_ncases(0) { }
+
+    template<class T>
+    select& recv(channel<T>& ch, T& value, bool* ok = NULL) {
+      add_case(&ch, false, &value, ok);
+      return *this;
+    }
+
+    template<class T>
+    select& send(channel<T>& ch, const T& value, bool* ok = NULL) {
+      add_case(&ch, true, const_cast<T*>(&value), ok);
+      return *this;
+    }
+
+    // Blocks until a case is completed, returns its index
+    int wait() {
+      return run(-1);
+    }
+
+    // Returns select::timeout if no case is completed in the given time
+    int wait_for(int milliseconds) {
+      return run(milliseconds < 0 ? 0: milliseconds);
+    }
+
+    // Like a select with a "default" case in Go
+    int try_wait() {
+      return run(0);
+    }
+
+  private:
+    struct select_case {
+      details::channel_base* ch;
+      bool is_send;
+      void* data;
+      bool* ok;
+    };
+
+    void add_case(details::channel_base* ch, bool is_send, void* data, bool* ok) {
+      assert(m_ncases < max_cases);
+      select_case c = { ch, is_send, data, ok };
+      m_cases[m_ncases++] = c;
+    }
+
+    void lock_all(details::channel_base** chans, int n) {
+      for (int i=0; i<n; ++i)
+        chans[i]->m_mutex.lock();
+    }
+
+    void unlock_all(details::channel_base** chans, int n) {
+      for (int i=n-1; i>=0; --i)
+        chans[i]->m_mutex.unlock();
+    }
+
+    int run(int timeout_msecs) {
+      // Sorted unique channels, to lock them without deadlocks
+      details::channel_base* chans[max_cases];
+      int nchans = 0;
+      for (int i=0; i<m_ncases; ++i)
+        chans[nchans++] = m_cases[i].ch;
+      std::sort(chans, chans+nchans);
+      nchans = static_cast<int>(std::unique(chans, chans+nchans) - chans);
+
+      lock_all(chans, nchans);
+
+      // Start from a different case each time (fairness between cases)
+      int start = (m_ncases > 0 ? static_cast<int>(next_start() % m_ncases): 0);
+      for (int k=0; k<m_ncases; ++k) {
+        int i = (start + k) % m_ncases;
+        select_case& c = m_cases[i];
+        futex::word* to_wake = NULL;
+        bool ok = false;
+        bool done = (c.is_send ?
+                     c.ch->try_send_locked(c.data, ok, to_wake):
+                     c.ch->try_recv_locked(c.data, ok, to_wake));
+        if (done) {
+          unlock_all(chans, nchans);
+          details::wake(to_wake);
+          if (c.ok)
+            *c.ok = ok;
+          return i;
+        }
+      }
+
+      if (timeout_msecs == 0) {
+        unlock_all(chans, nchans);
+        return timeout;
+      }
+
+      // Queue a waiter in each channel
+      details::chan_sync sync;
+      details::chan_waiter waiters[max_cases];
+      for (int i=0; i<m_ncases; ++i) {
+        select_case& c = m_cases[i];
+        waiters[i].sync = &sync;
+        waiters[i].index = i;
+        waiters[i].data = c.data;
+        (c.is_send ? c.ch->m_sendq: c.ch->m_recvq).push(&waiters[i]);
+      }
+      unlock_all(chans, nchans);
+
+      bool selected = sync.park(timeout_msecs);
+      int index = sync.selected.load(std::memory_order_acquire);
+
+      // Remove the waiters of the other cases
+      for (int i=0; i<m_ncases; ++i) {
+        select_case& c = m_cases[i];
+        if (selected && i == index)
+          continue;
+        lock_guard<mutex> lock(c.ch->m_mutex);
+        (c.is_send ? c.ch->m_sendq: c.ch->m_recvq).remove(&waiters[i]);
+      }
+
+      if (!selected)
+        return timeout;
+      if (m_cases[index].ok)
+        *m_cases[index].ok = waiters[index].ok;
+      return index;
+    }
+
+    static unsigned next_start() {
+      static thread_local unsigned seed = 1;
+      seed = seed*1103515245 + 12345;
+      return seed >> 16;
+    }
+
+    select_case m_cases[max_cases];
+    int m_ncases;
+
+    // Non-copyable
+    select(const select&);
+    select& operator=(const select&);
+  };
+
+} // namespace mt
+
+#endif // MT_CHANNEL_HEADER_FILE_INCLUDED
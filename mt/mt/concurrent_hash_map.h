@@ -0,0 +1,574 @@
+// mt - thread library to create C++ experiments         -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+#ifndef MT_CONCURRENT_HASH_MAP_HEADER_FILE_INCLUDED
+#define MT_CONCURRENT_HASH_MAP_HEADER_FILE_INCLUDED
+
+#include "mt/thread.h"
+#include "mt/futex.h"           // futex::cpu_relax()
+#include "mt/epoch.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <type_traits>
+
+namespace mt {
+
+  //////////////////////////////////////////////////////////////////////
+  // concurrent_hash_map class
+  //
+  // Hash map for shared caches where lookups are much more frequent
+  // than modifications.
+  //
+  // Layout: open addressing over groups of 8 slots. Each group fits a
+  // few cache lines and contains a version word, an overflow counter,
+  // 8 one-byte tags (7 bits of the hash) and the keys/values inline.
+  // A key is probed from its home group to the next ones while the
+  // group's overflow counter (keys that were displaced past it) isn't
+  // zero, so a miss usually touches only one group.
+  //
+  // Reads: lock-free. The version word of each group is a seqlock, a
+  // reader copies what it needs and retries if the version changed.
+  // That's why K and V must be trivially copyable.
+  //
+  // Writes: the version word is also the writer lock of the group
+  // (odd = locked), so locking is striped per group. Writers lock
+  // groups in increasing index order (the table doesn't wrap around,
+  // it has some extra groups at the end), so they cannot deadlock.
+  //
+  // Resizing is incremental: when the load factor is exceeded a table
+  // twice as big is attached to the current one, and each writer
+  // migrates a chunk of groups before doing its operation. A migrated
+  // group is marked as "moved" and readers/writers that find it go to
+  // the new table. Groups are moved in clusters (runs of groups linked
+  // by overflow counters), so a probe chain is never split between both
+  // tables. Old tables are freed with the epoch_domain. If a cluster
+  // doesn't fit in the new table (a very bad hash distribution), the new
+  // table is migrated to another table twice as big and the cluster is
+  // copied there.
+  //
+  // Limits: only one writer at a time migrates groups (the others
+  // continue with their operations and only wait for the migration
+  // when they cannot insert their key), so the migration advances only
+  // while there are writes; meanwhile lookups of moved groups visit
+  // both tables. With a single thread it's a bit slower than a
+  // std::unordered_map with an uncontended mutex: each operation pins
+  // the epoch (a full fence) and writers lock the group with a CAS, so
+  // it's useful when several threads read at the same time.
+
+  template<class K, class V,
+           class Hash = std::hash<K>,
+           class KeyEqual = std::equal_to<K> >
+  class concurrent_hash_map {
+    static_assert(std::is_trivially_copyable<K>::value &&
+                  std::is_trivially_copyable<V>::value,
+                  "Lock-free readers copy keys and values while they can be modified");
+
+  public:
+    typedef K key_type;
+    typedef V mapped_type;
+
+    explicit concurrent_hash_map(std::size_t initial_capacity = 64,
+                                 epoch_domain& domain = epoch_domain::global())
+      : m_domain(domain) {
+      std::size_t ngroups = 1;
+      while (ngroups*slots_per_group*3/4 < initial_capacity)
+        ngroups *= 2;
+      m_table.store(create_table(ngroups), std::memory_order_relaxed);
+      for (int i=0; i<counter_stripes; ++i)
+        m_counts[i].value.store(0, std::memory_order_relaxed);
+    }
+
+    ~concurrent_hash_map() {
+      table* t = m_table.load(std::memory_order_relaxed);
+      while (t) {
+        table* next = t->next.load(std::memory_order_relaxed);
+        destroy_table(t);
+        t = next;
+      }
+    }
+
+    // Copies the value associated to "key" in "value"
+    bool find(const K& key, V& value) const {
+      epoch_guard guard(m_domain);
+      std::size_t h = hash(key);
+      return find_in(m_table.load(std::memory_order_acquire), h, key, &value);
+    }
+
+    bool contains(const K& key) const {
+      epoch_guard guard(m_domain);
+      std::size_t h = hash(key);
+      return find_in(m_table.load(std::memory_order_acquire), h, key, NULL);
+    }
+
+    // Returns false if the key already existed (it's not modified)
+    bool insert(const K& key, const V& value) {
+      return modify(key, &value, insert_only) == inserted;
+    }
+
+    // Returns true if the key was inserted, false if it was assigned
+    bool insert_or_assign(const K& key, const V& value) {
+      return modify(key, &value, insert_or_update) == inserted;
+    }
+
+    bool erase(const K& key) {
+      return modify(key, NULL, remove) == removed;
+    }
+
+    // Approximate number of elements (exact if there are no writers)
+    std::size_t size() const {
+      long n = 0;
+      for (int i=0; i<counter_stripes; ++i)
+        n += m_counts[i].value.load(std::memory_order_relaxed);
+      return (n > 0 ? static_cast<std::size_t>(n): 0);
+    }
+
+  private:
+    static const int slots_per_group = 8;
+    static const int extra_groups = 8;      // Tail groups (no wrap around)
+    static const int migration_chunk = 16;  // Groups migrated per operation
+    static const int counter_stripes = 16;
+
+    // Version word bits
+    static const unsigned locked_bit = 1;
+    static const unsigned moved_bit = 2;
+    static const unsigned version_step = 4;
+
+    struct group {
+      std::atomic<unsigned> version;
+      std::atomic<unsigned char> overflow;           // Saturates at 255
+      std::atomic<unsigned char> tags[slots_per_group]; // 0 = empty
+      K keys[slots_per_group];
+      V values[slots_per_group];
+    };
+
+    struct table {
+      std::size_t ngroups;      // Power of two, + extra_groups allocated
+      std::size_t mask;
+      group* groups;
+      void* memory;
+      std::atomic<table*> next; // Table that we are migrating to
+      std::size_t migrated;     // Groups already migrated (m_migrate_mutex)
+
+      std::size_t capacity() const { return ngroups*slots_per_group; }
+      std::size_t total_groups() const { return ngroups+extra_groups; }
+    };
+
+    enum modify_mode { insert_only, insert_or_update, remove };
+    enum modify_result { inserted, updated, existed, removed, not_found,
+                         was_moved, table_full };
+
+    struct alignas(64) padded_counter {
+      std::atomic<long> value;
+    };
+
+    static std::size_t mix(std::size_t h) {
+      // Finalizer of MurmurHash3 (std::hash of integers is the identity)
+      unsigned long long x = h;
+      x ^= x >> 33;
+      x *= 0xff51afd7ed558ccdULL;
+      x ^= x >> 33;
+      x *= 0xc4ceb9fe1a85ec53ULL;
+      x ^= x >> 33;
+      return static_cast<std::size_t>(x);
+    }
+
+    std::size_t hash(const K& key) const {
+      return mix(m_hasher(key));
+    }
+
+    static std::size_t home_of(const table* t, std::size_t h) {
+      return h & t->mask;
+    }
+
+    static unsigned char tag_of(std::size_t h) {
+      return static_cast<unsigned char>(0x80 | (h >> (sizeof(std::size_t)*8 - 7)));
+    }
+
+    static table* create_table(std::size_t ngroups) {
+      table* t = new table;
+      t->ngroups = ngroups;
+      t->mask = ngroups-1;
+      t->memory = ::operator new(sizeof(group)*(ngroups+extra_groups) + 64);
+      std::size_t addr = reinterpret_cast<std::size_t>(t->memory);
+      t->groups = reinterpret_cast<group*>((addr + 63) & ~std::size_t(63));
+      for (std::size_t i=0; i<t->total_groups(); ++i) {
+        group* g = new (&t->groups[i]) group;
+        g->version.store(0, std::memory_order_relaxed);
+        g->overflow.store(0, std::memory_order_relaxed);
+        for (int j=0; j<slots_per_group; ++j)
+          g->tags[j].store(0, std::memory_order_relaxed);
+      }
+      t->next.store(NULL, std::memory_order_relaxed);
+      t->migrated = 0;
+      return t;
+    }
+
+    static void destroy_table(void* data) {
+      table* t = static_cast<table*>(data);
+      for (std::size_t i=0; i<t->total_groups(); ++i)
+        t->groups[i].~group();
+      ::operator delete(t->memory);
+      delete t;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // Group locking (writers)
+
+    // Returns false if the group was moved to the next table
+    static bool lock_group(group& g) {
+      unsigned v = g.version.load(std::memory_order_relaxed);
+      for (;;) {
+        if (v & moved_bit)
+          return false;
+        if (v & locked_bit) {
+          futex::cpu_relax();
+          v = g.version.load(std::memory_order_relaxed);
+          continue;
+        }
+        if (g.version.compare_exchange_weak(v, v | locked_bit,
+                                            std::memory_order_acquire,
+                                            std::memory_order_relaxed)) {
+          // Data writes cannot be seen before the lock bit
+          std::atomic_thread_fence(std::memory_order_release);
+          return true;
+        }
+      }
+    }
+
+    static void unlock_group(group& g, unsigned extra_bits = 0) {
+      unsigned v = g.version.load(std::memory_order_relaxed);
+      g.version.store(((v & ~locked_bit) + version_step) | extra_bits,
+                      std::memory_order_release);
+    }
+
+    static void unlock_groups(table* t, std::size_t from, std::size_t to) {
+      for (std::size_t i=from; i<=to; ++i)
+        unlock_group(t->groups[i]);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // Lookup (readers)
+
+    bool find_in(table* t, std::size_t h, const K& key, V* value) const {
+      unsigned char tag = tag_of(h);
+    restart:
+      for (std::size_t i=home_of(t, h); i<t->total_groups(); ++i) {
+        group& g = t->groups[i];
+        for (;;) {
+          unsigned v1 = g.version.load(std::memory_order_acquire);
+          if (v1 & locked_bit) {
+            futex::cpu_relax();
+            continue;
+          }
+          if (v1 & moved_bit) {
+            // The whole cluster is in the next table
+            t = t->next.load(std::memory_order_acquire);
+            goto restart;
+          }
+
+          bool found = false;
+          V tmp;
+          for (int j=0; j<slots_per_group; ++j) {
+            if (g.tags[j].load(std::memory_order_relaxed) == tag) {
+              K k;
+              std::memcpy(static_cast<void*>(&k), &g.keys[j], sizeof(K));
+              if (m_equal(k, key)) {
+                std::memcpy(static_cast<void*>(&tmp), &g.values[j], sizeof(V));
+                found = true;
+                break;
+              }
+            }
+          }
+          unsigned char overflow = g.overflow.load(std::memory_order_relaxed);
+
+          std::atomic_thread_fence(std::memory_order_acquire);
+          if (g.version.load(std::memory_order_relaxed) != v1)
+            continue;           // A writer modified the group, read it again
+
+          if (found) {
+            if (value)
+              *value = tmp;
+            return true;
+          }
+          if (overflow == 0)
+            return false;
+          break;                // Continue with the next group
+        }
+      }
+      return false;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // Modifications (writers)
+
+    modify_result modify(const K& key, const V* value, modify_mode mode) {
+      epoch_guard guard(m_domain);
+      std::size_t h = hash(key);
+
+      for (;;) {
+        table* t = m_table.load(std::memory_order_acquire);
+        table* next = t->next.load(std::memory_order_acquire);
+        if (next)
+          help_migrate(t, next);
+
+        modify_result result;
+        do {
+          result = modify_in(t, h, key, value, mode);
+          if (result == was_moved)
+            t = t->next.load(std::memory_order_acquire);
+        } while (result == was_moved);
+
+        if (result == table_full) {
+          // Waits the migration instead of spinning until some clusters
+          // are moved to the new table
+          start_resize(t);
+          table* current = m_table.load(std::memory_order_acquire);
+          help_migrate(current, current->next.load(std::memory_order_acquire), true);
+          continue;
+        }
+
+        if (result == inserted)
+          add_count(h, +1, t);
+        else if (result == removed)
+          add_count(h, -1, t);
+        return result;
+      }
+    }
+
+    modify_result modify_in(table* t, std::size_t h, const K& key,
+                            const V* value, modify_mode mode) {
+      unsigned char tag = tag_of(h);
+      std::size_t home = home_of(t, h);
+      if (!lock_group(t->groups[home]))
+        return was_moved;
+
+      // Search the key in the probe chain (locking each visited group)
+      std::size_t last = home;
+      std::size_t empty_group = 0;
+      int empty_slot = -1;
+      for (std::size_t i=home; ; ++i) {
+        group& g = t->groups[i];
+        if (i != home && !lock_group(g)) {
+          // Impossible: clusters are migrated in order and atomically
+          unlock_groups(t, home, i-1);
+          return was_moved;
+        }
+        last = i;
+
+        for (int j=0; j<slots_per_group; ++j) {
+          unsigned char slot_tag = g.tags[j].load(std::memory_order_relaxed);
+          if (slot_tag == tag && m_equal(g.keys[j], key)) {
+            modify_result result;
+            if (mode == remove) {
+              g.tags[j].store(0, std::memory_order_relaxed);
+              for (std::size_t k=home; k<i; ++k)
+                dec_overflow(t->groups[k]);
+              result = removed;
+            }
+            else if (mode == insert_or_update) {
+              g.values[j] = *value;
+              result = updated;
+            }
+            else
+              result = existed;
+            unlock_groups(t, home, last);
+            return result;
+          }
+          if (slot_tag == 0 && empty_slot < 0) {
+            empty_group = i;
+            empty_slot = j;
+          }
+        }
+
+        if (g.overflow.load(std::memory_order_relaxed) == 0)
+          break;                // The key is not in the next groups
+        if (i+1 == t->total_groups())
+          break;
+      }
+
+      if (mode == remove) {
+        unlock_groups(t, home, last);
+        return not_found;
+      }
+
+      // Look for an empty slot after the chain
+      while (empty_slot < 0) {
+        std::size_t i = last+1;
+        if (i == t->total_groups()) {
+          unlock_groups(t, home, last);
+          return table_full;
+        }
+        if (!lock_group(t->groups[i])) {
+          unlock_groups(t, home, last);
+          return was_moved;
+        }
+        last = i;
+        for (int j=0; j<slots_per_group; ++j) {
+          if (t->groups[i].tags[j].load(std::memory_order_relaxed) == 0) {
+            empty_group = i;
+            empty_slot = j;
+            break;
+          }
+        }
+      }
+
+      group& g = t->groups[empty_group];
+      g.keys[empty_slot] = key;
+      g.values[empty_slot] = *value;
+      g.tags[empty_slot].store(tag, std::memory_order_relaxed);
+      for (std::size_t k=home; k<empty_group; ++k)
+        inc_overflow(t->groups[k]);
+
+      unlock_groups(t, home, last);
+      return inserted;
+    }
+
+    static void inc_overflow(group& g) {
+      unsigned char o = g.overflow.load(std::memory_order_relaxed);
+      if (o < 255)
+        g.overflow.store(o+1, std::memory_order_relaxed);
+    }
+
+    static void dec_overflow(group& g) {
+      unsigned char o = g.overflow.load(std::memory_order_relaxed);
+      if (o < 255)              // A saturated counter is never decremented
+        g.overflow.store(o-1, std::memory_order_relaxed);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // Incremental resize
+
+    void add_count(std::size_t h, long delta, table* t) {
+      padded_counter& c = m_counts[h % counter_stripes];
+      long n = c.value.fetch_add(delta, std::memory_order_relaxed) + delta;
+      // Check the load factor from time to time only
+      if (delta > 0 && (n & 63) == 0) {
+        if (size() > t->capacity()*3/4)
+          start_resize(t);
+      }
+    }
+
+    void start_resize(table* t) {
+      if (t->next.load(std::memory_order_acquire))
+        return;                 // Already resizing
+
+      table* next = create_table(t->ngroups*2);
+      table* expected = NULL;
+      if (!t->next.compare_exchange_strong(expected, next,
+                                           std::memory_order_acq_rel))
+        destroy_table(next);
+    }
+
+    // Migrates some clusters from "t" to "next" (only one writer at a
+    // time does this, the others continue with their operations, or
+    // wait their turn if "wait" is true)
+    void help_migrate(table* t, table* next, bool wait = false) {
+      if (!next)
+        return;
+      if (wait)
+        m_migrate_mutex.lock();
+      else if (!m_migrate_mutex.try_lock())
+        return;
+
+      if (m_table.load(std::memory_order_relaxed) != t) {
+        m_migrate_mutex.unlock();
+        return;
+      }
+
+      std::size_t end = t->migrated + migration_chunk;
+      while (t->migrated < t->total_groups() && t->migrated < end)
+        migrate_cluster(t, next);
+
+      if (t->migrated == t->total_groups()) {
+        m_table.store(next, std::memory_order_release);
+        m_domain.retire(t, &concurrent_hash_map::destroy_table);
+      }
+      m_migrate_mutex.unlock();
+    }
+
+    void migrate_cluster(table* t, table* next) {
+      std::size_t first = t->migrated;
+      std::size_t i = first;
+      for (;; ++i) {
+        lock_group(t->groups[i]);
+        if (t->groups[i].overflow.load(std::memory_order_relaxed) == 0 ||
+            i+1 == t->total_groups())
+          break;
+      }
+
+      while (!copy_cluster(t, first, i, next))
+        grow(next);
+
+      for (std::size_t k=first; k<=i; ++k)
+        unlock_group(t->groups[k], moved_bit);
+      t->migrated = i+1;
+    }
+
+    // Copies the locked groups [first, last] of "t" to "next" (or to the
+    // table where "next" was moved). If a key doesn't fit, the copied
+    // keys are removed (nobody else can see them while the cluster is
+    // locked) and it returns false.
+    bool copy_cluster(table* t, std::size_t first, std::size_t last, table* next) {
+      for (std::size_t k=first; k<=last; ++k) {
+        group& g = t->groups[k];
+        for (int j=0; j<slots_per_group; ++j) {
+          if (g.tags[j].load(std::memory_order_relaxed) == 0)
+            continue;
+          if (modify_chain(next, hash(g.keys[j]), g.keys[j], &g.values[j], insert_only) != table_full)
+            continue;
+
+          for (std::size_t k2=first; k2<=k; ++k2) {
+            group& g2 = t->groups[k2];
+            for (int j2=0; j2<(k2 == k ? j: slots_per_group); ++j2)
+              if (g2.tags[j2].load(std::memory_order_relaxed) != 0)
+                modify_chain(next, hash(g2.keys[j2]), g2.keys[j2], NULL, remove);
+          }
+          return false;
+        }
+      }
+      return true;
+    }
+
+    // Moves all the groups of "t" (and of the tables where they go) to
+    // a table twice as big, used when a cluster of the previous table
+    // doesn't fit in "t" (called with m_migrate_mutex locked)
+    void grow(table* t) {
+      while (t->migrated == t->total_groups()) // Already moved by a previous grow()
+        t = t->next.load(std::memory_order_acquire);
+      start_resize(t);
+      table* next = t->next.load(std::memory_order_acquire);
+      while (t->migrated < t->total_groups())
+        migrate_cluster(t, next);
+    }
+
+    // modify_in() in the table where the cluster of the key is now
+    modify_result modify_chain(table* t, std::size_t h, const K& key,
+                               const V* value, modify_mode mode) {
+      modify_result result;
+      while ((result = modify_in(t, h, key, value, mode)) == was_moved)
+        t = t->next.load(std::memory_order_acquire);
+      return result;
+    }
+
+    std::atomic<table*> m_table;
+    epoch_domain& m_domain;
+    mutex m_migrate_mutex;
+    padded_counter m_counts[counter_stripes];
+    Hash m_hasher;
+    KeyEqual m_equal;
+
+    // Non-copyable
+    concurrent_hash_map(const concurrent_hash_map&);
+    concurrent_hash_map& operator=(const concurrent_hash_map&);
+  };
+
+} // namespace mt
+
+#endif // MT_CONCURRENT_HASH_MAP_HEADER_FILE_INCLUDED
@@ -0,0 +1,200 @@
+// mt - thread library to create C++ experiments         -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+#ifndef MT_EPOCH_HEADER_FILE_INCLUDED
+#define MT_EPOCH_HEADER_FILE_INCLUDED
+
+#include "mt/thread_registry.h"
+#include "mt/hazard_pointer.h"  // details::retired_ptr
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <vector>
+
+namespace mt {
+
+  //////////////////////////////////////////////////////////////////////
+  // epoch_domain class
+  //
+  // Epoch-based reclamation (Fraser, 2004). Readers pin the current
+  // global epoch with an epoch_guard while they access the shared
+  // structure (a store and a fence, no read-modify-write). Retired
+  // nodes go to the current thread's limbo list of the current epoch,
+  // and the global epoch advances only when all the pinned threads are
+  // in it. So a node retired in epoch E can be deleted when the global
+  // epoch reaches E+2.
+  //
+  // Reads are cheaper than with hazard pointers, but a reader that
+  // stays pinned for a long time blocks all the reclamation.
+  //
+  // The domain must outlive the threads that use it. Its destructor
+  // deletes everything that is still retired.
+
+  class epoch_domain {
+  public:
+    explicit epoch_domain(std::size_t retire_threshold = 64)
+      : m_epoch(0)
+      , m_threshold(retire_threshold) {
+    }
+
+    ~epoch_domain() {
+      m_records.for_each(reclaim_record());
+    }
+
+    // Default domain for the whole program
+    static epoch_domain& global() {
+      static epoch_domain domain;
+      return domain;
+    }
+
+    // Pins the current thread in the global epoch (nested calls are
+    // allowed). Use epoch_guard instead of calling enter()/leave().
+    void enter() {
+      record& r = m_records.local();
+      if (r.nesting++ == 0) {
+        unsigned e = m_epoch.load(std::memory_order_seq_cst);
+        r.epoch.store((e << 1) | active_bit, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+      }
+    }
+
+    void leave() {
+      record& r = m_records.local();
+      assert(r.nesting > 0);
+      if (--r.nesting == 0)
+        r.epoch.store(0, std::memory_order_release);
+    }
+
+    template<class T>
+    void retire(T* p) {
+      retire(p, &details::delete_object<T>);
+    }
+
+    void retire(void* p, void (*deleter)(void*)) {
+      record& r = m_records.local();
+      unsigned e = m_epoch.load(std::memory_order_seq_cst);
+      collect(r, e);
+
+      int i = e % 3;
+      details::retired_ptr rp = { p, deleter };
+      r.limbo[i].push_back(rp);
+      r.limbo_epoch[i] = e;
+
+      if (++r.pending >= m_threshold) {
+        if (try_advance())
+          collect(r, m_epoch.load(std::memory_order_seq_cst));
+      }
+    }
+
+    // Tries to advance the epoch and deletes the nodes of the current
+    // thread that aren't reachable anymore.
+    void reclaim() {
+      record& r = m_records.local();
+      try_advance();
+      collect(r, m_epoch.load(std::memory_order_seq_cst));
+    }
+
+    unsigned epoch() const {
+      return m_epoch.load(std::memory_order_relaxed);
+    }
+
+  private:
+    static const unsigned active_bit = 1;
+
+    struct record {
+      std::atomic<unsigned> epoch; // (pinned epoch << 1) | active_bit, or 0
+      unsigned nesting;
+      std::vector<details::retired_ptr> limbo[3];
+      unsigned limbo_epoch[3];
+      std::size_t pending;
+
+      record() : epoch(0), nesting(0), pending(0) {
+        limbo_epoch[0] = limbo_epoch[1] = limbo_epoch[2] = 0;
+      }
+
+      // Limbo lists are kept for the next thread that reuses the record
+      void thread_exit() {
+        epoch.store(0, std::memory_order_release);
+        nesting = 0;
+      }
+    };
+
+    struct check_pinned {
+      unsigned epoch;
+      bool* can_advance;
+      void operator()(record& r) {
+        unsigned v = r.epoch.load(std::memory_order_seq_cst);
+        if ((v & active_bit) && (v >> 1) != ((epoch << 1) >> 1))
+          *can_advance = false;
+      }
+    };
+
+    struct reclaim_record {
+      void operator()(record& r) {
+        for (int i=0; i<3; ++i)
+          details::reclaim_all(r.limbo[i]);
+        r.pending = 0;
+      }
+    };
+
+    bool try_advance() {
+      unsigned e = m_epoch.load(std::memory_order_seq_cst);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+
+      bool can_advance = true;
+      check_pinned check = { e, &can_advance };
+      m_records.for_each(check);
+      if (!can_advance)
+        return false;
+
+      return m_epoch.compare_exchange_strong(e, e+1, std::memory_order_seq_cst);
+    }
+
+    // Deletes the limbo lists that are two epochs old
+    void collect(record& r, unsigned e) {
+      for (int i=0; i<3; ++i) {
+        if (!r.limbo[i].empty() && e - r.limbo_epoch[i] >= 2) {
+          r.pending -= r.limbo[i].size();
+          details::reclaim_all(r.limbo[i]);
+        }
+      }
+    }
+
+    std::atomic<unsigned> m_epoch;
+    thread_registry<record> m_records;
+    std::size_t m_threshold;
+
+    // Non-copyable
+    epoch_domain(const epoch_domain&);
+    epoch_domain& operator=(const epoch_domain&);
+  };
+
+  //////////////////////////////////////////////////////////////////////
+  // epoch_guard class
+
+  class epoch_guard {
+  public:
+    explicit epoch_guard(epoch_domain& domain = epoch_domain::global())
+      : m_domain(domain) {
+      m_domain.enter();
+    }
+
+    ~epoch_guard() {
+      m_domain.leave();
+    }
+
+  private:
+    epoch_domain& m_domain;
+
+    // Non-copyable
+    epoch_guard(const epoch_guard&);
+    epoch_guard& operator=(const epoch_guard&);
+  };
+
+} // namespace mt
+
+#endif // MT_EPOCH_HEADER_FILE_INCLUDED
@@ -0,0 +1,1119 @@
+// mt - thread library to create C++ experiments         -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+#ifndef MT_FIBER_HEADER_FILE_INCLUDED
+#define MT_FIBER_HEADER_FILE_INCLUDED
+
+#include "mt/thread.h"
+#include "mt/futex.h"
+#include "mt/word_lock.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <new>
+#include <vector>
+
+#if defined(_WIN32)
+  #define MT_FIBER_WIN32
+#elif (defined(__x86_64__) || defined(__aarch64__)) && (defined(__ELF__) || defined(__APPLE__))
+  #define MT_FIBER_ASM
+#else
+  #define MT_FIBER_UCONTEXT
+  #include <ucontext.h>
+#endif
+
+#ifndef _WIN32
+  #include <sys/mman.h>
+  #include <unistd.h>
+  #ifndef MAP_ANONYMOUS
+    #define MAP_ANONYMOUS MAP_ANON
+  #endif
+#endif
+
+// With MSVC, compile with /GT (fiber-safe thread-local storage)
+#if defined(_MSC_VER)
+  #define MT_FIBER_NOINLINE __declspec(noinline)
+  #define MT_FIBER_OPAQUE(p)
+#else
+  #define MT_FIBER_NOINLINE __attribute__((noinline))
+  #define MT_FIBER_OPAQUE(p) __asm__ __volatile__("" : "+r"(p))
+#endif
+
+//////////////////////////////////////////////////////////////////////
+// Context switch in assembler
+//
+// mt_fiber_switch(&from_sp, to_sp) pushes the callee-saved registers
+// in the current stack, saves the stack pointer in from_sp, loads
+// to_sp, and pops the registers saved there. A new fiber starts in
+// mt_fiber_trampoline, which calls fn(arg) (fn/arg are loaded from the
+// initial stack in two callee-saved registers).
+//
+// The code is emitted in a COMDAT section (ELF) or as a weak
+// definition (Mach-O), so this header can be included in several
+// translation units.
+
+#ifdef MT_FIBER_ASM
+
+#if defined(__APPLE__)
+  #define MT_FIBER_ASM_FUNCTION(name)           \
+    ".text\n"                                   \
+    ".globl _" name "\n"                        \
+    ".weak_definition _" name "\n"              \
+    ".private_extern _" name "\n"               \
+    ".p2align 4\n"                              \
+    "_" name ":\n"
+  #define MT_FIBER_ASM_END(name) ""
+#else
+  #define MT_FIBER_ASM_FUNCTION(name)                                   \
+    ".pushsection .text." name ",\"axG\",%progbits," name ",comdat\n"   \
+    ".globl " name "\n"                                                 \
+    ".hidden " name "\n"                                                \
+    ".type " name ",%function\n"                                        \
+    ".p2align 4\n"                                                      \
+    name ":\n"
+  #define MT_FIBER_ASM_END(name)                \
+    ".size " name ",.-" name "\n"               \
+    ".popsection\n"
+#endif
+
+extern "C" void mt_fiber_switch(void** from_sp, void* to_sp);
+extern "C" void mt_fiber_trampoline();
+
+#if defined(__x86_64__)
+
+// System V ABI: rbx, rbp, r12-r15, MXCSR and the x87 control word
+__asm__(
+  MT_FIBER_ASM_FUNCTION("mt_fiber_switch")
+  "  pushq %rbp\n"
+  "  pushq %rbx\n"
+  "  pushq %r12\n"
+  "  pushq %r13\n"
+  "  pushq %r14\n"
+  "  pushq %r15\n"
+  "  subq $8, %rsp\n"
+  "  stmxcsr (%rsp)\n"
+  "  fnstcw 4(%rsp)\n"
+  "  movq %rsp, (%rdi)\n"
+  "  movq %rsi, %rsp\n"
+  "  ldmxcsr (%rsp)\n"
+  "  fldcw 4(%rsp)\n"
+  "  addq $8, %rsp\n"
+  "  popq %r15\n"
+  "  popq %r14\n"
+  "  popq %r13\n"
+  "  popq %r12\n"
+  "  popq %rbx\n"
+  "  popq %rbp\n"
+  "  ret\n"
+  MT_FIBER_ASM_END("mt_fiber_switch")
+  MT_FIBER_ASM_FUNCTION("mt_fiber_trampoline")
+  "  movq %r12, %rdi\n"
+  "  callq *%r13\n"
+  "  ud2\n"
+  MT_FIBER_ASM_END("mt_fiber_trampoline"));
+
+#elif defined(__aarch64__)
+
+// AAPCS64: x19-x30 and d8-d15
+__asm__(
+  MT_FIBER_ASM_FUNCTION("mt_fiber_switch")
+  "  sub sp, sp, #160\n"
+  "  stp x19, x20, [sp, #0]\n"
+  "  stp x21, x22, [sp, #16]\n"
+  "  stp x23, x24, [sp, #32]\n"
+  "  stp x25, x26, [sp, #48]\n"
+  "  stp x27, x28, [sp, #64]\n"
+  "  stp x29, x30, [sp, #80]\n"
+  "  stp d8, d9, [sp, #96]\n"
+  "  stp d10, d11, [sp, #112]\n"
+  "  stp d12, d13, [sp, #128]\n"
+  "  stp d14, d15, [sp, #144]\n"
+  "  mov x2, sp\n"
+  "  str x2, [x0]\n"
+  "  mov sp, x1\n"
+  "  ldp x19, x20, [sp, #0]\n"
+  "  ldp x21, x22, [sp, #16]\n"
+  "  ldp x23, x24, [sp, #32]\n"
+  "  ldp x25, x26, [sp, #48]\n"
+  "  ldp x27, x28, [sp, #64]\n"
+  "  ldp x29, x30, [sp, #80]\n"
+  "  ldp d8, d9, [sp, #96]\n"
+  "  ldp d10, d11, [sp, #112]\n"
+  "  ldp d12, d13, [sp, #128]\n"
+  "  ldp d14, d15, [sp, #144]\n"
+  "  add sp, sp, #160\n"
+  "  ret\n"
+  MT_FIBER_ASM_END("mt_fiber_switch")
+  MT_FIBER_ASM_FUNCTION("mt_fiber_trampoline")
+  "  mov x0, x19\n"
+  "  blr x20\n"
+  "  brk #0\n"
+  MT_FIBER_ASM_END("mt_fiber_trampoline"));
+
+#endif
+
+#endif // MT_FIBER_ASM
+
+namespace mt {
+
+  class fiber;
+  class fiber_scheduler;
+  class fiber_mutex;
+  class fiber_condition_variable;
+
+  namespace details {
+
+    //////////////////////////////////////////////////////////////////////
+    // fiber_stack struct and fiber_stack_pool class
+    //
+    // Stacks are allocated with mmap() with an inaccessible guard page
+    // at the bottom (a stack overflow crashes instead of corrupting
+    // other memory) and are reused by new fibers. They are unmapped
+    // when the pool is destroyed.
+    //
+    // Each guard page splits the mapping, so each stack costs two
+    // kernel VMAs: on Linux vm.max_map_count (65530 by default) limits
+    // the number of live stacks with guard pages to ~32K. Use
+    // guard_pages=false to create millions of fibers.
+    //
+    // On Windows the stacks are created by CreateFiberEx() (with its
+    // own guard page) and the pool only keeps the size.
+
+    struct fiber_stack {
+      void* base;               // Lowest address (including the guard page)
+      std::size_t size;         // Total size (including the guard page)
+    };
+
+    class fiber_stack_pool {
+    public:
+      fiber_stack_pool(std::size_t stack_size, bool guard_pages)
+        : m_page_size(page_size())
+        , m_guard_size(guard_pages ? m_page_size: 0) {
+        m_stack_size = (stack_size + m_page_size-1) & ~(m_page_size-1);
+      }
+
+      ~fiber_stack_pool() {
+        for (std::size_t i=0; i<m_slabs.size(); ++i)
+          unmap(m_slabs[i]);
+      }
+
+      std::size_t stack_size() const { return m_stack_size; }
+
+      fiber_stack allocate() {
+        lock_guard<word_lock> lock(m_lock);
+        if (m_free.empty())
+          map_slab();
+        fiber_stack s = m_free.back();
+        m_free.pop_back();
+        return s;
+      }
+
+      void release(const fiber_stack& s) {
+        lock_guard<word_lock> lock(m_lock);
+        m_free.push_back(s);
+      }
+
+    private:
+      // Stacks are mapped in slabs to reduce the number of syscalls
+      static const int stacks_per_slab = 16;
+
+      static std::size_t page_size() {
+#ifdef _WIN32
+        SYSTEM_INFO si;
+        ::GetSystemInfo(&si);
+        return si.dwPageSize;
+#else
+        return static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+#endif
+      }
+
+      void map_slab() {
+        fiber_stack slab;
+        std::size_t size = m_stack_size + m_guard_size;
+        slab.size = size * stacks_per_slab;
+#ifdef _WIN32
+        slab.base = NULL;
+#else
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+  #ifdef MAP_STACK
+        flags |= MAP_STACK;
+  #endif
+  #ifdef MAP_NORESERVE
+        flags |= MAP_NORESERVE;
+  #endif
+        slab.base = ::mmap(NULL, slab.size, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (slab.base == MAP_FAILED)
+          throw std::bad_alloc();
+#endif
+        m_slabs.push_back(slab);
+
+        for (int i=stacks_per_slab-1; i>=0; --i) {
+          fiber_stack s;
+          s.base = (slab.base ? static_cast<char*>(slab.base) + i*size: NULL);
+          s.size = size;
+#ifndef _WIN32
+          if (m_guard_size)
+            ::mprotect(s.base, m_guard_size, PROT_NONE);
+#endif
+          m_free.push_back(s);
+        }
+      }
+
+      void unmap(const fiber_stack& s) {
+#ifndef _WIN32
+        ::munmap(s.base, s.size);
+#else
+        (void)s;
+#endif
+      }
+
+      std::size_t m_page_size;
+      std::size_t m_guard_size;
+      std::size_t m_stack_size;
+      word_lock m_lock;
+      std::vector<fiber_stack> m_free;
+      std::vector<fiber_stack> m_slabs;
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    // fiber_context class
+    //
+    // Saved execution state of a fiber (or of the worker thread that
+    // runs fibers). jump() saves the current state in "from" and
+    // continues the execution of "to".
+
+    class fiber_context {
+    public:
+      typedef void (*entry_fn)(void* arg);
+
+#if defined(MT_FIBER_ASM)
+
+      fiber_context() : m_sp(NULL) { }
+
+      void init(const fiber_stack& stack, entry_fn fn, void* arg) {
+        std::uintptr_t top = reinterpret_cast<std::uintptr_t>(stack.base) + stack.size;
+        top &= ~std::uintptr_t(15);
+  #if defined(__x86_64__)
+        // Same layout that mt_fiber_switch leaves in the stack
+        void** sp = reinterpret_cast<void**>(top) - 10;
+        std::uint64_t control = 0x1F80 | (std::uint64_t(0x037F) << 32);
+        std::fill(sp, sp+10, static_cast<void*>(NULL));
+        sp[0] = reinterpret_cast<void*>(control);               // MXCSR/x87 CW
+        sp[3] = reinterpret_cast<void*>(fn);                    // r13
+        sp[4] = arg;                                            // r12
+        sp[7] = reinterpret_cast<void*>(&mt_fiber_trampoline); // Return address
+  #elif defined(__aarch64__)
+        void** sp = reinterpret_cast<void**>(top) - 20;
+        std::fill(sp, sp+20, static_cast<void*>(NULL));
+        sp[0] = arg;                                            // x19
+        sp[1] = reinterpret_cast<void*>(fn);                    // x20
+        sp[11] = reinterpret_cast<void*>(&mt_fiber_trampoline); // x30
+  #endif
+        m_sp = sp;
+      }
+
+      void init_current() { }
+      void destroy() { }
+
+      static void jump(fiber_context& from, fiber_context& to) {
+        mt_fiber_switch(&from.m_sp, to.m_sp);
+      }
+
+    private:
+      void* m_sp;
+
+#elif defined(MT_FIBER_UCONTEXT)
+
+      void init(const fiber_stack& stack, entry_fn fn, void* arg) {
+        getcontext(&m_uc);
+        m_uc.uc_stack.ss_sp = stack.base;
+        m_uc.uc_stack.ss_size = stack.size;
+        m_uc.uc_link = NULL;
+        m_fn = fn;
+        m_arg = arg;
+        std::uintptr_t p = reinterpret_cast<std::uintptr_t>(this);
+        makecontext(&m_uc, reinterpret_cast<void (*)()>(&fiber_context::entry), 2,
+                    static_cast<unsigned>(p >> 16 >> 16),
+                    static_cast<unsigned>(p & 0xffffffff));
+      }
+
+      void init_current() { }
+      void destroy() { }
+
+      static void jump(fiber_context& from, fiber_context& to) {
+        swapcontext(&from.m_uc, &to.m_uc);
+      }
+
+    private:
+      static void entry(unsigned hi, unsigned lo) {
+        std::uintptr_t p = (std::uintptr_t(hi) << 16 << 16) | lo;
+        fiber_context* ctx = reinterpret_cast<fiber_context*>(p);
+        ctx->m_fn(ctx->m_arg);
+      }
+
+      ucontext_t m_uc;
+      entry_fn m_fn;
+      void* m_arg;
+
+#elif defined(MT_FIBER_WIN32)
+
+      fiber_context() : m_fiber(NULL), m_converted(false) { }
+
+      void init(const fiber_stack& stack, entry_fn fn, void* arg) {
+        m_fn = fn;
+        m_arg = arg;
+        m_fiber = ::CreateFiberEx(0, stack.size, FIBER_FLAG_FLOAT_SWITCH,
+                                  &fiber_context::entry, this);
+        if (!m_fiber)
+          throw std::bad_alloc();
+      }
+
+      void init_current() {
+        m_fiber = ::ConvertThreadToFiberEx(NULL, FIBER_FLAG_FLOAT_SWITCH);
+        m_converted = (m_fiber != NULL);
+        if (!m_fiber)
+          m_fiber = ::GetCurrentFiber(); // Already a fiber
+      }
+
+      void destroy() {
+        if (m_converted)
+          ::ConvertFiberToThread();
+        else if (m_fiber)
+          ::DeleteFiber(m_fiber);
+        m_fiber = NULL;
+      }
+
+      static void jump(fiber_context&, fiber_context& to) {
+        ::SwitchToFiber(to.m_fiber);
+      }
+
+    private:
+      static VOID CALLBACK entry(LPVOID param) {
+        fiber_context* ctx = static_cast<fiber_context*>(param);
+        ctx->m_fn(ctx->m_arg);
+      }
+
+      LPVOID m_fiber;
+      bool m_converted;
+      entry_fn m_fn;
+      void* m_arg;
+
+#endif
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    // fiber_impl class
+    //
+    // A fiber: its context, its stack and the function to run. It's
+    // referenced by the scheduler while it runs and by the mt::fiber
+    // handle (if it wasn't detached).
+
+    class fiber_impl {
+    public:
+      fiber_impl()
+        : sched(NULL), next(NULL), refs(1), done(0), joiners(NULL) {
+      }
+      virtual ~fiber_impl() { }
+      virtual void run() = 0;
+
+      void release_ref() {
+        if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+          delete this;
+      }
+
+      fiber_context ctx;
+      fiber_stack stack;
+      fiber_scheduler* sched;
+      fiber_impl* next;         // Link in a run queue or a waiters list
+      std::atomic<int> refs;
+      futex::word done;         // 1 when the function has finished
+      word_lock join_lock;      // Protects "joiners"
+      fiber_impl* joiners;      // Fibers waiting in join()
+    };
+
+    template<class F>
+    class fiber_body : public fiber_impl {
+    public:
+      explicit fiber_body(const F& f) : m_f(f) { }
+      void run() { m_f(); }
+    private:
+      F m_f;
+    };
+
+    template<class F, class A>
+    struct fiber_args_binder {
+      F f;
+      A a;
+      void operator()() { f(a); }
+    };
+
+    template<class F, class A>
+    fiber_args_binder<F, A> bind_fiber_args(const F& f, A a) {
+      fiber_args_binder<F, A> binder = { f, a };
+      return binder;
+    }
+
+    // Intrusive FIFO of fibers (using fiber_impl::next)
+    class fiber_list {
+    public:
+      fiber_list() : m_head(NULL), m_tail(NULL) { }
+
+      bool empty() const { return m_head == NULL; }
+
+      void push(fiber_impl* f) {
+        f->next = NULL;
+        if (m_tail)
+          m_tail->next = f;
+        else
+          m_head = f;
+        m_tail = f;
+      }
+
+      fiber_impl* pop() {
+        fiber_impl* f = m_head;
+        if (f) {
+          m_head = f->next;
+          if (!m_head)
+            m_tail = NULL;
+        }
+        return f;
+      }
+
+    private:
+      fiber_impl* m_head;
+      fiber_impl* m_tail;
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    // fiber_worker struct
+    //
+    // State of each worker thread of a fiber_scheduler. When a fiber
+    // stops running (yield, block, sleep or finish) it switches
+    // directly to the next fiber of the worker's queue (or to the
+    // worker's idle loop), and the action that must be done with the
+    // previous fiber (re-queue it, unlock the list where it waits,
+    // etc.) is done by the next context *after* the switch, when the
+    // previous fiber can't be running anymore.
+
+    struct fiber_worker {
+      typedef void (*action_fn)(fiber_worker* w, void* arg);
+
+      fiber_scheduler* sched;
+      fiber_context main_ctx;   // The thread's own stack (idle loop)
+      fiber_impl* current;      // Running fiber (NULL in the idle loop)
+      action_fn after;          // Action after the next switch
+      void* after_arg;
+
+      word_lock queue_lock;
+      fiber_list queue;
+
+      fiber_worker() : sched(NULL), current(NULL), after(NULL), after_arg(NULL) { }
+
+      void push(fiber_impl* f) {
+        lock_guard<word_lock> lock(queue_lock);
+        queue.push(f);
+      }
+
+      fiber_impl* pop() {
+        lock_guard<word_lock> lock(queue_lock);
+        return queue.pop();
+      }
+
+      void run_after() {
+        if (after) {
+          action_fn fn = after;
+          after = NULL;
+          fn(this, after_arg);
+        }
+      }
+    };
+
+    // Opaque for the optimizer, so the compiler cannot cache the
+    // address of the thread-local variable across a context switch (a
+    // fiber can continue its execution in another thread).
+    MT_FIBER_NOINLINE inline fiber_worker*& current_worker() {
+      static thread_local fiber_worker* worker = NULL;
+      fiber_worker** p = &worker;
+      MT_FIBER_OPAQUE(p);
+      return *p;
+    }
+
+    inline fiber_impl* current_fiber() {
+      fiber_worker* w = current_worker();
+      return (w ? w->current: NULL);
+    }
+
+    // Stops the current fiber: continues with "next" (or the worker's
+    // idle loop if it's NULL) and calls "after(arg)" after the switch.
+    inline void switch_to(fiber_worker* w, fiber_impl* next,
+                          fiber_worker::action_fn after, void* arg) {
+      fiber_impl* self = w->current;
+      w->after = after;
+      w->after_arg = arg;
+      w->current = next;
+      fiber_context::jump(self->ctx, next ? next->ctx: w->main_ctx);
+
+      // Resumed (maybe in another worker thread)
+      current_worker()->run_after();
+    }
+
+    // Stops the current fiber and continues with the next one of the
+    // worker's queue
+    inline void suspend_current(fiber_worker::action_fn after, void* arg) {
+      fiber_worker* w = current_worker();
+      switch_to(w, w->pop(), after, arg);
+    }
+
+    inline void make_ready(fiber_impl* f);
+
+    inline void after_unlock(fiber_worker*, void* lock) {
+      static_cast<word_lock*>(lock)->unlock();
+    }
+
+    // Parks the current fiber, "lock" protects the list where the fiber
+    // was added (it's unlocked after the switch)
+    inline void block_current(word_lock& lock) {
+      suspend_current(&after_unlock, &lock);
+    }
+
+  } // namespace details
+
+  namespace this_fiber {
+    inline void yield();
+    inline void sleep_for(int milliseconds);
+  }
+
+  //////////////////////////////////////////////////////////////////////
+  // fiber_scheduler class
+  //
+  // M:N scheduler: runs fibers (stackful coroutines with their own
+  // stack) on a pool of worker threads. A fiber that yields, waits a
+  // fiber_mutex/fiber_condition_variable or sleeps doesn't block its
+  // worker thread: the worker switches to the next ready fiber in a
+  // few nanoseconds (only the callee-saved registers are saved).
+  //
+  // Each worker has its own queue of ready fibers, idle workers steal
+  // fibers from the others' queues. Fibers can use mt::mutex and other
+  // thread primitives, but they block the whole worker thread.
+  //
+  //   mt::fiber_scheduler sched(4);
+  //   sched.spawn(&my_function);   // Detached fiber
+  //   mt::fiber f(sched, &other_function, arg);
+  //   f.join();
+  //   sched.join();                // Waits all the fibers
+
+  class fiber_scheduler {
+  public:
+    // Creates "nthreads" workers (0 = one per CPU). Each fiber gets a
+    // stack of "stack_size" bytes (see details::fiber_stack_pool).
+    explicit fiber_scheduler(int nthreads = 0,
+                             std::size_t stack_size = 64*1024,
+                             bool guard_pages = true)
+      : m_stacks(stack_size, guard_pages)
+      , m_next_worker(0)
+      , m_work_seq(0)
+      , m_idle(0)
+      , m_waking(false)
+      , m_live(0)
+      , m_stop(false)
+      , m_timer_seq(0) {
+      if (nthreads <= 0)
+        nthreads = futex::details::number_of_cpus();
+
+      m_workers.resize(nthreads);
+      for (int i=0; i<nthreads; ++i) {
+        m_workers[i] = new details::fiber_worker;
+        m_workers[i]->sched = this;
+      }
+      for (int i=0; i<nthreads; ++i)
+        m_threads.push_back(new thread(&fiber_scheduler::worker_proc, m_workers[i]));
+      m_timer = new thread(&fiber_scheduler::timer_proc, this);
+    }
+
+    ~fiber_scheduler() {
+      join();
+
+      m_stop.store(true);
+      m_work_seq.fetch_add(1);
+      futex::wake_all(m_work_seq);
+      m_timer_seq.fetch_add(1);
+      futex::wake_all(m_timer_seq);
+
+      // Workers can steal from each other until all of them finish
+      for (std::size_t i=0; i<m_threads.size(); ++i) {
+        m_threads[i]->join();
+        delete m_threads[i];
+      }
+      for (std::size_t i=0; i<m_workers.size(); ++i)
+        delete m_workers[i];
+      m_timer->join();
+      delete m_timer;
+    }
+
+    // Returns the scheduler of the current fiber (or NULL if we are
+    // not inside a fiber)
+    static fiber_scheduler* current() {
+      details::fiber_worker* w = details::current_worker();
+      return (w && w->current ? w->sched: NULL);
+    }
+
+    // Runs f() in a new detached fiber
+    template<class F>
+    void spawn(const F& f) {
+      start(create(f));
+    }
+
+    template<class F, class A>
+    void spawn(const F& f, A a) {
+      start(create(details::bind_fiber_args(f, a)));
+    }
+
+    // Waits until all the fibers are finished
+    void join() {
+      int n;
+      while ((n = m_live.load(std::memory_order_acquire)) != 0)
+        futex::wait(m_live, n);
+    }
+
+    std::size_t stack_size() const { return m_stacks.stack_size(); }
+
+  private:
+    friend class fiber;
+    friend void details::make_ready(details::fiber_impl* f);
+    friend void this_fiber::yield();
+    friend void this_fiber::sleep_for(int milliseconds);
+
+    struct timer_entry {
+      std::chrono::steady_clock::time_point deadline;
+      details::fiber_impl* fiber;
+      bool operator<(const timer_entry& other) const {
+        return deadline > other.deadline; // Min-heap
+      }
+    };
+
+    template<class F>
+    details::fiber_impl* create(const F& f) {
+      details::fiber_impl* impl = new details::fiber_body<F>(f);
+      impl->sched = this;
+      impl->stack = m_stacks.allocate();
+      impl->ctx.init(impl->stack, &fiber_scheduler::fiber_entry, impl);
+      return impl;
+    }
+
+    void start(details::fiber_impl* impl) {
+      m_live.fetch_add(1, std::memory_order_relaxed);
+      post(impl);
+    }
+
+    // Adds the fiber to a run queue: the current worker's queue if we
+    // are in one of our workers, or the next one (round-robin)
+    void post(details::fiber_impl* f) {
+      details::fiber_worker* w = details::current_worker();
+      if (!w || w->sched != this)
+        w = m_workers[m_next_worker.fetch_add(1, std::memory_order_relaxed) % m_workers.size()];
+      w->push(f);
+
+      // Wake up an idle worker (only one wake-up in flight)
+      m_work_seq.fetch_add(1, std::memory_order_seq_cst);
+      if (m_idle.load(std::memory_order_seq_cst) > 0 &&
+          !m_waking.exchange(true, std::memory_order_acq_rel))
+        futex::wake_one(m_work_seq);
+    }
+
+    details::fiber_impl* steal(details::fiber_worker* thief) {
+      for (std::size_t i=0; i<m_workers.size(); ++i) {
+        if (m_workers[i] != thief) {
+          if (details::fiber_impl* f = m_workers[i]->pop())
+            return f;
+        }
+      }
+      return NULL;
+    }
+
+    static void fiber_entry(void* arg) {
+      details::fiber_impl* self = static_cast<details::fiber_impl*>(arg);
+      details::current_worker()->run_after();
+
+      try {
+        self->run();
+      }
+      catch (...) {
+        std::terminate();       // Exceptions cannot leave a fiber
+      }
+
+      // The stack is released after switching to another context
+      details::suspend_current(&fiber_scheduler::after_finish, self);
+      assert(false);            // Never resumed
+    }
+
+    static void after_finish(details::fiber_worker*, void* arg) {
+      details::fiber_impl* f = static_cast<details::fiber_impl*>(arg);
+      fiber_scheduler* sched = f->sched;
+
+      sched->m_stacks.release(f->stack);
+      f->ctx.destroy();
+
+      // Wake up joiners
+      details::fiber_impl* joiners;
+      {
+        lock_guard<word_lock> lock(f->join_lock);
+        joiners = f->joiners;
+        f->joiners = NULL;
+        f->done.store(1, std::memory_order_release);
+      }
+      futex::wake_all(f->done);
+      while (joiners) {
+        details::fiber_impl* next = joiners->next;
+        sched->post(joiners);
+        joiners = next;
+      }
+      f->release_ref();
+
+      if (sched->m_live.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        futex::wake_all(sched->m_live);
+    }
+
+    static void after_yield(details::fiber_worker* w, void* arg) {
+      w->push(static_cast<details::fiber_impl*>(arg));
+    }
+
+    static void after_sleep(details::fiber_worker*, void* arg) {
+      timer_entry* entry = static_cast<timer_entry*>(arg);
+      entry->fiber->sched->add_timer(*entry);
+    }
+
+    static void worker_proc(details::fiber_worker* w) {
+      w->sched->worker_loop(w);
+    }
+
+    void worker_loop(details::fiber_worker* w) {
+      details::current_worker() = w;
+      w->main_ctx.init_current();
+
+      for (;;) {
+        details::fiber_impl* f = w->pop();
+        if (!f)
+          f = steal(w);
+        if (f) {
+          w->current = f;
+          details::fiber_context::jump(w->main_ctx, f->ctx);
+          w->run_after();
+          continue;
+        }
+
+        // Idle: check the queues again after announcing that we are
+        // going to sleep (see post())
+        int seq = m_work_seq.load(std::memory_order_seq_cst);
+        m_idle.fetch_add(1, std::memory_order_seq_cst);
+        f = steal(NULL);
+        if (f)
+          w->push(f);
+        else if (!m_stop.load())
+          futex::wait(m_work_seq, seq);
+        m_idle.fetch_sub(1, std::memory_order_seq_cst);
+        m_waking.store(false, std::memory_order_release);
+
+        if (!f && m_stop.load())
+          break;
+      }
+
+      w->main_ctx.destroy();
+      details::current_worker() = NULL;
+    }
+
+    void add_timer(const timer_entry& entry) {
+      bool earliest;
+      {
+        lock_guard<mutex> lock(m_timers_mutex);
+        earliest = (m_timers.empty() || entry.deadline < m_timers.front().deadline);
+        m_timers.push_back(entry);
+        std::push_heap(m_timers.begin(), m_timers.end());
+      }
+      if (earliest) {
+        m_timer_seq.fetch_add(1, std::memory_order_release);
+        futex::wake_one(m_timer_seq);
+      }
+    }
+
+    static void timer_proc(fiber_scheduler* sched) {
+      sched->timer_loop();
+    }
+
+    void timer_loop() {
+      typedef std::chrono::steady_clock clock;
+      while (!m_stop.load()) {
+        int seq = m_timer_seq.load(std::memory_order_acquire);
+        int timeout = -1;
+        {
+          lock_guard<mutex> lock(m_timers_mutex);
+          clock::time_point now = clock::now();
+          while (!m_timers.empty() && m_timers.front().deadline <= now) {
+            post(m_timers.front().fiber);
+            std::pop_heap(m_timers.begin(), m_timers.end());
+            m_timers.pop_back();
+          }
+          if (!m_timers.empty()) {
+            timeout = static_cast<int>(
+              std::chrono::duration_cast<std::chrono::milliseconds>(
+                m_timers.front().deadline - now).count()) + 1;
+          }
+        }
+        if (timeout < 0)
+          futex::wait(m_timer_seq, seq);
+        else
+          futex::wait_for(m_timer_seq, seq, timeout);
+      }
+    }
+
+    details::fiber_stack_pool m_stacks;
+    std::vector<details::fiber_worker*> m_workers;
+    std::vector<thread*> m_threads;
+    std::atomic<unsigned> m_next_worker;
+
+    futex::word m_work_seq;             // Changes when a fiber is posted
+    std::atomic<int> m_idle;            // Number of idle workers
+    std::atomic<bool> m_waking;         // An idle worker is being woken up
+    futex::word m_live;                 // Number of unfinished fibers
+    std::atomic<bool> m_stop;
+
+    thread* m_timer;
+    mutex m_timers_mutex;
+    std::vector<timer_entry> m_timers;  // Heap of sleeping fibers
+    futex::word m_timer_seq;            // Changes to wake up the timer thread
+
+    // Non-copyable
+    fiber_scheduler(const fiber_scheduler&);
+    fiber_scheduler& operator=(const fiber_scheduler&);
+  };
+
+  namespace details {
+
+    inline void make_ready(fiber_impl* f) {
+      f->sched->post(f);
+    }
+
+  } // namespace details
+
+  //////////////////////////////////////////////////////////////////////
+  // fiber class
+  //
+  // Handle of a fiber (like mt::thread for threads). join() can be
+  // called from a fiber (only the fiber waits) or from a thread.
+
+  class fiber {
+  public:
+    fiber() : m_impl(NULL) { }
+
+    template<class Callable>
+    fiber(fiber_scheduler& sched, const Callable& f) {
+      launch(sched, sched.create(f));
+    }
+
+    template<class Callable, class A>
+    fiber(fiber_scheduler& sched, const Callable& f, A a) {
+      launch(sched, sched.create(details::bind_fiber_args(f, a)));
+    }
+
+    ~fiber() {
+      assert(!joinable());
+      detach();
+    }
+
+    bool joinable() const {
+      return m_impl != NULL;
+    }
+
+    void join() {
+      assert(joinable());
+      details::fiber_impl* f = m_impl;
+
+      if (details::current_fiber()) {
+        f->join_lock.lock();
+        if (f->done.load(std::memory_order_acquire))
+          f->join_lock.unlock();
+        else {
+          details::fiber_impl* self = details::current_fiber();
+          self->next = f->joiners;
+          f->joiners = self;
+          details::block_current(f->join_lock);
+        }
+      }
+      else {
+        while (!f->done.load(std::memory_order_acquire))
+          futex::wait(f->done, 0);
+      }
+      detach();
+    }
+
+    void detach() {
+      if (m_impl) {
+        m_impl->release_ref();
+        m_impl = NULL;
+      }
+    }
+
+  private:
+    void launch(fiber_scheduler& sched, details::fiber_impl* impl) {
+      impl->refs.fetch_add(1, std::memory_order_relaxed); // Ref for the handle
+      m_impl = impl;
+      sched.start(impl);
+    }
+
+    details::fiber_impl* m_impl;
+
+    // Non-copyable
+    fiber(const fiber&);
+    fiber& operator=(const fiber&);
+  };
+
+  //////////////////////////////////////////////////////////////////////
+  // this_fiber namespace
+  //
+  // Functions for the current fiber. Outside a fiber they act on the
+  // current thread.
+
+  namespace this_fiber {
+
+    // Lets other ready fibers of this worker run
+    inline void yield() {
+      details::fiber_impl* self = details::current_fiber();
+      if (!self) {
+        this_thread::yield();
+        return;
+      }
+      details::fiber_worker* w = details::current_worker();
+      details::fiber_impl* next = w->pop();
+      if (next)                 // Else there is nothing else to run
+        details::switch_to(w, next, &fiber_scheduler::after_yield, self);
+    }
+
+    inline void sleep_for(int milliseconds) {
+      details::fiber_impl* self = details::current_fiber();
+      if (!self) {
+        this_thread::sleep_for(milliseconds);
+        return;
+      }
+
+      fiber_scheduler::timer_entry entry;
+      entry.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(milliseconds);
+      entry.fiber = self;
+      details::suspend_current(&fiber_scheduler::after_sleep, &entry);
+    }
+
+    inline bool in_fiber() {
+      return details::current_fiber() != NULL;
+    }
+
+  } // namespace this_fiber
+
+  //////////////////////////////////////////////////////////////////////
+  // fiber_mutex class
+  //
+  // Mutex for fibers: a fiber that finds it locked is parked (its
+  // worker thread continues with other fibers). unlock() hands the
+  // ownership to the first waiter (FIFO). It must be used from fibers.
+
+  class fiber_mutex {
+  public:
+    fiber_mutex() : m_locked(false) { }
+
+    bool try_lock() {
+      lock_guard<word_lock> lock(m_lock);
+      if (m_locked)
+        return false;
+      m_locked = true;
+      return true;
+    }
+
+    void lock() {
+      m_lock.lock();
+      if (!m_locked) {
+        m_locked = true;
+        m_lock.unlock();
+        return;
+      }
+      assert(details::current_fiber());
+      m_waiters.push(details::current_fiber());
+      details::block_current(m_lock); // Resumed as the new owner
+    }
+
+    void unlock() {
+      details::fiber_impl* next;
+      {
+        lock_guard<word_lock> lock(m_lock);
+        next = m_waiters.pop();
+        if (!next)
+          m_locked = false;
+      }
+      if (next)
+        details::make_ready(next);
+    }
+
+  private:
+    word_lock m_lock;
+    bool m_locked;
+    details::fiber_list m_waiters;
+
+    // Non-copyable
+    fiber_mutex(const fiber_mutex&);
+    fiber_mutex& operator=(const fiber_mutex&);
+  };
+
+  //////////////////////////////////////////////////////////////////////
+  // fiber_condition_variable class
+
+  class fiber_condition_variable {
+  public:
+    fiber_condition_variable() { }
+
+    void wait(lock_guard<fiber_mutex>& guard) {
+      fiber_mutex& mutex = *guard.mutex();
+      assert(details::current_fiber());
+
+      m_lock.lock();
+      m_waiters.push(details::current_fiber());
+      mutex.unlock();
+      details::block_current(m_lock);
+      mutex.lock();
+    }
+
+    void notify_one() {
+      details::fiber_impl* f;
+      {
+        lock_guard<word_lock> lock(m_lock);
+        f = m_waiters.pop();
+      }
+      if (f)
+        details::make_ready(f);
+    }
+
+    void notify_all() {
+      details::fiber_list waiters;
+      {
+        lock_guard<word_lock> lock(m_lock);
+        std::swap(waiters, m_waiters);
+      }
+      while (details::fiber_impl* f = waiters.pop())
+        details::make_ready(f);
+    }
+
+  private:
+    word_lock m_lock;
+    details::fiber_list m_waiters;
+
+    // Non-copyable
+    fiber_condition_variable(const fiber_condition_variable&);
+    fiber_condition_variable& operator=(const fiber_condition_variable&);
+  };
+
+} // namespace mt
+
+#endif // MT_FIBER_HEADER_FILE_INCLUDED
@@ -0,0 +1,208 @@
+// mt - thread library to create C++ experiments         -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+#ifndef MT_FUTEX_HEADER_FILE_INCLUDED
+#define MT_FUTEX_HEADER_FILE_INCLUDED
+
+#include "mt/thread.h"
+
+#include <atomic>
+#include <climits>
+
+#if defined(__linux__)
+  #include <linux/futex.h>
+  #include <sys/syscall.h>
+  #include <unistd.h>
+  #include <errno.h>
+#elif !defined(_WIN32)
+  #include <sys/time.h>
+  #include <unistd.h>
+#endif
+
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+  #include <intrin.h>
+#endif
+
+namespace mt {
+
+  //////////////////////////////////////////////////////////////////////
+  // futex namespace
+  //
+  // Wait/wake on the address of a 32-bit atomic word. This is the
+  // building block of the primitives that must not own a kernel object
+  // (barrier, latch, counting_semaphore, etc.): they spin on the word
+  // for a while and only park the thread here when it doesn't change.
+  //
+  // Waits can return spuriously, callers must re-check their condition.
+  //
+  // - Linux: futex(2) with FUTEX_PRIVATE_FLAG.
+  // - Windows 8 or greater (_WIN32_WINNT >= 0x0602): WaitOnAddress().
+  // - Others: a yield/sleep polling loop (correct but not efficient).
+
+  namespace futex {
+
+    typedef std::atomic<int> word;
+
+    // Tells to the CPU that we are in a spin-wait loop
+    inline void cpu_relax() {
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+      _mm_pause();
+#elif defined(__i386__) || defined(__x86_64__)
+      __asm__ __volatile__("pause");
+#elif defined(__aarch64__) || defined(__arm__)
+      __asm__ __volatile__("yield");
+#endif
+    }
+
+    namespace details {
+      inline int number_of_cpus() {
+#ifdef _WIN32
+        SYSTEM_INFO si;
+        ::GetSystemInfo(&si);
+        return static_cast<int>(si.dwNumberOfProcessors);
+#else
+        return static_cast<int>(sysconf(_SC_NPROCESSORS_ONLN));
+#endif
+      }
+    }
+
+    // Number of cpu_relax() iterations before parking a thread. Each
+    // primitive spins this much (at most) before calling wait(). On
+    // uniprocessors spinning only delays the thread that we are
+    // waiting for, so we go directly to the futex.
+    inline int spin_count() {
+      static const int count = (details::number_of_cpus() > 1 ? 128: 0);
+      return count;
+    }
+
+    // Spins while "w == expected", returns true if the word changed
+    // before consuming all the "spins".
+    inline bool spin_while_equal(const word& w, int expected,
+                                 int spins = spin_count()) {
+      for (int i=0; i<spins; ++i) {
+        if (w.load(std::memory_order_acquire) != expected)
+          return true;
+        cpu_relax();
+      }
+      return (w.load(std::memory_order_acquire) != expected);
+    }
+
+#if defined(__linux__)
+
+    static_assert(sizeof(word) == sizeof(int), "std::atomic<int> must be a plain int");
+
+    namespace details {
+      inline long sys_futex(const word* w, int op, int val,
+                            const struct timespec* ts) {
+        return syscall(SYS_futex,
+                       const_cast<int*>(reinterpret_cast<const int*>(w)),
+                       op | FUTEX_PRIVATE_FLAG, val, ts, NULL, 0);
+      }
+    }
+
+    // Blocks the current thread while "w == expected"
+    inline void wait(const word& w, int expected) {
+      details::sys_futex(&w, FUTEX_WAIT, expected, NULL);
+    }
+
+    // Like wait() but returns false if the timeout (in milliseconds)
+    // has elapsed.
+    inline bool wait_for(const word& w, int expected, int milliseconds) {
+      struct timespec ts;
+      ts.tv_sec = milliseconds / 1000;
+      ts.tv_nsec = (milliseconds % 1000) * 1000000L;
+      if (details::sys_futex(&w, FUTEX_WAIT, expected, &ts) != 0 &&
+          errno == ETIMEDOUT)
+        return false;
+      return true;
+    }
+
+    inline void wake_one(const word& w) {
+      details::sys_futex(&w, FUTEX_WAKE, 1, NULL);
+    }
+
+    inline void wake_n(const word& w, int n) {
+      details::sys_futex(&w, FUTEX_WAKE, n, NULL);
+    }
+
+    inline void wake_all(const word& w) {
+      details::sys_futex(&w, FUTEX_WAKE, INT_MAX, NULL);
+    }
+
+#elif defined(_WIN32) && (_WIN32_WINNT >= 0x0602)
+
+    #pragma comment(lib, "synchronization.lib")
+
+    inline void wait(const word& w, int expected) {
+      ::WaitOnAddress(const_cast<word*>(&w), &expected, sizeof(int), INFINITE);
+    }
+
+    inline bool wait_for(const word& w, int expected, int milliseconds) {
+      if (!::WaitOnAddress(const_cast<word*>(&w), &expected, sizeof(int), milliseconds))
+        return (::GetLastError() != ERROR_TIMEOUT);
+      return true;
+    }
+
+    inline void wake_one(const word& w) {
+      ::WakeByAddressSingle(const_cast<word*>(&w));
+    }
+
+    inline void wake_n(const word& w, int n) {
+      for (int i=0; i<n; ++i)
+        ::WakeByAddressSingle(const_cast<word*>(&w));
+    }
+
+    inline void wake_all(const word& w) {
+      ::WakeByAddressAll(const_cast<word*>(&w));
+    }
+
+#else  // Polling fallback
+
+    namespace details {
+      inline double now_msecs() {
+#ifdef _WIN32
+        return static_cast<double>(::GetTickCount());
+#else
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        return tv.tv_sec*1000.0 + tv.tv_usec/1000.0;
+#endif
+      }
+    }
+
+    inline void wait(const word& w, int expected) {
+      for (int i=0; w.load(std::memory_order_acquire) == expected; ++i) {
+        if (i < 16)
+          this_thread::yield();
+        else
+          this_thread::sleep_for(1);
+      }
+    }
+
+    inline bool wait_for(const word& w, int expected, int milliseconds) {
+      double deadline = details::now_msecs() + milliseconds;
+      for (int i=0; w.load(std::memory_order_acquire) == expected; ++i) {
+        if (details::now_msecs() >= deadline)
+          return false;
+        if (i < 16)
+          this_thread::yield();
+        else
+          this_thread::sleep_for(1);
+      }
+      return true;
+    }
+
+    inline void wake_one(const word&) { }
+    inline void wake_n(const word&, int) { }
+    inline void wake_all(const word&) { }
+
+#endif
+
+  } // namespace futex
+
+} // namespace mt
+
+#endif // MT_FUTEX_HEADER_FILE_INCLUDED
@@ -0,0 +1,232 @@
+// mt - thread library to create C++ experiments         -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+#ifndef MT_HAZARD_POINTER_HEADER_FILE_INCLUDED
+#define MT_HAZARD_POINTER_HEADER_FILE_INCLUDED
+
+#include "mt/thread_registry.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <exception>
+#include <vector>
+
+namespace mt {
+
+  namespace details {
+
+    struct retired_ptr {
+      void* ptr;
+      void (*deleter)(void*);
+    };
+
+    template<class T>
+    void delete_object(void* p) {
+      delete static_cast<T*>(p);
+    }
+
+    inline void reclaim_all(std::vector<retired_ptr>& list) {
+      for (std::size_t i=0; i<list.size(); ++i)
+        list[i].deleter(list[i].ptr);
+      list.clear();
+    }
+
+  } // namespace details
+
+  class hazard_pointer;
+
+  //////////////////////////////////////////////////////////////////////
+  // hazard_domain class
+  //
+  // Safe memory reclamation with hazard pointers (Michael, 2004). A
+  // reader publishes the pointer that it's going to dereference in one
+  // of its thread's hazard slots (see hazard_pointer::protect()), and a
+  // writer that unlinks a node calls retire() instead of delete. Each
+  // thread keeps its own retire list, and when it reaches the
+  // threshold the list is scanned in batch: every node that is not in
+  // any hazard slot is deleted.
+  //
+  // The domain must outlive the threads that use it. Its destructor
+  // deletes everything that is still retired.
+
+  class hazard_domain {
+  public:
+    static const int slots_per_thread = 8;
+
+    explicit hazard_domain(std::size_t retire_threshold = 64)
+      : m_threshold(retire_threshold) {
+    }
+
+    ~hazard_domain() {
+      m_records.for_each(reclaim_record());
+    }
+
+    // Default domain for the whole program
+    static hazard_domain& global() {
+      static hazard_domain domain;
+      return domain;
+    }
+
+    template<class T>
+    void retire(T* p) {
+      retire(p, &details::delete_object<T>);
+    }
+
+    void retire(void* p, void (*deleter)(void*)) {
+      record& r = m_records.local();
+      details::retired_ptr rp = { p, deleter };
+      r.retired.push_back(rp);
+      if (r.retired.size() >= std::max(m_threshold, r.next_scan))
+        scan(r);
+    }
+
+    // Deletes all the nodes retired by the current thread that are not
+    // protected by any hazard pointer
+    void reclaim() {
+      scan(m_records.local());
+    }
+
+  private:
+    friend class hazard_pointer;
+
+    struct record {
+      std::atomic<void*> hazards[slots_per_thread];
+      unsigned used;            // Bitmask of used hazards (owner thread only)
+      std::vector<details::retired_ptr> retired;
+      std::size_t next_scan;
+
+      record() : used(0), next_scan(0) {
+        for (int i=0; i<slots_per_thread; ++i)
+          hazards[i].store(NULL, std::memory_order_relaxed);
+      }
+
+      // The retired list is kept, it will be scanned by the next thread
+      // that reuses this record (or by the domain destructor).
+      void thread_exit() {
+        for (int i=0; i<slots_per_thread; ++i)
+          hazards[i].store(NULL, std::memory_order_release);
+        used = 0;
+      }
+    };
+
+    struct collect_hazards {
+      std::vector<void*>* hazards;
+      void operator()(record& r) {
+        for (int i=0; i<slots_per_thread; ++i) {
+          void* p = r.hazards[i].load(std::memory_order_acquire);
+          if (p)
+            hazards->push_back(p);
+        }
+      }
+    };
+
+    struct reclaim_record {
+      void operator()(record& r) {
+        details::reclaim_all(r.retired);
+      }
+    };
+
+    void scan(record& r) {
+      // Pairs with the fence in hazard_pointer::protect(): if the reader
+      // published its hazard before we unlinked the node, we see it.
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+
+      std::vector<void*> hazards;
+      collect_hazards collect = { &hazards };
+      m_records.for_each(collect);
+      std::sort(hazards.begin(), hazards.end());
+
+      std::vector<details::retired_ptr>::iterator keep = r.retired.begin();
+      for (std::vector<details::retired_ptr>::iterator
+             it=r.retired.begin(), end=r.retired.end(); it != end; ++it) {
+        if (std::binary_search(hazards.begin(), hazards.end(), it->ptr))
+          *(keep++) = *it;
+        else
+          it->deleter(it->ptr);
+      }
+      r.retired.erase(keep, r.retired.end());
+
+      // Amortize the scan: wait until the list doubles the number of
+      // hazards (so at least half of the nodes can be deleted)
+      r.next_scan = 2*hazards.size();
+    }
+
+    record& acquire_slot(int& index) {
+      record& r = m_records.local();
+      for (int i=0; i<slots_per_thread; ++i) {
+        if ((r.used & (1u << i)) == 0) {
+          r.used |= (1u << i);
+          index = i;
+          return r;
+        }
+      }
+      assert(false && "Too many hazard pointers in the current thread");
+      std::terminate();
+    }
+
+    thread_registry<record> m_records;
+    std::size_t m_threshold;
+
+    // Non-copyable
+    hazard_domain(const hazard_domain&);
+    hazard_domain& operator=(const hazard_domain&);
+  };
+
+  //////////////////////////////////////////////////////////////////////
+  // hazard_pointer class
+  //
+  // One hazard slot of the current thread (a thread can have up to
+  // hazard_domain::slots_per_thread alive at the same time).
+  //
+  //   mt::hazard_pointer hp;
+  //   node* n = hp.protect(head);  // "n" cannot be deleted until...
+  //   ...
+  //   hp.reset();                  // ...we reset the hazard pointer
+
+  class hazard_pointer {
+  public:
+    explicit hazard_pointer(hazard_domain& domain = hazard_domain::global())
+      : m_record(&domain.acquire_slot(m_index)) {
+    }
+
+    ~hazard_pointer() {
+      reset();
+      m_record->used &= ~(1u << m_index);
+    }
+
+    // Loads "src" and protects the loaded pointer. The load is repeated
+    // until the published hazard matches the current value of "src".
+    template<class T>
+    T* protect(const std::atomic<T*>& src) {
+      T* p = src.load(std::memory_order_relaxed);
+      for (;;) {
+        m_record->hazards[m_index].store(p, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        T* q = src.load(std::memory_order_acquire);
+        if (p == q)
+          return p;
+        p = q;
+      }
+    }
+
+    void reset() {
+      m_record->hazards[m_index].store(NULL, std::memory_order_release);
+    }
+
+  private:
+    int m_index;
+    hazard_domain::record* m_record;
+
+    // Non-copyable
+    hazard_pointer(const hazard_pointer&);
+    hazard_pointer& operator=(const hazard_pointer&);
+  };
+
+} // namespace mt
+
+#endif // MT_HAZARD_POINTER_HEADER_FILE_INCLUDED
@@ -0,0 +1,74 @@
+// mt - thread library to create C++ experiments         -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+#ifndef MT_LATCH_HEADER_FILE_INCLUDED
+#define MT_LATCH_HEADER_FILE_INCLUDED
+
+#include "mt/futex.h"
+
+#include <cassert>
+
+namespace mt {
+
+  //////////////////////////////////////////////////////////////////////
+  // latch class
+  //
+  // Single-use downward counter (C++20 like). Threads waiting for zero
+  // spin on the counter and then park in the futex of the counter. The
+  // m_sleepers flag avoids the wake system call when nobody sleeps.
+
+  class latch {
+  public:
+    explicit latch(int expected)
+      : m_count(expected)
+      , m_sleepers(0) {
+      assert(expected >= 0);
+    }
+
+    void count_down(int n = 1) {
+      int old = m_count.fetch_sub(n, std::memory_order_seq_cst);
+      assert(old >= n);
+      if (old == n && m_sleepers.load(std::memory_order_seq_cst))
+        futex::wake_all(m_count);
+    }
+
+    bool try_wait() const {
+      return m_count.load(std::memory_order_acquire) == 0;
+    }
+
+    void wait() const {
+      int count = m_count.load(std::memory_order_acquire);
+      if (count == 0)
+        return;
+
+      for (int i=0; i<futex::spin_count(); ++i) {
+        futex::cpu_relax();
+        if ((count = m_count.load(std::memory_order_acquire)) == 0)
+          return;
+      }
+
+      m_sleepers.store(1, std::memory_order_seq_cst);
+      while ((count = m_count.load(std::memory_order_seq_cst)) != 0)
+        futex::wait(m_count, count);
+    }
+
+    void arrive_and_wait(int n = 1) {
+      count_down(n);
+      wait();
+    }
+
+  private:
+    futex::word m_count;
+    mutable std::atomic<int> m_sleepers;
+
+    // Non-copyable
+    latch(const latch&);
+    latch& operator=(const latch&);
+  };
+
+} // namespace mt
+
+#endif // MT_LATCH_HEADER_FILE_INCLUDED
@@ -0,0 +1,598 @@
+// mt - thread library to create C++ experiments         -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+#ifndef MT_LOGGER_HEADER_FILE_INCLUDED
+#define MT_LOGGER_HEADER_FILE_INCLUDED
+
+#include "mt/thread.h"
+#include "mt/futex.h"
+#include "mt/thread_registry.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#if (defined(__i386__) || defined(__x86_64__)) && !defined(_MSC_VER)
+  #include <x86intrin.h>
+#elif defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+  #include <intrin.h>
+#endif
+
+namespace mt {
+
+  class logger;
+
+  namespace details {
+
+    //////////////////////////////////////////////////////////////////////
+    // Encoding of log arguments
+    //
+    // Arithmetic values and pointers are copied as raw bytes. C strings
+    // and std::string are copied as a 32-bit length plus the characters
+    // (and a '\0'), so the background thread can format them even if
+    // the original string doesn't exist anymore. Only the first
+    // log_max_line characters of a string are copied (the formatted
+    // line is truncated to that length anyway).
+
+    const std::size_t log_max_line = 1024;
+
+    template<class T>
+    struct log_arg {
+      static_assert(std::is_arithmetic<T>::value || std::is_pointer<T>::value,
+                    "mt::logger only accepts arithmetic types, pointers and strings");
+      typedef T value_type;
+
+      static std::size_t size(const T&) { return sizeof(T); }
+
+      static char* write(char* p, const T& value) {
+        std::memcpy(p, &value, sizeof(T));
+        return p+sizeof(T);
+      }
+
+      static T read(const char*& p) {
+        T value;
+        std::memcpy(&value, p, sizeof(T));
+        p += sizeof(T);
+        return value;
+      }
+    };
+
+    struct log_string_arg {
+      typedef const char* value_type;
+
+      static std::size_t size(std::size_t len) {
+        return sizeof(std::uint32_t) + std::min(len, log_max_line) + 1;
+      }
+
+      static char* write(char* p, const char* s, std::size_t len) {
+        len = std::min(len, log_max_line);
+        std::uint32_t n = static_cast<std::uint32_t>(len);
+        std::memcpy(p, &n, sizeof(n));
+        p += sizeof(n);
+        std::memcpy(p, s, len);
+        p[len] = 0;
+        return p+len+1;
+      }
+
+      static const char* read(const char*& p) {
+        std::uint32_t n;
+        std::memcpy(&n, p, sizeof(n));
+        const char* s = p+sizeof(n);
+        p = s+n+1;
+        return s;               // Points to the record itself
+      }
+    };
+
+    template<>
+    struct log_arg<const char*> : log_string_arg {
+      static const char* str(const char* s) { return s ? s: "(null)"; }
+      static std::size_t size(const char* s) { return log_string_arg::size(std::strlen(str(s))); }
+      static char* write(char* p, const char* s) { return log_string_arg::write(p, str(s), std::strlen(str(s))); }
+    };
+
+    template<>
+    struct log_arg<char*> : log_arg<const char*> { };
+
+    template<>
+    struct log_arg<std::string> : log_string_arg {
+      static std::size_t size(const std::string& s) { return log_string_arg::size(s.size()); }
+      static char* write(char* p, const std::string& s) { return log_string_arg::write(p, s.c_str(), s.size()); }
+    };
+
+    inline std::size_t log_args_size() { return 0; }
+
+    template<class T, class... Rest>
+    std::size_t log_args_size(const T& value, const Rest&... rest) {
+      return log_arg<typename std::decay<T>::type>::size(value) + log_args_size(rest...);
+    }
+
+    inline char* log_args_write(char* p) { return p; }
+
+    template<class T, class... Rest>
+    char* log_args_write(char* p, const T& value, const Rest&... rest) {
+      p = log_arg<typename std::decay<T>::type>::write(p, value);
+      return log_args_write(p, rest...);
+    }
+
+    // Decodes the arguments one by one (accumulating them in
+    // "values") and finally calls snprintf() with all of them
+    template<class... Args>
+    struct log_decoder;
+
+    template<>
+    struct log_decoder<> {
+      template<class... Values>
+      static int format(const char* fmt, const char*, char* out, std::size_t n, Values... values) {
+        return std::snprintf(out, n, fmt, values...);
+      }
+    };
+
+    template<class T, class... Rest>
+    struct log_decoder<T, Rest...> {
+      template<class... Values>
+      static int format(const char* fmt, const char* p, char* out, std::size_t n, Values... values) {
+        typename log_arg<T>::value_type value = log_arg<T>::read(p);
+        return log_decoder<Rest...>::format(fmt, p, out, n, values..., value);
+      }
+    };
+
+    template<class... Args>
+    struct log_formatter {
+      static int format(const char* fmt, const char* args, char* out, std::size_t n) {
+        return log_decoder<Args...>::format(fmt, args, out, n);
+      }
+    };
+
+    // Cheap timestamp for each record: the CPU time-stamp counter when
+    // it's available (a few nanoseconds against ~20ns or more of
+    // steady_clock::now()), the background thread converts it to
+    // nanoseconds.
+    inline std::int64_t log_ticks() {
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+      return static_cast<std::int64_t>(__rdtsc());
+#elif defined(__aarch64__)
+      std::int64_t ticks;
+      __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(ticks));
+      return ticks;
+#else
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // log_record struct
+    //
+    // Header of each message in a log_buffer, followed by the encoded
+    // arguments. A record with size == 0 is a padding mark: the rest of
+    // the buffer must be skipped.
+
+    struct log_record {
+      typedef int (*format_fn)(const char* fmt, const char* args, char* out, std::size_t n);
+
+      std::uint32_t size;       // Total size of the record (multiple of 8)
+      std::uint32_t thread;     // Index of the thread that wrote it
+      std::int64_t time;        // log_ticks() when it was logged
+      const char* fmt;          // Format string (it's the "ID" of the message)
+      format_fn format;         // Knows the types of the arguments
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    // log_buffer class
+    //
+    // Single-producer/single-consumer ring of variable-sized records.
+    // The producer is the thread that owns the record in the logger's
+    // thread_registry, the consumer is the logger's background thread.
+    // m_head/m_tail are byte positions that wrap around 2^32.
+
+    class log_buffer {
+    public:
+      log_buffer()
+        : m_data(NULL), m_capacity(0)
+        , m_tail(0), m_cached_head(0), m_index(0), m_dropped(0)
+        , m_head(0), m_blocked(false), m_reported_drops(0) {
+      }
+
+      ~log_buffer() {
+        delete[] m_data;
+      }
+
+      // Called from thread_registry when the owner thread finishes, the
+      // next thread that reuses this buffer will get a new index
+      void thread_exit() {
+        m_index.store(0, std::memory_order_relaxed);
+      }
+
+    private:
+      friend class mt::logger;
+
+      char* m_data;
+      std::uint32_t m_capacity;          // Power of two
+
+      // Producer side
+      std::atomic<std::uint32_t> m_tail;
+      std::uint32_t m_cached_head;       // Last m_head seen by the producer
+      std::atomic<std::uint32_t> m_index; // Thread index (0 = not assigned yet)
+      std::atomic<unsigned long> m_dropped;
+
+      char m_padding[64];                // Avoid false sharing
+
+      // Consumer side
+      futex::word m_head;                // Producers can futex-wait on it
+      std::atomic<bool> m_blocked;       // A producer is waiting space
+      unsigned long m_reported_drops;
+    };
+
+  } // namespace details
+
+  //////////////////////////////////////////////////////////////////////
+  // logger class
+  //
+  // Asynchronous logger for hot paths. log() doesn't format anything:
+  // it copies a pointer to the format string, a pointer to a function
+  // that knows the types of the arguments, a timestamp and the raw
+  // arguments into a buffer of the calling thread (a lock-free SPSC
+  // ring, there is no shared lock between producers). A background
+  // thread drains all the buffers, formats the messages with
+  // snprintf() and writes them to the FILE* in big batches.
+  //
+  //   mt::logger log(stdout);
+  //   log.log("[producer %d] item %3d produced", producer_nth, item);
+  //
+  // The format string must be a string literal (only its address is
+  // stored) and the arguments must match its specifiers as in printf().
+  // Strings (const char* and std::string) are copied.
+  //
+  // When a thread's buffer is full, the message is dropped (and
+  // counted, see dropped()) or the thread waits for the background
+  // thread, depending on the overflow policy. A message that needs
+  // more than 1/4 of the buffer (e.g. with several long strings in a
+  // small buffer) is always dropped and counted, with both policies.
+  // In each pass the background thread merges the messages of all
+  // threads by timestamp.
+  //
+  // All the threads that use the logger must finish before its
+  // destruction (see thread_registry).
+
+  class logger {
+  public:
+    enum overflow_policy { drop, block };
+
+    // Maximum length of a formatted line (longer ones are truncated)
+    static const std::size_t max_line = details::log_max_line;
+
+    explicit logger(FILE* file,
+                    overflow_policy policy = drop,
+                    std::size_t buffer_size = 64*1024,
+                    int flush_interval_ms = 10)
+      : m_file(file)
+      , m_policy(policy)
+      , m_buffer_size(round_buffer_size(buffer_size))
+      , m_flush_interval(flush_interval_ms)
+      , m_start(clock::now())
+      , m_start_ticks(details::log_ticks())
+      , m_ns_per_tick(1.0)
+      , m_next_index(0)
+      , m_batch(64*1024)
+      , m_batch_size(0)
+      , m_signal(0)
+      , m_sleeping(false)
+      , m_flush_requests(0)
+      , m_flushed(0)
+      , m_stop(false) {
+      m_thread = new thread(&logger::thread_proc, this);
+    }
+
+    ~logger() {
+      m_stop.store(true);
+      wake_consumer();
+      m_thread->join();
+      delete m_thread;
+    }
+
+    template<class... Args>
+    void log(const char* fmt, const Args&... args) {
+      details::log_buffer& buf = local_buffer();
+
+      std::uint32_t need = static_cast<std::uint32_t>(
+        (sizeof(details::log_record) + details::log_args_size(args...) + 7) & ~std::size_t(7));
+      char* p = reserve(buf, need);
+      if (!p)
+        return;
+
+      details::log_record* rec = reinterpret_cast<details::log_record*>(p);
+      rec->size = need;
+      rec->thread = buf.m_index.load(std::memory_order_relaxed);
+      rec->time = details::log_ticks();
+      rec->fmt = fmt;
+      rec->format = &details::log_formatter<typename std::decay<Args>::type...>::format;
+      details::log_args_write(p+sizeof(details::log_record), args...);
+
+      commit(buf, need);
+    }
+
+    // Waits until all the messages logged before this call are written
+    void flush() {
+      int request = m_flush_requests.fetch_add(1) + 1;
+      wake_consumer();
+      int flushed;
+      while ((flushed = m_flushed.load(std::memory_order_acquire)) - request < 0)
+        futex::wait(m_flushed, flushed);
+    }
+
+    // Number of messages dropped because the buffers were full
+    unsigned long dropped() {
+      unsigned long total = 0;
+      m_buffers.for_each([&total](details::log_buffer& buf) {
+          total += buf.m_dropped.load(std::memory_order_relaxed);
+        });
+      return total;
+    }
+
+  private:
+    typedef std::chrono::steady_clock clock;
+
+    static std::uint32_t round_buffer_size(std::size_t size) {
+      std::uint32_t n = 8192;     // A message with a string of max_line fits
+      while (n < size && n < (1u << 30))
+        n <<= 1;
+      return n;
+    }
+
+    details::log_buffer& local_buffer() {
+      details::log_buffer& buf = m_buffers.local();
+      if (!buf.m_index.load(std::memory_order_relaxed)) {
+        if (!buf.m_data) {
+          buf.m_data = new char[m_buffer_size];
+          buf.m_capacity = m_buffer_size;
+        }
+        buf.m_index.store(m_next_index.fetch_add(1, std::memory_order_relaxed) + 1,
+                          std::memory_order_relaxed);
+      }
+      return buf;
+    }
+
+    // Returns the position where the record must be written, or NULL
+    // if it was dropped. A record can use up to 1/4 of the buffer, so
+    // it (and the padding at the end of the buffer) always fits once
+    // the background thread drains the buffer.
+    char* reserve(details::log_buffer& buf, std::uint32_t need) {
+      if (need > buf.m_capacity / 4) {
+        buf.m_dropped.store(buf.m_dropped.load(std::memory_order_relaxed)+1,
+                            std::memory_order_relaxed);
+        return NULL;
+      }
+
+      std::uint32_t tail = buf.m_tail.load(std::memory_order_relaxed);
+      std::uint32_t offset = tail & (buf.m_capacity-1);
+      std::uint32_t contiguous = buf.m_capacity - offset;
+      std::uint32_t total = (contiguous < need ? contiguous + need: need);
+
+      if (buf.m_capacity - (tail - buf.m_cached_head) < total) {
+        buf.m_cached_head = buf.m_head.load(std::memory_order_acquire);
+        while (buf.m_capacity - (tail - buf.m_cached_head) < total) {
+          if (m_policy == drop) {
+            buf.m_dropped.store(buf.m_dropped.load(std::memory_order_relaxed)+1,
+                                std::memory_order_relaxed);
+            return NULL;
+          }
+          wait_space(buf);
+        }
+      }
+
+      if (contiguous < need) {
+        // Padding mark, the record goes at the beginning of the buffer
+        // (published so the background thread can skip it before the
+        // record is committed)
+        reinterpret_cast<details::log_record*>(buf.m_data+offset)->size = 0;
+        buf.m_tail.store(tail + contiguous, std::memory_order_release);
+        offset = 0;
+      }
+      return buf.m_data+offset;
+    }
+
+    void commit(details::log_buffer& buf, std::uint32_t need) {
+      std::uint32_t tail = buf.m_tail.load(std::memory_order_relaxed) + need;
+      buf.m_tail.store(tail, std::memory_order_release);
+
+      // Wake up the background thread when the buffer is half full
+      if (tail - buf.m_cached_head > buf.m_capacity/2 &&
+          m_sleeping.load(std::memory_order_relaxed)) {
+        buf.m_cached_head = buf.m_head.load(std::memory_order_acquire);
+        if (tail - buf.m_cached_head > buf.m_capacity/2)
+          wake_consumer();
+      }
+    }
+
+    void wait_space(details::log_buffer& buf) {
+      buf.m_blocked.store(true, std::memory_order_seq_cst);
+      int head = buf.m_head.load(std::memory_order_seq_cst);
+      wake_consumer();
+      if (static_cast<std::uint32_t>(head) == buf.m_cached_head)
+        futex::wait_for(buf.m_head, head, m_flush_interval);
+      buf.m_cached_head = buf.m_head.load(std::memory_order_acquire);
+    }
+
+    void wake_consumer() {
+      m_signal.fetch_add(1, std::memory_order_seq_cst);
+      futex::wake_one(m_signal);
+    }
+
+    static void thread_proc(logger* self) {
+      self->consumer_loop();
+    }
+
+    void consumer_loop() {
+      for (;;) {
+        int seq = m_signal.load(std::memory_order_acquire);
+        bool stop = m_stop.load(std::memory_order_acquire);
+        int requests = m_flush_requests.load(std::memory_order_acquire);
+
+        drain_all();
+
+        if (requests != m_flushed.load(std::memory_order_relaxed)) {
+          m_flushed.store(requests, std::memory_order_release);
+          futex::wake_all(m_flushed);
+        }
+        if (stop)
+          break;
+
+        m_sleeping.store(true, std::memory_order_relaxed);
+        futex::wait_for(m_signal, seq, m_flush_interval);
+        m_sleeping.store(false, std::memory_order_relaxed);
+      }
+    }
+
+    void drain_all() {
+      // Ratio between the steady clock and the ticks since the start
+      std::int64_t ticks = details::log_ticks() - m_start_ticks;
+      double ns = static_cast<double>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - m_start).count());
+      if (ticks > 0 && ns > 0)
+        m_ns_per_tick = ns / static_cast<double>(ticks);
+
+      // Take a snapshot of the records in each buffer
+      m_pending.clear();
+      m_buffers.for_each([this](details::log_buffer& buf) {
+          report_drops(buf);
+
+          pending p;
+          p.buf = &buf;
+          p.head = static_cast<std::uint32_t>(buf.m_head.load(std::memory_order_relaxed));
+          p.tail = buf.m_tail.load(std::memory_order_acquire);
+          if (p.head != p.tail)
+            m_pending.push_back(p);
+        });
+
+      // Merge the records of all threads by timestamp
+      for (;;) {
+        pending* oldest = NULL;
+        const details::log_record* oldest_rec = NULL;
+        for (std::size_t i=0; i<m_pending.size(); ++i) {
+          const details::log_record* rec = peek(m_pending[i]);
+          if (rec && (!oldest_rec || rec->time < oldest_rec->time)) {
+            oldest = &m_pending[i];
+            oldest_rec = rec;
+          }
+        }
+        if (!oldest)
+          break;
+
+        format_record(oldest_rec);
+        oldest->head += oldest_rec->size;
+      }
+
+      // Release the space to the producers
+      for (std::size_t i=0; i<m_pending.size(); ++i) {
+        details::log_buffer& buf = *m_pending[i].buf;
+        buf.m_head.store(static_cast<int>(m_pending[i].head), std::memory_order_seq_cst);
+        if (buf.m_blocked.load(std::memory_order_seq_cst)) {
+          buf.m_blocked.store(false, std::memory_order_relaxed);
+          futex::wake_all(buf.m_head);
+        }
+      }
+
+      write_batch();
+      std::fflush(m_file);
+    }
+
+    struct pending {
+      details::log_buffer* buf;
+      std::uint32_t head;
+      std::uint32_t tail;
+    };
+
+    // Returns the next record of the buffer (or NULL if there is none)
+    const details::log_record* peek(pending& p) {
+      while (p.head != p.tail) {
+        std::uint32_t offset = p.head & (p.buf->m_capacity-1);
+        const details::log_record* rec =
+          reinterpret_cast<const details::log_record*>(p.buf->m_data+offset);
+        if (rec->size != 0)
+          return rec;
+        p.head += p.buf->m_capacity - offset; // Padding mark
+      }
+      return NULL;
+    }
+
+    void report_drops(details::log_buffer& buf) {
+      unsigned long drops = buf.m_dropped.load(std::memory_order_relaxed);
+      if (drops != buf.m_reported_drops) {
+        char* out = line_buffer();
+        int n = std::snprintf(out, max_line, "[%u] %lu messages dropped\n",
+                              buf.m_index.load(std::memory_order_relaxed),
+                              drops - buf.m_reported_drops);
+        m_batch_size += (n < 0 ? 0: std::min<std::size_t>(n, max_line-1));
+        buf.m_reported_drops = drops;
+      }
+    }
+
+    void format_record(const details::log_record* rec) {
+      char* out = line_buffer();
+      std::size_t room = max_line - 1;  // Keep space for the '\n'
+
+      int n = std::snprintf(out, room, "%12.6f [%u] ",
+                            double(rec->time - m_start_ticks) * m_ns_per_tick / 1e9,
+                            rec->thread);
+      std::size_t len = (n < 0 ? 0: std::min<std::size_t>(n, room-1));
+
+      n = rec->format(rec->fmt, reinterpret_cast<const char*>(rec+1), out+len, room-len);
+      len += (n < 0 ? 0: std::min<std::size_t>(n, room-len-1));
+
+      out[len++] = '\n';
+      m_batch_size += len;
+    }
+
+    // Returns space for one line at the end of the batch
+    char* line_buffer() {
+      if (m_batch.size() - m_batch_size < max_line)
+        write_batch();
+      return &m_batch[m_batch_size];
+    }
+
+    void write_batch() {
+      if (m_batch_size > 0) {
+        std::fwrite(&m_batch[0], 1, m_batch_size, m_file);
+        m_batch_size = 0;
+      }
+    }
+
+    FILE* m_file;
+    overflow_policy m_policy;
+    std::uint32_t m_buffer_size;
+    int m_flush_interval;
+    clock::time_point m_start;
+    std::int64_t m_start_ticks;
+    double m_ns_per_tick;         // Calibrated by the background thread
+    std::atomic<std::uint32_t> m_next_index;
+
+    thread_registry<details::log_buffer> m_buffers;
+    std::vector<char> m_batch;    // Formatted text (background thread only)
+    std::size_t m_batch_size;
+    std::vector<pending> m_pending;
+
+    futex::word m_signal;         // Changes to wake up the background thread
+    std::atomic<bool> m_sleeping;
+    futex::word m_flush_requests;
+    futex::word m_flushed;
+    std::atomic<bool> m_stop;
+    thread* m_thread;
+
+    // Non-copyable
+    logger(const logger&);
+    logger& operator=(const logger&);
+  };
+
+} // namespace mt
+
+#endif // MT_LOGGER_HEADER_FILE_INCLUDED
@@ -0,0 +1,427 @@
+// mt - thread library to create C++ experiments         -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+#ifndef MT_PARKING_LOT_HEADER_FILE_INCLUDED
+#define MT_PARKING_LOT_HEADER_FILE_INCLUDED
+
+#include "mt/futex.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace mt {
+
+  //////////////////////////////////////////////////////////////////////
+  // parking_lot namespace
+  //
+  // Global table of wait queues keyed by address (the design of
+  // WebKit's ParkingLot and Rust's parking_lot). A synchronization
+  // primitive only needs a few bits to know if it has waiters, the
+  // queue of waiting threads for its address lives here and exists
+  // only while some thread is parked on it.
+  //
+  // The table is a fixed array of buckets, each one with a small futex
+  // lock and an intrusive FIFO of parked threads. Each thread parks on
+  // its own thread-local futex word, so nothing is allocated.
+  //
+  // Callbacks (validate, on_timeout and the unpark callbacks) are
+  // called with the bucket locked: they must be short, and they must
+  // not park/unpark anything.
+
+  namespace parking_lot {
+
+    typedef std::intptr_t token;
+
+    // Token received by threads unparked without an explicit token
+    const token default_token = 0;
+
+    enum park_status {
+      unparked,                 // Woken up by an unpark function
+      invalid,                  // validate() returned false
+      timed_out                 // The timeout has elapsed
+    };
+
+    struct park_result {
+      park_status status;
+      token unpark_token;       // Valid only if status == unparked
+    };
+
+    struct unpark_result {
+      int unparked_threads;
+      int requeued_threads;
+      bool have_more_threads;   // More threads are parked on the same key
+    };
+
+    enum requeue_op {
+      requeue_abort,            // Don't do anything
+      unpark_one_requeue_rest,  // Unpark the first thread, requeue the rest
+      requeue_all               // Requeue all threads
+    };
+
+    namespace details {
+
+      //////////////////////////////////////////////////////////////////////
+      // bucket_lock class
+      //
+      // Mutex of 3 states (0 = unlocked, 1 = locked, 2 = locked with
+      // waiters) on a futex word (Drepper, "Futexes Are Tricky"). It
+      // can't use the parking lot itself.
+
+      class bucket_lock {
+      public:
+        void lock() {
+          int c = 0;
+          if (m_state.compare_exchange_strong(c, 1, std::memory_order_acquire))
+            return;
+
+          for (int i=0; i<futex::spin_count(); ++i) {
+            futex::cpu_relax();
+            c = 0;
+            if (m_state.load(std::memory_order_relaxed) == 0 &&
+                m_state.compare_exchange_weak(c, 1, std::memory_order_acquire))
+              return;
+          }
+
+          if (c != 2)
+            c = m_state.exchange(2, std::memory_order_acquire);
+          while (c != 0) {
+            futex::wait(m_state, 2);
+            c = m_state.exchange(2, std::memory_order_acquire);
+          }
+        }
+
+        void unlock() {
+          if (m_state.exchange(0, std::memory_order_release) == 2)
+            futex::wake_one(m_state);
+        }
+
+        futex::word m_state;    // Zero-initialized in the static table
+      };
+
+      // Per-thread data used to park the thread
+      struct thread_data {
+        futex::word parked;                 // 1 while it's in a queue
+        std::atomic<const void*> key;       // Address where it's parked
+        token unpark_token;
+        thread_data* next;
+      };
+
+      inline thread_data& current_thread_data() {
+        // Trivially destructible, so it's valid until the thread ends
+        static thread_local thread_data data;
+        return data;
+      }
+
+      struct alignas(64) bucket {   // One cache line per bucket
+        bucket_lock lock;
+        thread_data* head;
+        thread_data* tail;
+
+        void push(thread_data* td) {
+          td->next = NULL;
+          if (tail)
+            tail->next = td;
+          else
+            head = td;
+          tail = td;
+        }
+
+        // Removes "td" (whose previous node is "prev")
+        void remove(thread_data* prev, thread_data* td) {
+          if (prev)
+            prev->next = td->next;
+          else
+            head = td->next;
+          if (tail == td)
+            tail = prev;
+        }
+
+        bool has_key(const void* key, thread_data* from) const {
+          for (thread_data* td=from; td; td=td->next)
+            if (td->key.load(std::memory_order_relaxed) == key)
+              return true;
+          return false;
+        }
+      };
+
+      const std::size_t table_bits = 10;
+      const std::size_t table_size = std::size_t(1) << table_bits;
+
+      inline bucket* table() {
+        static bucket buckets[table_size]; // Zero-initialized
+        return buckets;
+      }
+
+      inline bucket& bucket_for(const void* key) {
+        // Fibonacci hashing
+        std::uint64_t h = static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(key));
+        h *= 0x9E3779B97F4A7C15ull;
+        return table()[h >> (64 - table_bits)];
+      }
+
+      // Locks the bucket where "td" is parked (its key can be changed
+      // by a requeue while we are waiting the lock)
+      inline bucket& lock_bucket_of(thread_data& td) {
+        for (;;) {
+          const void* key = td.key.load(std::memory_order_relaxed);
+          bucket& b = bucket_for(key);
+          b.lock.lock();
+          if (td.key.load(std::memory_order_relaxed) == key)
+            return b;
+          b.lock.unlock();
+        }
+      }
+
+      inline void lock_two(bucket& a, bucket& b) {
+        if (&a == &b)
+          a.lock.lock();
+        else if (&a < &b) {
+          a.lock.lock();
+          b.lock.lock();
+        }
+        else {
+          b.lock.lock();
+          a.lock.lock();
+        }
+      }
+
+      inline void unlock_two(bucket& a, bucket& b) {
+        a.lock.unlock();
+        if (&a != &b)
+          b.lock.unlock();
+      }
+
+      // Wakes up a thread that was removed from its queue. It can be
+      // called after unlocking the bucket: the thread can return from
+      // park() as soon as "parked" is zero (it was set to zero with the
+      // bucket locked), but the futex wake doesn't touch its memory.
+      inline void wake(thread_data* td) {
+        futex::wake_one(td->parked);
+      }
+
+    } // namespace details
+
+    // Parks the current thread in the queue of "key" if validate()
+    // returns true. before_sleep() is called after the thread is
+    // queued and the bucket is unlocked (e.g. to unlock a mutex). If
+    // the timeout (milliseconds, -1 = infinite) elapses,
+    // on_timeout(key, was_last_thread) is called with the bucket locked.
+    template<class Validate, class BeforeSleep, class OnTimeout>
+    park_result park(const void* key,
+                     Validate validate,
+                     BeforeSleep before_sleep,
+                     OnTimeout on_timeout,
+                     int timeout_ms = -1) {
+      details::thread_data& td = details::current_thread_data();
+      park_result result = { invalid, default_token };
+
+      {
+        details::bucket& b = details::bucket_for(key);
+        b.lock.lock();
+        if (!validate()) {
+          b.lock.unlock();
+          return result;
+        }
+        td.key.store(key, std::memory_order_relaxed);
+        td.unpark_token = default_token;
+        td.parked.store(1, std::memory_order_relaxed);
+        b.push(&td);
+        b.lock.unlock();
+      }
+
+      before_sleep();
+
+      typedef std::chrono::steady_clock clock;
+      clock::time_point deadline;
+      if (timeout_ms >= 0)
+        deadline = clock::now() + std::chrono::milliseconds(timeout_ms);
+
+      while (td.parked.load(std::memory_order_acquire)) {
+        if (timeout_ms < 0) {
+          futex::wait(td.parked, 1);
+          continue;
+        }
+
+        // Rounded up, so we don't time out before the deadline
+        long long remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+          deadline - clock::now() + std::chrono::microseconds(999)).count();
+        if (remaining > 0) {
+          futex::wait_for(td.parked, 1, static_cast<int>(remaining));
+          continue;
+        }
+
+        // Timeout: remove ourselves from the queue if nobody did it
+        details::bucket& b = details::lock_bucket_of(td);
+        if (td.parked.load(std::memory_order_relaxed)) {
+          details::thread_data* prev = NULL;
+          for (details::thread_data* it=b.head; it != &td; it=it->next)
+            prev = it;
+          b.remove(prev, &td);
+
+          const void* parked_key = td.key.load(std::memory_order_relaxed);
+          on_timeout(parked_key, !b.has_key(parked_key, b.head));
+          td.parked.store(0, std::memory_order_relaxed);
+          b.lock.unlock();
+
+          result.status = timed_out;
+          return result;
+        }
+        b.lock.unlock();
+        // We were unparked at the same time, "parked" is already zero
+      }
+
+      result.status = unparked;
+      result.unpark_token = td.unpark_token;
+      return result;
+    }
+
+    template<class Validate>
+    park_result park(const void* key, Validate validate, int timeout_ms = -1) {
+      struct noop {
+        void operator()() const { }
+        void operator()(const void*, bool) const { }
+      };
+      return park(key, validate, noop(), noop(), timeout_ms);
+    }
+
+    // Unparks the first thread parked on "key". callback(result) is
+    // called with the bucket locked (even if no thread was unparked)
+    // and its return value is the token received by the thread.
+    template<class Callback>
+    unpark_result unpark_one(const void* key, Callback callback) {
+      unpark_result result = { 0, 0, false };
+      details::bucket& b = details::bucket_for(key);
+      b.lock.lock();
+
+      details::thread_data* prev = NULL;
+      details::thread_data* td = b.head;
+      for (; td; prev=td, td=td->next) {
+        if (td->key.load(std::memory_order_relaxed) == key)
+          break;
+      }
+
+      if (td) {
+        b.remove(prev, td);
+        result.unparked_threads = 1;
+        result.have_more_threads = b.has_key(key, td->next);
+        td->unpark_token = callback(result);
+        td->parked.store(0, std::memory_order_release);
+        b.lock.unlock();
+        details::wake(td);
+      }
+      else {
+        callback(result);
+        b.lock.unlock();
+      }
+      return result;
+    }
+
+    // Unparks all threads parked on "key", returns how many
+    inline int unpark_all(const void* key, token unpark_token = default_token) {
+      details::bucket& b = details::bucket_for(key);
+      details::thread_data* woken = NULL;
+      details::thread_data* woken_tail = NULL;
+      int count = 0;
+
+      b.lock.lock();
+      details::thread_data* prev = NULL;
+      details::thread_data* td = b.head;
+      while (td) {
+        details::thread_data* next = td->next;
+        if (td->key.load(std::memory_order_relaxed) == key) {
+          b.remove(prev, td);
+          td->next = NULL;
+          if (woken_tail)
+            woken_tail->next = td;
+          else
+            woken = td;
+          woken_tail = td;
+          ++count;
+        }
+        else
+          prev = td;
+        td = next;
+      }
+
+      // All threads must be marked as unparked before unlocking the
+      // bucket (a thread that times out checks "parked" to know if it's
+      // still queued), and "next" can't be used after that.
+      for (td=woken; td; ) {
+        details::thread_data* next = td->next;
+        td->unpark_token = unpark_token;
+        td->parked.store(0, std::memory_order_release);
+        details::wake(td);
+        td = next;
+      }
+      b.lock.unlock();
+      return count;
+    }
+
+    // Moves the threads parked on "from" to the queue of "to" (or
+    // unparks the first one and moves the rest) depending on the
+    // requeue_op returned by validate(). callback(op, result) is called
+    // with both buckets locked. It's used by condition variables to
+    // avoid the thundering herd in notify_all(): the waiters are moved
+    // to the mutex's queue and woken up one by one on each unlock.
+    template<class Validate, class Callback>
+    unpark_result unpark_requeue(const void* from, const void* to,
+                                 Validate validate, Callback callback) {
+      unpark_result result = { 0, 0, false };
+      details::bucket& bfrom = details::bucket_for(from);
+      details::bucket& bto = details::bucket_for(to);
+      details::lock_two(bfrom, bto);
+
+      requeue_op op = validate();
+      if (op == requeue_abort) {
+        details::unlock_two(bfrom, bto);
+        return result;
+      }
+
+      details::thread_data* wakeup = NULL;
+      details::thread_data* prev = NULL;
+      details::thread_data* td = bfrom.head;
+      while (td) {
+        details::thread_data* next = td->next;
+        if (td->key.load(std::memory_order_relaxed) == from) {
+          if (op == unpark_one_requeue_rest && !wakeup) {
+            bfrom.remove(prev, td);
+            wakeup = td;
+            result.unparked_threads = 1;
+          }
+          else {
+            if (&bfrom != &bto) {
+              bfrom.remove(prev, td);
+              bto.push(td);
+            }
+            else
+              prev = td;
+            td->key.store(to, std::memory_order_relaxed);
+            ++result.requeued_threads;
+          }
+        }
+        else
+          prev = td;
+        td = next;
+      }
+
+      token t = callback(op, result);
+      if (wakeup) {
+        wakeup->unpark_token = t;
+        wakeup->parked.store(0, std::memory_order_release);
+      }
+      details::unlock_two(bfrom, bto);
+      if (wakeup)
+        details::wake(wakeup);
+      return result;
+    }
+
+  } // namespace parking_lot
+
+} // namespace mt
+
+#endif // MT_PARKING_LOT_HEADER_FILE_INCLUDED
@@ -0,0 +1,96 @@
+// mt - thread library to create C++ experiments         -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+#ifndef MT_RCU_PTR_HEADER_FILE_INCLUDED
+#define MT_RCU_PTR_HEADER_FILE_INCLUDED
+
+#include "mt/thread.h"
+#include "mt/epoch.h"
+
+#include <atomic>
+
+namespace mt {
+
+  //////////////////////////////////////////////////////////////////////
+  // rcu_ptr class
+  //
+  // Pointer to a read-mostly shared object (e.g. a configuration
+  // snapshot). Readers pin the epoch and load the pointer, without any
+  // atomic read-modify-write operation, and they see an immutable
+  // snapshot while the read_guard is alive. Writers publish a new copy
+  // and retire the old one in the epoch_domain, so it's deleted when
+  // the last reader of it leaves.
+  //
+  //   mt::rcu_ptr<config> cfg(new config);
+  //
+  //   {  // Reader
+  //     mt::rcu_ptr<config>::read_guard c(cfg);
+  //     use(c->value);
+  //   }
+  //
+  //   cfg.modify(set_value(2));  // Writer (copy, modify, publish)
+
+  template<class T>
+  class rcu_ptr {
+  public:
+    explicit rcu_ptr(T* initial, epoch_domain& domain = epoch_domain::global())
+      : m_ptr(initial)
+      , m_domain(domain) {
+    }
+
+    ~rcu_ptr() {
+      delete m_ptr.load(std::memory_order_relaxed);
+    }
+
+    class read_guard {
+    public:
+      explicit read_guard(const rcu_ptr& ptr)
+        : m_guard(ptr.m_domain)
+        , m_value(ptr.m_ptr.load(std::memory_order_acquire)) {
+      }
+
+      const T* get() const { return m_value; }
+      const T* operator->() const { return m_value; }
+      const T& operator*() const { return *m_value; }
+
+    private:
+      epoch_guard m_guard;
+      const T* m_value;
+    };
+
+    // Publishes a new object (the rcu_ptr takes its ownership)
+    void update(T* new_value) {
+      lock_guard<mutex> lock(m_writer);
+      T* old = m_ptr.exchange(new_value, std::memory_order_acq_rel);
+      if (old)
+        m_domain.retire(old);
+    }
+
+    // Copies the current object, calls f(T&) to modify the copy, and
+    // publishes it. Writers are serialized so no update is lost.
+    template<class F>
+    void modify(F f) {
+      lock_guard<mutex> lock(m_writer);
+      T* old = m_ptr.load(std::memory_order_relaxed);
+      T* copy = new T(*old);
+      f(*copy);
+      m_ptr.store(copy, std::memory_order_release);
+      m_domain.retire(old);
+    }
+
+  private:
+    std::atomic<T*> m_ptr;
+    epoch_domain& m_domain;
+    mutex m_writer;
+
+    // Non-copyable
+    rcu_ptr(const rcu_ptr&);
+    rcu_ptr& operator=(const rcu_ptr&);
+  };
+
+} // namespace mt
+
+#endif // MT_RCU_PTR_HEADER_FILE_INCLUDED
@@ -0,0 +1,347 @@
+// mt - thread library to create C++ experiments         -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+#ifndef MT_SCHEDULER_HEADER_FILE_INCLUDED
+#define MT_SCHEDULER_HEADER_FILE_INCLUDED
+
+// C++20 coroutines are required for this header
+
+#include "mt/thread.h"
+#include "mt/futex.h"
+#include "mt/semaphore.h"
+#include "mt/task.h"
+
+#include <algorithm>
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <vector>
+
+namespace mt {
+
+  namespace details {
+
+    //////////////////////////////////////////////////////////////////////
+    // handle_ring class
+    //
+    // Growable circular buffer of coroutine handles, it only allocates
+    // memory when it needs to duplicate its capacity.
+
+    class handle_ring {
+    public:
+      handle_ring() : m_items(64), m_head(0), m_size(0) { }
+
+      bool empty() const { return m_size == 0; }
+
+      void push(std::coroutine_handle<> h) {
+        if (m_size == m_items.size()) {
+          std::vector<std::coroutine_handle<> > items(m_items.size()*2);
+          for (std::size_t i=0; i<m_size; ++i)
+            items[i] = m_items[(m_head+i) % m_items.size()];
+          m_items.swap(items);
+          m_head = 0;
+        }
+        m_items[(m_head+m_size) % m_items.size()] = h;
+        ++m_size;
+      }
+
+      std::coroutine_handle<> pop() {
+        std::coroutine_handle<> h = m_items[m_head];
+        m_head = (m_head+1) % m_items.size();
+        --m_size;
+        return h;
+      }
+
+    private:
+      std::vector<std::coroutine_handle<> > m_items;
+      std::size_t m_head;
+      std::size_t m_size;
+    };
+
+  } // namespace details
+
+  //////////////////////////////////////////////////////////////////////
+  // scheduler class
+  //
+  // Multi-threaded executor for coroutines. It owns a pool of worker
+  // threads (mt::thread) that resume ready coroutines from a shared run
+  // queue, and a timer thread that posts coroutines which were
+  // suspended with sleep_for() when their deadline arrives.
+  //
+  // A suspended coroutine doesn't hold any thread, so thousands of
+  // tasks can wait for timers, mutexes, semaphores or queues (see
+  // mt/async.h) with only a few threads.
+  //
+  //   mt::scheduler sched(4);
+  //   sched.spawn(my_task(sched));  // Runs my_task in a worker
+  //   sched.join();                 // Waits all spawned tasks
+  //
+  // An exception that escapes a spawned task is passed to the error
+  // handler (see set_error_handler()), or if there is no handler, the
+  // first one is kept and rethrown by join().
+
+  class scheduler {
+  public:
+    typedef std::chrono::steady_clock clock;
+
+    // Creates "nthreads" workers (0 = one per CPU)
+    explicit scheduler(int nthreads = 0)
+      : m_ready(0)
+      , m_stop(false)
+      , m_timer_seq(0)
+      , m_spawned(0) {
+      if (nthreads <= 0)
+        nthreads = futex::details::number_of_cpus();
+
+      for (int i=0; i<nthreads; ++i)
+        m_workers.push_back(new thread(&scheduler::worker_proc, this));
+      m_timer = new thread(&scheduler::timer_proc, this);
+    }
+
+    ~scheduler() {
+      wait_spawned();
+
+      {
+        lock_guard<mutex> lock(m_mutex);
+        m_stop = true;
+      }
+      m_ready.release(static_cast<int>(m_workers.size()));
+      m_timer_seq.fetch_add(1);
+      futex::wake_all(m_timer_seq);
+
+      for (std::size_t i=0; i<m_workers.size(); ++i) {
+        m_workers[i]->join();
+        delete m_workers[i];
+      }
+      m_timer->join();
+      delete m_timer;
+    }
+
+    // Returns the scheduler of the current worker thread (or NULL if
+    // we are not inside a worker thread)
+    static scheduler* current() {
+      return current_ref();
+    }
+
+    // Enqueues a coroutine to be resumed in some worker thread
+    void post(std::coroutine_handle<> h) {
+      {
+        lock_guard<mutex> lock(m_mutex);
+        m_queue.push(h);
+      }
+      m_ready.release();
+    }
+
+    // Starts the given task in a worker thread. The task is owned by
+    // the scheduler and destroyed when it finishes.
+    void spawn(task<void>&& t) {
+      m_spawned.fetch_add(1, std::memory_order_relaxed);
+      post(run_spawned(std::move(t), this).handle());
+    }
+
+    // Waits until all the spawned tasks are finished, and rethrows the
+    // first exception of a spawned task (if there is no error handler)
+    void join() {
+      wait_spawned();
+
+      std::exception_ptr error;
+      {
+        lock_guard<mutex> lock(m_errors_mutex);
+        std::swap(error, m_error);
+      }
+      if (error)
+        std::rethrow_exception(error);
+    }
+
+    // Function called (from a worker thread) with each exception that
+    // escapes a spawned task
+    void set_error_handler(const std::function<void(std::exception_ptr)>& handler) {
+      lock_guard<mutex> lock(m_errors_mutex);
+      m_error_handler = handler;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // Awaitables
+
+    // "co_await sched.schedule()" continues the coroutine in a worker
+    struct schedule_awaiter {
+      scheduler* m_sched;
+      bool await_ready() const noexcept { return false; }
+      void await_suspend(std::coroutine_handle<> h) { m_sched->post(h); }
+      void await_resume() const noexcept { }
+    };
+
+    schedule_awaiter schedule() {
+      schedule_awaiter a = { this };
+      return a;
+    }
+
+    // "co_await sched.sleep_for(ms)" suspends the coroutine (without
+    // blocking the thread) for the given milliseconds
+    struct timer_awaiter {
+      scheduler* m_sched;
+      int m_milliseconds;
+      bool await_ready() const noexcept { return m_milliseconds <= 0; }
+      void await_suspend(std::coroutine_handle<> h) {
+        m_sched->add_timer(clock::now() + std::chrono::milliseconds(m_milliseconds), h);
+      }
+      void await_resume() const noexcept { }
+    };
+
+    timer_awaiter sleep_for(int milliseconds) {
+      timer_awaiter a = { this, milliseconds };
+      return a;
+    }
+
+  private:
+    struct timer_entry {
+      clock::time_point deadline;
+      std::coroutine_handle<> handle;
+      bool operator<(const timer_entry& other) const {
+        return deadline > other.deadline; // Min-heap
+      }
+    };
+
+    static scheduler*& current_ref() {
+      static thread_local scheduler* sched = NULL;
+      return sched;
+    }
+
+    // An exception cannot leave a detached_task (it would terminate
+    // the process), so it's reported here
+    static details::detached_task run_spawned(task<void> t, scheduler* sched) {
+      try {
+        co_await std::move(t);
+      }
+      catch (...) {
+        sched->report_error(std::current_exception());
+      }
+      if (sched->m_spawned.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        futex::wake_all(sched->m_spawned);
+    }
+
+    void report_error(std::exception_ptr error) {
+      std::function<void(std::exception_ptr)> handler;
+      {
+        lock_guard<mutex> lock(m_errors_mutex);
+        if (!m_error_handler) {
+          if (!m_error)
+            m_error = error;
+          return;
+        }
+        handler = m_error_handler;
+      }
+      handler(error);
+    }
+
+    void wait_spawned() {
+      int n;
+      while ((n = m_spawned.load(std::memory_order_acquire)) != 0)
+        futex::wait(m_spawned, n);
+    }
+
+    static void worker_proc(scheduler* sched) {
+      current_ref() = sched;
+      sched->worker_loop();
+    }
+
+    static void timer_proc(scheduler* sched) {
+      sched->timer_loop();
+    }
+
+    void worker_loop() {
+      for (;;) {
+        m_ready.acquire();
+
+        std::coroutine_handle<> h;
+        {
+          lock_guard<mutex> lock(m_mutex);
+          if (m_queue.empty()) {
+            if (m_stop)
+              break;
+            continue;
+          }
+          h = m_queue.pop();
+        }
+        h.resume();
+      }
+    }
+
+    void add_timer(clock::time_point deadline, std::coroutine_handle<> h) {
+      timer_entry entry = { deadline, h };
+      bool earliest;
+      {
+        lock_guard<mutex> lock(m_timers_mutex);
+        earliest = (m_timers.empty() || deadline < m_timers.front().deadline);
+        m_timers.push_back(entry);
+        std::push_heap(m_timers.begin(), m_timers.end());
+      }
+
+      // Wake up the timer thread only if it must re-calculate its timeout
+      if (earliest) {
+        m_timer_seq.fetch_add(1, std::memory_order_release);
+        futex::wake_one(m_timer_seq);
+      }
+    }
+
+    void timer_loop() {
+      for (;;) {
+        int seq = m_timer_seq.load(std::memory_order_acquire);
+        int timeout = -1;
+        {
+          lock_guard<mutex> lock(m_mutex);
+          if (m_stop)
+            break;
+        }
+        {
+          lock_guard<mutex> lock(m_timers_mutex);
+          clock::time_point now = clock::now();
+          while (!m_timers.empty() && m_timers.front().deadline <= now) {
+            post(m_timers.front().handle);
+            std::pop_heap(m_timers.begin(), m_timers.end());
+            m_timers.pop_back();
+          }
+          if (!m_timers.empty()) {
+            timeout = static_cast<int>(
+              std::chrono::duration_cast<std::chrono::milliseconds>(
+                m_timers.front().deadline - now).count()) + 1;
+          }
+        }
+
+        if (timeout < 0)
+          futex::wait(m_timer_seq, seq);
+        else
+          futex::wait_for(m_timer_seq, seq, timeout);
+      }
+    }
+
+    std::vector<thread*> m_workers;
+    thread* m_timer;
+
+    mutex m_mutex;                  // Protects m_queue and m_stop
+    details::handle_ring m_queue;   // Ready coroutines
+    counting_semaphore<> m_ready;   // Number of ready coroutines
+    bool m_stop;
+
+    mutex m_timers_mutex;
+    std::vector<timer_entry> m_timers; // Heap of sleeping coroutines
+    futex::word m_timer_seq;           // Changes to wake up the timer thread
+
+    futex::word m_spawned;          // Number of running spawned tasks
+
+    mutex m_errors_mutex;
+    std::function<void(std::exception_ptr)> m_error_handler;
+    std::exception_ptr m_error;     // First error of a spawned task (without handler)
+
+    // Non-copyable
+    scheduler(const scheduler&);
+    scheduler& operator=(const scheduler&);
+  };
+
+} // namespace mt
+
+#endif // MT_SCHEDULER_HEADER_FILE_INCLUDED
@@ -0,0 +1,111 @@
+// mt - thread library to create C++ experiments         -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+#ifndef MT_SEMAPHORE_HEADER_FILE_INCLUDED
+#define MT_SEMAPHORE_HEADER_FILE_INCLUDED
+
+#include "mt/futex.h"
+
+#include <cassert>
+#include <climits>
+
+namespace mt {
+
+  //////////////////////////////////////////////////////////////////////
+  // counting_semaphore class
+  //
+  // Semaphore (C++20 like) where the futex word is the counter itself.
+  // acquire() takes a unit with a CAS if it's available, spins a little
+  // if it isn't, and finally registers itself in m_waiters to park on
+  // the counter while it's zero. release() only wakes threads if
+  // m_waiters says that there are sleepers.
+
+  template<int LeastMaxValue = INT_MAX>
+  class counting_semaphore {
+  public:
+    static int max() { return LeastMaxValue; }
+
+    explicit counting_semaphore(int desired)
+      : m_count(desired)
+      , m_waiters(0) {
+      assert(desired >= 0 && desired <= LeastMaxValue);
+    }
+
+    void release(int update = 1) {
+      assert(update >= 0);
+      m_count.fetch_add(update, std::memory_order_seq_cst);
+      int waiters = m_waiters.load(std::memory_order_seq_cst);
+      if (waiters > 0) {
+        if (update == 1)
+          futex::wake_one(m_count);
+        else
+          futex::wake_n(m_count, update < waiters ? update: waiters);
+      }
+    }
+
+    bool try_acquire() {
+      int count = m_count.load(std::memory_order_relaxed);
+      while (count > 0) {
+        if (m_count.compare_exchange_weak(count, count-1,
+                                          std::memory_order_acquire,
+                                          std::memory_order_relaxed))
+          return true;
+      }
+      return false;
+    }
+
+    void acquire() {
+      if (try_acquire_spinning())
+        return;
+
+      m_waiters.fetch_add(1, std::memory_order_seq_cst);
+      while (!try_acquire())
+        futex::wait(m_count, 0);
+      m_waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // Returns false if the semaphore couldn't be acquired in the given
+    // milliseconds (approximately, the timeout is restarted on each
+    // spurious wake up).
+    bool try_acquire_for(int milliseconds) {
+      if (try_acquire_spinning())
+        return true;
+
+      bool result = true;
+      m_waiters.fetch_add(1, std::memory_order_seq_cst);
+      while (!try_acquire()) {
+        if (!futex::wait_for(m_count, 0, milliseconds)) {
+          result = try_acquire();
+          break;
+        }
+      }
+      m_waiters.fetch_sub(1, std::memory_order_relaxed);
+      return result;
+    }
+
+  private:
+    bool try_acquire_spinning() {
+      for (int i=0; i<futex::spin_count(); ++i) {
+        if (try_acquire())
+          return true;
+        futex::cpu_relax();
+      }
+      return try_acquire();
+    }
+
+    futex::word m_count;
+    std::atomic<int> m_waiters;
+
+    // Non-copyable
+    counting_semaphore(const counting_semaphore&);
+    counting_semaphore& operator=(const counting_semaphore&);
+  };
+
+  typedef counting_semaphore<1> binary_semaphore;
+
+} // namespace mt
+
+#endif // MT_SEMAPHORE_HEADER_FILE_INCLUDED
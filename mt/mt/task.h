@@ -0,0 +1,411 @@
+// mt - thread library to create C++ experiments         -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+#ifndef MT_TASK_HEADER_FILE_INCLUDED
+#define MT_TASK_HEADER_FILE_INCLUDED
+
+// C++20 coroutines are required for this header
+
+#include "mt/futex.h"
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+namespace mt {
+
+  //////////////////////////////////////////////////////////////////////
+  // frame_pool class
+  //
+  // Allocator for coroutine frames. Frames are rounded up to size
+  // classes of 64 bytes and recycled in per-thread free lists, so
+  // creating/destroying a task doesn't touch the global heap once the
+  // lists are warm. A frame can be freed in a different thread than
+  // the one that allocated it (it goes to the freeing thread's list).
+  // Frames bigger than max_pooled_size go directly to operator new.
+
+  class frame_pool {
+  public:
+    static const std::size_t granularity = 64;
+    static const std::size_t max_pooled_size = 2048;
+    static const std::size_t max_cached_per_class = 4096;
+
+    static void* allocate(std::size_t size) {
+      if (size <= max_pooled_size) {
+        std::size_t c = size_class(size);
+        thread_cache* cache = local_cache();
+        if (cache && cache->heads[c]) {
+          free_block* block = cache->heads[c];
+          cache->heads[c] = block->next;
+          --cache->counts[c];
+          return block;
+        }
+        return ::operator new((c+1) * granularity);
+      }
+      return ::operator new(size);
+    }
+
+    static void deallocate(void* p, std::size_t size) {
+      if (size <= max_pooled_size) {
+        std::size_t c = size_class(size);
+        thread_cache* cache = local_cache();
+        if (cache && cache->counts[c] < max_cached_per_class) {
+          free_block* block = static_cast<free_block*>(p);
+          block->next = cache->heads[c];
+          cache->heads[c] = block;
+          ++cache->counts[c];
+          return;
+        }
+      }
+      ::operator delete(p);
+    }
+
+  private:
+    static const std::size_t classes = max_pooled_size / granularity;
+
+    struct free_block {
+      free_block* next;
+    };
+
+    struct thread_cache {
+      free_block* heads[classes];
+      std::size_t counts[classes];
+
+      thread_cache() {
+        for (std::size_t c=0; c<classes; ++c) {
+          heads[c] = nullptr;
+          counts[c] = 0;
+        }
+      }
+
+      ~thread_cache() {
+        for (std::size_t c=0; c<classes; ++c) {
+          while (heads[c]) {
+            free_block* next = heads[c]->next;
+            ::operator delete(heads[c]);
+            heads[c] = next;
+          }
+        }
+        alive() = false;
+      }
+    };
+
+    static std::size_t size_class(std::size_t size) {
+      return (size == 0 ? 0: (size + granularity - 1) / granularity - 1);
+    }
+
+    // Flag to know if the thread_cache was already destroyed (frames
+    // destroyed from other thread_local destructors at thread exit).
+    static bool& alive() {
+      static thread_local bool flag = true;
+      return flag;
+    }
+
+    static thread_cache* local_cache() {
+      if (!alive())
+        return nullptr;
+      static thread_local thread_cache cache;
+      return &cache;
+    }
+  };
+
+  namespace details {
+
+    //////////////////////////////////////////////////////////////////////
+    // promise_base class
+
+    class promise_base {
+    public:
+      static void* operator new(std::size_t size) {
+        return frame_pool::allocate(size);
+      }
+
+      static void operator delete(void* p, std::size_t size) {
+        frame_pool::deallocate(p, size);
+      }
+
+      // Tasks are lazy, they start when they are awaited
+      std::suspend_always initial_suspend() noexcept {
+        return std::suspend_always();
+      }
+
+      // Symmetric transfer to the awaiting coroutine: the final
+      // suspension returns the continuation's handle so the resumption
+      // doesn't grow the stack.
+      struct final_awaiter {
+        bool await_ready() noexcept { return false; }
+
+        template<class Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept {
+          std::coroutine_handle<> continuation = h.promise().m_continuation;
+          if (continuation)
+            return continuation;
+          else
+            return std::noop_coroutine();
+        }
+
+        void await_resume() noexcept { }
+      };
+
+      final_awaiter final_suspend() noexcept {
+        return final_awaiter();
+      }
+
+      void unhandled_exception() {
+        m_exception = std::current_exception();
+      }
+
+      void set_continuation(std::coroutine_handle<> continuation) {
+        m_continuation = continuation;
+      }
+
+    protected:
+      void rethrow_if_exception() {
+        if (m_exception)
+          std::rethrow_exception(m_exception);
+      }
+
+    private:
+      std::coroutine_handle<> m_continuation;
+      std::exception_ptr m_exception;
+    };
+
+  } // namespace details
+
+  template<class T = void>
+  class task;
+
+  namespace details {
+
+    template<class T>
+    class task_promise : public promise_base {
+    public:
+      task<T> get_return_object() noexcept;
+
+      template<class U>
+      void return_value(U&& value) {
+        m_value.emplace(std::forward<U>(value));
+      }
+
+      T result() {
+        rethrow_if_exception();
+        return std::move(*m_value);
+      }
+
+    private:
+      std::optional<T> m_value;
+    };
+
+    template<>
+    class task_promise<void> : public promise_base {
+    public:
+      task<void> get_return_object() noexcept;
+
+      void return_void() noexcept { }
+
+      void result() {
+        rethrow_if_exception();
+      }
+    };
+
+  } // namespace details
+
+  //////////////////////////////////////////////////////////////////////
+  // task class
+  //
+  // Lazy coroutine that returns a T. The task starts running when it's
+  // co_await'ed (in the awaiting thread) and when it finishes it
+  // resumes the awaiting coroutine directly (symmetric transfer).
+  //
+  //   mt::task<int> answer() { co_return 42; }
+  //   mt::task<> example() { int v = co_await answer(); }
+
+  template<class T>
+  class task {
+  public:
+    typedef details::task_promise<T> promise_type;
+    typedef std::coroutine_handle<promise_type> handle_type;
+
+    task() noexcept : m_handle() { }
+    explicit task(handle_type h) noexcept : m_handle(h) { }
+
+    task(task&& other) noexcept : m_handle(other.m_handle) {
+      other.m_handle = handle_type();
+    }
+
+    task& operator=(task&& other) noexcept {
+      if (this != &other) {
+        if (m_handle)
+          m_handle.destroy();
+        m_handle = other.m_handle;
+        other.m_handle = handle_type();
+      }
+      return *this;
+    }
+
+    ~task() {
+      if (m_handle)
+        m_handle.destroy();
+    }
+
+    bool valid() const noexcept {
+      return (m_handle ? true: false);
+    }
+
+    bool done() const noexcept {
+      return (!m_handle || m_handle.done());
+    }
+
+    struct awaiter {
+      handle_type m_handle;
+
+      bool await_ready() noexcept {
+        return (!m_handle || m_handle.done());
+      }
+
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        m_handle.promise().set_continuation(awaiting);
+        return m_handle;
+      }
+
+      T await_resume() {
+        return m_handle.promise().result();
+      }
+    };
+
+    awaiter operator co_await() && noexcept {
+      awaiter a = { m_handle };
+      return a;
+    }
+
+  private:
+    handle_type m_handle;
+
+    // Non-copyable
+    task(const task&);
+    task& operator=(const task&);
+  };
+
+  namespace details {
+
+    template<class T>
+    inline task<T> task_promise<T>::get_return_object() noexcept {
+      return task<T>(std::coroutine_handle<task_promise<T> >::from_promise(*this));
+    }
+
+    inline task<void> task_promise<void>::get_return_object() noexcept {
+      return task<void>(std::coroutine_handle<task_promise<void> >::from_promise(*this));
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // detached_task class
+    //
+    // Fire-and-forget coroutine: it starts suspended, the owner resumes
+    // it once, and then the frame destroys itself when it finishes.
+
+    class detached_task {
+    public:
+      class promise_type {
+      public:
+        static void* operator new(std::size_t size) {
+          return frame_pool::allocate(size);
+        }
+
+        static void operator delete(void* p, std::size_t size) {
+          frame_pool::deallocate(p, size);
+        }
+
+        detached_task get_return_object() noexcept {
+          return detached_task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept { return std::suspend_always(); }
+        std::suspend_never final_suspend() noexcept { return std::suspend_never(); }
+        void return_void() noexcept { }
+        void unhandled_exception() noexcept { std::terminate(); }
+      };
+
+      explicit detached_task(std::coroutine_handle<promise_type> h) : m_handle(h) { }
+
+      std::coroutine_handle<> handle() const {
+        return m_handle;
+      }
+
+    private:
+      std::coroutine_handle<promise_type> m_handle;
+    };
+
+    template<class T>
+    struct sync_wait_state {
+      futex::word done;
+      std::optional<T> value;
+      std::exception_ptr exception;
+      sync_wait_state() : done(0) { }
+    };
+
+    template<>
+    struct sync_wait_state<void> {
+      futex::word done;
+      std::exception_ptr exception;
+      sync_wait_state() : done(0) { }
+    };
+
+    template<class T>
+    detached_task sync_wait_impl(task<T>& t, sync_wait_state<T>& state) {
+      try {
+        state.value.emplace(co_await std::move(t));
+      }
+      catch (...) {
+        state.exception = std::current_exception();
+      }
+      // The futex wake is the last access to "state" (it doesn't touch
+      // the memory), the waiter can destroy it as soon as it sees done=1
+      state.done.store(1, std::memory_order_release);
+      futex::wake_one(state.done);
+    }
+
+    inline detached_task sync_wait_impl(task<void>& t, sync_wait_state<void>& state) {
+      try {
+        co_await std::move(t);
+      }
+      catch (...) {
+        state.exception = std::current_exception();
+      }
+      state.done.store(1, std::memory_order_release);
+      futex::wake_one(state.done);
+    }
+
+  } // namespace details
+
+  //////////////////////////////////////////////////////////////////////
+  // sync_wait function
+  //
+  // Runs the given task from a regular (non-coroutine) function,
+  // blocking the current thread until the task finishes. This is the
+  // bridge between main() and the coroutine world.
+
+  template<class T>
+  T sync_wait(task<T> t) {
+    details::sync_wait_state<T> state;
+    details::sync_wait_impl(t, state).handle().resume();
+
+    while (state.done.load(std::memory_order_acquire) == 0)
+      futex::wait(state.done, 0);
+
+    if (state.exception)
+      std::rethrow_exception(state.exception);
+
+    if constexpr (!std::is_void<T>::value)
+      return std::move(*state.value);
+  }
+
+} // namespace mt
+
+#endif // MT_TASK_HEADER_FILE_INCLUDED
@@ -7,12 +7,19 @@
 #ifndef MT_THREAD_HEADER_FILE_INCLUDED
 #define MT_THREAD_HEADER_FILE_INCLUDED
 
-#ifndef _WIN32_WINNT
-#define _WIN32_WINNT 0x0400             // From Windows 2000
+#ifdef _WIN32
+  #ifndef _WIN32_WINNT
+  #define _WIN32_WINNT 0x0400           // From Windows 2000
+  #endif
+
+  #include <windows.h>
+#else
+  #include <errno.h>
+  #include <pthread.h>
+  #include <sched.h>
+  #include <time.h>
 #endif
 
-#include <windows.h>
-
 #include <cassert>
 #include <string>
 #include <exception>
@@ -43,6 +50,10 @@ namespace mt {
       m_mutex.unlock();
     }
 
+    mutex_type* mutex() const {
+      return &m_mutex;
+    }
+
   private:
     mutex_type& m_mutex;
 
@@ -51,6 +62,8 @@ namespace mt {
     lock_guard& operator=(const lock_guard&);
   };
 
+#ifdef _WIN32
+
   //////////////////////////////////////////////////////////////////////
   // mutex class
 
@@ -318,11 +331,263 @@ namespace mt {
 
     // Simplified API (here we do not implement duration/time_point C++0x classes
     inline void sleep_for(int milliseconds) {
-      ::Sleep(milliseconds);
+      ::Sleep(milliseconds > 0 ? milliseconds: 0);
+    }
+
+  } // namespace this_thread
+
+#else  // For UNIX like (pthreads)
+
+  //////////////////////////////////////////////////////////////////////
+  // mutex class
+
+  class mutex {
+  public:
+    typedef pthread_mutex_t* native_handle_type;
+
+    mutex() {
+      pthread_mutex_init(&m_mutex, NULL);
+    }
+
+    ~mutex() {
+      pthread_mutex_destroy(&m_mutex);
+    }
+
+    void lock() {
+      pthread_mutex_lock(&m_mutex);
+    }
+
+    bool try_lock() {
+      return pthread_mutex_trylock(&m_mutex) == 0;
+    }
+
+    void unlock() {
+      pthread_mutex_unlock(&m_mutex);
+    }
+
+    native_handle_type native_handle() {
+      return &m_mutex;
+    }
+
+  private:
+    pthread_mutex_t m_mutex;
+
+    // Non-copyable
+    mutex(const mutex&);
+    mutex& operator=(const mutex&);
+  };
+
+  //////////////////////////////////////////////////////////////////////
+  // condition_variable class
+
+  class condition_variable {
+  public:
+    condition_variable() {
+      pthread_cond_init(&m_cond, NULL);
+    }
+
+    ~condition_variable() {
+      pthread_cond_destroy(&m_cond);
+    }
+
+    // The external monitor must be a lock_guard of the mutex that
+    // protects the condition, as in the Win32 implementation.
+    template<class Mutex>
+    void wait(lock_guard<Mutex>& external_monitor) {
+      pthread_cond_wait(&m_cond, external_monitor.mutex()->native_handle());
+    }
+
+    void notify_one() {
+      pthread_cond_signal(&m_cond);
+    }
+
+    void notify_all() {
+      pthread_cond_broadcast(&m_cond);
+    }
+
+  private:
+    pthread_cond_t m_cond;
+
+    // Non-copyable
+    condition_variable(const condition_variable&);
+    condition_variable& operator=(const condition_variable&);
+  };
+
+  //////////////////////////////////////////////////////////////////////
+  // ultra-simplistic thread class implementation based on C++0x
+
+  class thread {
+  public:
+    class details;
+    class id {
+      friend class thread;
+      friend class details;
+
+      pthread_t m_native_id;
+      bool m_valid;
+      id(pthread_t id) : m_native_id(id), m_valid(true) { }
+      unsigned long key() const { return m_valid ? (unsigned long)m_native_id: 0; }
+    public:
+      id() : m_native_id(), m_valid(false) { }
+      bool operator==(const id& y) const {
+        return (m_valid == y.m_valid) &&
+          (!m_valid || pthread_equal(m_native_id, y.m_native_id));
+      }
+      bool operator!=(const id& y) const { return !operator==(y); }
+      bool operator< (const id& y) const { return key() <  y.key(); }
+      bool operator<=(const id& y) const { return key() <= y.key(); }
+      bool operator> (const id& y) const { return key() >  y.key(); }
+      bool operator>=(const id& y) const { return key() >= y.key(); }
+
+      // TODO should we replace this with support for iostreams?
+      unsigned long get_native_id() { return key(); }
+    };
+
+    typedef pthread_t native_handle_type;
+
+  private:
+
+    template<class Callable>
+    struct f_wrapper0 {
+      Callable f;
+      f_wrapper0(const Callable& f) : f(f) { }
+      void operator()() { f(); }
+    };
+
+    template<class Callable, class A>
+    struct f_wrapper1 {
+      Callable f;
+      A a;
+      f_wrapper1(const Callable& f, A a) : f(f), a(a) { }
+      void operator()() { f(a); }
+    };
+
+    template<class Callable, class A, class B>
+    struct f_wrapper2 {
+      Callable f;
+      A a;
+      B b;
+      f_wrapper2(const Callable& f, A a, B b) : f(f), a(a), b(b) { }
+      void operator()() { f(a, b); }
+    };
+
+    template<class T>
+    static void* thread_proxy(void* data) {
+      T* t = (T*)data;
+      (*t)();
+      delete t;
+      return NULL;
+    }
+
+    template<class T>
+    void launch(T* data) {
+      pthread_t native;
+      if (pthread_create(&native, NULL, thread_proxy<T>, (void*)data) != 0) {
+        delete data;
+        throw std::exception(); // TODO throw a system_error
+      }
+      m_id = id(native);
+    }
+
+    id m_id;
+
+  public:
+
+    // Create an instance to represent the current thread
+    thread()
+      : m_id() {
+    }
+
+    // Create a new thread without arguments
+    template<class Callable>
+    thread(const Callable& f) {
+      launch(new f_wrapper0<Callable>(f));
+    }
+
+    // Create a new thread with one argument
+    template<class Callable, class A>
+    thread(const Callable& f, A a) {
+      launch(new f_wrapper1<Callable, A>(f, a));
+    }
+
+    // Create a new thread with two arguments
+    template<class Callable, class A, class B>
+    thread(const Callable& f, A a, B b) {
+      launch(new f_wrapper2<Callable, A, B>(f, a, b));
+    }
+
+    ~thread() {
+      if (joinable())
+        detach();
+    }
+
+    bool joinable() const {
+      return
+        m_id.m_valid &&
+        !pthread_equal(m_id.m_native_id, pthread_self());
+    }
+
+    void join() {
+      if (joinable()) {
+        pthread_join(m_id.m_native_id, NULL);
+        m_id = id();
+      }
+    }
+
+    void detach() {
+      if (m_id.m_valid)
+        pthread_detach(m_id.m_native_id);
+
+      m_id = id();
+    }
+
+    id get_id() const {
+      return m_id;
+    }
+
+    native_handle_type native_handle() {
+      return m_id.m_native_id;
+    }
+
+    class details {
+    public:
+      static id get_current_thread_id() {
+        return id(pthread_self());
+      }
+    };
+
+  };
+
+  //////////////////////////////////////////////////////////////////////
+  // this_thread namespace
+
+  namespace this_thread {
+
+    inline thread::id get_id() {
+      return thread::details::get_current_thread_id();
+    }
+
+    inline void yield() {
+      sched_yield();
+    }
+
+    // Simplified API (here we do not implement duration/time_point C++0x classes
+    inline void sleep_for(int milliseconds) {
+      if (milliseconds < 0)
+        milliseconds = 0;
+      struct timespec ts;
+      ts.tv_sec = milliseconds / 1000;
+      ts.tv_nsec = (milliseconds % 1000) * 1000000L;
+      // Continues with the remaining time only when it's interrupted
+      // by a signal
+      while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+        ;
     }
 
   } // namespace this_thread
 
+#endif
+
   //////////////////////////////////////////////////////////////////////
   // thread_guard class
 
@@ -0,0 +1,248 @@
+// mt - thread library to create C++ experiments         -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+#ifndef MT_THREAD_REGISTRY_HEADER_FILE_INCLUDED
+#define MT_THREAD_REGISTRY_HEADER_FILE_INCLUDED
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace mt {
+
+  namespace details {
+
+    //////////////////////////////////////////////////////////////////////
+    // thread_exit_hooks class
+    //
+    // Thread-local table used by all the thread_registry instances to
+    // find the record of the current thread, and to release those
+    // records when the thread finishes.
+
+    class thread_exit_hooks {
+    public:
+      typedef void (*release_fn)(void* node);
+
+      struct entry {
+        unsigned long owner;    // Unique ID of the registry
+        void* node;
+        release_fn release;
+      };
+
+      ~thread_exit_hooks() {
+        for (std::size_t i=0; i<m_entries.size(); ++i)
+          m_entries[i].release(m_entries[i].node);
+        destroyed() = true;
+      }
+
+      // Returns false when the thread is finishing and its hooks were
+      // already destroyed (e.g. a registry used from a static destructor)
+      static bool available() {
+        return !destroyed();
+      }
+
+      void* find(unsigned long owner) {
+        if (m_last.owner == owner)
+          return m_last.node;
+        for (std::size_t i=0; i<m_entries.size(); ++i) {
+          if (m_entries[i].owner == owner) {
+            m_last = m_entries[i];
+            return m_last.node;
+          }
+        }
+        return NULL;
+      }
+
+      void add(unsigned long owner, void* node, release_fn release) {
+        entry e = { owner, node, release };
+        m_entries.push_back(e);
+        m_last = e;
+      }
+
+      void remove(unsigned long owner) {
+        for (std::size_t i=0; i<m_entries.size(); ++i) {
+          if (m_entries[i].owner == owner) {
+            m_entries.erase(m_entries.begin()+i);
+            break;
+          }
+        }
+        if (m_last.owner == owner)
+          m_last.owner = 0;
+      }
+
+      static thread_exit_hooks& get() {
+        static thread_local thread_exit_hooks hooks;
+        return hooks;
+      }
+
+      // Record of a registry used by a finishing thread after its hooks
+      // were destroyed. They are kept in plain thread_local arrays
+      // (trivially destructible, so valid until the thread ends) and
+      // the thread uses the same record for the rest of its teardown.
+      // NULL means that the registry doesn't have a record yet.
+      static void*& finishing_node(unsigned long owner) {
+        static thread_local unsigned long owners[max_finishing];
+        static thread_local void* nodes[max_finishing];
+        static thread_local void* overflow;
+        for (int i=0; i<max_finishing; ++i) {
+          if (owners[i] == owner)
+            return nodes[i];
+          if (owners[i] == 0) {
+            owners[i] = owner;
+            return nodes[i];
+          }
+        }
+        overflow = NULL;        // Too many registries, a new record each time
+        return overflow;
+      }
+
+      static unsigned long new_owner_id() {
+        static std::atomic<unsigned long> next(1);
+        return next.fetch_add(1, std::memory_order_relaxed);
+      }
+
+    private:
+      static const int max_finishing = 16;
+
+      static bool& destroyed() {
+        static thread_local bool flag = false;
+        return flag;
+      }
+
+      thread_exit_hooks() {
+        m_last.owner = 0;
+        m_last.node = NULL;
+        m_last.release = NULL;
+      }
+
+      std::vector<entry> m_entries;
+      entry m_last;
+    };
+
+  } // namespace details
+
+  //////////////////////////////////////////////////////////////////////
+  // thread_registry class
+  //
+  // Lock-free, push-only list of per-thread records. local() returns
+  // the record of the current thread (creating or reusing one the first
+  // time), and for_each() visits the records of all threads. When a
+  // thread finishes, its record is released (Record::thread_exit() is
+  // called) and can be reused by a new thread, so the list only grows
+  // up to the maximum number of simultaneous threads. A thread that
+  // uses the registry after its record was released (from a static or
+  // thread_local destructor) gets one record for the rest of its
+  // teardown, which is never released.
+  //
+  // The registry must outlive the threads that are using it, or those
+  // threads' records are leaked instead of deleted.
+
+  template<class Record>
+  class thread_registry {
+  public:
+    thread_registry()
+      : m_head(NULL)
+      , m_id(details::thread_exit_hooks::new_owner_id()) {
+    }
+
+    ~thread_registry() {
+      // The record of the current thread can be deleted
+      void* mine = NULL;
+      if (details::thread_exit_hooks::available()) {
+        details::thread_exit_hooks& hooks = details::thread_exit_hooks::get();
+        mine = hooks.find(m_id);
+        hooks.remove(m_id);
+      }
+
+      node* n = m_head.load(std::memory_order_acquire);
+      while (n) {
+        node* next = n->next;
+        // Records of finishing threads don't have hooks to release them
+        if (n != mine && !n->finishing &&
+            n->in_use.load(std::memory_order_acquire))
+          n->orphan.store(true, std::memory_order_release); // Leaked
+        else
+          delete n;
+        n = next;
+      }
+    }
+
+    Record& local() {
+      // A finishing thread gets a record that is never released
+      if (!details::thread_exit_hooks::available()) {
+        void*& n = details::thread_exit_hooks::finishing_node(m_id);
+        if (!n) {
+          node* r = acquire_node();
+          r->finishing = true;
+          n = r;
+        }
+        return *static_cast<node*>(n);
+      }
+
+      details::thread_exit_hooks& hooks = details::thread_exit_hooks::get();
+      node* n = static_cast<node*>(hooks.find(m_id));
+      if (!n) {
+        n = acquire_node();
+        hooks.add(m_id, n, &thread_registry::release_node);
+      }
+      return *n;
+    }
+
+    // Calls f(Record&) for each record (of active or finished threads)
+    template<class F>
+    void for_each(F f) {
+      for (node* n=m_head.load(std::memory_order_acquire); n; n=n->next)
+        f(static_cast<Record&>(*n));
+    }
+
+  private:
+    struct node : public Record {
+      std::atomic<bool> in_use;
+      std::atomic<bool> orphan;
+      bool finishing;           // Used by a finishing thread, never released
+      node* next;
+      node() : in_use(true), orphan(false), finishing(false), next(NULL) { }
+    };
+
+    node* acquire_node() {
+      // Reuse the record of a finished thread
+      for (node* n=m_head.load(std::memory_order_acquire); n; n=n->next) {
+        bool expected = false;
+        if (!n->in_use.load(std::memory_order_relaxed) &&
+            n->in_use.compare_exchange_strong(expected, true,
+                                              std::memory_order_acquire))
+          return n;
+      }
+
+      node* n = new node;
+      node* head = m_head.load(std::memory_order_relaxed);
+      do {
+        n->next = head;
+      } while (!m_head.compare_exchange_weak(head, n,
+                                             std::memory_order_release,
+                                             std::memory_order_relaxed));
+      return n;
+    }
+
+    static void release_node(void* data) {
+      node* n = static_cast<node*>(data);
+      if (n->orphan.load(std::memory_order_acquire))
+        return;
+      n->thread_exit();
+      n->in_use.store(false, std::memory_order_release);
+    }
+
+    std::atomic<node*> m_head;
+    unsigned long m_id;
+
+    // Non-copyable
+    thread_registry(const thread_registry&);
+    thread_registry& operator=(const thread_registry&);
+  };
+
+} // namespace mt
+
+#endif // MT_THREAD_REGISTRY_HEADER_FILE_INCLUDED
@@ -0,0 +1,251 @@
+// mt - thread library to create C++ experiments         -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+#ifndef MT_WORD_LOCK_HEADER_FILE_INCLUDED
+#define MT_WORD_LOCK_HEADER_FILE_INCLUDED
+
+#include "mt/thread.h"
+#include "mt/futex.h"
+#include "mt/parking_lot.h"
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+
+namespace mt {
+
+  class word_condition_variable;
+
+  //////////////////////////////////////////////////////////////////////
+  // word_lock class
+  //
+  // Mutex of one byte: a "locked" bit and a "parked" bit (some thread
+  // is waiting in the parking lot). lock()/unlock() are a single CAS
+  // when there is no contention, so it can be embedded in every small
+  // object (e.g. each entry of a cache) where a mt::mutex would be
+  // too big.
+  //
+  // A contended lock() spins for a while and then parks the thread.
+  // unlock() releases the lock and unparks one thread, which competes
+  // again for the lock (barging), so it isn't fair.
+
+  class word_lock {
+  public:
+    word_lock() : m_state(0) { }
+
+    bool try_lock() {
+      std::uint8_t state = m_state.load(std::memory_order_relaxed);
+      while (!(state & locked_bit)) {
+        if (m_state.compare_exchange_weak(state, state | locked_bit,
+                                          std::memory_order_acquire,
+                                          std::memory_order_relaxed))
+          return true;
+      }
+      return false;
+    }
+
+    void lock() {
+      std::uint8_t expected = 0;
+      if (!m_state.compare_exchange_weak(expected, locked_bit,
+                                         std::memory_order_acquire,
+                                         std::memory_order_relaxed))
+        lock_slow();
+    }
+
+    void unlock() {
+      std::uint8_t expected = locked_bit;
+      if (!m_state.compare_exchange_strong(expected, 0,
+                                           std::memory_order_release,
+                                           std::memory_order_relaxed))
+        unlock_slow();
+    }
+
+    bool is_locked() const {
+      return (m_state.load(std::memory_order_relaxed) & locked_bit) != 0;
+    }
+
+  private:
+    friend class word_condition_variable;
+
+    static const std::uint8_t locked_bit = 1;
+    static const std::uint8_t parked_bit = 2;
+
+    void lock_slow() {
+      int spins = 0;
+      for (;;) {
+        std::uint8_t state = m_state.load(std::memory_order_relaxed);
+
+        if (!(state & locked_bit)) {
+          if (m_state.compare_exchange_weak(state, state | locked_bit,
+                                            std::memory_order_acquire,
+                                            std::memory_order_relaxed))
+            return;
+          continue;
+        }
+
+        // Spin only if nobody is parked (if there are parked threads,
+        // the lock is held for a long time)
+        if (!(state & parked_bit) && spins < futex::spin_count()) {
+          ++spins;
+          futex::cpu_relax();
+          continue;
+        }
+
+        if (!(state & parked_bit) &&
+            !m_state.compare_exchange_weak(state, state | parked_bit,
+                                           std::memory_order_relaxed,
+                                           std::memory_order_relaxed))
+          continue;
+
+        parking_lot::park(this, [this]() -> bool {
+            return m_state.load(std::memory_order_relaxed) == (locked_bit | parked_bit);
+          });
+        spins = 0;
+      }
+    }
+
+    void unlock_slow() {
+      parking_lot::unpark_one(this, [this](const parking_lot::unpark_result& result) {
+          // Keep the parked bit if there are more threads waiting
+          m_state.store(result.have_more_threads ? parked_bit: 0,
+                        std::memory_order_release);
+          return parking_lot::default_token;
+        });
+    }
+
+    // Used by word_condition_variable::notify_all() (called with the
+    // parking lot's bucket locked)
+    bool mark_parked_if_locked() {
+      std::uint8_t state = m_state.load(std::memory_order_relaxed);
+      for (;;) {
+        if (!(state & locked_bit))
+          return false;
+        if (m_state.compare_exchange_weak(state, state | parked_bit,
+                                          std::memory_order_relaxed,
+                                          std::memory_order_relaxed))
+          return true;
+      }
+    }
+
+    void mark_parked() {
+      m_state.fetch_or(parked_bit, std::memory_order_relaxed);
+    }
+
+    std::atomic<std::uint8_t> m_state;
+
+    // Non-copyable
+    word_lock(const word_lock&);
+    word_lock& operator=(const word_lock&);
+  };
+
+  //////////////////////////////////////////////////////////////////////
+  // word_condition_variable class
+  //
+  // Condition variable of the size of a pointer: it only stores the
+  // word_lock used by the current waiters (NULL if there are no
+  // waiters), the waiters themselves are in the parking lot.
+  //
+  // notify_all() doesn't wake up all threads to fight for the lock: if
+  // the lock is held, the waiters are moved to the lock's queue and
+  // they are woken up one by one as the lock is released.
+  //
+  // All the waiters at a given time must use the same word_lock.
+
+  class word_condition_variable {
+  public:
+    word_condition_variable() : m_lock(NULL) { }
+
+    void wait(lock_guard<word_lock>& guard) {
+      wait_internal(*guard.mutex(), -1);
+    }
+
+    // Returns false if the timeout has elapsed
+    bool wait_for(lock_guard<word_lock>& guard, int milliseconds) {
+      return wait_internal(*guard.mutex(), milliseconds);
+    }
+
+    void notify_one() {
+      if (!m_lock.load(std::memory_order_relaxed))
+        return;
+
+      parking_lot::unpark_one(this, [this](const parking_lot::unpark_result& result) {
+          if (!result.have_more_threads)
+            m_lock.store(NULL, std::memory_order_relaxed);
+          return parking_lot::default_token;
+        });
+    }
+
+    void notify_all() {
+      word_lock* lock = m_lock.load(std::memory_order_relaxed);
+      if (!lock)
+        return;
+
+      parking_lot::unpark_requeue(
+        this, lock,
+        [this, lock]() -> parking_lot::requeue_op {
+          if (m_lock.load(std::memory_order_relaxed) != lock)
+            return parking_lot::requeue_abort;
+
+          m_lock.store(NULL, std::memory_order_relaxed);
+
+          // If the lock is held, all the threads will wait for it
+          if (lock->mark_parked_if_locked())
+            return parking_lot::requeue_all;
+          return parking_lot::unpark_one_requeue_rest;
+        },
+        [lock](parking_lot::requeue_op op,
+               const parking_lot::unpark_result& result) -> parking_lot::token {
+          if (op == parking_lot::unpark_one_requeue_rest &&
+              result.requeued_threads > 0)
+            lock->mark_parked();
+          return parking_lot::default_token;
+        });
+    }
+
+  private:
+    bool wait_internal(word_lock& lock, int milliseconds) {
+      bool requeued = false;
+      parking_lot::park_result result = parking_lot::park(
+        this,
+        [this, &lock]() -> bool {
+          word_lock* current = m_lock.load(std::memory_order_relaxed);
+          if (!current)
+            m_lock.store(&lock, std::memory_order_relaxed);
+          else if (current != &lock)
+            return false;       // Misuse: waiters with different locks
+          return true;
+        },
+        [&lock]() {
+          lock.unlock();
+        },
+        [this, &requeued](const void* key, bool was_last_thread) {
+          requeued = (key != this);
+          if (!requeued && was_last_thread)
+            m_lock.store(NULL, std::memory_order_relaxed);
+        },
+        milliseconds);
+
+      assert(result.status != parking_lot::invalid);
+      if (result.status == parking_lot::invalid)
+        return true;            // The lock wasn't released
+
+      lock.lock();
+
+      // A thread that was requeued to the lock's queue was notified,
+      // even if it timed out there
+      return (result.status != parking_lot::timed_out || requeued);
+    }
+
+    std::atomic<word_lock*> m_lock;
+
+    // Non-copyable
+    word_condition_variable(const word_condition_variable&);
+    word_condition_variable& operator=(const word_condition_variable&);
+  };
+
+} // namespace mt
+
+#endif // MT_WORD_LOCK_HEADER_FILE_INCLUDED
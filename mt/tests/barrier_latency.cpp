@@ -0,0 +1,93 @@
+// mt - thread library to create C++ experiments         -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+// Measures the round-trip latency of a barrier (time for all the
+// threads to pass one phase) comparing mt::barrier against a
+// barrier made with mt::mutex + mt::condition_variable.
+//
+// Usage: barrier_latency [rounds]
+
+#include "mt/thread.h"
+#include "mt/barrier.h"
+#include "chrono.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace mt;
+
+// The classic barrier that we used before mt::barrier
+class cv_barrier {
+public:
+  explicit cv_barrier(int expected)
+    : m_expected(expected)
+    , m_remaining(expected)
+    , m_phase(0) {
+  }
+
+  void arrive_and_wait() {
+    lock_guard<mutex> lock(m_monitor);
+    int phase = m_phase;
+    if (--m_remaining == 0) {
+      m_remaining = m_expected;
+      ++m_phase;
+      m_cond.notify_all();
+    }
+    else {
+      while (phase == m_phase)
+        m_cond.wait(lock);
+    }
+  }
+
+private:
+  mutex m_monitor;
+  condition_variable m_cond;
+  int m_expected;
+  int m_remaining;
+  int m_phase;
+};
+
+template<class Barrier>
+struct worker {
+  Barrier* b;
+  int rounds;
+  worker(Barrier* b, int rounds) : b(b), rounds(rounds) { }
+  void operator()() {
+    for (int i=0; i<rounds; ++i)
+      b->arrive_and_wait();
+  }
+};
+
+// Returns the average microseconds per phase
+template<class Barrier>
+double run(int nthreads, int rounds) {
+  Barrier b(nthreads);
+  std::vector<thread*> threads;
+
+  Chrono chrono;
+  for (int i=1; i<nthreads; ++i)
+    threads.push_back(new thread(worker<Barrier>(&b, rounds)));
+  worker<Barrier>(&b, rounds)();
+
+  for (size_t i=0; i<threads.size(); ++i) {
+    threads[i]->join();
+    delete threads[i];
+  }
+  return chrono.elapsed() * 1000000.0 / rounds;
+}
+
+int main(int argc, char* argv[]) {
+  int rounds = (argc > 1 ? std::atoi(argv[1]): 2000);
+
+  std::printf("threads,mt_barrier_us,cv_barrier_us\n");
+  for (int n=2; n<=64; n*=2) {
+    double a = run<barrier<> >(n, rounds);
+    double b = run<cv_barrier>(n, rounds);
+    std::printf("%d,%.3f,%.3f\n", n, a, b);
+  }
+  return 0;
+}
@@ -0,0 +1,194 @@
+// mt - thread library to create C++ experiments         -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+// A producer -> workers -> consumer pipeline written with channels,
+// a select with timeouts, and a throughput comparison between a
+// buffered channel and the synchronized_queue of
+// condition_variables.cpp (without the logging).
+//
+// Usage: channels [items]
+
+#include "mt/thread.h"
+#include "mt/channel.h"
+#include "chrono.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <queue>
+#include <string>
+#include <vector>
+
+using namespace mt;
+
+int nitems = 200000;
+
+//////////////////////////////////////////////////////////////////////
+// Pipeline
+
+channel<int> numbers(64);
+channel<long long> squares(64);
+std::atomic<int> running_workers(0);
+
+void generator() {
+  for (int i=1; i<=nitems; ++i)
+    numbers.send(i);
+  numbers.close();
+}
+
+void squarer() {
+  int n;
+  while (numbers.recv(n))
+    squares.send((long long)n*n);
+
+  // The last worker closes the output channel
+  if (--running_workers == 0)
+    squares.close();
+}
+
+bool test_pipeline() {
+  const int nworkers = 3;
+  running_workers = nworkers;
+
+  std::vector<thread*> threads;
+  threads.push_back(new thread(&generator));
+  for (int i=0; i<nworkers; ++i)
+    threads.push_back(new thread(&squarer));
+
+  long long sum = 0, expected = 0;
+  long long sq;
+  while (squares.recv(sq))
+    sum += sq;
+
+  for (size_t i=0; i<threads.size(); ++i) {
+    threads[i]->join();
+    delete threads[i];
+  }
+
+  for (int i=1; i<=nitems; ++i)
+    expected += (long long)i*i;
+
+  std::printf("pipeline: sum %lld (expected %lld)\n", sum, expected);
+  return sum == expected;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Select
+
+channel<int> ints;              // Unbuffered
+channel<std::string> strings;   // Unbuffered
+
+void delayed_sender() {
+  this_thread::sleep_for(20);
+  strings.send("hello");
+  this_thread::sleep_for(20);
+  ints.send(5);
+}
+
+bool test_select() {
+  thread t(&delayed_sender);
+
+  int i = 0;
+  std::string s;
+  int got = 0, timeouts = 0;
+  while (got < 2) {
+    mt::select sel;
+    sel.recv(ints, i).recv(strings, s);
+    switch (sel.wait_for(5)) {
+      case 0: ++got; std::printf("select: received int %d\n", i); break;
+      case 1: ++got; std::printf("select: received string \"%s\"\n", s.c_str()); break;
+      case mt::select::timeout: ++timeouts; break;
+    }
+  }
+  t.join();
+
+  mt::select sel;
+  sel.recv(ints, i);
+  bool empty = (sel.try_wait() == mt::select::timeout);
+
+  std::printf("select: %d timeouts, try_wait on empty channel: %s\n",
+              timeouts, empty ? "timeout": "ready");
+  return (i == 5 && s == "hello" && timeouts > 0 && empty);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Throughput
+
+class synchronized_queue {
+  static const size_t MAX = 64;
+
+  std::queue<int> items;
+  mutex monitor;
+  condition_variable full;
+  condition_variable empty;
+
+public:
+  void add(int item) {
+    lock_guard<mutex> lock(monitor);
+    while (items.size() == MAX)
+      full.wait(lock);
+    items.push(item);
+    if (items.size() == 1)
+      empty.notify_one();
+  }
+
+  int remove() {
+    lock_guard<mutex> lock(monitor);
+    while (items.size() == 0)
+      empty.wait(lock);
+    int res = items.front();
+    items.pop();
+    if (items.size() == MAX-1)
+      full.notify_one();
+    return res;
+  }
+};
+
+synchronized_queue the_queue;
+channel<int> the_channel(64);
+
+void queue_producer() {
+  for (int i=0; i<nitems; ++i)
+    the_queue.add(i);
+}
+
+void channel_producer() {
+  for (int i=0; i<nitems; ++i)
+    the_channel.send(i);
+}
+
+void throughput() {
+  Chrono chrono;
+  {
+    thread p(&queue_producer);
+    for (int i=0; i<nitems; ++i)
+      the_queue.remove();
+    p.join();
+  }
+  double t_queue = chrono.elapsed();
+
+  chrono.reset();
+  {
+    thread p(&channel_producer);
+    int v;
+    for (int i=0; i<nitems; ++i)
+      the_channel.recv(v);
+    p.join();
+  }
+  double t_channel = chrono.elapsed();
+
+  std::printf("throughput: synchronized_queue %.0f items/sec, channel %.0f items/sec\n",
+              nitems / t_queue, nitems / t_channel);
+}
+
+int main(int argc, char* argv[]) {
+  if (argc > 1)
+    nitems = std::atoi(argv[1]);
+
+  bool ok = test_pipeline();
+  ok = test_select() && ok;
+  throughput();
+  return ok ? 0: 1;
+}
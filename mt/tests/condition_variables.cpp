@@ -5,15 +5,19 @@
 // see LICENSE.md for more details.
 
 #include "mt/thread.h"
+#include "mt/logger.h"
 
 #include <queue>
-#include <iostream>
-#include <iomanip>
 #include <exception>
 
 using namespace mt;
 using namespace std;
 
+// Logging with "cout << ... << endl" inside the critical sections
+// serializes the threads in the stream lock, mt::logger doesn't (the
+// threads wait when their buffer is full, so no line is lost)
+logger the_log(stdout, logger::block);
+
 class synchronized_queue {
   static const size_t MAX = 4;
 
@@ -31,15 +35,14 @@ public:
     lock_guard<mutex> lock(monitor);
 
     while (items.size() == MAX) {
-      cout << ">  [producer " << producer_nth << "] is full" << endl;
+      the_log.log(">  [producer %d] is full", producer_nth);
       full.wait(lock);
-      cout << ">  [producer " << producer_nth << "] now i can produce" << endl;
+      the_log.log(">  [producer %d] now i can produce", producer_nth);
     }
 
     assert(items.size() < MAX);
     items.push(item);
-    cout << setw(2) << items.size()
-         << " [producer " << producer_nth << "] item " << setw(3) << item << " produced" << endl;
+    the_log.log("%2d [producer %d] item %3d produced", int(items.size()), producer_nth, item);
 
     assert(items.size() <= MAX);
 
@@ -51,9 +54,9 @@ public:
     lock_guard<mutex> lock(monitor);
 
     while (items.size() == 0) {
-      cout << ">  [consumer " << consumer_nth << "] is empty" << endl;
+      the_log.log(">  [consumer %d] is empty", consumer_nth);
       empty.wait(lock);
-      cout << ">  [consumer " << consumer_nth << "] now i can consume" << endl;
+      the_log.log(">  [consumer %d] now i can consume", consumer_nth);
     }
 
     assert(items.size() <= MAX);
@@ -61,8 +64,7 @@ public:
     int res = items.front();
     items.pop();
 
-    cout << setw(2) << items.size()
-         << " [consumer " << consumer_nth << "] item " << setw(3) << res << " consumed" << endl;
+    the_log.log("%2d [consumer %d] item %3d consumed", int(items.size()), consumer_nth, res);
 
     if (items.size() == MAX-1)
       full.notify_one();
@@ -111,7 +113,7 @@ int main() {
   this_thread::sleep_for(1000);
   stop_flag = true;
 
-  cout << "stop all threads" << endl;
+  the_log.log("stop all threads");
 
   // Join everything
   p1.join();
@@ -0,0 +1,131 @@
+// mt - thread library to create C++ experiments         -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+// Runs thousands of coroutines on a few worker threads. Each one
+// sleeps on a timer, takes an async_mutex, goes through an
+// async_semaphore, and sends a value to a consumer coroutine through
+// an async_queue. No coroutine holds a thread while it waits. Spawned
+// tasks that throw don't terminate the process.
+//
+// Usage: coroutines [tasks] [threads]
+
+#include "mt/task.h"
+#include "mt/scheduler.h"
+#include "mt/async.h"
+#include "chrono.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+
+using namespace mt;
+
+async_mutex counter_mutex;
+long counter = 0;
+
+async_semaphore limit(8);         // Max 8 tasks in the "expensive zone"
+std::atomic<int> inside(0);
+std::atomic<int> max_inside(0);
+
+async_queue<int> results;
+
+task<int> square(int x) {
+  co_return x*x;
+}
+
+task<> producer(scheduler& sched, int nth) {
+  co_await sched.sleep_for(nth % 16);
+
+  co_await counter_mutex.lock();
+  ++counter;
+  counter_mutex.unlock();
+
+  co_await limit.acquire();
+  int n = ++inside;
+  int m = max_inside.load();
+  while (n > m && !max_inside.compare_exchange_weak(m, n))
+    ;
+  co_await sched.schedule();    // Give the chance to other tasks to enter
+  --inside;
+  limit.release();
+
+  results.push(co_await square(nth));
+}
+
+task<long long> consumer(scheduler& sched, int ntasks) {
+  co_await sched.schedule();
+  long long sum = 0;
+  for (int i=0; i<ntasks; ++i)
+    sum += co_await results.pop();
+  co_return sum;
+}
+
+task<> throwing_task(scheduler& sched, int nth) {
+  co_await sched.sleep_for(nth % 3);
+  if (nth % 2)
+    throw std::runtime_error("spawned task error");
+}
+
+// Exceptions of spawned tasks are rethrown by join() or given to the
+// error handler
+bool test_exceptions() {
+  bool rethrown = false;
+  {
+    scheduler sched(2);
+    for (int i=0; i<10; ++i)
+      sched.spawn(throwing_task(sched, i));
+    try {
+      sched.join();
+    }
+    catch (const std::runtime_error&) {
+      rethrown = true;
+    }
+    sched.join();               // The error was already reported
+  }
+
+  std::atomic<int> handled(0);
+  {
+    scheduler sched(2);
+    sched.set_error_handler([&handled](std::exception_ptr) { ++handled; });
+    for (int i=0; i<10; ++i)
+      sched.spawn(throwing_task(sched, i));
+    sched.join();
+  }
+  std::printf("exceptions: rethrown %s, handled %d (expected 5)\n",
+              rethrown ? "yes": "no", handled.load());
+  return rethrown && handled == 5;
+}
+
+int main(int argc, char* argv[]) {
+  int ntasks = (argc > 1 ? std::atoi(argv[1]): 20000);
+  int nthreads = (argc > 2 ? std::atoi(argv[2]): 4);
+
+  Chrono chrono;
+  long long sum;
+  {
+    scheduler sched(nthreads);
+    for (int i=0; i<ntasks; ++i)
+      sched.spawn(producer(sched, i));
+
+    sum = sync_wait(consumer(sched, ntasks));
+    sched.join();
+  }
+  double secs = chrono.elapsed();
+
+  long long expected = 0;
+  for (int i=0; i<ntasks; ++i)
+    expected += (long long)i*i;
+
+  std::printf("%d tasks on %d threads in %.3f seconds\n", ntasks, nthreads, secs);
+  std::printf("counter: %ld (expected %d)\n", counter, ntasks);
+  std::printf("sum: %lld (expected %lld)\n", sum, expected);
+  std::printf("max tasks inside the semaphore: %d (expected <= 8)\n", max_inside.load());
+
+  const bool exceptions = test_exceptions();
+
+  return (counter == ntasks && sum == expected && max_inside.load() <= 8 &&
+          exceptions) ? 0: 1;
+}
@@ -5,8 +5,8 @@
 // see LICENSE.md for more details.
 
 #include "mt/thread.h"
+#include "mt/logger.h"
 
-#include <iostream>
 #include <utility>
 #include <vector>
 
@@ -18,6 +18,9 @@ class philosopher;
 vector<philosopher*> philosophers;
 mutex philosophers_mutex;
 
+// The threads wait when their buffer is full, so no line is lost
+logger the_log(stdout, logger::block);
+
 enum state_t { THINKING, EATING };
 
 class philosopher {
@@ -31,12 +34,12 @@ public:
   void eat() {
     m_state = EATING;
     m_feed++;
-    cout << "philosopher " << m_id << " is eating (" << m_feed << ")" << endl;
+    the_log.log("philosopher %d is eating (%d)", int(m_id), int(m_feed));
   }
 
   void think() {
     m_state = THINKING;
-    cout << "philosopher " << m_id << " is thinking" << endl;
+    the_log.log("philosopher %d is thinking", int(m_id));
   }
 
   state_t state() const {
@@ -0,0 +1,194 @@
+// mt - thread library to create C++ experiments         -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+// Measures the fiber switch time, creates many sleeping fibers, and
+// runs a producer/consumer with fiber_mutex/fiber_condition_variable.
+//
+// Usage: fibers [number of fibers]
+//
+// (Run "fibers 1000000" to create a million fibers, it needs ~4GB
+// of memory.)
+
+#include "mt/thread.h"
+#include "mt/fiber.h"
+#include "chrono.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+
+using namespace mt;
+
+//////////////////////////////////////////////////////////////////////
+// Switch time
+
+const int yields = 1000000;
+
+// Raw context switch (without scheduler) between the main thread and
+// a context that jumps back immediately
+details::fiber_context main_ctx;
+details::fiber_context ping_ctx;
+
+void ping(void*) {
+  for (;;)
+    details::fiber_context::jump(ping_ctx, main_ctx);
+}
+
+void test_raw_switch() {
+  details::fiber_stack_pool pool(64*1024, true);
+  details::fiber_stack stack = pool.allocate();
+  ping_ctx.init(stack, &ping, NULL);
+  main_ctx.init_current();
+
+  Chrono chrono;
+  for (int i=0; i<yields; ++i)
+    details::fiber_context::jump(main_ctx, ping_ctx);
+  double t = chrono.elapsed();
+  std::printf("switch: %.1f ns per context switch\n", t * 1e9 / (2.0*yields));
+
+  ping_ctx.destroy();
+  main_ctx.destroy();
+  pool.release(stack);
+}
+
+void yielder() {
+  for (int i=0; i<yields; ++i)
+    this_fiber::yield();
+}
+
+void test_switch() {
+  fiber_scheduler sched(1);
+  Chrono chrono;
+  sched.spawn(&yielder);
+  sched.spawn(&yielder);
+  sched.join();
+  double t = chrono.elapsed();
+  std::printf("yield: %.1f ns per yield (2 fibers in 1 worker)\n", t * 1e9 / (2.0*yields));
+}
+
+//////////////////////////////////////////////////////////////////////
+// Many fibers
+
+fiber_mutex counter_mutex;
+long counter = 0;
+
+void sleeper() {
+  {
+    lock_guard<fiber_mutex> lock(counter_mutex);
+    ++counter;
+  }
+  this_fiber::sleep_for(100);
+  {
+    lock_guard<fiber_mutex> lock(counter_mutex);
+    ++counter;
+  }
+}
+
+bool test_many_fibers(int n) {
+  // Small stacks without guard pages (see fiber_stack_pool)
+  fiber_scheduler sched(0, 16*1024, false);
+  counter = 0;
+
+  Chrono chrono;
+  for (int i=0; i<n; ++i)
+    sched.spawn(&sleeper);
+  double t_spawn = chrono.elapsed();
+  sched.join();
+  double t = chrono.elapsed();
+
+  std::printf("many fibers: %d fibers of %dKB, %.0f ns per spawn, all finished in %.3f s\n",
+              n, int(sched.stack_size()/1024), t_spawn * 1e9 / n, t);
+  return counter == 2L*n;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Producer/consumer
+
+class bounded_queue {
+  static const std::size_t MAX = 8;
+
+  std::deque<int> items;
+  fiber_mutex monitor;
+  fiber_condition_variable not_full;
+  fiber_condition_variable not_empty;
+
+public:
+  void push(int item) {
+    lock_guard<fiber_mutex> lock(monitor);
+    while (items.size() == MAX)
+      not_full.wait(lock);
+    items.push_back(item);
+    not_empty.notify_one();
+  }
+
+  int pop() {
+    lock_guard<fiber_mutex> lock(monitor);
+    while (items.empty())
+      not_empty.wait(lock);
+    int item = items.front();
+    items.pop_front();
+    not_full.notify_one();
+    return item;
+  }
+};
+
+bounded_queue the_queue;
+const int items_per_producer = 50000;
+std::atomic<long> consumed(0);
+
+void producer() {
+  for (int i=1; i<=items_per_producer; ++i)
+    the_queue.push(i);
+}
+
+void consumer() {
+  long sum = 0;
+  for (int i=0; i<items_per_producer; ++i)
+    sum += the_queue.pop();
+  consumed += sum;
+}
+
+// Joins the producer from another fiber
+void producer_and_join() {
+  fiber f(*fiber_scheduler::current(), &producer);
+  f.join();
+}
+
+bool test_producer_consumer() {
+  const int pairs = 8;
+  fiber_scheduler sched(4);
+  Chrono chrono;
+  std::vector<fiber*> consumers;
+  for (int i=0; i<pairs; ++i) {
+    sched.spawn(&producer_and_join);
+    consumers.push_back(new fiber(sched, &consumer));
+  }
+  for (int i=0; i<pairs; ++i) {
+    consumers[i]->join();       // Join from a thread
+    delete consumers[i];
+  }
+  sched.join();
+  double t = chrono.elapsed();
+
+  long expected = long(pairs) * items_per_producer * (items_per_producer+1) / 2;
+  std::printf("producer/consumer: %.0f items/sec\n", pairs * items_per_producer / t);
+  return consumed == expected;
+}
+
+int main(int argc, char* argv[]) {
+  int n = 100000;
+  if (argc > 1)
+    n = std::atoi(argv[1]);
+
+  bool ok = true;
+  test_raw_switch();
+  test_switch();
+  ok = test_many_fibers(n) && ok;
+  ok = test_producer_consumer() && ok;
+
+  std::printf(ok ? "ok\n": "FAILED\n");
+  return ok ? 0: 1;
+}
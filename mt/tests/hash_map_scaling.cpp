@@ -0,0 +1,188 @@
+// mt - thread library to create C++ experiments         -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+// Read-heavy benchmark (90% find, 9% insert, 1% erase) of
+// mt::concurrent_hash_map against a std::unordered_map protected by
+// a single mt::mutex (like philosophers_mutex in
+// dining_philosophers.cpp). Prints operations per second for each
+// number of threads in CSV format. Also checks that concurrent
+// inserts with several incremental resizes don't lose any key, even
+// with a hash function that puts the keys in a few long clusters.
+//
+// Usage: hash_map_scaling [max_threads] [ops_per_thread]
+
+#include "mt/thread.h"
+#include "mt/concurrent_hash_map.h"
+#include "chrono.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <unordered_map>
+#include <vector>
+
+using namespace mt;
+
+const int key_range = 1 << 16;
+
+class locked_map {
+public:
+  bool find(int key, int& value) {
+    lock_guard<mutex> lock(m_mutex);
+    std::unordered_map<int, int>::iterator it = m_map.find(key);
+    if (it == m_map.end())
+      return false;
+    value = it->second;
+    return true;
+  }
+
+  bool insert(int key, int value) {
+    lock_guard<mutex> lock(m_mutex);
+    return m_map.insert(std::make_pair(key, value)).second;
+  }
+
+  bool erase(int key) {
+    lock_guard<mutex> lock(m_mutex);
+    return m_map.erase(key) > 0;
+  }
+
+private:
+  mutex m_mutex;
+  std::unordered_map<int, int> m_map;
+};
+
+template<class Map>
+struct worker {
+  Map* map;
+  int ops;
+  unsigned seed;
+
+  void operator()() {
+    int value;
+    for (int i=0; i<ops; ++i) {
+      seed = seed*1103515245 + 12345;
+      int key = (seed >> 8) % key_range;
+      int op = (seed >> 4) % 100;
+      if (op < 90)
+        map->find(key, value);
+      else if (op < 99)
+        map->insert(key, key);
+      else
+        map->erase(key);
+    }
+  }
+};
+
+template<class Map>
+double run(int nthreads, int ops) {
+  Map map;
+  for (int k=0; k<key_range; k+=2)
+    map.insert(k, k);
+
+  std::vector<thread*> threads;
+  Chrono chrono;
+  for (int i=0; i<nthreads; ++i) {
+    worker<Map> w = { &map, ops, (unsigned)i*7919 + 1 };
+    threads.push_back(new thread(w));
+  }
+  for (int i=0; i<nthreads; ++i) {
+    threads[i]->join();
+    delete threads[i];
+  }
+  return (double)nthreads*ops / chrono.elapsed();
+}
+
+typedef concurrent_hash_map<int, int> int_map;
+
+struct inserter {
+  int_map* map;
+  int first, count;
+  void operator()() {
+    for (int k=first; k<first+count; ++k)
+      map->insert(k, k*3);
+  }
+};
+
+bool check_resizes() {
+  int_map map(16);              // Force a lot of resizes
+  const int per_thread = 50000;
+  std::vector<thread*> threads;
+  for (int i=0; i<4; ++i) {
+    inserter ins = { &map, i*per_thread, per_thread };
+    threads.push_back(new thread(ins));
+  }
+  for (int i=0; i<4; ++i) {
+    threads[i]->join();
+    delete threads[i];
+  }
+
+  bool ok = (map.size() == 4*per_thread);
+  for (int k=0; k<4*per_thread && ok; ++k) {
+    int v;
+    ok = (map.find(k, v) && v == k*3);
+  }
+  for (int k=0; k<4*per_thread && ok; k+=2)
+    ok = map.erase(k);
+  for (int k=0; k<4*per_thread && ok; ++k)
+    ok = (map.contains(k) == (k & 1 ? true: false));
+  return ok;
+}
+
+// Only 7 different hashes
+struct bad_hash {
+  std::size_t operator()(int key) const { return key % 7; }
+};
+
+typedef concurrent_hash_map<int, int, bad_hash> bad_map;
+
+struct bad_inserter {
+  bad_map* map;
+  int first, count;
+  void operator()() {
+    for (int k=first; k<first+count; ++k) {
+      map->insert(k, k);
+      if (k & 1)
+        map->erase(k);
+    }
+  }
+};
+
+bool check_bad_hash() {
+  bad_map map(16);
+  const int per_thread = 1000;
+  std::vector<thread*> threads;
+  for (int i=0; i<4; ++i) {
+    bad_inserter ins = { &map, i*per_thread, per_thread };
+    threads.push_back(new thread(ins));
+  }
+  for (int i=0; i<4; ++i) {
+    threads[i]->join();
+    delete threads[i];
+  }
+
+  bool ok = (map.size() == 2*per_thread);
+  for (int k=0; k<4*per_thread && ok; ++k)
+    ok = (map.contains(k) == (k & 1 ? false: true));
+  return ok;
+}
+
+int main(int argc, char* argv[]) {
+  int max_threads = (argc > 1 ? std::atoi(argv[1]): 8);
+  int ops = (argc > 2 ? std::atoi(argv[2]): 1000000);
+
+  bool ok = check_resizes();
+  std::printf("concurrent inserts with resizes: %s\n", ok ? "ok": "FAILED");
+  bool bad = check_bad_hash();
+  std::printf("bad hash function: %s\n", bad ? "ok": "FAILED");
+  ok &= bad;
+
+  std::printf("threads,concurrent_hash_map_ops_per_sec,mutex_unordered_map_ops_per_sec\n");
+  for (int n=1; n<=max_threads; n*=2) {
+    double a = run<int_map>(n, ops);
+    double b = run<locked_map>(n, ops);
+    std::printf("%d,%.0f,%.0f\n", n, a, b);
+  }
+  return ok ? 0: 1;
+}
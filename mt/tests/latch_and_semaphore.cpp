@@ -0,0 +1,77 @@
+// mt - thread library to create C++ experiments         -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+#include "mt/thread.h"
+#include "mt/barrier.h"
+#include "mt/latch.h"
+#include "mt/semaphore.h"
+
+#include <cassert>
+#include <cstdio>
+#include <vector>
+
+using namespace mt;
+
+const int nworkers = 8;
+const int nphases = 100;
+
+latch workers_ready(nworkers);
+latch start(1);
+counting_semaphore<> slots(2);    // At most 2 workers in the critical zone
+std::atomic<int> inside(0);
+std::atomic<int> max_inside(0);
+
+struct phase_completion {
+  int* phases;
+  void operator()() { ++(*phases); }
+};
+
+int completed_phases = 0;
+phase_completion completion = { &completed_phases };
+barrier<phase_completion> phases(nworkers, completion);
+
+void worker() {
+  workers_ready.count_down();
+  start.wait();
+
+  for (int i=0; i<nphases; ++i) {
+    slots.acquire();
+    int n = ++inside;
+    int m = max_inside.load();
+    while (n > m && !max_inside.compare_exchange_weak(m, n))
+      ;
+    --inside;
+    slots.release();
+
+    phases.arrive_and_wait();
+    // All threads must see the same number of completed phases here
+    assert(completed_phases == i+1);
+  }
+}
+
+int main() {
+  std::vector<thread*> threads;
+  for (int i=0; i<nworkers; ++i)
+    threads.push_back(new thread(&worker));
+
+  workers_ready.wait();
+  std::printf("all workers are ready\n");
+  start.count_down();
+
+  for (size_t i=0; i<threads.size(); ++i) {
+    threads[i]->join();
+    delete threads[i];
+  }
+
+  std::printf("completed phases: %d (expected %d)\n", completed_phases, nphases);
+  std::printf("max workers inside: %d (expected <= 2)\n", max_inside.load());
+
+  binary_semaphore sem(0);
+  bool acquired = sem.try_acquire_for(50);
+  std::printf("try_acquire_for() on empty semaphore: %s\n", acquired ? "acquired": "timeout");
+
+  return (completed_phases == nphases && max_inside.load() <= 2 && !acquired) ? 0: 1;
+}
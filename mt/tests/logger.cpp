@@ -0,0 +1,166 @@
+// mt - thread library to create C++ experiments         -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+// Measures the cost of a log call in the hot path (when the buffer
+// has space) and the sustained throughput of several threads with
+// mt::logger (drop and block policies) and with the classic
+// "cout << ... << endl" protected by a mutex. Checks that long
+// strings are truncated (not dropped) and that the messages that don't
+// fit in a buffer are counted as dropped even with the block policy.
+//
+// Usage: logger [threads] [messages per thread]
+
+#include "mt/thread.h"
+#include "mt/logger.h"
+#include "chrono.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace mt;
+
+int nthreads = 4;
+int nmessages = 200000;
+
+logger* the_logger = NULL;
+std::ofstream* the_stream = NULL;
+mutex stream_mutex;
+
+void logger_proc(int nth) {
+  std::string name = "worker";
+  for (int i=0; i<nmessages; ++i)
+    the_logger->log("[%s %d] item %3d produced (%.2f)", name, nth, i & 255, i * 0.5);
+}
+
+void stream_proc(int nth) {
+  std::string name = "worker";
+  for (int i=0; i<nmessages; ++i) {
+    lock_guard<mutex> lock(stream_mutex);
+    *the_stream << "[" << name << " " << nth << "] item " << (i & 255)
+                << " produced (" << (i * 0.5) << ")" << std::endl;
+  }
+}
+
+double run_threads(void (*proc)(int)) {
+  std::vector<thread*> threads;
+  Chrono chrono;
+  for (int i=0; i<nthreads; ++i)
+    threads.push_back(new thread(proc, i+1));
+  for (int i=0; i<nthreads; ++i) {
+    threads[i]->join();
+    delete threads[i];
+  }
+  return chrono.elapsed();
+}
+
+void test_latency() {
+  const int n = 10000;
+  std::string name = "worker";
+  FILE* file = std::tmpfile();
+  logger log(file, logger::drop, 4*1024*1024, 1000);
+
+  double best = 1e9;
+  for (int round=0; round<10; ++round) {
+    Chrono chrono;
+    for (int i=0; i<n; ++i)
+      log.log("[%s %d] item %3d produced (%.2f)", name, 1, i & 255, i * 0.5);
+    best = std::min(best, chrono.elapsed());
+    log.flush();
+  }
+  std::printf("%-14s %8.1f ns/call  (best of 10 rounds of %d calls, %lu dropped)\n",
+              "hot path", best * 1e9 / n, n, log.dropped());
+  std::fclose(file);
+}
+
+bool test_long_messages() {
+  FILE* file = std::tmpfile();
+  unsigned long dropped;
+  {
+    logger log(file, logger::block, 1024); // Rounded to the minimum size
+    std::string big(100000, 'x');
+    for (int i=0; i<100; ++i)
+      log.log("%s", big);
+    log.log("%s %s %s", big, big, big);    // Bigger than 1/4 of the buffer
+    log.flush();
+    dropped = log.dropped();
+  }
+
+  // Count the lines and the 'x' of each line
+  std::rewind(file);
+  int lines = 0, longest = 0, xs = 0;
+  for (int c; (c = std::fgetc(file)) != EOF; ) {
+    if (c == 'x')
+      ++xs;
+    else if (c == '\n') {
+      ++lines;
+      longest = std::max(longest, xs);
+      xs = 0;
+    }
+  }
+  std::fclose(file);
+
+  std::printf("%-14s %d lines, %d chars of the longest string, %lu dropped\n",
+              "long messages", lines, longest, dropped);
+  return (lines == 101 &&       // 100 messages + the report of the dropped one
+          longest > 0 && longest < int(logger::max_line) &&
+          dropped == 1);
+}
+
+void test_logger(const char* name, logger::overflow_policy policy) {
+  FILE* file = std::tmpfile();
+  double t, total;
+  unsigned long dropped;
+  {
+    logger log(file, policy, 256*1024);
+    the_logger = &log;
+
+    Chrono chrono;
+    t = run_threads(&logger_proc);
+    log.flush();
+    total = chrono.elapsed();
+    dropped = log.dropped();
+    the_logger = NULL;
+  }
+  long size = std::ftell(file);
+  std::fclose(file);
+
+  std::printf("%-14s %8.1f ns/message  (%.3f s until flushed, %ld bytes, %lu dropped)\n",
+              name, t * 1e9 / (double(nthreads) * nmessages), total, size, dropped);
+}
+
+void test_stream() {
+  std::ofstream stream("logger_test.txt");
+  the_stream = &stream;
+  double t = run_threads(&stream_proc);
+  the_stream = NULL;
+  stream.close();
+  std::remove("logger_test.txt");
+
+  std::printf("%-14s %8.1f ns/message\n", "cout+endl", t * 1e9 / (double(nthreads) * nmessages));
+}
+
+int main(int argc, char* argv[]) {
+  if (argc > 1) nthreads = std::atoi(argv[1]);
+  if (argc > 2) nmessages = std::atoi(argv[2]);
+
+  bool ok = test_long_messages();
+  test_latency();
+
+  std::printf("throughput with %d threads, %d messages per thread:\n", nthreads, nmessages);
+  test_logger("logger(drop)", logger::drop);
+  test_logger("logger(block)", logger::block);
+  test_stream();
+
+  // Example of the output
+  logger log(stdout);
+  log.log("%s %d %u %ld %c %.3f %p %s", "hello", -1, 2u, 3L, 'x', 4.5, (void*)&log, std::string("bye"));
+  log.log("100%% done");
+  return ok ? 0: 1;
+}
@@ -0,0 +1,238 @@
+// mt - thread library to create C++ experiments         -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+// Lock-free stacks (Treiber) that free their nodes with hazard
+// pointers and with epochs, and a rcu_ptr read by several threads
+// while it's updated. Checks that all the nodes are deleted at the
+// end, that readers never see a deleted (poisoned) object, and that
+// epoch guards used from thread_local destructors don't block the
+// reclamation.
+
+#include "mt/thread.h"
+#include "mt/hazard_pointer.h"
+#include "mt/epoch.h"
+#include "mt/rcu_ptr.h"
+#include "chrono.h"
+
+#include <cstdio>
+#include <vector>
+
+using namespace mt;
+
+std::atomic<int> live_nodes(0);
+
+struct node {
+  int value;
+  node* next;
+  node(int value) : value(value), next(NULL) { ++live_nodes; }
+  ~node() { value = -1; --live_nodes; }
+};
+
+class hp_stack {
+public:
+  hp_stack(hazard_domain& domain) : m_head(NULL), m_domain(domain) { }
+
+  ~hp_stack() {
+    int v;
+    while (pop(v))
+      ;
+  }
+
+  void push(int value) {
+    node* n = new node(value);
+    n->next = m_head.load(std::memory_order_relaxed);
+    while (!m_head.compare_exchange_weak(n->next, n, std::memory_order_release))
+      ;
+  }
+
+  bool pop(int& value) {
+    hazard_pointer hp(m_domain);
+    for (;;) {
+      node* n = hp.protect(m_head);
+      if (!n)
+        return false;
+      if (m_head.compare_exchange_strong(n, n->next, std::memory_order_acquire)) {
+        value = n->value;
+        hp.reset();
+        m_domain.retire(n);
+        return true;
+      }
+    }
+  }
+
+private:
+  std::atomic<node*> m_head;
+  hazard_domain& m_domain;
+};
+
+class epoch_stack {
+public:
+  epoch_stack(epoch_domain& domain) : m_head(NULL), m_domain(domain) { }
+
+  ~epoch_stack() {
+    int v;
+    while (pop(v))
+      ;
+  }
+
+  void push(int value) {
+    node* n = new node(value);
+    n->next = m_head.load(std::memory_order_relaxed);
+    while (!m_head.compare_exchange_weak(n->next, n, std::memory_order_release))
+      ;
+  }
+
+  bool pop(int& value) {
+    epoch_guard guard(m_domain);
+    node* n = m_head.load(std::memory_order_acquire);
+    while (n && !m_head.compare_exchange_weak(n, n->next, std::memory_order_acquire))
+      ;
+    if (!n)
+      return false;
+    value = n->value;
+    m_domain.retire(n);
+    return true;
+  }
+
+private:
+  std::atomic<node*> m_head;
+  epoch_domain& m_domain;
+};
+
+const int nthreads = 4;
+const int nitems = 100000;
+std::atomic<bool> failed(false);
+
+template<class Stack>
+void stack_worker(Stack* stack) {
+  for (int i=0; i<nitems; ++i) {
+    stack->push(i);
+    int v;
+    if (stack->pop(v) && v < 0)
+      failed = true;            // We have read a deleted node
+  }
+}
+
+template<class Stack, class Domain>
+double run_stack() {
+  Chrono chrono;
+  {
+    Domain domain;
+    Stack stack(domain);
+    std::vector<thread*> threads;
+    for (int i=0; i<nthreads; ++i)
+      threads.push_back(new thread(&stack_worker<Stack>, &stack));
+    for (int i=0; i<nthreads; ++i) {
+      threads[i]->join();
+      delete threads[i];
+    }
+  }
+  return chrono.elapsed();
+}
+
+struct config {
+  int a, b;                     // Invariant: b == a*2
+  config() : a(0), b(0) { }
+  ~config() { a = b = -1; }
+};
+
+struct increment_config {
+  void operator()(config& c) {
+    ++c.a;
+    c.b = c.a*2;
+  }
+};
+
+std::atomic<bool> stop_readers(false);
+
+void config_reader(rcu_ptr<config>* cfg) {
+  int last = 0;
+  while (!stop_readers) {
+    rcu_ptr<config>::read_guard c(*cfg);
+    if (c->b != c->a*2 || c->a < last)
+      failed = true;
+    last = c->a;
+  }
+}
+
+// Uses the epoch domain from its destructor, after the thread
+// released its record
+struct teardown_reader {
+  epoch_domain* domain;
+  teardown_reader() : domain(NULL) { }
+  ~teardown_reader() {
+    if (!domain)
+      return;
+    for (int i=0; i<3; ++i) {
+      epoch_guard guard(*domain);
+    }
+    domain->retire(new node(0));
+  }
+};
+
+void teardown_thread(epoch_domain* domain) {
+  // Constructed before the first use of the domain, so it's destroyed
+  // after the thread's record was released
+  static thread_local teardown_reader reader;
+  reader.domain = domain;
+  epoch_guard guard(*domain);
+}
+
+bool test_teardown() {
+  epoch_domain domain(1);
+  for (int i=0; i<4; ++i) {
+    thread t(&teardown_thread, &domain);
+    t.join();
+  }
+
+  // Nothing is pinned, so the epoch advances and the nodes retired by
+  // this thread are deleted
+  const unsigned epoch = domain.epoch();
+  for (int i=0; i<4; ++i)
+    domain.retire(new node(0));
+  domain.reclaim();
+  domain.reclaim();
+  return domain.epoch() >= epoch+2;
+}
+
+int main() {
+  double t_hp = run_stack<hp_stack, hazard_domain>();
+  std::printf("hazard pointers stack: %.3f seconds, live nodes: %d\n", t_hp, live_nodes.load());
+  bool ok = (live_nodes == 0);
+
+  double t_ep = run_stack<epoch_stack, epoch_domain>();
+  std::printf("epoch-based stack: %.3f seconds, live nodes: %d\n", t_ep, live_nodes.load());
+  ok = ok && (live_nodes == 0);
+
+  {
+    epoch_domain domain;
+    rcu_ptr<config> cfg(new config, domain);
+    std::vector<thread*> readers;
+    for (int i=0; i<nthreads; ++i)
+      readers.push_back(new thread(&config_reader, &cfg));
+
+    for (int i=0; i<nitems; ++i)
+      cfg.modify(increment_config());
+
+    stop_readers = true;
+    for (int i=0; i<nthreads; ++i) {
+      readers[i]->join();
+      delete readers[i];
+    }
+
+    rcu_ptr<config>::read_guard c(cfg);
+    std::printf("rcu_ptr: final value %d (expected %d)\n", c->a, nitems);
+    ok = ok && (c->a == nitems);
+  }
+
+  const bool teardown = test_teardown();
+  std::printf("epoch guards at thread exit: %s, live nodes: %d\n",
+              teardown ? "ok": "pinned", live_nodes.load());
+  ok = ok && teardown && (live_nodes == 0);
+
+  std::printf("readers saw deleted objects: %s\n", failed ? "yes": "no");
+  return (ok && !failed) ? 0: 1;
+}
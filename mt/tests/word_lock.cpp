@@ -0,0 +1,242 @@
+// mt - thread library to create C++ experiments         -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+// Compares mt::word_lock (1 byte) against mt::mutex with one
+// contended lock and with one lock per entry of a big table, and
+// tests mt::word_condition_variable with a bounded queue, notify_all()
+// and wait_for().
+//
+// Usage: word_lock [threads]
+
+#include "mt/thread.h"
+#include "mt/word_lock.h"
+#include "chrono.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <vector>
+
+using namespace mt;
+
+int nthreads = 4;
+
+//////////////////////////////////////////////////////////////////////
+// One contended lock
+
+const int increments = 200000;
+
+template<class Lock>
+struct counter {
+  Lock lock;
+  long value;
+  counter() : value(0) { }
+};
+
+template<class Lock>
+void increment_counter(counter<Lock>* c) {
+  for (int i=0; i<increments; ++i) {
+    lock_guard<Lock> guard(c->lock);
+    ++c->value;
+  }
+}
+
+template<class Lock>
+bool test_counter(const char* name) {
+  counter<Lock> c;
+  std::vector<thread*> threads;
+  Chrono chrono;
+  for (int i=0; i<nthreads; ++i)
+    threads.push_back(new thread(&increment_counter<Lock>, &c));
+  for (int i=0; i<nthreads; ++i) {
+    threads[i]->join();
+    delete threads[i];
+  }
+  double t = chrono.elapsed();
+  std::printf("%-12s one lock:   %7.1f ns/lock\n", name, t * 1e9 / (double(nthreads) * increments));
+  return c.value == long(nthreads) * increments;
+}
+
+//////////////////////////////////////////////////////////////////////
+// One lock per table entry
+
+const int table_size = 1 << 20;
+const int updates = 500000;
+
+template<class Lock>
+struct entry {
+  Lock lock;
+  unsigned int hits;
+};
+
+template<class Lock>
+void update_table(entry<Lock>* table) {
+  unsigned int seed = reinterpret_cast<std::uintptr_t>(&seed) & 0xffff;
+  for (int i=0; i<updates; ++i) {
+    seed = seed*1103515245 + 12345;
+    entry<Lock>& e = table[(seed >> 4) % table_size];
+    lock_guard<Lock> guard(e.lock);
+    ++e.hits;
+  }
+}
+
+template<class Lock>
+bool test_table(const char* name) {
+  std::vector<entry<Lock> > table(table_size);
+  for (int i=0; i<table_size; ++i)
+    table[i].hits = 0;
+
+  std::vector<thread*> threads;
+  Chrono chrono;
+  for (int i=0; i<nthreads; ++i)
+    threads.push_back(new thread(&update_table<Lock>, &table[0]));
+  for (int i=0; i<nthreads; ++i) {
+    threads[i]->join();
+    delete threads[i];
+  }
+  double t = chrono.elapsed();
+
+  long total = 0;
+  for (int i=0; i<table_size; ++i)
+    total += table[i].hits;
+
+  std::printf("%-12s per entry:  %7.1f ns/lock  (%d entries of %d bytes = %.1f MB)\n",
+              name, t * 1e9 / (double(nthreads) * updates), table_size,
+              int(sizeof(entry<Lock>)), double(table_size) * sizeof(entry<Lock>) / (1024*1024));
+  return total == long(nthreads) * updates;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Condition variable
+
+class bounded_queue {
+  static const std::size_t MAX = 16;
+
+  std::deque<int> items;
+  word_lock lock;
+  word_condition_variable not_full;
+  word_condition_variable not_empty;
+
+public:
+  void push(int item) {
+    lock_guard<word_lock> guard(lock);
+    while (items.size() == MAX)
+      not_full.wait(guard);
+    items.push_back(item);
+    not_empty.notify_one();
+  }
+
+  int pop() {
+    lock_guard<word_lock> guard(lock);
+    while (items.empty())
+      not_empty.wait(guard);
+    int item = items.front();
+    items.pop_front();
+    not_full.notify_one();
+    return item;
+  }
+};
+
+bounded_queue the_queue;
+const int items_per_producer = 100000;
+
+void producer() {
+  for (int i=1; i<=items_per_producer; ++i)
+    the_queue.push(i);
+}
+
+void consumer(long* sum) {
+  for (int i=0; i<items_per_producer; ++i)
+    *sum += the_queue.pop();
+}
+
+bool test_queue() {
+  std::vector<thread*> threads;
+  std::vector<long> sums(nthreads, 0);
+  Chrono chrono;
+  for (int i=0; i<nthreads; ++i) {
+    threads.push_back(new thread(&producer));
+    threads.push_back(new thread(&consumer, &sums[i]));
+  }
+  for (std::size_t i=0; i<threads.size(); ++i) {
+    threads[i]->join();
+    delete threads[i];
+  }
+  double t = chrono.elapsed();
+
+  long total = 0, expected = long(nthreads) * items_per_producer * (items_per_producer+1) / 2;
+  for (int i=0; i<nthreads; ++i)
+    total += sums[i];
+
+  std::printf("bounded_queue: %.0f items/sec\n", nthreads * items_per_producer / t);
+  return total == expected;
+}
+
+word_lock gate_lock;
+word_condition_variable gate_cv;
+bool gate_open = false;
+std::atomic<int> passed(0);
+
+void wait_gate() {
+  lock_guard<word_lock> guard(gate_lock);
+  while (!gate_open)
+    gate_cv.wait(guard);
+  ++passed;
+}
+
+bool test_notify_all() {
+  const int n = 16;
+  std::vector<thread*> threads;
+  for (int i=0; i<n; ++i)
+    threads.push_back(new thread(&wait_gate));
+
+  this_thread::sleep_for(50);
+  {
+    lock_guard<word_lock> guard(gate_lock);
+    gate_open = true;
+    gate_cv.notify_all();       // Requeued to gate_lock
+  }
+  for (int i=0; i<n; ++i) {
+    threads[i]->join();
+    delete threads[i];
+  }
+
+  // Nobody notifies this one
+  word_lock lock;
+  word_condition_variable cv;
+  Chrono chrono;
+  bool notified;
+  {
+    lock_guard<word_lock> guard(lock);
+    notified = cv.wait_for(guard, 30);
+  }
+  double t = chrono.elapsed();
+
+  std::printf("notify_all: %d/%d threads passed, wait_for: %s after %.0f ms\n",
+              passed.load(), n, notified ? "notified": "timeout", t*1000);
+  return passed == n && !notified && t >= 0.025;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc > 1)
+    nthreads = std::atoi(argv[1]);
+
+  std::printf("sizeof(word_lock) = %d, sizeof(word_condition_variable) = %d\n",
+              int(sizeof(word_lock)), int(sizeof(word_condition_variable)));
+  std::printf("sizeof(mutex) = %d, sizeof(condition_variable) = %d\n",
+              int(sizeof(mutex)), int(sizeof(condition_variable)));
+
+  bool ok = true;
+  ok = test_counter<word_lock>("word_lock") && ok;
+  ok = test_counter<mutex>("mutex") && ok;
+  ok = test_table<word_lock>("word_lock") && ok;
+  ok = test_table<mutex>("mutex") && ok;
+  ok = test_queue() && ok;
+  ok = test_notify_all() && ok;
+
+  std::printf(ok ? "ok\n": "FAILED\n");
+  return ok ? 0: 1;
+}
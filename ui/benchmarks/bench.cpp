@@ -0,0 +1,404 @@
+// ui - Basic User Interface library to do experiments          -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+// Rendering benchmark: clears, fills, blits, blends, text, dirty-rect
+// presents and full-frame redraws at 720p, 1080p and 4K, reported as
+// ms/frame, frames/second and megapixels/second (pixels written by
+// the scenario, or presented for the window ones).
+//
+// Each frame is compared pixel by pixel with a 720p golden image of
+// the scenario at full size (QOI files in benchmarks/golden, see
+// check_golden() for the bigger resolutions). A pixel with a channel
+// difference bigger than the tolerance fails the test and saves the
+// frame as bench_<scenario>_<resolution>.png, so optimizations of the
+// pixel paths cannot change the output without notice. It also checks
+// that a kernel with a broken tail (the last pixels of a span are
+// skipped) is detected.
+//
+// Run it with UI_HEADLESS=1 (no window is shown). UI_GOLDEN_UPDATE=1
+// writes the golden images again (after an intended change of the
+// output), UI_GOLDEN=dir reads them from other directory.
+
+#include <ui/ui.h>
+#include "chrono.h"
+#include "../tests/test.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using namespace ui;
+
+#ifndef UI_GOLDEN_DIR
+#define UI_GOLDEN_DIR "golden"
+#endif
+
+// Tolerance of the golden images: max difference per channel of each
+// pixel
+static const int channel_tolerance = 2;
+
+// Minimum time and frames of each measurement
+static const double min_seconds = 0.25;
+static const int min_frames = 3;
+
+//////////////////////////////////////////////////////////////////////
+// Assets and helpers
+
+struct assets {
+  bitmap sprite;                // 64x64 translucent sprite
+  font text_font;
+
+  assets()
+    : sprite(64, 64)
+    , text_font(new builtin_glyph_source(14)) {
+    sprite.clear(0);
+    fill_gradient(sprite, rect(8, 8, 48, 48), premultiply(rgba(255, 160, 0, 255)),
+                  premultiply(rgba(0, 80, 255, 96)), gradient_vertical);
+    for (int i=0; i<8; ++i)
+      draw_line_aa(sprite, 4, 4 + i*7.5, 60, 60 - i*7.5, premultiply(rgba(255, 255, 255, 200)));
+  }
+};
+
+// A color for each cell of a grid
+pixel cell_color(int i, int j, int alpha = 255) {
+  unsigned h = unsigned(i)*73856093u ^ unsigned(j)*19349663u;
+  h ^= h >> 13;
+  h *= 0x5bd1e995u;
+  return premultiply(rgba((h >> 8) & 0xff, (h >> 16) & 0xff, (h >> 24) & 0xff, alpha));
+}
+
+rect bounds(const bitmap& bmp) {
+  return rect(0, 0, bmp.width(), bmp.height());
+}
+
+//////////////////////////////////////////////////////////////////////
+// Scenarios
+//
+// Each frame function draws the same content each time (so the result
+// doesn't depend on the number of measured frames) and returns the
+// number of pixels that it wrote or presented.
+
+long long frame_clear(window& wnd, assets&) {
+  bitmap& fb = wnd.framebuffer();
+  fill_rect(fb, bounds(fb), rgba(32, 32, 48));
+  return (long long)fb.width() * fb.height();
+}
+
+// Opaque cells of 40x30 with a 2 pixel gap
+long long frame_fills(window& wnd, assets&) {
+  bitmap& fb = wnd.framebuffer();
+  long long pixels = (long long)fb.width() * fb.height();
+  fill_rect(fb, bounds(fb), rgba(0, 0, 0));
+  for (int y=0, j=0; y<fb.height(); y+=32, ++j)
+    for (int x=0, i=0; x<fb.width(); x+=42, ++i) {
+      fill_rect(fb, rect(x, y, 40, 30), cell_color(i, j));
+      pixels += 40*30;
+    }
+  return pixels;
+}
+
+// Copies of the sprite (alpha included) in a grid
+long long frame_blits(window& wnd, assets& a) {
+  bitmap& fb = wnd.framebuffer();
+  long long pixels = (long long)fb.width() * fb.height();
+  fill_rect(fb, bounds(fb), rgba(64, 64, 64));
+  for (int y=0; y<fb.height(); y+=64)
+    for (int x=0; x<fb.width(); x+=64) {
+      blit(fb, x, y, a.sprite, rect(0, 0, 64, 64));
+      pixels += 64*64;
+    }
+  return pixels;
+}
+
+// Translucent sprites and rectangles composited with several operators
+long long frame_blends(window& wnd, assets& a) {
+  bitmap& fb = wnd.framebuffer();
+  long long pixels = (long long)fb.width() * fb.height();
+  fill_rect(fb, bounds(fb), rgba(200, 200, 200));
+  static const blend_op ops[4] = { blend_src_over, blend_dst_over, blend_src_atop, blend_xor };
+  for (int y=0, j=0; y<fb.height(); y+=48, ++j)
+    for (int x=0, i=0; x<fb.width(); x+=48, ++i) {
+      blend_rect(fb, rect(x, y, 64, 64), cell_color(i, j, 128), ops[(i+j) % 4]);
+      blit(fb, x+8, y+8, a.sprite, blend_src_over);
+      pixels += 2*64*64;
+    }
+  return pixels;
+}
+
+// Lines of text (each glyph is a coverage mask blended over the frame)
+long long frame_text(window& wnd, assets& a) {
+  static const char* line = "The quick brown fox jumps over the lazy dog 0123456789 ";
+  bitmap& fb = wnd.framebuffer();
+  fill_rect(fb, bounds(fb), rgba(250, 250, 240));
+  const int w = measure_text(a.text_font, line);
+  const int h = a.text_font.line_height();
+  for (int y=0, j=0; y<fb.height(); y+=h, ++j)
+    for (int x=0; x<fb.width(); x+=w)
+      draw_text(fb, a.text_font, x, y, line, (j & 1 ? rgba(0, 0, 0): rgba(0, 0, 160)));
+  return (long long)fb.width() * fb.height();
+}
+
+// A widget of the UI scenarios (240x180 cells), drawn in a view of
+// its cell so its text doesn't overflow to the next widget (the image
+// would depend on the order in which the widgets are drawn)
+rect draw_widget(bitmap& fb, assets& a, int i, int j) {
+  const rect rc = rect(i*240, j*180, 240, 180) & bounds(fb);
+  bitmap view(rc.w, rc.h, fb.span(rc.x, rc.y), fb.stride());
+  fill_rect(view, rect(0, 0, 240, 180), rgba(40, 40, 60));
+  fill_gradient(view, rect(0, 0, 240, 24), rgba(80, 80, 140), rgba(40, 40, 90),
+                gradient_vertical);
+  draw_line(view, 0, 0, 239, 0, rgba(120, 120, 160));
+  draw_line(view, 0, 0, 0, 179, rgba(120, 120, 160));
+  draw_text(view, a.text_font, 8, 5, "Widget title", rgba(255, 255, 255));
+  for (int k=0; k<4; ++k)
+    draw_text(view, a.text_font, 8, 32 + k*18, "Label of a widget", rgba(210, 210, 210));
+  blit(view, 168, 40, a.sprite, blend_src_over);
+  blend_rect(view, rect(8, 140, 100, 28), cell_color(i, j, 160));
+  draw_text(view, a.text_font, 20, 147, "Button", rgba(255, 255, 255));
+  return rc;
+}
+
+// All the widgets redrawn and presented each frame
+long long frame_full_redraw(window& wnd, assets& a) {
+  bitmap& fb = wnd.framebuffer();
+  for (int j=0; j*180<fb.height(); ++j)
+    for (int i=0; i*240<fb.width(); ++i)
+      draw_widget(fb, a, i, j);
+  wnd.invalidate();
+  wnd.present();
+  return (long long)fb.width() * fb.height();
+}
+
+// Only 4 widgets change each frame, their areas are presented
+long long frame_dirty(window& wnd, assets& a) {
+  static int next = 0;
+  bitmap& fb = wnd.framebuffer();
+  const int cols = (fb.width() + 239) / 240;
+  const int rows = (fb.height() + 179) / 180;
+  long long pixels = 0;
+  for (int k=0; k<4; ++k, ++next) {
+    const int n = next % (cols*rows);
+    const rect rc = draw_widget(fb, a, n % cols, n / cols);
+    wnd.invalidate(rc);
+    pixels += rc.area();
+  }
+  wnd.present();
+  return pixels;
+}
+
+// The dirty scenario starts from the whole UI
+void prepare_dirty(window& wnd, assets& a) {
+  frame_full_redraw(wnd, a);
+}
+
+typedef long long (*frame_fn)(window& wnd, assets& a);
+typedef void (*prepare_fn)(window& wnd, assets& a);
+
+struct scenario {
+  const char* name;
+  const char* golden;           // Both UI scenarios give the same image
+  frame_fn frame;
+  prepare_fn prepare;
+};
+
+static const scenario scenarios[] = {
+  { "clear",       "clear",  frame_clear,       NULL },
+  { "fills",       "fills",  frame_fills,       NULL },
+  { "blits",       "blits",  frame_blits,       NULL },
+  { "blends",      "blends", frame_blends,      NULL },
+  { "text",        "text",   frame_text,        NULL },
+  { "dirty",       "ui",     frame_dirty,       prepare_dirty },
+  { "full_redraw", "ui",     frame_full_redraw, NULL },
+};
+
+struct resolution {
+  const char* name;
+  int width, height;
+};
+
+static const resolution resolutions[] = {
+  { "720p",  1280,  720 },
+  { "1080p", 1920, 1080 },
+  { "4K",    3840, 2160 },
+};
+
+//////////////////////////////////////////////////////////////////////
+// Golden images
+//
+// The golden images are 720p frames at full size. The scenarios draw
+// from the top-left corner, so the first 1280x720 pixels of a 1080p or
+// 4K frame must be the golden image too, and the whole frame is
+// compared with the scenario drawn with the scalar kernels (the
+// reference implementation).
+
+static const resolution& golden_resolution = resolutions[0];
+
+std::string golden_filename(const char* golden) {
+  const char* dir = std::getenv("UI_GOLDEN");
+  return std::string(dir ? dir: UI_GOLDEN_DIR) + "/" + golden + "_" + golden_resolution.name + ".qoi";
+}
+
+bool load_golden(const char* golden, surface& image) {
+  const std::string filename = golden_filename(golden);
+  if (!image.load(filename) ||
+      image.width() != golden_resolution.width ||
+      image.height() != golden_resolution.height) {
+    std::printf("%s: cannot load %s (UI_GOLDEN_UPDATE=1 creates it)\n",
+                golden, filename.c_str());
+    return false;
+  }
+  return true;
+}
+
+// Compares the expected image with the top-left part of the result of
+// the same size, returns false if a pixel has a channel with a
+// difference bigger than channel_tolerance
+bool compare_images(const bitmap& result, const bitmap& expected,
+                    int& max_diff, int& bad_pixels) {
+  max_diff = 0;
+  bad_pixels = 0;
+  for (int y=0; y<expected.height(); ++y) {
+    const pixel* r = result.row(y);
+    const pixel* e = expected.row(y);
+    for (int x=0; x<expected.width(); ++x) {
+      // The golden image has no alpha
+      int diff = 0;
+      for (int shift=0; shift<24; shift+=8)
+        diff = std::max(diff, std::abs(int((r[x] >> shift) & 0xff) -
+                                       int((e[x] >> shift) & 0xff)));
+      max_diff = std::max(max_diff, diff);
+      if (diff > channel_tolerance)
+        ++bad_pixels;
+    }
+  }
+  return bad_pixels == 0;
+}
+
+// Draws the last frame of the scenario with the scalar kernels
+void draw_reference(const scenario& s, window& wnd, assets& a) {
+  const simd_level old = current_simd_level();
+  set_simd_level(simd_scalar);
+  if (s.prepare)
+    s.prepare(wnd, a);
+  s.frame(wnd, a);
+  set_simd_level(old);
+}
+
+// Saves the result to look at it, always returns false
+bool report_difference(const scenario& s, const resolution& res, const bitmap& result,
+                       const std::string& expected, int max_diff, int bad_pixels) {
+  const std::string output = std::string("bench_") + s.name + "_" + res.name + ".png";
+  save_image(result, output);
+  std::printf("%s %s: differs from %s (max channel difference %d, %d pixels over %d), "
+              "result saved in %s\n", s.name, res.name, expected.c_str(), max_diff, bad_pixels,
+              channel_tolerance, output.c_str());
+  return false;
+}
+
+bool check_golden(const scenario& s, const resolution& res, assets& a, const bitmap& result) {
+  const bool full = (res.width == golden_resolution.width &&
+                     res.height == golden_resolution.height);
+  const std::string filename = golden_filename(s.golden);
+  if (full && std::getenv("UI_GOLDEN_UPDATE")) {
+    if (!save_image(result, filename)) {
+      std::printf("%s %s: cannot write %s\n", s.name, res.name, filename.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  surface golden;
+  if (!load_golden(s.golden, golden))
+    return false;
+
+  int max_diff, bad_pixels;
+  if (!compare_images(result, golden.get(), max_diff, bad_pixels))
+    return report_difference(s, res, result, filename, max_diff, bad_pixels);
+  if (full || current_simd_level() == simd_scalar)
+    return true;
+
+  window reference(res.width, res.height);
+  draw_reference(s, reference, a);
+  if (!compare_images(result, reference.framebuffer(), max_diff, bad_pixels))
+    return report_difference(s, res, result, "the scalar kernels", max_diff, bad_pixels);
+  return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Benchmark
+
+bool run(const scenario& s, const resolution& res, assets& a) {
+  window wnd(res.width, res.height);
+  if (s.prepare)
+    s.prepare(wnd, a);
+  s.frame(wnd, a);              // Warm-up (page faults, glyph caches)
+
+  int frames = 0;
+  long long pixels = 0;
+  Chrono chrono;
+  double elapsed;
+  do {
+    pixels += s.frame(wnd, a);
+    ++frames;
+  } while ((elapsed = chrono.elapsed()) < min_seconds || frames < min_frames);
+
+  std::printf("%-12s %-6s %8.2f ms/frame %8.1f fps %8.0f MP/s\n",
+              s.name, res.name, elapsed * 1000.0 / frames, frames / elapsed,
+              pixels / elapsed / 1e6);
+  return check_golden(s, res, a, wnd.framebuffer());
+}
+
+//////////////////////////////////////////////////////////////////////
+// Broken kernel
+
+static raster_kernels::blend_mask_fn real_blend_mask = NULL;
+
+// The blend_mask kernel of the active level without the last w%4
+// columns (as a SIMD kernel that forgets its scalar tail)
+void blend_mask_without_tail(pixel* dst, int dst_stride,
+                             const uint8_t* mask, int mask_stride,
+                             pixel color, int w, int h) {
+  real_blend_mask(dst, dst_stride, mask, mask_stride, color, w & ~3, h);
+}
+
+// The text scenario drawn with the broken kernel must not match its
+// golden image
+bool test_broken_tail(assets& a) {
+  const resolution& res = golden_resolution;
+  surface golden;
+  if (!load_golden("text", golden))
+    return false;
+
+  const raster_kernels* old = &kernels();
+  raster_kernels broken = *old;
+  real_blend_mask = broken.blend_mask;
+  broken.blend_mask = &blend_mask_without_tail;
+
+  window wnd(res.width, res.height);
+  raster_details::active_kernels().store(&broken, std::memory_order_relaxed);
+  frame_text(wnd, a);
+  raster_details::active_kernels().store(old, std::memory_order_relaxed);
+
+  int max_diff, bad_pixels;
+  const bool detected = !compare_images(wnd.framebuffer(), golden.get(), max_diff, bad_pixels);
+  std::printf("broken tail  %-6s %d pixels over %d (max channel difference %d)\n",
+              res.name, bad_pixels, channel_tolerance, max_diff);
+  return detected;
+}
+
+int ui_main()
+{
+  assets a;
+  bool ok = true;
+  for (std::size_t i=0; i<sizeof(scenarios)/sizeof(scenarios[0]); ++i)
+    for (std::size_t j=0; j<sizeof(resolutions)/sizeof(resolutions[0]); ++j)
+      ok &= run(scenarios[i], resolutions[j], a);
+  if (!std::getenv("UI_GOLDEN_UPDATE"))
+    ok &= check("broken tail", test_broken_tail(a));
+
+  return report(ok);
+}
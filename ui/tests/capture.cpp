@@ -0,0 +1,314 @@
+// ui - Basic User Interface library to do experiments          -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+// Tests the BGRA to YUV 4:2:0 conversion (known colors, and the SIMD
+// kernels against the scalar one), the Y4M and raw BGRA files written
+// by frame_capture, dropped frame accounting, capturing a ui::window
+// (the frames written when only the damage is copied, and the cost of
+// the capture in the render thread). Prints the conversion speed of
+// each SIMD level and the cost of the capture at 60 FPS.
+
+#include <ui/ui.h>
+#include "chrono.h"
+#include "test.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace ui;
+
+void random_bitmap(bitmap& bmp, unsigned seed) {
+  std::srand(seed);
+  for (int y=0; y<bmp.height(); ++y)
+    for (int x=0; x<bmp.width(); ++x)
+      bmp.put_pixel(x, y, rgba(std::rand() & 255, std::rand() & 255,
+                               std::rand() & 255, std::rand() & 255));
+}
+
+std::vector<uint8_t> convert(const bitmap& bmp, simd_level level) {
+  simd_level old = current_simd_level();
+  set_simd_level(level);
+  std::vector<uint8_t> out(yuv420_size(bmp.width(), bmp.height()));
+  bgra_to_yuv420(bmp, &out[0]);
+  set_simd_level(old);
+  return out;
+}
+
+bool test_colors() {
+  using namespace yuv_details;
+  return (to_y(0, 0, 0) == 16 && to_u(0, 0, 0) == 128 && to_v(0, 0, 0) == 128 &&
+          to_y(255, 255, 255) == 235 && to_u(255, 255, 255) == 128 && to_v(255, 255, 255) == 128 &&
+          to_y(255, 0, 0) == 82 && to_u(255, 0, 0) == 90 && to_v(255, 0, 0) == 240 &&
+          to_y(0, 0, 255) == 41 && to_u(0, 0, 255) == 240 && to_v(0, 0, 255) == 110);
+}
+
+// Odd sizes test the last column/row of chroma and the scalar tails
+bool test_kernels(int w, int h) {
+  bitmap bmp(w, h);
+  random_bitmap(bmp, w*h);
+  std::vector<uint8_t> ref = convert(bmp, simd_scalar);
+  return (convert(bmp, simd_sse2) == ref &&
+          convert(bmp, simd_avx2) == ref);
+}
+
+void bench_kernels() {
+  bitmap bmp(1920, 1080);
+  random_bitmap(bmp, 1);
+  std::vector<uint8_t> out(yuv420_size(1920, 1080));
+  simd_level old = current_simd_level();
+  for (int l=simd_scalar; l<=detect_simd_level(); ++l) {
+    set_simd_level(simd_level(l));
+    Chrono chrono;
+    for (int i=0; i<20; ++i)
+      bgra_to_yuv420(bmp, &out[0]);
+    std::printf("%-6s 1080p to yuv420 %6.2f ms\n",
+                simd_level_name(simd_level(l)), chrono.elapsed() * 1000.0 / 20);
+  }
+  set_simd_level(old);
+}
+
+std::string read_file(const char* filename) {
+  std::string data;
+  if (std::FILE* f = std::fopen(filename, "rb")) {
+    char buf[4096];
+    std::size_t n;
+    while ((n = std::fread(buf, 1, sizeof(buf), f)) > 0)
+      data.append(buf, n);
+    std::fclose(f);
+  }
+  return data;
+}
+
+bool test_y4m() {
+  const int w = 33, h = 17, frames = 5;
+  capture_stats st;
+  {
+    frame_capture cap("capture.y4m", w, h, 30.0);
+    bitmap bmp(w, h);
+    for (int i=0; i<frames; ++i) {
+      bmp.clear(rgba(255, 0, 0));
+      bmp.put_pixel(0, 0, rgba(i*50, i*50, i*50));
+      cap.capture(bmp);
+      mt::this_thread::sleep_for(1);
+    }
+    cap.close();
+    st = cap.stats();
+    if (cap.failed())
+      return false;
+  }
+
+  const std::string header = "YUV4MPEG2 W33 H17 F30:1 Ip A1:1 C420jpeg\n";
+  const std::size_t frame_size = 6 + yuv420_size(w, h);
+  std::string data = read_file("capture.y4m");
+  std::remove("capture.y4m");
+  if (st.captured + st.dropped != frames || st.written != st.captured ||
+      data.size() != header.size() + st.written*frame_size ||
+      data.compare(0, header.size(), header) != 0)
+    return false;
+
+  // Check each frame: the first luma sample is the gray pixel, the
+  // rest of the frame is red
+  for (int i=0; i<st.written; ++i) {
+    std::size_t pos = header.size() + i*frame_size;
+    const uint8_t* y = reinterpret_cast<const uint8_t*>(data.c_str() + pos + 6);
+    const uint8_t* v = y + w*h + ((w+1)/2)*((h+1)/2);
+    if (data.compare(pos, 6, "FRAME\n") != 0 ||
+        y[1] != 82 || y[w*h-1] != 82 || v[((w+1)/2)*((h+1)/2)-1] != 240)
+      return false;
+  }
+  return true;
+}
+
+bool test_bgra() {
+  const int w = 16, h = 8;
+  {
+    frame_capture cap("capture.bgra", w, h, 60.0, frame_capture::format_bgra, 8);
+    bitmap bmp(w, h);
+    for (int i=0; i<3; ++i) {
+      bmp.clear(rgba(1, 2, 3, 4));
+      cap.capture(bmp);
+    }
+  }
+  std::string data = read_file("capture.bgra");
+  std::remove("capture.bgra");
+  return (data.size() == 3*w*h*4 &&
+          data[0] == 3 && data[1] == 2 && data[2] == 1 && data[3] == 4);
+}
+
+// Capturing as fast as possible with 2 buffers: the writer can't keep
+// up, so frames are dropped but never lost without being counted
+bool test_dropped() {
+  const int frames = 100;
+  capture_stats st;
+  {
+    frame_capture cap("capture.y4m", 1280, 720, 60.0, frame_capture::format_y4m, 2);
+    bitmap bmp(1280, 720);
+    bmp.clear(0);
+    for (int i=0; i<frames; ++i)
+      cap.capture(bmp);
+    cap.close();
+    st = cap.stats();
+  }
+  std::remove("capture.y4m");
+  std::printf("burst  captured %3d dropped %3d written %3d\n",
+              st.captured, st.dropped, st.written);
+  return (st.captured + st.dropped == frames && st.written == st.captured &&
+          st.captured >= 2);
+}
+
+// A 1080p window presenting 60 frames at 60 FPS
+bool test_window() {
+  const int frames = 60;
+  capture_stats st;
+  {
+    window w(1920, 1080);
+    frame_capture cap("capture.y4m", 1920, 1080);
+    w.set_capture(&cap);
+
+    bitmap bmp(1920, 1080);
+    for (int i=0; i<frames; ++i) {
+      Chrono chrono;
+      fill_gradient(bmp, rect(0, 0, 1920, 1080), rgba(i*4, 0, 0), rgba(0, 0, 255), gradient_horizontal);
+      w.present_frame(bmp);
+      int ms = 16 - int(chrono.elapsed() * 1000.0);
+      if (ms > 0)
+        mt::this_thread::sleep_for(ms);
+    }
+    w.set_capture(NULL);
+    cap.close();
+    st = cap.stats();
+  }
+  std::remove("capture.y4m");
+  std::printf("60fps  captured %3d dropped %3d written %3d  "
+              "capture() %6.1f us  convert+write %5.2f ms\n",
+              st.captured, st.dropped, st.written, st.copy_us, st.encode_ms);
+  return (st.captured + st.dropped == frames && st.written == st.captured);
+}
+
+// Frames of a window where each present() modifies a small area,
+// mixed with frames of present_frame(). With 2 buffers some frames are
+// dropped, each written frame must be exactly the presented one (the
+// first pixel has the number of the frame).
+bool test_damage() {
+  const int w = 64, h = 48, frames = 60;
+  std::vector<bitmap*> expected;
+  {
+    window win(w, h);
+    frame_capture cap("capture.bgra", w, h, 60.0, frame_capture::format_bgra, 2);
+    win.set_capture(&cap);
+
+    bitmap& fb = win.framebuffer();
+    bitmap other(w, h);
+    std::srand(1);
+    for (int i=0; i<frames; ++i) {
+      bitmap* frame;
+      if (i % 10 == 5) {
+        other.clear(rgba(0, 0, i*4));
+        other.put_pixel(0, 0, rgba(i, 0, 0));
+        frame = &other;
+      }
+      else {
+        const rect rc(std::rand() % w, std::rand() % h, 1 + std::rand() % 24, 1 + std::rand() % 24);
+        fill_rect(fb, rc, rgba(0, i*4, 255));
+        fb.put_pixel(0, 0, rgba(i, 0, 0));
+        win.invalidate(rc);
+        win.invalidate(rect(0, 0, 1, 1));
+        frame = &fb;
+      }
+      expected.push_back(new bitmap(w, h));
+      blit(*expected.back(), 0, 0, *frame, rect(0, 0, w, h));
+
+      if (frame == &other)
+        win.present_frame(other);
+      else
+        win.present();
+    }
+    win.set_capture(NULL);
+  }
+
+  std::string data = read_file("capture.bgra");
+  std::remove("capture.bgra");
+  const std::size_t frame_size = w*h*4;
+  bool ok = (!data.empty() && data.size() % frame_size == 0);
+  int last = -1;
+  for (std::size_t pos=0; ok && pos<data.size(); pos+=frame_size) {
+    const int i = uint8_t(data[pos+2]);
+    ok = (i > last && i < frames);
+    for (int y=0; ok && y<h; ++y)
+      ok = (std::memcmp(data.c_str() + pos + y*w*4, expected[i]->row(y), w*4) == 0);
+    last = i;
+  }
+  for (std::size_t i=0; i<expected.size(); ++i)
+    delete expected[i];
+  return ok;
+}
+
+// A 1080p window presenting 60 frames where only a 240x180 widget
+// changes: after the first frames (which copy the whole frame) the
+// render thread copies the widget and not the frame, the median cost
+// must be less than 1% of the 16.7 ms of a frame
+bool test_render_cost() {
+  const int warmup = 10, frames = 60;
+  std::vector<double> costs;
+  capture_stats st;
+  {
+    window w(1920, 1080);
+    frame_capture cap("capture.y4m", 1920, 1080);
+    w.set_capture(&cap);
+
+    bitmap& fb = w.framebuffer();
+    double total_us = 0.0;
+    for (int i=0; i<warmup+frames; ++i) {
+      Chrono chrono;
+      const rect rc(100 + (i%8)*200, 100 + (i%4)*200, 240, 180);
+      fill_gradient(fb, rc, rgba(i*4, 0, 0), rgba(0, 0, 255), gradient_horizontal);
+      w.invalidate(rc);
+      w.present();
+
+      st = cap.stats();
+      if (i >= warmup && st.copy_us*st.captured > total_us)
+        costs.push_back(st.copy_us*st.captured - total_us);
+      total_us = st.copy_us*st.captured;
+
+      int ms = 16 - int(chrono.elapsed() * 1000.0);
+      if (ms > 0)
+        mt::this_thread::sleep_for(ms);
+    }
+    w.set_capture(NULL);
+    cap.close();
+    st = cap.stats();
+  }
+  std::remove("capture.y4m");
+  if (costs.empty())
+    return false;
+
+  std::sort(costs.begin(), costs.end());
+  const double median = costs[costs.size()/2];
+  std::printf("widget captured %3d dropped %3d written %3d  capture() median %6.1f us\n",
+              st.captured, st.dropped, st.written, median);
+  return (median < 1000.0/60.0*10.0);
+}
+
+int ui_main()
+{
+  bool ok = true;
+  ok &= check("colors", test_colors());
+  ok &= check("kernels/odd", test_kernels(37, 21));
+  ok &= check("kernels/1080p", test_kernels(1920, 1080));
+  ok &= check("y4m", test_y4m());
+  ok &= check("bgra", test_bgra());
+  ok &= check("dropped", test_dropped());
+  ok &= check("window", test_window());
+  ok &= check("damage", test_damage());
+  ok &= check("render cost", test_render_cost());
+  bench_kernels();
+
+  return report(ok);
+}
@@ -0,0 +1,231 @@
+// ui - Basic User Interface library to do experiments          -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+// Tests the console: word wrapping, re-wrapping only the affected
+// lines when the width changes, the ring buffer of lines, and that
+// incremental renders (scrolled pixels, appended text) give the same
+// pixels as drawing the whole console again. Prints the cost per
+// frame of tailing a fast log.
+
+#include <ui/ui.h>
+#include "chrono.h"
+#include "test.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+using namespace ui;
+
+bool same_pixels(const bitmap& a, const bitmap& b) {
+  for (int y=0; y<a.height(); ++y)
+    if (std::memcmp(a.row(y), b.row(y), a.width()*sizeof(pixel)) != 0)
+      return false;
+  return true;
+}
+
+// Renders the content of "c" from scratch in "expected" and compares
+// it with "result"
+bool check_render(console& c, bitmap& result, bitmap& expected) {
+  bitmap copy(expected.width(), expected.height());
+  blit(copy, 0, 0, result, rect(0, 0, result.width(), result.height()));
+  c.invalidate();
+  c.render(expected);
+  return same_pixels(copy, expected);
+}
+
+bool test_wrap() {
+  font f(new builtin_glyph_source);     // 8 pixels per character
+  console c(f, rect(0, 0, 80, 80));     // 10 characters per row
+
+  c.write("aaaa bbbb cccc");
+  bool ok = (c.rows() == 2);            // "aaaa bbbb " + "cccc"
+  c.write("\n" + std::string(25, 'x'));
+  ok &= (c.rows() == 5);                // 10 + 10 + 5 characters
+  c.write("\n\n");
+  ok &= (c.lines() == 4 && c.rows() == 7);
+
+  // Text written in pieces gives the same layout
+  console d(f, rect(0, 0, 80, 80));
+  const char* pieces[] = { "aa", "aa bb", "bb", " cc", "cc\n", "xxxxxxxxxxxx",
+                           "xxxxxxxxxxxxx", "\n", "\n" };
+  for (int i=0; i<9; ++i)
+    d.write(pieces[i]);
+  return ok && d.rows() == c.rows() && d.text(0) == "aaaa bbbb cccc";
+}
+
+bool test_relayout() {
+  font f(new builtin_glyph_source);
+  console c(f, rect(0, 0, 200, 100));   // 25 characters
+  for (int i=0; i<100; ++i) {
+    c.write("short\n");                 // 5 characters
+    if (i % 25 == 0)
+      c.write(std::string(60, 'l') + "\n");
+  }
+  const long long rows = c.rows();
+
+  // Only the 4 long lines are re-wrapped
+  c.set_area(rect(0, 0, 400, 100));     // 50 characters
+  bool ok = (c.relayouts() == 4 && c.rows() == rows - 4);
+  c.set_area(rect(0, 0, 40, 100));      // 5 characters
+  ok &= (c.relayouts() == 8 && c.rows() == 100 + 4*12 + 1);
+  c.set_area(rect(0, 0, 200, 100));
+  ok &= (c.relayouts() == 12 && c.rows() == rows);
+  return ok;
+}
+
+bool test_ring() {
+  font f(new builtin_glyph_source);
+  console c(f, rect(0, 0, 100, 100), 100);
+  char buf[32];
+  for (int i=0; i<1000; ++i) {
+    std::sprintf(buf, "line %d\n", i);
+    c.write(buf);
+  }
+  const std::size_t bytes = c.bytes();
+  for (int i=0; i<10000; ++i)
+    c.write("another line\n");
+
+  // The last line is the current (empty) one
+  return (c.lines() == 100 && c.bytes() == bytes &&
+          c.text(0) == "another line" && c.text(99).empty());
+}
+
+bool test_incremental() {
+  const int w = 200, h = 120;
+  font f(new builtin_glyph_source);
+  bitmap result(w, h), expected(w, h);
+  fill_rect(result, rect(0, 0, w, h), rgba(255, 255, 255));
+  fill_rect(expected, rect(0, 0, w, h), rgba(255, 255, 255));
+
+  // The console in the middle of the bitmap
+  console c(f, rect(10, 20, 150, 81), 200);
+  bool ok = true;
+  char buf[64];
+  for (int i=0; i<150; ++i) {
+    c.set_color(rgba(i*40 % 256, 0, 128));
+    std::sprintf(buf, "Line %d ", i);
+    c.write(buf);
+    // Partial lines, long lines and several lines per frame
+    if (i % 3 == 0) c.write("continues\n");
+    if (i % 7 == 0) c.write("a long line that is wrapped in several rows\n");
+    if (i % 5 == 0) c.write("\n\n");
+    rect damage = c.render(result);
+    ok &= c.area().contains(damage);
+    if (i % 10 == 0)
+      ok &= check_render(c, result, expected);
+  }
+  ok &= check_render(c, result, expected);
+
+  // Scrolling back, forward and to the end
+  const int steps[] = { 1, 3, 2, -4, 10, -5, 100, -2, -200 };
+  for (int i=0; i<9; ++i) {
+    c.scroll(steps[i]);
+    c.render(result);
+    ok &= check_render(c, result, expected);
+  }
+  ok &= c.following();
+
+  // New text while looking at older lines doesn't move the view
+  c.scroll(5);
+  c.render(result);
+  c.write("more text\n");
+  ok &= c.render(result).empty();
+  ok &= check_render(c, result, expected);
+  return ok;
+}
+
+// Text appended to the last row only damages the new glyphs
+bool test_damage() {
+  font f(new builtin_glyph_source);
+  bitmap bmp(200, 100);
+  fill_rect(bmp, rect(0, 0, 200, 100), rgba(255, 255, 255));
+  console c(f, rect(0, 0, 200, 100));
+  c.write("Hello");
+  rect a = c.render(bmp);
+  c.write(" world");
+  rect b = c.render(bmp);
+  return (a.x == 0 && a.x2() <= 40 && b.x >= 40 && b.x2() <= 88 && b.h <= 8);
+}
+
+bool test_window() {
+  window w(320, 64);                    // 8 rows
+  char buf[32];
+  for (int i=0; i<20; ++i) {
+    std::sprintf(buf, "Line %d\n", i);
+    w << buf;
+  }
+  // The last rows are visible, the first one is "Line 13" (an empty
+  // row follows "Line 19")
+  bitmap& fb = w.framebuffer();
+  bitmap expected(320, 8);
+  fill_rect(expected, rect(0, 0, 320, 8), rgba(255, 255, 255));
+  font f(new builtin_glyph_source);
+  draw_text(expected, f, 0, 0, "Line 13", rgba(0, 0, 0));
+  bool ok = true;
+  for (int y=0; y<8; ++y)
+    ok &= (std::memcmp(fb.row(y), expected.row(y), 320*sizeof(pixel)) == 0);
+
+  w.scroll_text(13);
+  ok &= (w.text_console().rows() == 21 && !w.text_console().following());
+  return ok;
+}
+
+void benchmark() {
+  const int w = 1920, h = 1080, frames = 200;
+  font f(new builtin_glyph_source(14));
+  bitmap bmp(w, h);
+  fill_rect(bmp, rect(0, 0, w, h), rgba(255, 255, 255));
+  console c(f, rect(0, 0, w, h), 10000);
+
+  char buf[128];
+  long long n = 0;
+  double write_time = 0, render_time = 0;
+  for (int lines_per_frame=1; lines_per_frame<=1000; lines_per_frame*=10) {
+    Chrono chrono;
+    for (int i=0; i<frames; ++i) {
+      for (int j=0; j<lines_per_frame; ++j, ++n) {
+        std::sprintf(buf, "%lld [info] request handled in %d us by worker %d\n",
+                     n, int(n*7919 % 10000), int(n % 16));
+        c.write(buf);
+      }
+      write_time += chrono.elapsed();
+      chrono.reset();
+      c.render(bmp);
+      render_time += chrono.elapsed();
+      chrono.reset();
+    }
+    std::printf("1080p tail %4d lines/frame  write %7.3f ms/frame  render %6.3f ms/frame"
+                "  (%lld lines, %.1f MB)\n",
+                lines_per_frame, write_time * 1000.0 / frames, render_time * 1000.0 / frames,
+                n, c.bytes() / 1048576.0);
+    write_time = render_time = 0;
+  }
+
+  // Full redraw for comparison
+  Chrono chrono;
+  for (int i=0; i<frames/10; ++i) {
+    c.invalidate();
+    c.render(bmp);
+  }
+  std::printf("1080p full redraw          %6.3f ms/frame\n",
+              chrono.elapsed() * 1000.0 / (frames/10));
+}
+
+int ui_main()
+{
+  bool ok = true;
+  ok &= check("wrap", test_wrap());
+  ok &= check("relayout", test_relayout());
+  ok &= check("ring", test_ring());
+  ok &= check("incremental", test_incremental());
+  ok &= check("damage", test_damage());
+  ok &= check("window", test_window());
+
+  benchmark();
+
+  return report(ok);
+}
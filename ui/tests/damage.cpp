@@ -0,0 +1,157 @@
+// ui - Basic User Interface library to do experiments          -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+// Tests the damage_region (clipping, merging, coalescing and the bound
+// on the number of rectangles), the damage recorded by ui::window, and
+// compares the cost of presenting only the dirty rectangles of a 4K
+// frame against copying the whole frame.
+
+#include <ui/ui.h>
+#include "chrono.h"
+#include "test.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+using namespace ui;
+
+bool disjoint(const damage_region& d) {
+  const std::vector<rect>& r = d.rects();
+  for (std::size_t i=0; i<r.size(); ++i)
+    for (std::size_t j=i+1; j<r.size(); ++j)
+      if (r[i].intersects(r[j]))
+        return false;
+  return true;
+}
+
+bool test_region() {
+  damage_region d(rect(0, 0, 100, 100), 4);
+  bool ok = d.empty();
+
+  // Clipping
+  d.add(rect(-10, -10, 20, 20));
+  d.add(rect(200, 0, 10, 10));
+  ok &= (d.size() == 1 && d.rects()[0] == rect(0, 0, 10, 10));
+
+  // Contained rectangles don't change anything
+  d.add(rect(2, 2, 3, 3));
+  ok &= (d.size() == 1 && d.area() == 100);
+
+  // Overlapping rectangles are merged
+  d.add(rect(5, 5, 10, 10));
+  ok &= (d.size() == 1 && d.rects()[0] == rect(0, 0, 15, 15));
+
+  // Far rectangles are kept separated
+  d.add(rect(50, 50, 10, 10));
+  ok &= (d.size() == 2 && d.area() == 15*15 + 100);
+
+  // Adjacent glyphs of a line are coalesced
+  d.clear();
+  for (int x=0; x<80; x+=8)
+    d.add(rect(x, 40, 7, 8 + (x/8)%2));
+  ok &= (d.size() == 1 && d.bounds() == rect(0, 40, 79, 9));
+
+  // Never more than max_rects rectangles
+  d.clear();
+  for (int i=0; i<50; ++i)
+    d.add(rect(std::rand() % 100, std::rand() % 100, 1 + std::rand() % 5, 1 + std::rand() % 5));
+  ok &= (d.size() <= 4 && disjoint(d));
+
+  d.add_all();
+  ok &= (d.size() == 1 && d.area() == 100*100);
+  return ok;
+}
+
+// Random rectangles: the region must cover all of them
+bool test_coverage() {
+  const int w = 64, h = 48;
+  std::vector<char> dirty(w*h, 0);
+  damage_region d(rect(0, 0, w, h), 8);
+
+  for (int i=0; i<200; ++i) {
+    rect r(std::rand() % (w+8) - 4, std::rand() % (h+8) - 4,
+           std::rand() % 12, std::rand() % 12);
+    d.add(r);
+    r = r & rect(0, 0, w, h);
+    for (int y=r.y; y<r.y2(); ++y)
+      for (int x=r.x; x<r.x2(); ++x)
+        dirty[y*w+x] = 1;
+  }
+
+  bool ok = (d.size() <= 8 && disjoint(d));
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x) {
+      bool covered = false;
+      for (std::size_t i=0; i<d.size(); ++i)
+        covered |= d.rects()[i].contains(x, y);
+      if (dirty[y*w+x] && !covered)
+        ok = false;
+    }
+  return ok;
+}
+
+bool test_window() {
+  window w(320, 200);
+  bool ok = (w.damage().area() == 320*200); // A new window is dirty
+  w.present();
+  ok &= w.damage().empty();
+
+  w << "Hello";
+  rect b = w.damage().bounds();
+  ok &= (w.damage().size() == 1 && b.x == 0 && b.y == 0 && b.x2() <= 40 && b.y2() <= 8);
+
+  w.invalidate(rect(300, 100, 100, 100));
+  ok &= (w.damage().size() == 2 && w.damage().area() == b.area() + 20*100);
+  w.present();
+  ok &= w.damage().empty();
+  return ok;
+}
+
+// Copies the damage of each frame to a "screen" bitmap (like a
+// compositor would do with the window surface)
+void benchmark() {
+  const int w = 3840, h = 2160, frames = 50;
+  bitmap back(w, h), screen(w, h);
+  fill_rect(back, rect(0, 0, w, h), rgba(255, 255, 255));
+  fill_rect(screen, rect(0, 0, w, h), 0);
+  font f(new builtin_glyph_source(16));
+  damage_region d(rect(0, 0, w, h));
+
+  Chrono chrono;
+  for (int i=0; i<frames; ++i) {
+    draw_text(back, f, 0, (i*16) % h, "A log line in a 4K window", rgba(0, 0, 0));
+    blit(screen, 0, 0, back, rect(0, 0, w, h));
+  }
+  double full_ms = chrono.elapsed() * 1000.0 / frames;
+
+  long long pixels = 0;
+  chrono.reset();
+  for (int i=0; i<frames; ++i) {
+    d.add(draw_text(back, f, 0, (i*16) % h, "A log line in a 4K window", rgba(0, 0, 0)));
+    for (std::size_t j=0; j<d.size(); ++j) {
+      const rect& r = d.rects()[j];
+      blit(screen, r.x, r.y, back, r);
+    }
+    pixels += d.area();
+    d.clear();
+  }
+  double partial_ms = chrono.elapsed() * 1000.0 / frames;
+
+  std::printf("4K text frame: full present %.3f ms  damage present %.3f ms (%lld pixels/frame)\n",
+              full_ms, partial_ms, pixels / frames);
+}
+
+int ui_main()
+{
+  bool ok = true;
+  ok &= check("region", test_region());
+  ok &= check("coverage", test_coverage());
+  ok &= check("window", test_window());
+
+  benchmark();
+
+  return report(ok);
+}
@@ -0,0 +1,273 @@
+// ui - Basic User Interface library to do experiments          -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+// Records random scenes in display lists and checks that replaying
+// them (optimized or not, whole or clipped) gives the same pixels as
+// calling the raster functions directly, that optimize() merges fills
+// and keeps the order of overlapping commands, and that a scene only
+// redraws the changed layers. Prints the cost of a frame of a mostly
+// static UI drawn directly and with a scene.
+
+#include <ui/ui.h>
+#include "ui/display_list.h"
+#include "chrono.h"
+#include "test.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace ui;
+
+pixel random_color() {
+  return premultiply(rgba(std::rand() % 256, std::rand() % 256,
+                          std::rand() % 256, std::rand() % 256));
+}
+
+rect random_rect(int w, int h) {
+  int x = std::rand() % (w+40) - 20;
+  int y = std::rand() % (h+40) - 20;
+  return rect(x, y, std::rand() % (w/2), std::rand() % (h/2));
+}
+
+// Draws the same random scene directly or in a display list, with a
+// few colors so there are commands with the same state
+template<class Painter>
+void draw_scene(Painter& p, unsigned seed, int w, int h,
+                const bitmap& sprite, font& f) {
+  std::srand(seed);
+  const pixel colors[3] = { rgba(255, 0, 0), rgba(0, 128, 0),
+                            premultiply(rgba(0, 0, 255, 128)) };
+  p.fill_rect(rect(0, 0, w, h), rgba(255, 255, 255));
+  for (int i=0; i<300; ++i) {
+    switch (std::rand() % 9) {
+      case 0: p.fill_rect(random_rect(w, h), random_color() | 0xff000000); break;
+      case 1: p.blend_rect(random_rect(w, h), random_color(),
+                           blend_op(std::rand() % blend_op_count)); break;
+      case 2: p.fill_gradient(random_rect(w, h), random_color(), random_color(),
+                              gradient_direction(std::rand() % 2)); break;
+      case 3: p.blit(std::rand() % w - 16, std::rand() % h - 16, sprite); break;
+      case 4: p.blit(std::rand() % w - 16, std::rand() % h - 16, sprite,
+                     rect(4, 4, 20, 20)); break;
+      case 5: p.draw_line(std::rand() % w, std::rand() % h,
+                          std::rand() % w, std::rand() % h, colors[std::rand() % 3]); break;
+      case 6: p.draw_line_aa(std::rand() % (w*10) / 10.0, std::rand() % (h*10) / 10.0,
+                             std::rand() % (w*10) / 10.0, std::rand() % (h*10) / 10.0,
+                             colors[std::rand() % 3]); break;
+      case 7: {
+        int x = std::rand() % w - 20, y = std::rand() % h - 4;
+        p.draw_text(f, x, y, "Display list", colors[std::rand() % 2]);
+        break;
+      }
+      case 8: {
+        // Grid cells (adjacent fills with the same color)
+        int x = std::rand() % w, y = std::rand() % h;
+        pixel c = colors[std::rand() % 2];
+        for (int j=0; j<5; ++j)
+          p.fill_rect(rect(x + j*8, y, 8, 8), c);
+        break;
+      }
+    }
+  }
+}
+
+// Calls the raster functions directly on a bitmap
+struct direct_painter {
+  bitmap& bmp;
+  explicit direct_painter(bitmap& bmp) : bmp(bmp) { }
+
+  void fill_rect(const rect& rc, pixel c) { ui::fill_rect(bmp, rc, c); }
+  void blend_rect(const rect& rc, pixel c, blend_op op) { ui::blend_rect(bmp, rc, c, op); }
+  void fill_gradient(const rect& rc, pixel c0, pixel c1, gradient_direction d) {
+    ui::fill_gradient(bmp, rc, c0, c1, d);
+  }
+  void blit(int x, int y, const bitmap& src) { ui::blit(bmp, x, y, src); }
+  void blit(int x, int y, const bitmap& src, const rect& rc) { ui::blit(bmp, x, y, src, rc); }
+  void draw_line(int x0, int y0, int x1, int y1, pixel c) { ui::draw_line(bmp, x0, y0, x1, y1, c); }
+  void draw_line_aa(double x0, double y0, double x1, double y1, pixel c) {
+    ui::draw_line_aa(bmp, x0, y0, x1, y1, c);
+  }
+  void draw_text(font& f, int x, int y, const std::string& s, pixel c) {
+    ui::draw_text(bmp, f, x, y, s, c);
+  }
+};
+
+bool same_pixels(const bitmap& a, const bitmap& b) {
+  for (int y=0; y<a.height(); ++y)
+    if (std::memcmp(a.row(y), b.row(y), a.width()*sizeof(pixel)) != 0)
+      return false;
+  return true;
+}
+
+bool test_identical(bool optimized) {
+  const int w = 333, h = 201;
+  bitmap sprite(32, 32), expected(w, h), result(w, h);
+  fill_gradient(sprite, rect(0, 0, 32, 32), premultiply(rgba(255, 0, 0, 200)),
+                premultiply(rgba(0, 0, 255, 50)), gradient_vertical);
+  font f(new builtin_glyph_source(12));
+
+  bool ok = true;
+  for (unsigned seed=1; seed<=5; ++seed) {
+    direct_painter d(expected);
+    draw_scene(d, seed, w, h, sprite, f);
+
+    display_list list;
+    draw_scene(list, seed, w, h, sprite, f);
+    std::size_t n = list.size();
+    if (optimized) {
+      list.optimize();
+      ok &= (list.size() < n);
+    }
+
+    result.clear(0);
+    list.replay(result);
+    ok &= same_pixels(expected, result);
+
+    // Replaying in 4 clipped parts
+    result.clear(0);
+    list.replay(result, rect(0, 0, 100, 100));
+    list.replay(result, rect(100, 0, w-100, 100));
+    list.replay(result, rect(0, 100, 200, h-100));
+    list.replay(result, rect(200, 100, w-200, h-100));
+    ok &= same_pixels(expected, result);
+  }
+  return ok;
+}
+
+bool test_optimize() {
+  display_list list;
+  // A row of 10 red cells, a blue rectangle over the 5th one, and a
+  // red cell after it that cannot be moved before the blue one
+  for (int i=0; i<10; ++i)
+    list.fill_rect(rect(i*10, 0, 10, 10), rgba(255, 0, 0));
+  list.fill_rect(rect(45, 0, 10, 10), rgba(0, 0, 255));
+  list.fill_rect(rect(50, 0, 10, 10), rgba(255, 0, 0));
+  // Text between red cells in other place
+  font f(new builtin_glyph_source(12));
+  list.draw_text(f, 0, 50, "a", rgba(255, 255, 255));
+  list.fill_rect(rect(0, 10, 100, 10), rgba(255, 0, 0));
+  list.draw_text(f, 20, 50, "b", rgba(255, 255, 255));
+
+  list.optimize();
+  bitmap bmp(100, 70);
+  bmp.clear(0);
+  list.replay(bmp);
+
+  // Cells + row merged in one fill, then the blue one, the red cell
+  // over it and both texts together
+  return (list.size() == 5 &&
+          bmp.get_pixel(47, 5) == rgba(0, 0, 255) &&
+          bmp.get_pixel(52, 5) == rgba(255, 0, 0) &&
+          bmp.get_pixel(5, 15) == rgba(255, 0, 0));
+}
+
+bool test_scene() {
+  const int w = 200, h = 100;
+  bitmap bmp(w, h), expected(w, h);
+  font f(new builtin_glyph_source(12));
+  scene s(w, h, rgba(0, 0, 0));
+  int panel = s.add_layer();
+  int label = s.add_layer();
+
+  s.record(panel).fill_rect(rect(10, 10, 100, 50), rgba(0, 0, 128));
+  s.record(label).draw_text(f, 20, 20, "Hello", rgba(255, 255, 255));
+  bool ok = (s.render(bmp).area() == w*h);
+
+  // Nothing changed
+  ok &= s.render(bmp).empty();
+
+  // The label moves: only its old and new bounds are redrawn
+  rect old_bounds = s.list(label).bounds();
+  s.record(label).draw_text(f, 60, 20, "Hello", rgba(255, 255, 255));
+  const damage_region& damage = s.render(bmp);
+  ok &= (damage.area() <= old_bounds.area() + s.list(label).bounds().area());
+
+  expected.clear(rgba(0, 0, 0));
+  fill_rect(expected, rect(10, 10, 100, 50), rgba(0, 0, 128));
+  draw_text(expected, f, 60, 20, "Hello", rgba(255, 255, 255));
+  ok &= same_pixels(expected, bmp);
+
+  // Hidden label
+  s.set_visible(label, false);
+  s.render(bmp);
+  fill_rect(expected, rect(0, 0, w, h), rgba(0, 0, 0));
+  fill_rect(expected, rect(10, 10, 100, 50), rgba(0, 0, 128));
+  ok &= same_pixels(expected, bmp);
+  return ok;
+}
+
+// A mostly static 1080p UI: 40 widgets (panel, border, text, button
+// cells), where one of them changes each frame
+struct ui_painter {
+  font& f;
+  explicit ui_painter(font& f) : f(f) { }
+
+  template<class Painter>
+  void widget(Painter& p, int i, int frame) {
+    const int x = (i % 8) * 240, y = (i / 8) * 216;
+    p.fill_rect(rect(x+4, y+4, 232, 208), rgba(40, 40, 60));
+    p.fill_rect(rect(x+4, y+4, 232, 24), rgba(60, 60, 100));
+    for (int j=0; j<8; ++j)
+      p.fill_rect(rect(x+8 + j*28, y+180, 28, 24), rgba(80, 80, 80));
+    for (int j=0; j<6; ++j)
+      p.draw_text(f, x+10, y+40 + j*20, "Label of a widget", rgba(220, 220, 220));
+    char buf[32];
+    std::sprintf(buf, "Frame %d", frame);
+    p.draw_text(f, x+10, y+8, buf, rgba(255, 255, 0));
+  }
+};
+
+void benchmark() {
+  const int w = 1920, h = 1080, widgets = 40, frames = 30;
+  bitmap frame(w, h);
+  font f(new builtin_glyph_source(14));
+  ui_painter painter(f);
+
+  direct_painter d(frame);
+  Chrono chrono;
+  for (int i=0; i<frames; ++i) {
+    fill_rect(frame, rect(0, 0, w, h), rgba(0, 0, 0));
+    for (int j=0; j<widgets; ++j)
+      painter.widget(d, j, (j == i % widgets ? i: 0));
+  }
+  const double direct_ms = chrono.elapsed() * 1000.0 / frames;
+
+  scene s(w, h);
+  for (int j=0; j<widgets; ++j)
+    painter.widget(s.record(s.add_layer()), j, 0);
+  s.render(frame);
+
+  chrono.reset();
+  long long pixels = 0;
+  for (int i=0; i<frames; ++i) {
+    int j = i % widgets;
+    painter.widget(s.record(j), j, i);
+    pixels += s.render(frame).area();
+  }
+  const double scene_ms = chrono.elapsed() * 1000.0 / frames;
+
+  chrono.reset();
+  for (int i=0; i<frames; ++i)
+    s.render(frame);
+  const double static_us = chrono.elapsed() * 1e6 / frames;
+
+  std::printf("1080p UI   direct %6.2f ms/frame  scene (1 widget changed) %5.2f ms/frame "
+              "(%lld px)  scene (static) %5.2f us/frame\n",
+              direct_ms, scene_ms, pixels / frames, static_us);
+}
+
+int ui_main()
+{
+  bool ok = true;
+  ok &= check("identical", test_identical(false));
+  ok &= check("identical/optimized", test_identical(true));
+  ok &= check("optimize", test_optimize());
+  ok &= check("scene", test_scene());
+
+  benchmark();
+
+  return report(ok);
+}
@@ -0,0 +1,157 @@
+// ui - Basic User Interface library to do experiments          -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+// Tests the MPSC event_queue (FIFO order per producer with several
+// producer threads, timeouts), that waiting for events doesn't burn
+// CPU, and measures the latency of post_event() -> wait_event() from
+// another thread.
+
+#include <ui/ui.h>
+#include "mt/thread.h"
+#include "chrono.h"
+#include "test.h"
+
+#include <cstdio>
+#include <ctime>
+#include <vector>
+
+using namespace ui;
+
+bool test_fifo() {
+  event_queue q;
+  event ev;
+  bool ok = !q.try_pop(ev);
+
+  for (int i=0; i<10; ++i) {
+    event e(event_key_down);
+    e.key = i;
+    q.push(e);
+  }
+  for (int i=0; i<10; ++i)
+    ok &= (q.try_pop(ev) && ev.type == event_key_down && ev.key == i);
+  ok &= !q.try_pop(ev);
+
+  // Pending events are deleted with the queue
+  q.push(event(event_close));
+  return ok;
+}
+
+const int producers = 4;
+const int events_per_producer = 50000;
+
+struct producer {
+  event_queue* q;
+  int id;
+
+  producer(event_queue* q, int id) : q(q), id(id) { }
+
+  void operator()() {
+    for (int i=0; i<events_per_producer; ++i) {
+      event ev(event_user);
+      ev.x = id;
+      ev.data = i;
+      q->push(ev);
+    }
+  }
+};
+
+bool test_producers() {
+  event_queue q;
+  std::vector<mt::thread*> threads;
+  for (int i=0; i<producers; ++i)
+    threads.push_back(new mt::thread(producer(&q, i)));
+
+  // Events of each producer arrive in order
+  std::vector<long> next(producers, 0);
+  bool ok = true;
+  event ev;
+  for (int n=0; n<producers*events_per_producer; ++n) {
+    if (!q.wait_pop(ev, 5000)) {
+      ok = false;
+      break;
+    }
+    ok &= (ev.type == event_user && ev.data == next[ev.x]++);
+  }
+  ok &= !q.try_pop(ev);
+
+  for (int i=0; i<producers; ++i) {
+    threads[i]->join();
+    delete threads[i];
+  }
+  return ok;
+}
+
+// Waiting must sleep the thread instead of spinning
+bool test_idle() {
+  event_queue q;
+  event ev;
+  Chrono chrono;
+  std::clock_t cpu = std::clock();
+  bool timeout = !q.wait_pop(ev, 200);
+  double cpu_ms = (std::clock() - cpu) * 1000.0 / CLOCKS_PER_SEC;
+  double wall_ms = chrono.elapsed() * 1000.0;
+
+  std::printf("idle wait: %.1f ms wall, %.1f ms CPU\n", wall_ms, cpu_ms);
+  return (timeout && wall_ms >= 190.0 && cpu_ms < 20.0);
+}
+
+struct poster {
+  window* w;
+  int count;
+  const Chrono* chrono;         // Shared with the receiver
+  double* sent;                 // Time of each post
+
+  void operator()() {
+    for (int i=0; i<count; ++i) {
+      mt::this_thread::sleep_for(1);
+      event ev(event_user);
+      ev.data = i;
+      sent[i] = chrono->elapsed();
+      w->post_event(ev);
+    }
+  }
+};
+
+bool test_window_events(window& w) {
+  event ev;
+  bool ok = !w.poll_event(ev) && !w.wait_event(ev, 10);
+
+  const int count = 200;
+  std::vector<double> sent(count), received(count);
+  Chrono chrono;
+  poster p = { &w, count, &chrono, &sent[0] };
+  mt::thread thread(p);
+
+  for (int i=0; i<count; ++i) {
+    ok &= (w.wait_event(ev, 5000) && ev.type == event_user && ev.data == i);
+    received[i] = chrono.elapsed();
+  }
+  thread.join();
+
+  double total = 0.0, worst = 0.0;
+  for (int i=0; i<count; ++i) {
+    double latency = received[i] - sent[i];
+    total += latency;
+    if (latency > worst)
+      worst = latency;
+  }
+  std::printf("post_event -> wait_event latency: avg %.1f us, worst %.1f us\n",
+              total * 1e6 / count, worst * 1e6);
+  return ok;
+}
+
+int ui_main()
+{
+  bool ok = true;
+  ok &= check("fifo", test_fifo());
+  ok &= check("producers", test_producers());
+  ok &= check("idle", test_idle());
+
+  window w(320, 200);
+  ok &= check("window_events", test_window_events(w));
+
+  return report(ok);
+}
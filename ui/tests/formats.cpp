@@ -0,0 +1,286 @@
+// ui - Basic User Interface library to do experiments          -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+// Checks the pixel formats: the SIMD converters give the same values
+// as the generic loops for each pair of formats, conversions without
+// loss are exact in both directions, staged blends match the per
+// pixel reference, and the runtime convert() matches the templates.
+// Prints the speed of the converters of each SIMD level.
+
+#include <ui/ui.h>
+#include "ui/convert.h"
+#include "chrono.h"
+#include "test.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace ui;
+
+pixel random_premultiplied() {
+  return premultiply(rgba(std::rand() % 256, std::rand() % 256,
+                          std::rand() % 256, std::rand() % 256));
+}
+
+// Random valid pixels of each format
+template<class Format>
+void random_bitmap(basic_bitmap<Format>& bmp, unsigned seed) {
+  std::srand(seed);
+  for (int y=0; y<bmp.height(); ++y)
+    for (int x=0; x<bmp.width(); ++x) {
+      pixel c = random_premultiplied();
+      // Some transparent and opaque pixels
+      switch (std::rand() % 8) {
+        case 0: c = 0; break;
+        case 1: c |= 0xff000000; break;
+      }
+      bmp.put_pixel(x, y, Format::from_pixel(c));
+    }
+}
+
+template<class Format>
+bool same(const basic_bitmap<Format>& a, const basic_bitmap<Format>& b) {
+  for (int y=0; y<a.height(); ++y)
+    if (std::memcmp(a.row(y), b.row(y),
+                    a.width()*sizeof(typename Format::value_type)) != 0)
+      return false;
+  return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Checks of one pair of formats
+
+// Blends "src" at (3, 1) in "dst" with the per pixel loop
+template<class Dst, class Src, int Op = 0>
+struct reference_blend {
+  static void run(blend_op op, basic_bitmap<Dst>& dst, const basic_bitmap<Src>& src) {
+    if (op != Op) {
+      reference_blend<Dst, Src, Op+1>::run(op, dst, src);
+      return;
+    }
+    for (int y=1; y<dst.height(); ++y)
+      convert_details::blend_row<blend_op(Op), Dst, Src>::scalar(
+        dst.span(3, y), src.row(y-1), dst.width()-3);
+  }
+};
+
+template<class Dst, class Src>
+struct reference_blend<Dst, Src, blend_op_count> {
+  static void run(blend_op, basic_bitmap<Dst>&, const basic_bitmap<Src>&) { }
+};
+
+template<class Dst, class Src>
+struct pair_checks {
+  // All SIMD levels convert like the generic loop (odd widths to
+  // test the tail of the SIMD rows)
+  static bool convert() {
+    const int w = 61, h = 7;
+    basic_bitmap<Src> src(w, h);
+    basic_bitmap<Dst> expected(w, h), result(w, h);
+    random_bitmap(src, 1);
+    for (int y=0; y<h; ++y)
+      convert_details::generic_converter<Dst, Src>::scalar(expected.row(y), src.row(y), w);
+
+    bool ok = true;
+    for (int l=simd_scalar; l<=simd_avx2; ++l) {
+      set_simd_level(simd_level(l));
+      result.clear(0);
+      blit(result, 0, 0, src, rect(0, 0, w, h));
+      ok &= same(expected, result);
+    }
+    set_simd_level(detect_simd_level());
+
+    // The same with the runtime dispatcher
+    result.clear(0);
+    ui::convert(pixel_buffer(result), pixel_buffer(src));
+    ok &= same(expected, result);
+    return ok;
+  }
+
+  // Staged blends (clipped, with a source offset) give the same
+  // pixels as the reference loop
+  static bool blend() {
+    const int w = 300, h = 5;
+    basic_bitmap<Src> src(w, h);
+    basic_bitmap<Dst> dst(w, h), expected(w, h), result(w, h);
+    random_bitmap(src, 2);
+    random_bitmap(dst, 3);
+
+    bool ok = true;
+    for (int op=0; op<blend_op_count; ++op) {
+      blit(expected, 0, 0, dst, rect(0, 0, w, h));
+      reference_blend<Dst, Src>::run(blend_op(op), expected, src);
+
+      for (int l=simd_scalar; l<=simd_avx2; ++l) {
+        set_simd_level(simd_level(l));
+        blit(result, 0, 0, dst, rect(0, 0, w, h));
+        blit(result, 3, 1, src, rect(0, 0, w, h), blend_op(op));
+        ok &= same(expected, result);
+      }
+    }
+    set_simd_level(detect_simd_level());
+    return ok;
+  }
+};
+
+// Runs the checks of all pairs of formats
+template<int D = 0, int S = 0>
+struct all_pairs {
+  static bool run(const char* name) {
+    typedef typename format_traits<pixel_format(D)>::type Dst;
+    typedef typename format_traits<pixel_format(S)>::type Src;
+    bool ok;
+    if (std::strcmp(name, "convert") == 0)
+      ok = pair_checks<Dst, Src>::convert();
+    else
+      ok = pair_checks<Dst, Src>::blend();
+    if (!ok)
+      std::printf("%s %s <- %s: FAILED\n", name,
+                  pixel_format_name(pixel_format(D)), pixel_format_name(pixel_format(S)));
+    return all_pairs<(S+1 < format_count ? D: D+1),
+                     (S+1 < format_count ? S+1: 0)>::run(name) && ok;
+  }
+};
+
+template<>
+struct all_pairs<format_count, 0> {
+  static bool run(const char*) { return true; }
+};
+
+//////////////////////////////////////////////////////////////////////
+// Other tests
+
+// Formats that keep all the information of some pixels convert them
+// back exactly
+bool test_round_trips() {
+  const int w = 50, h = 10;
+  bitmap bgra(w, h), tmp(w, h);
+  bitmap_rgba8 rgba8(w, h);
+  bitmap_bgra8_straight straight(w, h);
+  bitmap_rgb565 rgb565(w, h), rgb565_2(w, h);
+  bitmap_a8 a8(w, h), a8_2(w, h);
+  bool ok = true;
+
+  random_bitmap(bgra, 4);
+  blit(rgba8, 0, 0, bgra, rect(0, 0, w, h));
+  blit(tmp, 0, 0, rgba8, rect(0, 0, w, h));
+  ok &= same(bgra, tmp);
+
+  blit(straight, 0, 0, bgra, rect(0, 0, w, h));
+  blit(tmp, 0, 0, straight, rect(0, 0, w, h));
+  ok &= same(bgra, tmp);
+
+  random_bitmap(rgb565, 5);
+  blit(tmp, 0, 0, rgb565, rect(0, 0, w, h));
+  blit(rgb565_2, 0, 0, tmp, rect(0, 0, w, h));
+  ok &= same(rgb565, rgb565_2);
+
+  random_bitmap(a8, 6);
+  blit(tmp, 0, 0, a8, rect(0, 0, w, h));
+  blit(a8_2, 0, 0, tmp, rect(0, 0, w, h));
+  ok &= same(a8, a8_2);
+
+  // Known values
+  ok &= (rgb565_format::to_pixel(0xffff) == rgba(255, 255, 255));
+  ok &= (rgb565_format::from_pixel(rgba(255, 0, 0)) == 0xf800);
+  ok &= (rgba8_format::from_pixel(rgba(1, 2, 3, 4)) == 0x04030201);
+  ok &= (bgra8_straight_format::from_pixel(rgba(64, 0, 0, 128)) == rgba(128, 0, 0, 128));
+  ok &= (a8_format::to_pixel(128) == rgba(128, 128, 128, 128));
+  return ok;
+}
+
+template<class Format>
+bool check_fill() {
+  basic_bitmap<Format> bmp(40, 10);
+  bmp.clear(0);
+  const pixel c = premultiply(rgba(200, 100, 50, 128));
+  fill_rect(bmp, rect(5, 2, 100, 3), c);
+  const typename Format::value_type v = Format::from_pixel(c);
+  return (bmp.get_pixel(5, 2) == v && bmp.get_pixel(39, 4) == v &&
+          bmp.get_pixel(4, 2) == 0 && bmp.get_pixel(5, 5) == 0);
+}
+
+bool test_fill() {
+  return (check_fill<bgra8_format>() &&
+          check_fill<bgra8_straight_format>() &&
+          check_fill<rgba8_format>() &&
+          check_fill<rgb565_format>() &&
+          check_fill<a8_format>());
+}
+
+//////////////////////////////////////////////////////////////////////
+// Benchmark
+
+template<class Dst, class Src>
+void bench_convert() {
+  const int w = 1920, h = 1080, frames = 20;
+  basic_bitmap<Src> src(w, h);
+  basic_bitmap<Dst> dst(w, h);
+  random_bitmap(src, 7);
+
+  std::printf("%-14s <- %-14s", pixel_format_name(Dst::id), pixel_format_name(Src::id));
+  for (int l=simd_scalar; l<=detect_simd_level(); ++l) {
+    set_simd_level(simd_level(l));
+    Chrono chrono;
+    for (int i=0; i<frames; ++i)
+      blit(dst, 0, 0, src, rect(0, 0, w, h));
+    std::printf("  %s %6.0f MP/s", simd_level_name(simd_level(l)),
+                double(w)*h*frames / chrono.elapsed() / 1e6);
+  }
+  std::printf("\n");
+  set_simd_level(detect_simd_level());
+}
+
+template<class Dst, class Src>
+void bench_blend() {
+  const int w = 1920, h = 1080, frames = 10;
+  basic_bitmap<Src> src(w, h);
+  basic_bitmap<Dst> dst(w, h);
+  random_bitmap(src, 8);
+  random_bitmap(dst, 9);
+
+  Chrono chrono;
+  for (int i=0; i<frames; ++i)
+    for (int y=0; y<h; ++y)
+      convert_details::blend_row<blend_src_over, Dst, Src>::scalar(dst.row(y), src.row(y), w);
+  const double reference = double(w)*h*frames / chrono.elapsed() / 1e6;
+
+  chrono.reset();
+  for (int i=0; i<frames; ++i)
+    blit(dst, 0, 0, src, blend_src_over);
+  std::printf("%-14s over %-14s  per pixel %6.0f MP/s  staged %6.0f MP/s\n",
+              pixel_format_name(Dst::id), pixel_format_name(Src::id),
+              reference, double(w)*h*frames / chrono.elapsed() / 1e6);
+}
+
+void benchmark() {
+  bench_convert<rgba8_format, bgra8_format>();
+  bench_convert<bgra8_format, rgba8_format>();
+  bench_convert<rgb565_format, bgra8_format>();
+  bench_convert<bgra8_format, rgb565_format>();
+  bench_convert<bgra8_format, a8_format>();
+  bench_convert<a8_format, bgra8_format>();
+  bench_convert<bgra8_format, bgra8_straight_format>();
+  bench_convert<bgra8_straight_format, bgra8_format>();
+
+  bench_blend<rgb565_format, bgra8_format>();
+  bench_blend<bgra8_format, rgba8_format>();
+  bench_blend<bgra8_format, a8_format>();
+}
+
+int ui_main()
+{
+  bool ok = true;
+  ok &= check("convert", all_pairs<>::run("convert"));
+  ok &= check("blend", all_pairs<>::run("blend"));
+  ok &= check("round trips", test_round_trips());
+  ok &= check("fill", test_fill());
+
+  benchmark();
+
+  return report(ok);
+}
@@ -0,0 +1,340 @@
+// ui - Basic User Interface library to do experiments          -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+// Tests the frame_monitor (draw calls and pixels of each frame, reuse
+// of the slots, busy time added from other thread while frames are
+// closed) and the hud: it only modifies its own area (or only the
+// graph when nothing was drawn over it) and isn't counted in the draw
+// calls, the graph shows slow frames, and it works with
+// window::present() and with the present thread of a swap_chain, and
+// the text console doesn't scroll the HUD pixels into the text. Prints
+// the cost of the HUD compared with a 1080p frame.
+
+#include <ui/ui.h>
+#include "chrono.h"
+#include "test.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+
+using namespace ui;
+
+// The area "rc" of "bmp" has the pixels of the HUD panel
+bool shows_panel(const bitmap& bmp, const hud& h, const rect& rc) {
+  for (int y=0; y<rc.h; ++y)
+    if (std::memcmp(bmp.span(rc.x, rc.y+y), h.panel().row(y), rc.w*sizeof(pixel)) != 0)
+      return false;
+  return true;
+}
+
+bool test_slots() {
+  frame_monitor m;
+  bitmap bmp(100, 100);
+  font f(new builtin_glyph_source);
+  bool ok = true;
+  for (int i=0; i<10; ++i) {
+    m.begin_frame();
+    for (int j=0; j<=i; ++j)
+      fill_rect(bmp, rect(j, 0, 10, 10), 0);
+    fill_rect(bmp, rect(90, 90, 20, 20), 0);    // Clipped to 10x10
+    fill_rect(bmp, rect(200, 0, 10, 10), 0);    // Outside (not counted)
+    m.end_frame();
+    ok &= (m.frames() == i+1);
+  }
+
+  frame_sample s;
+  for (int i=0; i<10; ++i)
+    ok &= (m.sample(i, s) && s.frame == i &&
+           s.draw_calls == i+2 && s.pixels == (i+2)*100);
+  ok &= !m.sample(10, s);                       // Open frame
+
+  // draw_text() counts the pixels of the (trimmed) glyphs
+  draw_text(bmp, f, 0, 0, "abc", 0);
+  m.end_frame();
+  ok &= (m.sample(10, s) && s.draw_calls == 1 && s.pixels > 0 && s.pixels <= 3*8*8);
+  return ok;
+}
+
+// The slot of the open frame is the slot of the frame "slots" frames
+// ago
+bool test_reuse() {
+  frame_monitor m;
+  for (int i=0; i<300; ++i)
+    m.end_frame();
+
+  frame_sample s;
+  const int oldest = 300 - frame_monitor::slots + 1;
+  return (!m.sample(0, s) && !m.sample(oldest-1, s) &&
+          m.sample(oldest, s) && m.sample(299, s) && !m.sample(300, s));
+}
+
+// Adds busy time from other thread while frames are closed
+struct busy_worker {
+  frame_monitor* monitor;
+  int thread;
+  int count;
+  std::atomic<bool>* done;
+  void operator()() {
+    for (int i=0; i<count; ++i) {
+      monitor->add_busy(thread, 1e-6);
+      monitor->add_present(1e-6);
+    }
+    done->store(true);
+  }
+};
+
+bool test_threads() {
+  frame_monitor m;
+  const int t = m.add_thread("worker");
+  std::atomic<bool> done(false);
+  busy_worker worker = { &m, t, 20000, &done };
+  mt::thread thread(worker);
+
+  // All frames must stay in the ring to add their busy time
+  while (!done && m.frames() < frame_monitor::slots-2) {
+    m.end_frame();
+    mt::this_thread::yield();
+  }
+  thread.join();
+  m.end_frame();
+
+  long long busy = 0, present = 0;
+  frame_sample s;
+  for (long long f=0; f<m.frames(); ++f)
+    if (m.sample(f, s)) {
+      busy += s.busy_us[t];
+      present += s.present_us;
+    }
+  return (t == 0 && m.threads() == 1 && m.thread_name(0) == "worker" &&
+          busy == 20000 && present == 20000);
+}
+
+bool test_draw() {
+  const int w = 640, h = 360;
+  bitmap bmp(w, h);
+  fill_rect(bmp, rect(0, 0, w, h), rgba(255, 255, 255));
+
+  hud overlay(hud::bottom_right);
+  frame_monitor& m = overlay.monitor();
+  for (int i=0; i<3; ++i)
+    m.end_frame();
+  mt::this_thread::sleep_for(40);               // More than 2 frames of 60 FPS
+  m.end_frame();
+
+  const rect rc = overlay.draw(bmp);
+  bool ok = (rc == rect(w-hud::width-8, h-hud::height-8, hud::width, hud::height) &&
+             rc == overlay.bounds(w, h) && shows_panel(bmp, overlay, rc));
+
+  // Nothing outside the HUD
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x)
+      if (!rc.contains(x, y) && bmp.get_pixel(x, y) != rgba(255, 255, 255))
+        ok = false;
+
+  // The last column of the graph is the slow frame, the previous one
+  // is a fast frame
+  const int x = rc.x2()-4-1, y = rc.y2()-4-1;
+  ok &= (bmp.get_pixel(x, y) == hud_details::bad_color &&
+         bmp.get_pixel(x-1, y) == hud_details::good_color);
+
+  // Without new frames nothing is copied, new frames are added once
+  // per frame budget and only modify the graph
+  ok &= overlay.draw(bmp, true).empty();
+  overlay.set_budget(1000.0);
+  m.end_frame();
+  ok &= overlay.draw(bmp, true).empty();
+  overlay.set_budget(1000.0 / 60.0);
+  mt::this_thread::sleep_for(20);
+  const rect graph = overlay.draw(bmp, true);
+  ok &= (graph == rect(rc.x+4, rc.y2()-4-32, hud::width-8, 32) &&
+         shows_panel(bmp, overlay, rc));
+
+  // The HUD isn't counted in the draw calls of the frame (neither
+  // the copy nor the update of the text)
+  overlay.invalidate();
+  mt::this_thread::sleep_for(300);
+  overlay.draw(bmp);
+  m.end_frame();
+  frame_sample s;
+  ok &= (m.sample(m.frames()-1, s) && s.draw_calls == 0 && s.pixels == 0);
+
+  // Clipped in a small target
+  bitmap small(100, 50);
+  rect clipped = overlay.draw(small, true);
+  ok &= (clipped == rect(0, 0, 100-8, 50-8));
+  return ok;
+}
+
+bool test_window() {
+  window wnd(640, 360);
+  hud overlay;
+  wnd.set_hud(&overlay);
+  bitmap& fb = wnd.framebuffer();
+  fill_rect(fb, rect(0, 0, 640, 360), rgba(255, 255, 255));
+  wnd.invalidate();
+  for (int i=0; i<5; ++i)
+    wnd.present();
+
+  const rect rc = overlay.bounds(640, 360);
+  bool ok = (overlay.monitor().frames() == 5 && shows_panel(fb, overlay, rc) &&
+             fb.get_pixel(0, 0) == rgba(255, 255, 255));
+
+  // Drawing over the HUD
+  fill_rect(fb, rect(0, 0, 640, 360), rgba(0, 0, 255));
+  wnd.invalidate(rect(rc.x+10, rc.y+10, 10, 10));
+  wnd.present();
+  ok &= shows_panel(fb, overlay, rc);
+  wnd << "text\n";
+  wnd.present();
+  ok &= shows_panel(fb, overlay, rc);
+
+  wnd.set_hud(NULL);
+  wnd.present();
+  return ok && overlay.monitor().frames() == 7;
+}
+
+// The text of a window with the HUD is the same as without it
+bool test_console() {
+  const int w = 320, h = 240;
+  window with_hud(w, h), without_hud(w, h);
+  hud overlay(hud::top_right);
+  with_hud.set_hud(&overlay);
+  for (int i=0; i<200; ++i) {
+    char line[64];
+    std::snprintf(line, sizeof(line), "Line %d of a long text that wraps around the HUD\n", i);
+    with_hud << line;
+    without_hud << line;
+    with_hud.present();
+    without_hud.present();
+  }
+
+  const rect rc = overlay.bounds(w, h);
+  bitmap& a = with_hud.framebuffer();
+  bitmap& b = without_hud.framebuffer();
+  int different = 0;
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x)
+      if (!rc.contains(x, y) && a.get_pixel(x, y) != b.get_pixel(x, y))
+        ++different;
+  if (different > 0)
+    std::printf("console: %d pixels outside the HUD are different\n", different);
+  return different == 0 && shows_panel(a, overlay, rc);
+}
+
+bool test_swap_chain() {
+  const int w = 320, h = 240, frames = 20;
+  window wnd(w, h);
+  hud overlay;
+  wnd.set_hud(&overlay);
+  bool ok = true;
+  {
+    swap_chain chain(&wnd, w, h, 2);
+    chain.set_monitor(&overlay.monitor());
+    for (int i=0; i<frames; ++i) {
+      bitmap& bmp = chain.acquire();
+      fill_rect(bmp, rect(0, 0, w, h), rgba(0, 0, i));
+      chain.submit();
+    }
+    chain.wait_idle();
+    ok &= (overlay.monitor().frames() == frames);
+  }
+  frame_monitor& m = overlay.monitor();
+  m.end_frame();
+
+  long long busy = 0;
+  frame_sample s;
+  for (int f=0; f<=frames; ++f)
+    if (m.sample(f, s))
+      busy += s.busy_us[0];
+
+  // The last frame with the HUD over it
+  bitmap& fb = wnd.framebuffer();
+  return (ok && m.threads() == 1 && m.thread_name(0) == "present" && busy > 0 &&
+          fb.get_pixel(0, 0) == rgba(0, 0, frames-1) &&
+          shows_panel(fb, overlay, overlay.bounds(w, h)));
+}
+
+// A widget like the ones of the bench UI scenarios (240x180 cells)
+rect draw_widget(bitmap& fb, font& f, int i, int j) {
+  const rect rc(i*240, j*180, 240, 180);
+  fill_rect(fb, rc, rgba(40, 40, 60));
+  fill_gradient(fb, rect(rc.x, rc.y, rc.w, 24), rgba(80, 80, 140), rgba(40, 40, 90),
+                gradient_vertical);
+  draw_line(fb, rc.x, rc.y, rc.x2()-1, rc.y, rgba(120, 120, 160));
+  draw_line(fb, rc.x, rc.y, rc.x, rc.y2()-1, rgba(120, 120, 160));
+  draw_text(fb, f, rc.x+8, rc.y+5, "Widget title", rgba(255, 255, 255));
+  for (int k=0; k<4; ++k)
+    draw_text(fb, f, rc.x+8, rc.y+32 + k*18, "Label of a widget", rgba(210, 210, 210));
+  blend_rect(fb, rect(rc.x+8, rc.y+140, 100, 28), premultiply(rgba(i*40 % 256, j*60 % 256, 200, 160)));
+  draw_text(fb, f, rc.x+20, rc.y+147, "Button", rgba(255, 255, 255));
+  return rc;
+}
+
+// Presents frames of a 1080p window with the HUD, all the widgets are
+// redrawn ("dirty" = 0) or only "dirty" widgets. Returns the HUD cost
+// in % of the frame time.
+double bench_window(font& f, int frames, int dirty) {
+  const int cols = 8, rows = 6;
+  window wnd(1920, 1080);
+  hud overlay;
+  wnd.set_hud(&overlay);
+  bitmap& fb = wnd.framebuffer();
+  int next = 0;
+
+  Chrono chrono;
+  for (int i=0; i<frames; ++i) {
+    if (i == frames/4) {        // Warm up
+      chrono.reset();
+      overlay.reset_cost();
+    }
+    overlay.monitor().begin_frame();
+    if (dirty == 0 || i == 0) {
+      for (int j=0; j<rows; ++j)
+        for (int k=0; k<cols; ++k)
+          draw_widget(fb, f, k, j);
+      wnd.invalidate();
+    }
+    else {
+      for (int k=0; k<dirty; ++k, ++next)
+        wnd.invalidate(draw_widget(fb, f, next % cols, next / cols % rows));
+    }
+    wnd.present();
+  }
+  const double frame_ms = chrono.elapsed() * 1000.0 / (frames - frames/4);
+  const double percent = 100.0 * overlay.draw_ms() / frame_ms;
+
+  frame_sample s;
+  overlay.monitor().sample(frames-1, s);
+  std::printf("1080p %-11s %7.3f ms/frame (%4d draw calls, %.2f MP)  hud %.4f ms (%.2f%%)\n",
+              dirty == 0 ? "full redraw": "dirty", frame_ms,
+              s.draw_calls, s.pixels / 1e6, overlay.draw_ms(), percent);
+  return percent;
+}
+
+// The HUD costs less than 1% of a redrawn frame and of a frame where
+// only some widgets are redrawn (including the updates of the text)
+bool benchmark() {
+  font f(new builtin_glyph_source(14));
+  const double full = bench_window(f, 80, 0);
+  const double dirty = bench_window(f, 400, 4);
+  return full < 1.0 && dirty < 1.0;
+}
+
+int ui_main()
+{
+  bool ok = true;
+  ok &= check("slots", test_slots());
+  ok &= check("reuse", test_reuse());
+  ok &= check("threads", test_threads());
+  ok &= check("draw", test_draw());
+  ok &= check("window", test_window());
+  ok &= check("console", test_console());
+  ok &= check("swap_chain", test_swap_chain());
+  ok &= check("cost", benchmark());
+
+  return report(ok);
+}
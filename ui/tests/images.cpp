@@ -0,0 +1,331 @@
+// ui - Basic User Interface library to do experiments          -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+// Tests loading PPM/BMP/QOI files (saved with save_image() and hand
+// made files with bottom-up rows, alpha and odd headers), the zero-copy
+// path of 32bpp BMP files, and the surface_cache (hits, reloading
+// modified files and preloading). Prints the time to load a few
+// hundred assets of each format.
+
+#include <ui/ui.h>
+#include "chrono.h"
+#include "test.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using namespace ui;
+
+void random_bitmap(bitmap& bmp, unsigned seed) {
+  std::srand(seed);
+  for (int y=0; y<bmp.height(); ++y)
+    for (int x=0; x<bmp.width(); ++x) {
+      // Mix of repeated and random colors (to use all the QOI ops)
+      if (x > 0 && (std::rand() & 3) == 0)
+        bmp.put_pixel(x, y, bmp.get_pixel(x-1, y) + (std::rand() & 1));
+      else
+        bmp.put_pixel(x, y, rgba(std::rand() & 255, std::rand() & 255, std::rand() & 255));
+    }
+}
+
+bool same(const bitmap& a, const bitmap& b) {
+  if (a.width() != b.width() || a.height() != b.height())
+    return false;
+  for (int y=0; y<a.height(); ++y)
+    for (int x=0; x<a.width(); ++x)
+      if (a.get_pixel(x, y) != b.get_pixel(x, y))
+        return false;
+  return true;
+}
+
+bool write_file(const char* filename, const std::vector<uint8_t>& data) {
+  std::FILE* f = std::fopen(filename, "wb");
+  if (!f)
+    return false;
+  bool ok = (std::fwrite(&data[0], 1, data.size(), f) == data.size());
+  return (std::fclose(f) == 0 && ok);
+}
+
+void put16(std::vector<uint8_t>& v, int x) {
+  v.push_back(uint8_t(x));
+  v.push_back(uint8_t(x >> 8));
+}
+
+void put32(std::vector<uint8_t>& v, uint32_t x) {
+  put16(v, x & 0xffff);
+  put16(v, x >> 16);
+}
+
+// BMP header (BITMAPINFOHEADER or BITMAPV4HEADER with masks)
+std::vector<uint8_t> bmp_header(int w, int h, int bpp, int offset, bool v4) {
+  std::vector<uint8_t> v;
+  v.push_back('B');
+  v.push_back('M');
+  put32(v, 0);
+  put32(v, 0);
+  put32(v, offset);
+  put32(v, v4 ? 108: 40);
+  put32(v, w);
+  put32(v, uint32_t(h));
+  put16(v, 1);
+  put16(v, bpp);
+  put32(v, v4 ? 3: 0);
+  put32(v, 0);
+  put32(v, 0);
+  put32(v, 0);
+  put32(v, 0);
+  put32(v, 0);
+  if (v4) {
+    put32(v, 0xff0000);
+    put32(v, 0xff00);
+    put32(v, 0xff);
+    put32(v, 0xff000000);
+  }
+  v.resize(offset, 0);
+  return v;
+}
+
+bool test_round_trip(const char* filename, bool mapped) {
+  bitmap bmp(67, 45);
+  random_bitmap(bmp, 67);
+  if (!save_image(bmp, filename))
+    return false;
+
+  surface s;
+  bool ok = (s.load(filename) && same(s.get(), bmp) && s.mapped() == mapped);
+  std::remove(filename);
+  return ok;
+}
+
+// 3x2 24bpp bottom-up BMP, rows padded to 12 bytes
+bool test_bmp24() {
+  std::vector<uint8_t> v = bmp_header(3, 2, 24, 54, false);
+  const uint8_t bottom[12] = { 1,2,3, 4,5,6, 7,8,9, 0,0,0 };
+  const uint8_t top[12] = { 10,11,12, 13,14,15, 16,17,18, 0,0,0 };
+  v.insert(v.end(), bottom, bottom+12);
+  v.insert(v.end(), top, top+12);
+  write_file("test24.bmp", v);
+
+  surface s;
+  bool ok = (s.load("test24.bmp") && !s.mapped() &&
+             s.get().get_pixel(0, 0) == rgba(12, 11, 10) &&
+             s.get().get_pixel(2, 0) == rgba(18, 17, 16) &&
+             s.get().get_pixel(0, 1) == rgba(3, 2, 1) &&
+             s.get().get_pixel(2, 1) == rgba(9, 8, 7));
+  std::remove("test24.bmp");
+  return ok;
+}
+
+// 2x2 32bpp bottom-up BMP with straight alpha: used in place (with a
+// negative stride) and premultiplied
+bool test_bmp32_alpha() {
+  std::vector<uint8_t> v = bmp_header(2, 2, 32, 124, true);
+  put32(v, rgba(200, 100, 50, 255));  // Bottom row
+  put32(v, rgba(200, 100, 50, 128));
+  put32(v, rgba(10, 20, 30, 0));      // Top row
+  put32(v, rgba(255, 255, 255, 255));
+  write_file("test32.bmp", v);
+
+  surface s;
+  bool ok = (s.load("test32.bmp") && s.mapped() &&
+             s.get().stride() < 0 &&
+             s.get().get_pixel(0, 0) == 0 &&
+             s.get().get_pixel(1, 0) == rgba(255, 255, 255) &&
+             s.get().get_pixel(0, 1) == rgba(200, 100, 50) &&
+             s.get().get_pixel(1, 1) == premultiply(rgba(200, 100, 50, 128)));
+  s.reset();
+
+  // The file wasn't modified
+  surface s2;
+  ok &= (s2.load("test32.bmp") &&
+         s2.get().get_pixel(1, 1) == premultiply(rgba(200, 100, 50, 128)));
+  std::remove("test32.bmp");
+  return ok;
+}
+
+// QOI with alpha (RGBA op), a run, an index and diff ops
+bool test_qoi_alpha() {
+  std::vector<uint8_t> v;
+  const char* magic = "qoif";
+  v.insert(v.end(), magic, magic+4);
+  const uint8_t header[10] = { 0,0,0,4, 0,0,0,2, 4, 0 };
+  v.insert(v.end(), header, header+10);
+  const uint8_t ops[] = {
+    0xff, 200, 100, 50, 128,    // RGBA
+    0xc0 | 1,                   // Run of 2
+    0x40 | (3<<4) | (2<<2) | 1, // Diff (+1, 0, -1)
+    0xfe, 0, 0, 0,              // RGB (keeps the alpha)
+    0x00 | uint8_t((200*3 + 100*5 + 50*7 + 128*11) % 64), // Index
+    0x80 | 32, (8<<4) | 8,      // Luma (0, 0, 0)
+    0xff, 1, 2, 3, 255
+  };
+  v.insert(v.end(), ops, ops+sizeof(ops));
+  v.insert(v.end(), 7, 0);
+  v.push_back(1);
+  write_file("test.qoi", v);
+
+  const pixel a = premultiply(rgba(200, 100, 50, 128));
+  surface s;
+  bool ok = (s.load("test.qoi") &&
+             s.get().get_pixel(0, 0) == a &&
+             s.get().get_pixel(1, 0) == a &&
+             s.get().get_pixel(2, 0) == a &&
+             s.get().get_pixel(3, 0) == premultiply(rgba(201, 100, 49, 128)) &&
+             s.get().get_pixel(0, 1) == rgba(0, 0, 0, 128) &&
+             s.get().get_pixel(1, 1) == a &&
+             s.get().get_pixel(2, 1) == a &&
+             s.get().get_pixel(3, 1) == rgba(1, 2, 3));
+  std::remove("test.qoi");
+  return ok;
+}
+
+bool test_ppm_maxval() {
+  const char* text = "P6\n# comment\n2 1\n15\n";
+  std::vector<uint8_t> v(text, text+std::strlen(text));
+  const uint8_t px[6] = { 15, 0, 7, 1, 2, 3 };
+  v.insert(v.end(), px, px+6);
+  write_file("test.ppm", v);
+
+  surface s;
+  bool ok = (s.load("test.ppm") &&
+             s.get().get_pixel(0, 0) == rgba(255, 0, 119) &&
+             s.get().get_pixel(1, 0) == rgba(17, 34, 51));
+  std::remove("test.ppm");
+  return ok;
+}
+
+// Truncated files, unknown formats and missing files
+bool test_invalid() {
+  bitmap bmp(20, 10);
+  bmp.clear(0);
+  const char* names[] = { "bad.ppm", "bad.bmp", "bad.qoi" };
+  bool ok = true;
+  for (int i=0; i<3; ++i) {
+    save_image(bmp, names[i]);
+    if (std::FILE* f = std::fopen(names[i], "r+b")) {
+      std::fseek(f, 0, SEEK_END);
+      long size = std::ftell(f);
+      std::fclose(f);
+      // Keep the header and a few bytes
+      std::vector<uint8_t> data(size);
+      f = std::fopen(names[i], "rb");
+      std::fread(&data[0], 1, size, f);
+      std::fclose(f);
+      data.resize(i == 2 ? 20: 70);
+      write_file(names[i], data);
+    }
+    ok &= (load_image(names[i]) == NULL);
+    std::remove(names[i]);
+  }
+
+  std::vector<uint8_t> junk(100, 'x');
+  write_file("junk.bmp", junk);
+  ok &= (load_image("junk.bmp") == NULL);
+  std::remove("junk.bmp");
+  ok &= (load_image("does-not-exist.bmp") == NULL);
+  return ok;
+}
+
+bool test_rgb24_kernels() {
+  std::vector<uint8_t> src(3*103);
+  for (std::size_t i=0; i<src.size(); ++i)
+    src[i] = uint8_t(std::rand());
+  std::vector<pixel> a(103), b(103);
+  bool ok = true;
+  for (int order=0; order<2; ++order) {
+    image_io_details::rgb24_row_scalar(&src[0], &a[0], 103, order == 1);
+    simd_level old = current_simd_level();
+    set_simd_level(simd_avx2);
+    image_io_details::rgb24_row(&src[0], &b[0], 103, order == 1);
+    set_simd_level(old);
+    ok &= (a == b);
+  }
+  return ok;
+}
+
+bool test_cache() {
+  bitmap bmp(16, 16);
+  bmp.clear(rgba(255, 0, 0));
+  save_image(bmp, "cached.qoi");
+
+  surface_cache cache;
+  surface* a = cache.get("cached.qoi");
+  surface* b = cache.get("cached.qoi");
+  bool ok = (a && a == b && cache.hits() == 1 && cache.loads() == 1);
+
+  // A different size (and mtime) reloads the file
+  bitmap bmp2(8, 8);
+  bmp2.clear(rgba(0, 255, 0));
+  save_image(bmp2, "cached.qoi");
+  surface* c = cache.get("cached.qoi");
+  ok &= (c && c->width() == 8 && c->get().get_pixel(0, 0) == rgba(0, 255, 0) &&
+         cache.loads() == 2 && cache.size() == 1);
+
+  std::remove("cached.qoi");
+  ok &= (cache.get("cached.qoi") == NULL);
+  return ok;
+}
+
+// Loads 300 assets of 128x128 with preload() (files are in the page
+// cache, so this measures the mapping and decoding costs)
+bool bench_preload(const char* ext) {
+  const int n = 300;
+  std::vector<std::string> names;
+  bitmap bmp(128, 128);
+  for (int i=0; i<n; ++i) {
+    char name[64];
+    std::sprintf(name, "asset%03d.%s", i, ext);
+    names.push_back(name);
+    random_bitmap(bmp, i);
+    save_image(bmp, name);
+  }
+
+  surface_cache cache;
+  Chrono chrono;
+  int failed = cache.preload(names);
+  double load = chrono.elapsed();
+
+  chrono.reset();
+  for (int i=0; i<n; ++i)
+    cache.get(names[i]);
+  double hits = chrono.elapsed();
+
+  // Draw them (the first access to the pixels of mapped files)
+  bitmap target(128, 128);
+  chrono.reset();
+  for (int i=0; i<n; ++i)
+    blit(target, 0, 0, cache.get(names[i])->get(), blend_src);
+  double draw = chrono.elapsed();
+
+  std::printf("%s  preload %3d files %7.2f ms  %6.1f MP/s  cached get %5.1f us  blit %6.2f ms\n",
+              ext, n, load*1000.0, n*128.0*128.0/load/1e6, hits*1e6/n, draw*1000.0);
+
+  for (int i=0; i<n; ++i)
+    std::remove(names[i].c_str());
+  return (failed == 0 && cache.size() == std::size_t(n) && cache.hits() == 2*n);
+}
+
+int ui_main()
+{
+  bool ok = true;
+  ok &= check("ppm", test_round_trip("test.ppm", false));
+  ok &= check("bmp", test_round_trip("test.bmp", true));
+  ok &= check("qoi", test_round_trip("test.qoi", false));
+  ok &= check("bmp24", test_bmp24());
+  ok &= check("bmp32/alpha", test_bmp32_alpha());
+  ok &= check("qoi/alpha", test_qoi_alpha());
+  ok &= check("ppm/maxval", test_ppm_maxval());
+  ok &= check("invalid", test_invalid());
+  ok &= check("rgb24", test_rgb24_kernels());
+  ok &= check("cache", test_cache());
+  ok &= check("preload/ppm", bench_preload("ppm"));
+  ok &= check("preload/bmp", bench_preload("bmp"));
+  ok &= check("preload/qoi", bench_preload("qoi"));
+
+  return report(ok);
+}
@@ -0,0 +1,118 @@
+// ui - Basic User Interface library to do experiments          -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+// Draws text and a gradient through the framebuffer of a ui::window,
+// saves the frame as PPM and PNG, and checks the PPM file against the
+// framebuffer pixels. It works without a display (set UI_HEADLESS=1
+// to avoid opening a X11 window when there is one). Files are saved
+// as offscreen.ppm and offscreen.png in the current directory. Also
+// checks the patterns of UI_DUMP.
+
+#include <ui/ui.h>
+#include "chrono.h"
+#include "test.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace ui;
+
+void draw_gradient(bitmap& bmp, int y0) {
+  for (int y=y0; y<bmp.height(); ++y) {
+    pixel* p = bmp.row(y);
+    for (int x=0; x<bmp.width(); ++x)
+      p[x] = rgba(x * 255 / bmp.width(), (y-y0) * 255 / (bmp.height()-y0), 128);
+  }
+}
+
+bool check_ppm(const bitmap& bmp, const std::string& filename) {
+  std::FILE* f = std::fopen(filename.c_str(), "rb");
+  if (!f)
+    return false;
+
+  int w, h, maxval;
+  bool ok = (std::fscanf(f, "P6 %d %d %d", &w, &h, &maxval) == 3 &&
+             std::fgetc(f) == '\n' &&
+             w == bmp.width() && h == bmp.height() && maxval == 255);
+
+  std::vector<unsigned char> line(w*3);
+  for (int y=0; y<h && ok; ++y) {
+    ok = (std::fread(&line[0], 1, line.size(), f) == line.size());
+    const pixel* p = bmp.row(y);
+    for (int x=0; x<w && ok; ++x)
+      ok = (rgba(line[x*3], line[x*3+1], line[x*3+2]) == (p[x] | 0xff000000));
+  }
+  std::fclose(f);
+  return ok;
+}
+
+bool check_png_header(const std::string& filename) {
+  std::FILE* f = std::fopen(filename.c_str(), "rb");
+  if (!f)
+    return false;
+
+  unsigned char header[16];
+  bool ok = (std::fread(header, 1, 16, f) == 16 &&
+             std::memcmp(header, "\x89PNG\r\n\x1a\n", 8) == 0 &&
+             std::memcmp(header+12, "IHDR", 4) == 0);
+  std::fclose(f);
+  return ok;
+}
+
+bool check_dump_filenames() {
+#if WIN32
+  return true;
+#else
+  std::string s;
+  return (offscreen::dump_filename("frame%03d.png", 7, s) && s == "frame007.png" &&
+          offscreen::dump_filename("f%d-%%.ppm", 12, s) && s == "f12-%.ppm" &&
+          offscreen::dump_filename("f%4d", 5, s) && s == "f   5" &&
+          offscreen::dump_filename("same.png", 3, s) && s == "same.png" &&
+          !offscreen::dump_filename("f%s.png", 0, s) &&
+          !offscreen::dump_filename("f%d%d.png", 0, s) &&
+          !offscreen::dump_filename("f%n.png", 0, s) &&
+          !offscreen::dump_filename("f%099999d.png", 0, s) &&
+          !offscreen::dump_filename("f%", 0, s));
+#endif
+}
+
+int ui_main()
+{
+  const std::string prefix = "offscreen";
+
+  window w(640, 480);
+  w << "Hello World! ";
+  w << "This window is rendered in memory.";
+
+  bitmap& bmp = w.framebuffer();
+  Chrono chrono;
+  draw_gradient(bmp, 32);
+  std::printf("gradient:  %.3f ms\n", chrono.elapsed() * 1000.0);
+  w.invalidate(rect(0, 32, bmp.width(), bmp.height()-32));
+  w.present();
+
+  // A black pixel from the "H" glyph, and white background
+  bool ok = (bmp.get_pixel(0, 0) == rgba(0, 0, 0) &&
+             bmp.get_pixel(0, 20) == rgba(255, 255, 255));
+
+  chrono.reset();
+  ok = w.save(prefix + ".ppm") && ok;
+  std::printf("save PPM:  %.3f ms\n", chrono.elapsed() * 1000.0);
+
+  chrono.reset();
+  ok = w.save(prefix + ".png") && ok;
+  std::printf("save PNG:  %.3f ms\n", chrono.elapsed() * 1000.0);
+
+  ok = check_ppm(bmp, prefix + ".ppm") && ok;
+  ok = check_png_header(prefix + ".png") && ok;
+  ok = check_dump_filenames() && ok;
+
+  w.waitkey();
+
+  return report(ok);
+}
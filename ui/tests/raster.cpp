@@ -0,0 +1,261 @@
+// ui - Basic User Interface library to do experiments          -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+// Checks that the SIMD raster kernels produce exactly the same pixels
+// as the scalar ones (all Porter-Duff operators, coverage masks,
+// unaligned spans and tails), tests lines, gradients and clipped
+// blits, and measures clearing and blending a 4K frame with each SIMD
+// level.
+
+#include "ui/raster.h"
+#include "chrono.h"
+#include "test.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace ui;
+
+const char* op_names[blend_op_count] = {
+  "clear", "src", "dst", "src_over", "dst_over", "src_in", "dst_in",
+  "src_out", "dst_out", "src_atop", "dst_atop", "xor"
+};
+
+// Random premultiplied color, with many opaque and transparent pixels
+// to exercise the fast paths
+pixel random_color() {
+  int a;
+  switch (std::rand() % 4) {
+    case 0: a = 0; break;
+    case 1: a = 255; break;
+    default: a = std::rand() % 256; break;
+  }
+  return premultiply(rgba(std::rand() % 256, std::rand() % 256, std::rand() % 256, a));
+}
+
+bool test_mul255() {
+  for (uint32_t x=0; x<256; ++x)
+    for (uint32_t a=0; a<256; ++a)
+      if (raster_details::mul255(x, a) != (x*a + 127) / 255)
+        return false;
+  return true;
+}
+
+bool test_level(simd_level level) {
+  const raster_kernels& ref = raster_kernels_for(simd_scalar);
+  const raster_kernels& k = raster_kernels_for(level);
+  if (k.level != level)
+    return true;                // Not supported by this CPU
+
+  const int maxlen = 67;
+  std::vector<pixel> src(maxlen+8), dst(maxlen+8), a(maxlen+8), b(maxlen+8);
+
+  for (int iter=0; iter<200; ++iter) {
+    for (int i=0; i<maxlen+8; ++i) {
+      src[i] = random_color();
+      dst[i] = random_color();
+    }
+    // Some runs of opaque/transparent source pixels
+    if (iter % 3 == 0)
+      for (int i=8; i<24; ++i)
+        src[i] = (iter % 2 ? 0: src[i] | 0xff000000);
+
+    const int offset = iter % 8;
+    const int n = iter % maxlen;
+    const pixel color = random_color();
+
+    for (int op=0; op<blend_op_count; ++op) {
+      a = dst; b = dst;
+      ref.blend[op](&a[offset], &src[offset], n);
+      k.blend[op](&b[offset], &src[offset], n);
+      if (a != b) {
+        std::printf("%s blend %s differs (n=%d)\n", simd_level_name(level), op_names[op], n);
+        return false;
+      }
+
+      a = dst; b = dst;
+      ref.blend_solid[op](&a[offset], color, n);
+      k.blend_solid[op](&b[offset], color, n);
+      if (a != b) {
+        std::printf("%s blend_solid %s differs (n=%d)\n", simd_level_name(level), op_names[op], n);
+        return false;
+      }
+    }
+
+    // Coverage masks with empty and full runs (like glyphs), some
+    // of them only with 0 and 255, in h rows of w pixels separated by
+    // one pixel
+    std::vector<uint8_t> mask(maxlen+8);
+    for (int i=0; i<maxlen+8; ++i) {
+      int r = std::rand() % 4;
+      mask[i] = (r == 0 ? 0: r == 1 || iter % 4 == 1 ? 255: std::rand() % 256);
+    }
+    const int h = 1 + iter % 3;
+    const int w = std::max(0, n/h - 1);
+    for (int opaque=0; opaque<2; ++opaque) {
+      pixel c = (opaque ? color | 0xff000000: color);
+      a = dst; b = dst;
+      ref.blend_mask(&a[offset], int((w+1)*sizeof(pixel)), &mask[offset], w+1, c, w, h);
+      k.blend_mask(&b[offset], int((w+1)*sizeof(pixel)), &mask[offset], w+1, c, w, h);
+      if (a != b) {
+        std::printf("%s blend_mask differs (%dx%d)\n", simd_level_name(level), w, h);
+        return false;
+      }
+    }
+
+    a = dst; b = dst;
+    ref.fill(&a[offset], n, color);
+    k.fill(&b[offset], n, color);
+    if (a != b)
+      return false;
+
+    b = dst;
+    k.fill_stream(&b[offset], n, color);
+    if (a != b)
+      return false;
+  }
+  return true;
+}
+
+bool test_known_values() {
+  bitmap bmp(4, 1);
+  fill_rect(bmp, rect(0, 0, 4, 1), rgba(255, 255, 255));
+
+  // 50% black over white
+  blend_rect(bmp, rect(0, 0, 1, 1), premultiply(rgba(0, 0, 0, 128)));
+  // Opaque red over white
+  blend_rect(bmp, rect(1, 0, 1, 1), rgba(255, 0, 0));
+  // Transparent over white
+  blend_rect(bmp, rect(2, 0, 1, 1), 0);
+  // Clear
+  blend_rect(bmp, rect(3, 0, 1, 1), rgba(1, 2, 3), blend_clear);
+
+  return (bmp.get_pixel(0, 0) == rgba(127, 127, 127) &&
+          bmp.get_pixel(1, 0) == rgba(255, 0, 0) &&
+          bmp.get_pixel(2, 0) == rgba(255, 255, 255) &&
+          bmp.get_pixel(3, 0) == 0);
+}
+
+int count_pixels(const bitmap& bmp, pixel color) {
+  int n = 0;
+  for (int y=0; y<bmp.height(); ++y)
+    for (int x=0; x<bmp.width(); ++x)
+      n += (bmp.get_pixel(x, y) == color);
+  return n;
+}
+
+bool test_lines() {
+  const pixel white = rgba(255, 255, 255), black = rgba(0, 0, 0);
+  bitmap bmp(64, 64);
+  bool ok = true;
+
+  fill_rect(bmp, rect(0, 0, 64, 64), white);
+  draw_line(bmp, 3, 5, 40, 20, black);
+  ok &= (bmp.get_pixel(3, 5) == black && bmp.get_pixel(40, 20) == black);
+  ok &= (count_pixels(bmp, black) == 38);
+
+  // Clipped lines must not write outside the bitmap
+  fill_rect(bmp, rect(0, 0, 64, 64), white);
+  draw_line(bmp, -100, -50, 200, 150, black);
+  draw_line(bmp, -10, 10, 100, 10, black);
+  ok &= (count_pixels(bmp, black) > 0 && bmp.get_pixel(0, 10) == black);
+
+  // Anti-aliased horizontal line at an integer y has full coverage
+  // in the middle
+  fill_rect(bmp, rect(0, 0, 64, 64), white);
+  draw_line_aa(bmp, 10, 30, 50, 30, black);
+  ok &= (bmp.get_pixel(30, 30) == black && bmp.get_pixel(30, 31) == white);
+
+  // Diagonal anti-aliased line has intermediate values
+  fill_rect(bmp, rect(0, 0, 64, 64), white);
+  draw_line_aa(bmp, 0.0, 0.0, 63.0, 20.0, black);
+  ok &= (count_pixels(bmp, white) + count_pixels(bmp, black) < 64*64);
+  return ok;
+}
+
+bool test_gradient() {
+  const pixel c0 = rgba(0, 0, 0), c1 = rgba(255, 100, 10);
+  bitmap bmp(100, 50);
+  fill_gradient(bmp, rect(0, 0, 100, 50), c0, c1, gradient_horizontal);
+  bool ok = (bmp.get_pixel(0, 10) == c0 && bmp.get_pixel(99, 10) == c1 &&
+             get_r(bmp.get_pixel(50, 0)) == 129);
+
+  // Clipped gradients keep the colors of the full rectangle
+  fill_gradient(bmp, rect(-50, 0, 100, 50), c0, c1, gradient_horizontal);
+  ok &= (bmp.get_pixel(0, 0) == rgba(129, 51, 5));
+
+  fill_gradient(bmp, rect(0, 0, 100, 50), c0, c1, gradient_vertical);
+  ok &= (bmp.get_pixel(10, 0) == c0 && bmp.get_pixel(10, 49) == c1);
+  return ok;
+}
+
+bool test_blit() {
+  bitmap dst(32, 32), sprite(8, 8);
+  fill_rect(dst, rect(0, 0, 32, 32), rgba(255, 255, 255));
+  fill_rect(sprite, rect(0, 0, 8, 8), rgba(0, 0, 255));
+  fill_rect(sprite, rect(0, 0, 8, 4), 0);  // Transparent top half
+
+  // Partially outside the top-left corner
+  blit(dst, -2, -2, sprite);
+  bool ok = (dst.get_pixel(0, 0) == rgba(255, 255, 255) &&
+             dst.get_pixel(0, 2) == rgba(0, 0, 255) &&
+             dst.get_pixel(6, 0) == rgba(255, 255, 255));
+
+  // Copy (the transparent pixels are copied too)
+  blit(dst, 24, 24, sprite, rect(0, 0, 8, 8));
+  ok &= (dst.get_pixel(24, 24) == 0 && dst.get_pixel(31, 31) == rgba(0, 0, 255));
+  return ok;
+}
+
+void benchmark(simd_level level) {
+  if (raster_kernels_for(level).level != level)
+    return;
+  set_simd_level(level);
+
+  const int w = 3840, h = 2160, frames = 10;
+  bitmap frame(w, h), layer(w, h);
+  fill_rect(layer, rect(0, 0, w, h), premultiply(rgba(10, 200, 30, 100)));
+  fill_rect(frame, rect(0, 0, w, h), 0); // Page faults out of the timings
+
+  Chrono chrono;
+  for (int i=0; i<frames; ++i)
+    fill_rect(frame, rect(0, 0, w, h), rgba(i, i, i));
+  double clear_ms = chrono.elapsed() * 1000.0 / frames;
+
+  chrono.reset();
+  for (int i=0; i<frames; ++i)
+    blend_rect(frame, rect(0, 0, w, h), premultiply(rgba(255, 0, 0, 64)));
+  double fill_ms = chrono.elapsed() * 1000.0 / frames;
+
+  chrono.reset();
+  for (int i=0; i<frames; ++i)
+    blit(frame, 0, 0, layer);
+  double blend_ms = chrono.elapsed() * 1000.0 / frames;
+
+  std::printf("%-6s 4K clear %6.2f ms  blend color %6.2f ms  blend bitmap %6.2f ms\n",
+              simd_level_name(level), clear_ms, fill_ms, blend_ms);
+}
+
+int main() {
+  bool ok = true;
+  std::printf("detected SIMD level: %s\n", simd_level_name(detect_simd_level()));
+
+  ok &= check("mul255", test_mul255());
+  ok &= check("level/sse2", test_level(simd_sse2));
+  ok &= check("level/avx2", test_level(simd_avx2));
+  ok &= check("known_values", test_known_values());
+  ok &= check("lines", test_lines());
+  ok &= check("gradient", test_gradient());
+  ok &= check("blit", test_blit());
+
+  benchmark(simd_scalar);
+  benchmark(simd_sse2);
+  benchmark(simd_avx2);
+
+  return report(ok);
+}
@@ -0,0 +1,154 @@
+// ui - Basic User Interface library to do experiments          -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+// Tests the swap_chain pacing modes: every frame presented in order
+// (immediate and fixed FPS), newest-frame-wins with a slow display
+// (the producer never blocks, old frames are dropped), and presenting
+// in a ui::window. Prints the frame time stats of each mode.
+
+#include <ui/ui.h>
+#include "chrono.h"
+#include "test.h"
+
+#include <cstdio>
+#include <vector>
+
+using namespace ui;
+
+// Records the ID of each presented frame (stored in its first pixel)
+class recorder : public present_target {
+  int m_delay_ms;
+public:
+  std::vector<int> ids;
+
+  explicit recorder(int delay_ms = 0) : m_delay_ms(delay_ms) { }
+
+  void present_frame(const bitmap& frame) {
+    if (m_delay_ms)
+      mt::this_thread::sleep_for(m_delay_ms);
+    ids.push_back(int(frame.get_pixel(0, 0)));
+  }
+};
+
+void print_stats(const char* name, const frame_stats& st, double submit_us) {
+  std::printf("%-10s presented %3d dropped %3d  %6.1f fps  avg %5.2f ms  "
+              "p50 %5.2f  p99 %5.2f  max %5.2f  submit %5.1f us\n",
+              name, st.presented, st.dropped, st.fps, st.avg_ms,
+              st.p50_ms, st.p99_ms, st.max_ms, submit_us);
+}
+
+// Renders "frames" frames, returns the average time of submit()
+double render(swap_chain& chain, int frames) {
+  double submit = 0.0;
+  for (int i=0; i<frames; ++i) {
+    bitmap& bmp = chain.acquire();
+    fill_rect(bmp, rect(0, 0, bmp.width(), bmp.height()), pixel(i));
+    Chrono chrono;
+    chain.submit();
+    submit += chrono.elapsed();
+  }
+  chain.wait_idle();
+  return submit * 1e6 / frames;
+}
+
+bool in_order(const std::vector<int>& ids, int frames) {
+  if (int(ids.size()) != frames)
+    return false;
+  for (int i=0; i<frames; ++i)
+    if (ids[i] != i)
+      return false;
+  return true;
+}
+
+bool test_immediate(int buffers) {
+  recorder target;
+  bool ok;
+  {
+    swap_chain chain(&target, 64, 64, buffers, swap_chain::pacing_immediate);
+    double us = render(chain, 200);
+    frame_stats st = chain.stats();
+    ok = (st.presented == 200 && st.dropped == 0);
+    print_stats(buffers == 2 ? "immediate2": "immediate3", st, us);
+  }
+  return ok && in_order(target.ids, 200);
+}
+
+bool test_fixed_fps() {
+  recorder target;
+  bool ok;
+  {
+    swap_chain chain(&target, 64, 64, 2, swap_chain::pacing_fixed_fps, 50.0);
+    Chrono chrono;
+    double us = render(chain, 25);
+    double elapsed = chrono.elapsed();
+    frame_stats st = chain.stats();
+    print_stats("fixed50", st, us);
+
+    // 25 frames at 50 fps = 24 intervals of 20 ms
+    ok = (st.presented == 25 && elapsed >= 0.46 &&
+          st.avg_ms > 18.0 && st.avg_ms < 25.0);
+  }
+  return ok && in_order(target.ids, 25);
+}
+
+bool test_latest() {
+  recorder target(5);           // A display that takes 5 ms per frame
+  bool ok;
+  {
+    swap_chain chain(&target, 64, 64, 2, swap_chain::pacing_latest, 0.0);
+    Chrono chrono;
+    const int frames = 100;
+    double us = 0.0;
+    for (int i=0; i<frames; ++i) {
+      mt::this_thread::sleep_for(1); // Rendering a frame takes ~1 ms
+      bitmap& bmp = chain.acquire();
+      bmp.put_pixel(0, 0, pixel(i));
+      Chrono c;
+      chain.submit();
+      us += c.elapsed();
+    }
+    double produce = chrono.elapsed();
+    chain.wait_idle();
+    frame_stats st = chain.stats();
+    print_stats("latest", st, us * 1e6 / frames);
+
+    ok = (chain.buffers() == 3 &&
+          st.presented + st.dropped == frames && st.dropped > 0 &&
+          st.presented > 1 &&
+          produce < 0.005 * frames * 0.8); // The producer didn't wait the display
+  }
+
+  // Increasing IDs and the last frame is always presented
+  for (std::size_t i=1; i<target.ids.size(); ++i)
+    ok &= (target.ids[i] > target.ids[i-1]);
+  return ok && !target.ids.empty() && target.ids.back() == 99;
+}
+
+bool test_window() {
+  window w(320, 200);
+  {
+    swap_chain chain(&w, 320, 200, 3);
+    for (int i=0; i<10; ++i) {
+      bitmap& bmp = chain.acquire();
+      fill_rect(bmp, rect(0, 0, 320, 200), rgba(i*20, 0, 0));
+      chain.submit();
+    }
+    chain.wait_idle();
+  }
+  return (w.framebuffer().get_pixel(100, 100) == rgba(180, 0, 0));
+}
+
+int ui_main()
+{
+  bool ok = true;
+  ok &= check("immediate/2", test_immediate(2));
+  ok &= check("immediate/3", test_immediate(3));
+  ok &= check("fixed_fps", test_fixed_fps());
+  ok &= check("latest", test_latest());
+  ok &= check("window", test_window());
+
+  return report(ok);
+}
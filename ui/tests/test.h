@@ -0,0 +1,27 @@
+// ui - Basic User Interface library to do experiments          -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+// Helpers shared by the ui tests.
+
+#ifndef UI_TESTS_TEST_HEADER_FILE_INCLUDED
+#define UI_TESTS_TEST_HEADER_FILE_INCLUDED
+
+#include <cstdio>
+
+// Prints the name of a failed test
+inline bool check(const char* name, bool result) {
+  if (!result)
+    std::printf("%s: FAILED\n", name);
+  return result;
+}
+
+// Prints the final result and returns the exit code of the test
+inline int report(bool ok) {
+  std::printf("%s\n", ok ? "ok": "FAILED");
+  return ok ? 0: 1;
+}
+
+#endif // UI_TESTS_TEST_HEADER_FILE_INCLUDED
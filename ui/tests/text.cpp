@@ -0,0 +1,181 @@
+// ui - Basic User Interface library to do experiments          -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+// Tests the glyph atlas and cached text rendering (same pixels as the
+// built-in font, measuring, kerning, UTF-8 fallback, atlas growth),
+// and checks that the throughput is at least the one of drawing each
+// character from its bitmap (the path that the atlas replaced) in
+// optimized builds.
+
+#include "ui/text.h"
+#include "chrono.h"
+#include "test.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+
+using namespace ui;
+
+const pixel white = rgba(255, 255, 255);
+const pixel black = rgba(0, 0, 0);
+
+bool same_pixels(const bitmap& a, const bitmap& b) {
+  for (int y=0; y<a.height(); ++y)
+    for (int x=0; x<a.width(); ++x)
+      if (a.get_pixel(x, y) != b.get_pixel(x, y))
+        return false;
+  return true;
+}
+
+// At size 8 the atlas must produce the original font8x8 glyphs
+bool test_builtin_pixels() {
+  font f(new builtin_glyph_source);
+  bitmap a(200, 40), b(200, 40);
+  bool ok = true;
+
+  const char* texts[] = { "Hello World!", "{[(0123456789)]}", "~`@#$%^&*_+|" };
+  const int xs[] = { 0, -5, 190 };    // Clipped on the left/right side
+  const int ys[] = { 3, -4, 36 };     // Clipped on the top/bottom side
+
+  for (int i=0; i<3; ++i) {
+    fill_rect(a, rect(0, 0, 200, 40), white);
+    fill_rect(b, rect(0, 0, 200, 40), white);
+    font8x8::draw_text(a, xs[i], ys[i], texts[i], black);
+    draw_text(b, f, xs[i], ys[i], texts[i], black);
+    ok &= same_pixels(a, b);
+  }
+  return ok;
+}
+
+bool test_measure() {
+  font f(new builtin_glyph_source);
+  font big(new builtin_glyph_source(16));
+  bool ok = (measure_text(f, "") == 0 &&
+             measure_text(f, "abc") == 24 &&
+             measure_text(big, "abc") == 48 &&
+             big.line_height() == 16);
+
+  // Only the used glyphs are loaded (just once)
+  ok &= (f.loaded_glyphs() == 3);
+  measure_text(f, "cabbage");
+  ok &= (f.loaded_glyphs() == 5);
+  return ok;
+}
+
+// Glyph source with kerning pairs for "AV"
+class kerned_source : public builtin_glyph_source {
+public:
+  void get_kerning_pairs(std::vector<kerning_pair>& pairs) {
+    kerning_pair p = { 'A', 'V', -3 };
+    pairs.push_back(p);
+  }
+};
+
+bool test_kerning() {
+  font f(new kerned_source);
+  bitmap bmp(64, 8);
+  fill_rect(bmp, rect(0, 0, 64, 8), white);
+  rect r = draw_text(bmp, f, 0, 0, "AVA", black);
+
+  return (f.kerning('A', 'V') == -3 &&
+          f.kerning('V', 'A') == 0 &&
+          measure_text(f, "AVA") == 21 &&
+          r.x2() <= 21 && r.y >= 0 && r.y2() <= 8);
+}
+
+bool test_utf8() {
+  font f(new builtin_glyph_source);
+  bitmap a(64, 8), b(64, 8);
+  fill_rect(a, rect(0, 0, 64, 8), white);
+  fill_rect(b, rect(0, 0, 64, 8), white);
+
+  // Characters without glyph are drawn as '?'
+  draw_text(a, f, 0, 0, "a\xc3\xb1" "b\xe2\x82\xac", black); // "añb€"
+  draw_text(b, f, 0, 0, "a?b?", black);
+  return (same_pixels(a, b) &&
+          measure_text(f, "\xc3\xb1") == 8 &&
+          measure_text(f, "\xf0\x9f\x98\x80") == 8);
+}
+
+bool test_atlas_growth() {
+  glyph_atlas atlas(64, 16);
+  std::vector<uint8_t> cov(20*10, 255);
+  int x, y, lasty = 0;
+  for (int i=0; i<12; ++i) {
+    atlas.insert(20, 10, &cov[0], x, y);
+    lasty = y;
+  }
+  // 3 glyphs per shelf, 4 shelves of 10 pixels = 40 pixels -> 64
+  bool ok = (atlas.height() == 64 && lasty == 30 && atlas.row(39)[59] == 255);
+
+  // A glyph wider than the atlas, the previous glyphs don't move
+  std::vector<uint8_t> wide(300*4, 128);
+  atlas.insert(300, 4, &wide[0], x, y);
+  ok &= (atlas.width() == 512 && x == 60 && y == 0 &&
+         atlas.row(3)[359] == 128 && atlas.row(3)[360] == 0 &&
+         atlas.row(39)[59] == 255 && atlas.row(39)[60] == 0);
+
+  // Many sizes in one font
+  for (int size=8; size<=48; size+=8) {
+    font f(new builtin_glyph_source(size));
+    measure_text(f, " !\"#$%&'()*+,-./0123456789:;<=>?@ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                 "[\\]^_`abcdefghijklmnopqrstuvwxyz{|}~");
+    ok &= (f.loaded_glyphs() == 95 &&
+           f.atlas().height() >= size);
+  }
+  return ok;
+}
+
+// Best of several runs (interleaved, so both paths get the same
+// conditions)
+bool benchmark() {
+  const std::string line = "The quick brown fox jumps over the lazy dog 0123456789";
+  const int lines = 20000, runs = 5;
+  bitmap bmp(640, 480);
+  fill_rect(bmp, rect(0, 0, 640, 480), white);
+  font f(new builtin_glyph_source);
+  font big(new builtin_glyph_source(16));
+  double per_char = 0.0, atlas = 0.0, atlas16 = 0.0;
+
+  for (int run=0; run<runs; ++run) {
+    Chrono chrono;
+    for (int i=0; i<lines; ++i)
+      font8x8::draw_text(bmp, 0, (i*8) % 472, line, black);
+    per_char = std::max(per_char, lines / chrono.elapsed());
+
+    chrono.reset();
+    for (int i=0; i<lines; ++i)
+      draw_text(bmp, f, 0, (i*8) % 472, line, black);
+    atlas = std::max(atlas, lines / chrono.elapsed());
+
+    chrono.reset();
+    for (int i=0; i<lines; ++i)
+      draw_text(bmp, big, 0, (i*16) % 464, line, black);
+    atlas16 = std::max(atlas16, lines / chrono.elapsed());
+  }
+
+  std::printf("lines/sec: font8x8 (opaque bits) %.0f  atlas %.0f  atlas (16px, anti-aliased) %.0f\n",
+              per_char, atlas, atlas16);
+#ifdef NDEBUG
+  return atlas >= per_char;
+#else
+  return true;                  // The paths are compared in optimized builds
+#endif
+}
+
+int main() {
+  bool ok = true;
+  ok &= check("builtin_pixels", test_builtin_pixels());
+  ok &= check("measure", test_measure());
+  ok &= check("kerning", test_kerning());
+  ok &= check("utf8", test_utf8());
+  ok &= check("atlas_growth", test_atlas_growth());
+
+  ok &= check("speed", benchmark());
+
+  return report(ok);
+}
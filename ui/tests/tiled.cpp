@@ -0,0 +1,186 @@
+// ui - Basic User Interface library to do experiments          -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+// Renders random scenes with the tiled_renderer (several thread counts
+// and tile sizes) and checks that the pixels are identical to calling
+// the raster functions directly, then measures full-screen redraws at
+// 1080p and 4K with 1..N threads.
+
+#include <ui/ui.h>
+#include "ui/tiled.h"
+#include "chrono.h"
+#include "test.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace ui;
+
+pixel random_color() {
+  return premultiply(rgba(std::rand() % 256, std::rand() % 256,
+                          std::rand() % 256, std::rand() % 256));
+}
+
+rect random_rect(int w, int h) {
+  int x = std::rand() % (w+40) - 20;
+  int y = std::rand() % (h+40) - 20;
+  return rect(x, y, std::rand() % (w/2), std::rand() % (h/2));
+}
+
+// Draws the same random scene directly or with the renderer
+template<class Painter>
+void draw_scene(Painter& p, unsigned seed, int w, int h,
+                const bitmap& sprite, font& f) {
+  std::srand(seed);
+  p.fill_rect(rect(0, 0, w, h), rgba(255, 255, 255));
+  for (int i=0; i<300; ++i) {
+    switch (std::rand() % 8) {
+      case 0: p.fill_rect(random_rect(w, h), random_color() | 0xff000000); break;
+      case 1: p.blend_rect(random_rect(w, h), random_color(),
+                           blend_op(std::rand() % blend_op_count)); break;
+      case 2: p.fill_gradient(random_rect(w, h), random_color(), random_color(),
+                              gradient_direction(std::rand() % 2)); break;
+      case 3: p.blit(std::rand() % w - 16, std::rand() % h - 16, sprite); break;
+      case 4: p.blit(std::rand() % w - 16, std::rand() % h - 16, sprite,
+                     rect(4, 4, 20, 20)); break;
+      case 5: p.draw_line(std::rand() % w, std::rand() % h,
+                          std::rand() % w, std::rand() % h, random_color()); break;
+      case 6: p.draw_line_aa(std::rand() % (w*10) / 10.0, std::rand() % (h*10) / 10.0,
+                             std::rand() % (w*10) / 10.0, std::rand() % (h*10) / 10.0,
+                             random_color()); break;
+      case 7: {
+        int x = std::rand() % w - 20, y = std::rand() % h - 4;
+        p.draw_text(f, x, y, "Tiled text", random_color() | 0xff000000);
+        break;
+      }
+    }
+  }
+}
+
+// Calls the raster functions directly on a bitmap
+struct direct_painter {
+  bitmap& bmp;
+  explicit direct_painter(bitmap& bmp) : bmp(bmp) { }
+
+  void fill_rect(const rect& rc, pixel c) { ui::fill_rect(bmp, rc, c); }
+  void blend_rect(const rect& rc, pixel c, blend_op op) { ui::blend_rect(bmp, rc, c, op); }
+  void fill_gradient(const rect& rc, pixel c0, pixel c1, gradient_direction d) {
+    ui::fill_gradient(bmp, rc, c0, c1, d);
+  }
+  void blit(int x, int y, const bitmap& src) { ui::blit(bmp, x, y, src); }
+  void blit(int x, int y, const bitmap& src, const rect& rc) { ui::blit(bmp, x, y, src, rc); }
+  void draw_line(int x0, int y0, int x1, int y1, pixel c) { ui::draw_line(bmp, x0, y0, x1, y1, c); }
+  void draw_line_aa(double x0, double y0, double x1, double y1, pixel c) {
+    ui::draw_line_aa(bmp, x0, y0, x1, y1, c);
+  }
+  void draw_text(font& f, int x, int y, const std::string& s, pixel c) {
+    ui::draw_text(bmp, f, x, y, s, c);
+  }
+};
+
+bool same_pixels(const bitmap& a, const bitmap& b) {
+  for (int y=0; y<a.height(); ++y)
+    if (std::memcmp(a.row(y), b.row(y), a.width()*sizeof(pixel)) != 0)
+      return false;
+  return true;
+}
+
+bool test_identical(int threads, int tile_size) {
+  const int w = 333, h = 201;   // Partial tiles on the edges
+  bitmap sprite(32, 32), expected(w, h), result(w, h);
+  fill_gradient(sprite, rect(0, 0, 32, 32), premultiply(rgba(255, 0, 0, 200)),
+                premultiply(rgba(0, 0, 255, 50)), gradient_vertical);
+  font f(new builtin_glyph_source(12));
+
+  tiled_renderer r(result, threads, tile_size);
+  bool ok = true;
+  for (unsigned seed=1; seed<=5; ++seed) {
+    direct_painter d(expected);
+    draw_scene(d, seed, w, h, sprite, f);
+    draw_scene(r, seed, w, h, sprite, f);
+    r.flush();
+    ok &= same_pixels(expected, result);
+    ok &= (r.pending() == 0 && r.damage().bounds() == rect(0, 0, w, h));
+  }
+  return ok;
+}
+
+bool test_damage() {
+  bitmap bmp(256, 256);
+  tiled_renderer r(bmp, 2);
+  r.fill_rect(rect(10, 10, 20, 20), rgba(0, 0, 0));
+  r.fill_rect(rect(200, 200, 100, 100), rgba(0, 0, 0)); // Clipped
+  r.flush();
+  bool ok = (r.damage().size() == 2 &&
+             r.damage().area() == 20*20 + 56*56);
+  r.flush();                    // Nothing recorded
+  ok &= r.damage().empty();
+  return ok;
+}
+
+// A full-screen frame: background, 200 translucent panels, sprites,
+// lines and text
+template<class Painter>
+void benchmark_frame(Painter& p, int i, int w, int h, const bitmap& sprite, font& f) {
+  std::srand(i);
+  p.fill_gradient(rect(0, 0, w, h), rgba(20, 20, 40), rgba(60, 60, 120),
+                  gradient_vertical);
+  for (int j=0; j<200; ++j)
+    p.blend_rect(rect(std::rand() % w, std::rand() % h, w/4, h/4),
+                 premultiply(rgba(255, 255, 255, 40)), blend_src_over);
+  for (int j=0; j<500; ++j)
+    p.blit(std::rand() % w, std::rand() % h, sprite);
+  for (int j=0; j<200; ++j)
+    p.draw_line_aa(std::rand() % w, std::rand() % h,
+                   std::rand() % w, std::rand() % h, rgba(255, 0, 0));
+  for (int y=0; y<h; y+=32)
+    p.draw_text(f, 8, y, "The quick brown fox jumps over the lazy dog", rgba(255, 255, 255));
+}
+
+void benchmark(int w, int h, const char* name) {
+  bitmap frame(w, h), sprite(64, 64);
+  fill_gradient(sprite, rect(0, 0, 64, 64), premultiply(rgba(255, 255, 0, 180)),
+                premultiply(rgba(0, 128, 255, 90)), gradient_horizontal);
+  font f(new builtin_glyph_source(16));
+  const int frames = 5;
+
+  direct_painter d(frame);
+  Chrono chrono;
+  for (int i=0; i<frames; ++i)
+    benchmark_frame(d, i, w, h, sprite, f);
+  const double base_ms = chrono.elapsed() * 1000.0 / frames;
+  std::printf("%-5s direct:       %7.2f ms/frame  %6.1f fps\n",
+              name, base_ms, 1000.0 / base_ms);
+
+  const int ncpus = mt::futex::details::number_of_cpus();
+  for (int threads=1; threads<=ncpus*2 && threads<=16; threads*=2) {
+    tiled_renderer r(frame, threads);
+    chrono.reset();
+    for (int i=0; i<frames; ++i) {
+      benchmark_frame(r, i, w, h, sprite, f);
+      r.flush();
+    }
+    double ms = chrono.elapsed() * 1000.0 / frames;
+    std::printf("%-5s %2d thread(s): %7.2f ms/frame  %6.1f fps  speedup %.2fx\n",
+                name, threads, ms, 1000.0 / ms, base_ms / ms);
+  }
+}
+
+int ui_main()
+{
+  bool ok = true;
+  ok &= check("identical/1x64", test_identical(1, 64));
+  ok &= check("identical/4x64", test_identical(4, 64));
+  ok &= check("identical/3x32", test_identical(3, 32));
+  ok &= check("identical/2x100", test_identical(2, 100));
+  ok &= check("damage", test_damage());
+
+  benchmark(1920, 1080, "1080p");
+  benchmark(3840, 2160, "4K");
+
+  return report(ok);
+}
@@ -0,0 +1,154 @@
+// ui - Basic User Interface library to do experiments          -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+#ifndef UI_BITMAP_HEADER_FILE_INCLUDED
+#define UI_BITMAP_HEADER_FILE_INCLUDED
+
+#include <cassert>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+#if WIN32
+  #include <malloc.h>
+#endif
+
+#include "ui/pixel_format.h"
+
+namespace ui {
+
+  //////////////////////////////////////////////////////////////////////
+  // basic_bitmap class
+  //
+  // In-memory framebuffer of pixels of the given format (see
+  // ui/pixel_format.h). Rows are contiguous spans of pixels separated
+  // by stride() bytes. It can own its memory (rows aligned to 64
+  // bytes), or wrap memory owned by someone else (a DIB section, a
+  // shared memory XImage, etc.).
+
+  template<class Format>
+  class basic_bitmap {
+  public:
+    typedef Format format_type;
+    typedef typename Format::value_type value_type;
+
+    static const int alignment = 64;
+
+    // Creates an owned bitmap (the content is not initialized)
+    basic_bitmap(int width, int height)
+      : m_width(width)
+      , m_height(height)
+      , m_stride((width*int(sizeof(value_type)) + alignment-1) & ~(alignment-1))
+      , m_owned(true) {
+      assert(width > 0 && height > 0);
+      m_bits = static_cast<uint8_t*>(alloc_bits(std::size_t(m_stride) * height));
+    }
+
+    // Wraps external memory, "stride" is the number of bytes from one
+    // row to the next one. "bits" points to the first row, the stride
+    // is negative for bottom-up images (e.g. a BMP file).
+    basic_bitmap(int width, int height, void* bits, int stride)
+      : m_width(width)
+      , m_height(height)
+      , m_stride(stride)
+      , m_owned(false)
+      , m_bits(static_cast<uint8_t*>(bits)) {
+      assert(width > 0 && height > 0);
+      assert(stride >= width*int(sizeof(value_type)) ||
+             -stride >= width*int(sizeof(value_type)));
+    }
+
+    ~basic_bitmap() {
+      if (m_owned)
+        free_bits(m_bits);
+    }
+
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    int stride() const { return m_stride; }
+
+    // Returns the span of width() pixels of the given row
+    value_type* row(int y) {
+      assert(y >= 0 && y < m_height);
+      return reinterpret_cast<value_type*>(m_bits + std::ptrdiff_t(m_stride) * y);
+    }
+
+    const value_type* row(int y) const {
+      assert(y >= 0 && y < m_height);
+      return reinterpret_cast<const value_type*>(m_bits + std::ptrdiff_t(m_stride) * y);
+    }
+
+    // Returns the span of pixels from (x, y) to the end of the row
+    value_type* span(int x, int y) {
+      assert(x >= 0 && x < m_width);
+      return row(y) + x;
+    }
+
+    const value_type* span(int x, int y) const {
+      assert(x >= 0 && x < m_width);
+      return row(y) + x;
+    }
+
+    value_type get_pixel(int x, int y) const {
+      return *span(x, y);
+    }
+
+    void put_pixel(int x, int y, value_type color) {
+      *span(x, y) = color;
+    }
+
+    void clear(value_type color) {
+      for (int y=0; y<m_height; ++y) {
+        value_type* p = row(y);
+        for (int x=0; x<m_width; ++x)
+          p[x] = color;
+      }
+    }
+
+  private:
+    static void* alloc_bits(std::size_t size) {
+      void* ptr;
+#if WIN32
+      ptr = _aligned_malloc(size, alignment);
+#else
+      if (posix_memalign(&ptr, alignment, size) != 0)
+        ptr = NULL;
+#endif
+      if (!ptr)
+        throw std::bad_alloc();
+      return ptr;
+    }
+
+    static void free_bits(void* ptr) {
+#if WIN32
+      _aligned_free(ptr);
+#else
+      std::free(ptr);
+#endif
+    }
+
+    int m_width;
+    int m_height;
+    int m_stride;
+    bool m_owned;
+    uint8_t* m_bits;
+
+    // Non-copyable
+    basic_bitmap(const basic_bitmap&);
+    basic_bitmap& operator=(const basic_bitmap&);
+  };
+
+  // The framebuffer format used to draw and present frames
+  typedef basic_bitmap<bgra8_format> bitmap;
+
+  typedef basic_bitmap<bgra8_straight_format> bitmap_bgra8_straight;
+  typedef basic_bitmap<rgba8_format> bitmap_rgba8;
+  typedef basic_bitmap<rgb565_format> bitmap_rgb565;
+  typedef basic_bitmap<a8_format> bitmap_a8;
+
+} // namespace ui
+
+#endif // UI_BITMAP_HEADER_FILE_INCLUDED
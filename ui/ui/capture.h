@@ -0,0 +1,410 @@
+// ui - Basic User Interface library to do experiments          -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+#ifndef UI_CAPTURE_HEADER_FILE_INCLUDED
+#define UI_CAPTURE_HEADER_FILE_INCLUDED
+
+#include "ui/bitmap.h"
+#include "ui/damage.h"
+#include "ui/rect.h"
+#include "ui/yuv.h"
+
+#include "mt/semaphore.h"
+#include "mt/thread.h"
+#include "chrono.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace ui {
+
+  //////////////////////////////////////////////////////////////////////
+  // capture_stats struct
+
+  struct capture_stats {
+    int captured;               // Frames copied by capture()/start_capture()
+    int dropped;                // Frames lost because all the buffers were in use
+    int written;                // Frames written in the file
+    double copy_us;             // Average time of capture() or of start_capture()
+                                // plus finish_capture() (caller thread)
+    double encode_ms;           // Average time to convert and write a frame
+
+    capture_stats()
+      : captured(0), dropped(0), written(0)
+      , copy_us(0.0), encode_ms(0.0) {
+    }
+  };
+
+  //////////////////////////////////////////////////////////////////////
+  // frame_capture class
+  //
+  // Records the presented frames in a video file. capture() only
+  // copies the frame to a free buffer of a fixed pool (so the memory
+  // is bounded), a writer thread converts it and writes it in the
+  // file. When the writer is behind and there are no free buffers the
+  // frame is dropped (and counted), capture() never waits for the disk.
+  //
+  // capture(frame, damage) (e.g. the framebuffer of a window and its
+  // invalidated area) copies only the area that changed since the
+  // previous captured frame (the damage of dropped frames is
+  // accumulated), the writer thread applies these pixels to its own
+  // copy of the whole frame before converting it. A frame that stays
+  // unmodified while it's presented can be copied by the writer thread
+  // instead: start_capture() hands it to the writer (if it isn't busy
+  // with other frames, in other case it's copied by the caller) and
+  // finish_capture() waits until it was copied.
+  //
+  // Formats:
+  //   format_y4m   YUV4MPEG2 stream with 4:2:0 frames (see yuv.h),
+  //                e.g. "ffmpeg -i capture.y4m capture.mp4".
+  //   format_bgra  Raw 32bpp frames, without header or row padding
+  //                ("ffmpeg -f rawvideo -pix_fmt bgra -s WxH ...").
+  //
+  // The capture functions must be called from one thread at a time
+  // (e.g. the render thread, or the present thread of a swap_chain).
+  // Frames with a different size are cropped or padded with black.
+
+  class frame_capture {
+  public:
+    enum format {
+      format_y4m,
+      format_bgra
+    };
+
+    frame_capture(const std::string& filename, int width, int height,
+                  double fps = 60.0, format fmt = format_y4m, int buffers = 4)
+      : m_width(width)
+      , m_height(height)
+      , m_format(fmt)
+      , m_nbuffers(std::max(1, buffers))
+      , m_file(std::fopen(filename.c_str(), "wb"))
+      , m_frame(width, height)
+      , m_stale(rect(0, 0, width, height))
+      , m_free_count(0)
+      , m_filled_count(0)
+      , m_copied(0)
+      , m_pending(0)
+      , m_handed_off(false)
+      , m_free_head(0), m_free_tail(0)
+      , m_filled_head(0), m_filled_tail(0)
+      , m_free_ring(m_nbuffers)
+      , m_filled_ring(m_nbuffers+1)   // Plus the end-of-stream mark
+      , m_captured(0)
+      , m_dropped(0)
+      , m_written(0)
+      , m_copy_time(0.0)
+      , m_encode_us(0)
+      , m_failed(!m_file)
+      , m_thread(NULL) {
+      if (!m_file)
+        return;
+
+      if (m_format == format_y4m) {
+        // Frame rate as a fraction (e.g. 30000:1001 for 29.97)
+        int num = int(fps+0.5), den = 1;
+        if (std::fabs(fps - num) > 0.001) {
+          num = int(fps*1000.0 + 0.5);
+          den = 1000;
+        }
+        std::fprintf(m_file, "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 C420jpeg\n",
+                     width, height, num, den);
+        m_output.resize(yuv420_size(width, height));
+      }
+      else
+        m_output.resize(std::size_t(width)*height*sizeof(pixel));
+
+      // Buffers are cleared to map their pages now and not in the
+      // first capture() calls
+      for (int i=0; i<m_nbuffers; ++i) {
+        m_buffers.push_back(new bitmap(width, height));
+        m_buffers.back()->clear(0);
+        m_patches.push_back(damage_region(rect(0, 0, width, height)));
+        m_sources.push_back(NULL);
+        push_free(i);
+      }
+      m_frame.clear(0);
+      m_stale.add_all();
+      std::memset(&m_output[0], 0, m_output.size());
+      m_thread = new mt::thread(writer_thread(this));
+    }
+
+    ~frame_capture() {
+      close();
+    }
+
+    bool is_open() const { return m_file != NULL; }
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    int buffers() const { return m_nbuffers; }
+
+    // True if the file couldn't be created or a write failed
+    bool failed() const { return m_failed.load(std::memory_order_relaxed); }
+
+    // Copies the frame to be written by the writer thread. Returns
+    // false if the frame was dropped.
+    bool capture(const bitmap& frame) {
+      return capture(frame, all_damaged());
+    }
+
+    // Like capture(), "damage" is the area of the frame that changed
+    // since the previous captured (or dropped) frame, only the pixels
+    // that the writer doesn't have are copied
+    bool capture(const bitmap& frame, const damage_region& damage) {
+      if (!m_thread)
+        return false;
+
+      Chrono chrono;
+      const int i = acquire_buffer(damage);
+      if (i < 0)
+        return false;
+
+      const std::vector<rect>& rects = m_stale.rects();
+      for (std::size_t j=0; j<rects.size(); ++j)
+        copy_area(frame, *m_buffers[i], rects[j]);
+      std::swap(m_patches[i], m_stale);
+      m_stale.clear();
+      m_copy_time += chrono.elapsed();
+
+      // (Not timed, with one CPU the writer can start running here)
+      push_filled(i);
+      return true;
+    }
+
+    // The writer thread copies the frame if it's idle (the frame must
+    // not be modified until finish_capture() returns), in other case
+    // it's copied now. Returns false if the frame was dropped.
+    bool start_capture(const bitmap& frame) {
+      if (!m_thread)
+        return false;
+
+      Chrono chrono;
+      const int i = acquire_buffer(all_damaged());
+      if (i < 0)
+        return false;
+
+      // The damage of the next capture(frame, damage) isn't relative
+      // to this frame, so it will copy the whole frame
+      if (m_pending.load(std::memory_order_acquire) > 0) {
+        copy_area(frame, *m_buffers[i], m_stale.clip());
+        m_patches[i].add_all();
+      }
+      else {
+        m_sources[i] = &frame;
+        m_handed_off = true;
+      }
+      m_copy_time += chrono.elapsed();
+
+      push_filled(i);
+      return true;
+    }
+
+    // Waits until the writer copied the frame of the last
+    // start_capture() (returns immediately if it was copied by
+    // start_capture() or dropped)
+    void finish_capture() {
+      if (!m_handed_off)
+        return;
+
+      Chrono chrono;
+      m_copied.acquire();
+      m_handed_off = false;
+      m_copy_time += chrono.elapsed();
+    }
+
+    // Writes the pending frames and closes the file
+    void close() {
+      if (m_thread) {
+        m_filled_ring[advance(m_filled_tail, m_nbuffers+1)] = -1;
+        m_filled_count.release();
+        m_thread->join();
+        delete m_thread;
+        m_thread = NULL;
+      }
+      if (m_file) {
+        if (std::fclose(m_file) != 0)
+          m_failed = true;
+        m_file = NULL;
+      }
+      for (std::size_t i=0; i<m_buffers.size(); ++i)
+        delete m_buffers[i];
+      m_buffers.clear();
+    }
+
+    // Call it from the thread that calls capture()
+    capture_stats stats() const {
+      capture_stats st;
+      st.captured = m_captured.load(std::memory_order_relaxed);
+      st.dropped = m_dropped.load(std::memory_order_relaxed);
+      st.written = m_written.load(std::memory_order_acquire);
+      if (st.captured > 0)
+        st.copy_us = 1e6 * m_copy_time / st.captured;
+      if (st.written > 0)
+        st.encode_ms = 1e-3 * m_encode_us.load(std::memory_order_relaxed) / st.written;
+      return st;
+    }
+
+  private:
+    struct writer_thread {
+      frame_capture* capture;
+      explicit writer_thread(frame_capture* capture) : capture(capture) { }
+      void operator()() { capture->writer_loop(); }
+    };
+
+    // Returns the position "i" of a ring of "n" elements and moves it
+    // to the next one (wrapped here, a free-running counter modulo "n"
+    // would jump when it overflows)
+    static unsigned advance(unsigned& i, int n) {
+      const unsigned j = i;
+      if (++i == unsigned(n))
+        i = 0;
+      return j;
+    }
+
+    void push_free(int i) {
+      m_free_ring[advance(m_free_tail, m_nbuffers)] = i;
+      m_free_count.release();
+    }
+
+    void push_filled(int i) {
+      m_captured.fetch_add(1, std::memory_order_relaxed);
+      m_pending.fetch_add(1, std::memory_order_relaxed);
+      m_filled_ring[advance(m_filled_tail, m_nbuffers+1)] = i;
+      m_filled_count.release();
+    }
+
+    // Adds the damage of a frame to the stale area (it's kept if the
+    // frame is dropped), then returns a free buffer (or -1 if the frame
+    // is dropped)
+    int acquire_buffer(const damage_region& damage) {
+      if (damage.size() == 1 && damage.rects()[0].contains(m_stale.clip()))
+        m_stale.add_all();
+      else {
+        for (std::size_t j=0; j<damage.size(); ++j)
+          m_stale.add(damage.rects()[j]);
+      }
+      if (!m_free_count.try_acquire()) {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return -1;
+      }
+      return m_free_ring[advance(m_free_head, m_nbuffers)];
+    }
+
+    const damage_region& all_damaged() {
+      if (m_all.empty()) {
+        m_all.set_clip(rect(0, 0, m_width, m_height));
+        m_all.add_all();
+      }
+      return m_all;
+    }
+
+    // Copies the area "rc" of the buffer from the frame, the pixels
+    // outside the frame are black
+    static void copy_area(const bitmap& src, bitmap& dst, const rect& rc) {
+      const rect in = rc & rect(0, 0, src.width(), src.height());
+      for (int y=rc.y; y<rc.y2(); ++y) {
+        pixel* d = dst.row(y);
+        if (in.empty() || y < in.y || y >= in.y2()) {
+          std::memset(d+rc.x, 0, rc.w*sizeof(pixel));
+          continue;
+        }
+        std::memset(d+rc.x, 0, (in.x-rc.x)*sizeof(pixel));
+        std::memcpy(d+in.x, src.row(y)+in.x, in.w*sizeof(pixel));
+        std::memset(d+in.x2(), 0, (rc.x2()-in.x2())*sizeof(pixel));
+      }
+    }
+
+    void writer_loop() {
+      for (;;) {
+        m_filled_count.acquire();
+        const int i = m_filled_ring[advance(m_filled_head, m_nbuffers+1)];
+        if (i < 0)
+          break;
+
+        Chrono chrono;
+        if (const bitmap* source = m_sources[i]) {
+          copy_area(*source, m_frame, rect(0, 0, m_width, m_height));
+          m_sources[i] = NULL;
+          m_copied.release();
+        }
+        else {
+          damage_region& patch = m_patches[i];
+          for (std::size_t j=0; j<patch.size(); ++j)
+            copy_area(*m_buffers[i], m_frame, patch.rects()[j]);
+          patch.clear();
+        }
+        // The buffer can be reused as soon as it's applied
+        push_free(i);
+        encode(m_frame);
+
+        if (!m_failed) {
+          if (m_format == format_y4m)
+            write("FRAME\n", 6);
+          write(&m_output[0], m_output.size());
+
+          m_encode_us.fetch_add((long long)(chrono.elapsed() * 1e6), std::memory_order_relaxed);
+          m_written.fetch_add(1, std::memory_order_release);
+        }
+        m_pending.fetch_sub(1, std::memory_order_release);
+      }
+    }
+
+    void encode(const bitmap& frame) {
+      if (m_format == format_y4m)
+        bgra_to_yuv420(frame, &m_output[0]);
+      else {
+        const std::size_t row_size = m_width*sizeof(pixel);
+        for (int y=0; y<m_height; ++y)
+          std::memcpy(&m_output[y*row_size], frame.row(y), row_size);
+      }
+    }
+
+    void write(const void* data, std::size_t size) {
+      if (std::fwrite(data, 1, size, m_file) != size)
+        m_failed = true;
+    }
+
+    int m_width, m_height;
+    format m_format;
+    int m_nbuffers;
+    std::FILE* m_file;
+    std::vector<bitmap*> m_buffers;
+    std::vector<damage_region> m_patches;   // Area of each filled buffer with pixels
+    std::vector<const bitmap*> m_sources;   // Frame to be copied by the writer (or NULL)
+    bitmap m_frame;                         // Whole frame (writer thread)
+    damage_region m_stale;                  // Changed since the last captured frame
+    damage_region m_all;                    // The whole frame
+    std::vector<uint8_t> m_output;  // Converted frame (writer thread)
+
+    // SPSC rings of buffer indexes (capture() pops free buffers and
+    // pushes filled ones, the writer thread does the opposite)
+    mt::counting_semaphore<> m_free_count, m_filled_count;
+    mt::counting_semaphore<> m_copied;  // The writer copied a frame of start_capture()
+    std::atomic<int> m_pending; // Filled frames not written yet
+    bool m_handed_off;          // Waiting for the writer to copy a frame (caller thread)
+    unsigned m_free_head, m_free_tail;
+    unsigned m_filled_head, m_filled_tail;
+    std::vector<int> m_free_ring, m_filled_ring;
+
+    std::atomic<int> m_captured, m_dropped, m_written;
+    double m_copy_time;         // Seconds in capture() (caller thread)
+    std::atomic<long long> m_encode_us; // Converting/writing (writer thread)
+    std::atomic<bool> m_failed;
+
+    mt::thread* m_thread;
+
+    // Non-copyable
+    frame_capture(const frame_capture&);
+    frame_capture& operator=(const frame_capture&);
+  };
+
+} // namespace ui
+
+#endif // UI_CAPTURE_HEADER_FILE_INCLUDED
@@ -0,0 +1,491 @@
+// ui - Basic User Interface library to do experiments          -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+#ifndef UI_CONSOLE_HEADER_FILE_INCLUDED
+#define UI_CONSOLE_HEADER_FILE_INCLUDED
+
+#include "ui/bitmap.h"
+#include "ui/raster.h"
+#include "ui/rect.h"
+#include "ui/text.h"
+
+#include <cassert>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace ui {
+
+  //////////////////////////////////////////////////////////////////////
+  // console class
+  //
+  // Text output with scrollback in an area of a bitmap. Lines are kept
+  // in a ring buffer of max_lines entries (the oldest ones are dropped
+  // and their memory reused), each one with its rows already wrapped
+  // to the width of the area (at spaces, or anywhere in long words).
+  //
+  // Layout is incremental: written text re-wraps only the last row of
+  // the current line, and a change of width re-wraps only the lines
+  // that don't fit in one row in the old or the new width.
+  //
+  // render() draws only what changed since the last call: when the
+  // view moves, the pixels of the rows that are still visible are
+  // moved with memmove() and only the exposed rows are drawn, and text
+  // appended to the last row is drawn without redrawing the row. So
+  // tailing a log costs the same per frame with 100 or 1M lines.
+  //
+  // The area is supposed to be cleared with the background color when
+  // the console is created, call invalidate() if something else draws
+  // there. Something that is drawn over the console after each render()
+  // (e.g. a hud) must be given with set_overlay(), so its pixels are
+  // not moved to other rows when the view scrolls.
+
+  class console {
+    struct line {
+      std::string text;         // Without '\n'
+      std::vector<int> rows;    // Byte offset where each row starts
+      long long first_row;      // Absolute index of the first row
+      int width;                // Width of the whole text in pixels
+      int last_cp;              // Last code point (for kerning)
+      pixel color;
+    };
+
+    // The last drawn row, to draw only text appended to it
+    struct drawn_tail {
+      long long row;
+      long long line;           // Sequence number of the line
+      int begin, end;           // Bytes of the line drawn in the row
+    };
+
+  public:
+    static const int max_line_bytes = 4096; // Longer lines are split
+
+    console(font& f, const rect& area, int max_lines = 10000,
+            pixel background = rgba(255, 255, 255), pixel color = rgba(0, 0, 0))
+      : m_font(f)
+      , m_area(area)
+      , m_lines(max_lines > 0 ? max_lines: 1)
+      , m_first(0)
+      , m_count(0)
+      , m_first_seq(0)
+      , m_background(background)
+      , m_color(color)
+      , m_top(0)
+      , m_following(true)
+      , m_drawn_valid(true)     // The area is cleared
+      , m_drawn_top(0)
+      , m_dirty_from(0)
+      , m_relayouts(0) {
+      assert(area.w > 0 && area.h > 0);
+      new_line();
+      m_tail.row = 0;
+      m_tail.line = 0;
+      m_tail.begin = m_tail.end = 0;
+    }
+
+    const rect& area() const { return m_area; }
+
+    // Color of the new lines (and of the current one if it's empty)
+    void set_color(pixel color) {
+      m_color = color;
+      line& l = last();
+      if (l.text.empty())
+        l.color = color;
+    }
+
+    // Appends UTF-8 text, '\n' starts a new line
+    void write(const std::string& text) {
+      std::size_t i = 0;
+      while (i < text.size()) {
+        std::size_t nl = text.find('\n', i);
+        std::size_t end = (nl == std::string::npos ? text.size(): nl);
+        append(text.data()+i, end-i);
+        if (nl == std::string::npos)
+          break;
+        new_line();
+        i = nl+1;
+      }
+    }
+
+    // Changes the area where the console is rendered, re-wrapping the
+    // lines if the width changes
+    void set_area(const rect& area) {
+      assert(area.w > 0 && area.h > 0);
+      const long long top_line = line_of_row(top_row());
+
+      if (area.w != m_area.w) {
+        const int old_w = m_area.w;
+        m_area = area;
+        long long row = first().first_row;
+        for (int i=0; i<m_count; ++i) {
+          line& l = get(i);
+          // Lines that fit in one row with both widths keep their layout
+          if (l.width > old_w || l.width > area.w) {
+            wrap(l, 0);
+            ++m_relayouts;
+          }
+          l.first_row = row;
+          row += int(l.rows.size());
+        }
+        if (!m_following)
+          m_top = get(int(top_line - m_first_seq)).first_row;
+      }
+      else
+        m_area = area;
+
+      invalidate();
+    }
+
+    // Scrolls the view the given number of rows, positive to see older
+    // rows. The view follows new output while it's at the end.
+    void scroll(int rows) {
+      m_top = top_row() - rows;
+      const long long end = end_top();
+      if (m_top < first().first_row) m_top = first().first_row;
+      if (m_top > end) m_top = end;
+      m_following = (m_top == end);
+    }
+
+    void scroll_to_end() {
+      m_following = true;
+    }
+
+    bool following() const { return m_following; }
+
+    // Area of the target covered by something that is drawn after
+    // render() (an empty rect if there is nothing)
+    void set_overlay(const rect& rc) {
+      m_overlay = rc;
+    }
+
+    // The next render() draws the whole area
+    void invalidate() {
+      m_drawn_valid = false;
+    }
+
+    // Draws the changes in the area of "target" and returns the bounds
+    // of the modified pixels
+    rect render(bitmap& target) {
+      assert((m_area & rect(0, 0, target.width(), target.height())) == m_area);
+      bitmap view(m_area.w, m_area.h, target.span(m_area.x, m_area.y), target.stride());
+      const int lh = m_font.line_height();
+      const int visible = visible_rows();
+      const long long top = top_row();
+      const long long bottom = top + visible;
+      rect damage;
+
+      if (!m_drawn_valid ||
+          top - m_drawn_top >= visible ||
+          m_drawn_top - top >= visible) {
+        fill_rect(view, rect(0, 0, m_area.w, m_area.h), m_background);
+        m_tail.row = -1;
+        draw_rows(view, top, top, bottom, damage);
+        damage = rect(0, 0, m_area.w, m_area.h);
+      }
+      else {
+        const int delta = int(top - m_drawn_top);
+        long long from = bottom, to = bottom;
+        if (delta != 0) {
+          scroll_pixels(view, delta*lh, visible*lh);
+          damage = rect(0, 0, m_area.w, visible*lh);
+          if (delta > 0)
+            from = bottom - delta;
+          else {
+            // Rows exposed at the top
+            draw_rows(view, top, top, top - delta, damage);
+          }
+        }
+        // Changed rows (from the first modified one to the end)
+        if (m_dirty_from < from)
+          from = (m_dirty_from > top ? m_dirty_from: top);
+        draw_rows(view, top, from, to, damage);
+        if (delta != 0)
+          redraw_overlaid_rows(view, top, delta, damage);
+      }
+
+      m_drawn_valid = true;
+      m_drawn_top = top;
+      m_dirty_from = end_row();
+      update_tail(top, bottom);
+      return damage.offset(m_area.x, m_area.y);
+    }
+
+    // Number of lines in the scrollback
+    int lines() const { return m_count; }
+
+    // Text of the i-th line (0 is the oldest one)
+    const std::string& text(int i) const { return get(i).text; }
+
+    // Rows of all the lines with the current width
+    long long rows() const { return end_row() - first().first_row; }
+
+    int visible_rows() const {
+      int n = m_area.h / m_font.line_height();
+      return (n > 0 ? n: 1);
+    }
+
+    // Lines re-wrapped by set_area()
+    long long relayouts() const { return m_relayouts; }
+
+    // Memory used by the text and the layout of the lines
+    std::size_t bytes() const {
+      std::size_t n = m_lines.size() * sizeof(line);
+      for (std::size_t i=0; i<m_lines.size(); ++i)
+        n += m_lines[i].text.capacity() + m_lines[i].rows.capacity()*sizeof(int);
+      return n;
+    }
+
+  private:
+    line& get(int i) { return m_lines[(m_first+i) % m_lines.size()]; }
+    const line& get(int i) const { return m_lines[(m_first+i) % m_lines.size()]; }
+    line& first() { return get(0); }
+    const line& first() const { return get(0); }
+    line& last() { return get(m_count-1); }
+    const line& last() const { return get(m_count-1); }
+
+    long long end_row() const {
+      const line& l = last();
+      return l.first_row + int(l.rows.size());
+    }
+
+    // First row of the view when it's following the output
+    long long end_top() const {
+      long long top = end_row() - visible_rows();
+      return (top > first().first_row ? top: first().first_row);
+    }
+
+    long long top_row() const {
+      if (m_following)
+        return end_top();
+      // The rows of the view could be dropped
+      return (m_top > first().first_row ? m_top: first().first_row);
+    }
+
+    // Index (0 = oldest) of the line with the given absolute row
+    int index_of_row(long long row) const {
+      int lo = 0, hi = m_count-1;
+      while (lo < hi) {
+        int mid = (lo+hi+1) / 2;
+        if (get(mid).first_row <= row)
+          lo = mid;
+        else
+          hi = mid-1;
+      }
+      return lo;
+    }
+
+    long long line_of_row(long long row) const {
+      return m_first_seq + index_of_row(row);
+    }
+
+    void new_line() {
+      long long row = 0;
+      if (m_count > 0)
+        row = end_row();
+
+      // Drop the oldest line (its slot is reused)
+      if (m_count == int(m_lines.size())) {
+        m_first = (m_first+1) % m_lines.size();
+        --m_count;
+        ++m_first_seq;
+      }
+
+      ++m_count;
+      line& l = last();
+      l.text.clear();
+      l.rows.clear();
+      l.rows.push_back(0);
+      l.first_row = row;
+      l.width = 0;
+      l.last_cp = -1;
+      l.color = m_color;
+    }
+
+    void append(const char* s, std::size_t n) {
+      while (n > 0) {
+        line& l = last();
+        std::size_t room = max_line_bytes - l.text.size();
+        if (room == 0) {
+          new_line();
+          continue;
+        }
+        std::size_t k = (n < room ? n: room);
+        const std::size_t begin = l.text.size();
+        l.text.append(s, k);
+        l.width += measure(l.text, begin, l.last_cp);
+
+        // Only the last row can change
+        const int row = int(l.rows.size())-1;
+        if (l.first_row + row < m_dirty_from)
+          m_dirty_from = l.first_row + row;
+        wrap(l, row);
+
+        s += k;
+        n -= k;
+      }
+    }
+
+    // Width of the text from the "begin" byte, continuing from the
+    // code point "prev"
+    int measure(const std::string& text, std::size_t begin, int& prev) {
+      int width = 0;
+      for (std::size_t i=begin; i<text.size(); ) {
+        int cp = text_details::next_codepoint(text, i);
+        if (prev >= 0)
+          width += m_font.kerning(prev, cp);
+        width += m_font.get(cp).advance;
+        prev = cp;
+      }
+      return width;
+    }
+
+    // Wraps the line from the beginning of the given row
+    void wrap(line& l, int row) {
+      l.rows.resize(row+1);
+      const int w = m_area.w;
+      std::size_t i = l.rows[row];
+      std::size_t space = 0;    // Byte after the last space of the row
+      int x = 0, prev = -1;
+
+      while (i < l.text.size()) {
+        const std::size_t start = i;
+        const int cp = text_details::next_codepoint(l.text, i);
+        int advance = m_font.get(cp).advance;
+        if (prev >= 0)
+          advance += m_font.kerning(prev, cp);
+
+        if (x + advance > w && start > std::size_t(l.rows.back())) {
+          i = (space > std::size_t(l.rows.back()) ? space: start);
+          l.rows.push_back(int(i));
+          x = 0;
+          prev = -1;
+          space = 0;
+          continue;
+        }
+        x += advance;
+        prev = cp;
+        if (cp == ' ')
+          space = i;
+      }
+    }
+
+    // Bytes of the row "r" of the line
+    static void row_range(const line& l, int r, int& begin, int& end) {
+      begin = l.rows[r];
+      end = (r+1 < int(l.rows.size()) ? l.rows[r+1]: int(l.text.size()));
+    }
+
+    // Draws the rows [from, to) of the view that starts in "top"
+    void draw_rows(bitmap& view, long long top, long long from, long long to, rect& damage) {
+      const int lh = m_font.line_height();
+      if (to > end_row())
+        to = end_row();
+      if (from >= to)
+        return;
+
+      int i = index_of_row(from);
+      int r = int(from - get(i).first_row);
+      for (long long row=from; row<to; ++row) {
+        const line& l = get(i);
+        const int y = int(row - top) * lh;
+        bitmap band(m_area.w, lh, view.span(0, y), view.stride());
+        int begin, end;
+        row_range(l, r, begin, end);
+
+        // Text appended to the last drawn row
+        if (row == m_tail.row && m_first_seq+i == m_tail.line &&
+            begin == m_tail.begin && end >= m_tail.end &&
+            row >= m_drawn_top && row < m_drawn_top + visible_rows()) {
+          if (end > m_tail.end) {
+            m_buf.assign(l.text, begin, end-begin);
+            const int w = measure_text(m_font, m_buf);
+            m_buf.erase(0, m_tail.end-begin);
+            const int x = w - measure_text(m_font, m_buf);
+            damage = damage | draw_text(band, m_font, x, 0, m_buf, l.color).offset(0, y);
+          }
+        }
+        else {
+          fill_rect(band, rect(0, 0, m_area.w, lh), m_background);
+          m_buf.assign(l.text, begin, end-begin);
+          draw_text(band, m_font, 0, 0, m_buf, l.color);
+          damage = damage | rect(0, y, m_area.w, lh);
+        }
+
+        if (++r == int(l.rows.size())) {
+          ++i;
+          r = 0;
+        }
+      }
+    }
+
+    // Moves the rows of pixels "dy" pixels up (or down if it's negative)
+    void scroll_pixels(bitmap& view, int dy, int height) {
+      const std::size_t bytes = m_area.w * sizeof(pixel);
+      if (dy > 0) {
+        for (int y=0; y+dy<height; ++y)
+          std::memmove(view.row(y), view.row(y+dy), bytes);
+      }
+      else {
+        for (int y=height-1; y+dy>=0; --y)
+          std::memmove(view.row(y), view.row(y+dy), bytes);
+      }
+    }
+
+    // Draws again the rows that scroll_pixels() moved from the area of
+    // the overlay (they have its pixels instead of the text)
+    void redraw_overlaid_rows(bitmap& view, long long top, int delta, rect& damage) {
+      const rect overlay = (m_overlay & m_area).offset(-m_area.x, -m_area.y);
+      if (overlay.empty())
+        return;
+
+      const int lh = m_font.line_height();
+      const int visible = visible_rows();
+      m_tail.row = -1;          // Whole rows
+      for (int k=0; k<visible; ++k) {
+        const int src = k + delta;
+        if (src >= 0 && src < visible &&
+            src*lh < overlay.y2() && (src+1)*lh > overlay.y)
+          draw_rows(view, top, top+k, top+k+1, damage);
+      }
+    }
+
+    void update_tail(long long top, long long bottom) {
+      const long long row = end_row()-1;
+      m_tail.row = -1;
+      if (row >= top && row < bottom) {
+        const line& l = last();
+        m_tail.row = row;
+        m_tail.line = m_first_seq + m_count-1;
+        row_range(l, int(l.rows.size())-1, m_tail.begin, m_tail.end);
+      }
+    }
+
+    font& m_font;
+    rect m_area;
+    std::vector<line> m_lines;  // Ring buffer
+    int m_first;                // Slot of the oldest line
+    int m_count;
+    long long m_first_seq;      // Sequence number of the oldest line
+    pixel m_background;
+    pixel m_color;
+    long long m_top;            // First row of the view (if it isn't following)
+    bool m_following;
+    bool m_drawn_valid;         // The area shows the rows from m_drawn_top
+    long long m_drawn_top;
+    long long m_dirty_from;     // First row modified since the last render()
+    drawn_tail m_tail;
+    rect m_overlay;             // Area drawn over the console by others
+    long long m_relayouts;
+    std::string m_buf;          // Text of the row being drawn
+
+    // Non-copyable
+    console(const console&);
+    console& operator=(const console&);
+  };
+
+} // namespace ui
+
+#endif // UI_CONSOLE_HEADER_FILE_INCLUDED
@@ -0,0 +1,475 @@
+// ui - Basic User Interface library to do experiments          -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+#ifndef UI_CONVERT_HEADER_FILE_INCLUDED
+#define UI_CONVERT_HEADER_FILE_INCLUDED
+
+#include "ui/raster.h"
+
+#include <cstring>
+
+#if UI_X86_SIMD
+  #include <emmintrin.h>
+#endif
+
+namespace ui {
+
+  //////////////////////////////////////////////////////////////////////
+  // Row converters
+  //
+  // converter<Dst, Src> converts a row of Src pixels to Dst pixels.
+  // The generic loop goes through a premultiplied "pixel", and is
+  // instantiated for each pair of formats, so the compiler sees the
+  // whole conversion without any check of the format in the loop.
+  // Common pairs have SSE2 rows that give the same values; row()
+  // returns the function to use for a SIMD level, so it's selected
+  // once per blit and not per row or pixel.
+
+  namespace convert_details {
+
+    template<class Dst, class Src>
+    struct generic_converter {
+      typedef typename Dst::value_type dst_type;
+      typedef typename Src::value_type src_type;
+      typedef void (*row_fn)(dst_type* dst, const src_type* src, int n);
+
+      static void scalar(dst_type* dst, const src_type* src, int n) {
+        for (int i=0; i<n; ++i)
+          dst[i] = Dst::from_pixel(Src::to_pixel(src[i]));
+      }
+    };
+
+    // SIMD row of a pair of formats (available = 0 if there is none)
+    template<class Dst, class Src>
+    struct sse2_converter {
+      enum { available = 0 };
+      static void run(typename Dst::value_type*, const typename Src::value_type*, int) { }
+    };
+
+#if UI_X86_SIMD
+
+    // Swaps R and B of 4 pixels
+    inline __m128i swap_rb_sse2(__m128i x) {
+      const __m128i ga = _mm_set1_epi32(0xff00ff00);
+      __m128i rb = _mm_andnot_si128(ga, x);
+      rb = _mm_shufflehi_epi16(_mm_shufflelo_epi16(rb, 0xb1), 0xb1);
+      return _mm_or_si128(_mm_and_si128(x, ga), rb);
+    }
+
+    struct swap_rb_sse2_row {
+      enum { available = 1 };
+      static void run(uint32_t* dst, const uint32_t* src, int n) {
+        int i = 0;
+        for (; i+4<=n; i+=4)
+          _mm_storeu_si128((__m128i*)(dst+i),
+                           swap_rb_sse2(_mm_loadu_si128((const __m128i*)(src+i))));
+        for (; i<n; ++i)
+          dst[i] = rgba8_format::to_pixel(src[i]);
+      }
+    };
+
+    template<> struct sse2_converter<rgba8_format, bgra8_format> : swap_rb_sse2_row { };
+    template<> struct sse2_converter<bgra8_format, rgba8_format> : swap_rb_sse2_row { };
+
+    // 4 pixels to 4 rgb565 values in the 32-bit lanes
+    inline __m128i to_rgb565_sse2(__m128i x) {
+      __m128i r = _mm_and_si128(_mm_srli_epi32(x, 8), _mm_set1_epi32(0xf800));
+      __m128i g = _mm_and_si128(_mm_srli_epi32(x, 5), _mm_set1_epi32(0x07e0));
+      __m128i b = _mm_and_si128(_mm_srli_epi32(x, 3), _mm_set1_epi32(0x001f));
+      return _mm_or_si128(_mm_or_si128(r, g), b);
+    }
+
+    template<>
+    struct sse2_converter<rgb565_format, bgra8_format> {
+      enum { available = 1 };
+      static void run(uint16_t* dst, const uint32_t* src, int n) {
+        // Values are biased by 0x8000 so the signed pack doesn't saturate
+        const __m128i bias32 = _mm_set1_epi32(0x8000);
+        const __m128i bias16 = _mm_set1_epi16(-0x8000);
+        int i = 0;
+        for (; i+8<=n; i+=8) {
+          __m128i lo = to_rgb565_sse2(_mm_loadu_si128((const __m128i*)(src+i)));
+          __m128i hi = to_rgb565_sse2(_mm_loadu_si128((const __m128i*)(src+i+4)));
+          __m128i v = _mm_packs_epi32(_mm_sub_epi32(lo, bias32), _mm_sub_epi32(hi, bias32));
+          _mm_storeu_si128((__m128i*)(dst+i), _mm_add_epi16(v, bias16));
+        }
+        for (; i<n; ++i)
+          dst[i] = rgb565_format::from_pixel(src[i]);
+      }
+    };
+
+    template<>
+    struct sse2_converter<bgra8_format, rgb565_format> {
+      enum { available = 1 };
+      static void run(uint32_t* dst, const uint16_t* src, int n) {
+        const __m128i m5 = _mm_set1_epi16(0x1f), m6 = _mm_set1_epi16(0x3f);
+        const __m128i alpha = _mm_set1_epi16(short(0xff00));
+        int i = 0;
+        for (; i+8<=n; i+=8) {
+          __m128i v = _mm_loadu_si128((const __m128i*)(src+i));
+          __m128i r = _mm_and_si128(_mm_srli_epi16(v, 11), m5);
+          __m128i g = _mm_and_si128(_mm_srli_epi16(v, 5), m6);
+          __m128i b = _mm_and_si128(v, m5);
+          r = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+          g = _mm_or_si128(_mm_slli_epi16(g, 2), _mm_srli_epi16(g, 4));
+          b = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+          // B | G<<8 and R | A<<8 interleaved are B, G, R, A bytes
+          __m128i bg = _mm_or_si128(b, _mm_slli_epi16(g, 8));
+          __m128i ra = _mm_or_si128(r, alpha);
+          _mm_storeu_si128((__m128i*)(dst+i), _mm_unpacklo_epi16(bg, ra));
+          _mm_storeu_si128((__m128i*)(dst+i+4), _mm_unpackhi_epi16(bg, ra));
+        }
+        for (; i<n; ++i)
+          dst[i] = rgb565_format::to_pixel(src[i]);
+      }
+    };
+
+    template<>
+    struct sse2_converter<bgra8_format, a8_format> {
+      enum { available = 1 };
+      static void run(uint32_t* dst, const uint8_t* src, int n) {
+        int i = 0;
+        for (; i+16<=n; i+=16) {
+          __m128i a = _mm_loadu_si128((const __m128i*)(src+i));
+          __m128i lo = _mm_unpacklo_epi8(a, a), hi = _mm_unpackhi_epi8(a, a);
+          _mm_storeu_si128((__m128i*)(dst+i), _mm_unpacklo_epi16(lo, lo));
+          _mm_storeu_si128((__m128i*)(dst+i+4), _mm_unpackhi_epi16(lo, lo));
+          _mm_storeu_si128((__m128i*)(dst+i+8), _mm_unpacklo_epi16(hi, hi));
+          _mm_storeu_si128((__m128i*)(dst+i+12), _mm_unpackhi_epi16(hi, hi));
+        }
+        for (; i<n; ++i)
+          dst[i] = a8_format::to_pixel(src[i]);
+      }
+    };
+
+    template<>
+    struct sse2_converter<a8_format, bgra8_format> {
+      enum { available = 1 };
+      static void run(uint8_t* dst, const uint32_t* src, int n) {
+        int i = 0;
+        for (; i+16<=n; i+=16) {
+          __m128i a0 = _mm_srli_epi32(_mm_loadu_si128((const __m128i*)(src+i)), 24);
+          __m128i a1 = _mm_srli_epi32(_mm_loadu_si128((const __m128i*)(src+i+4)), 24);
+          __m128i a2 = _mm_srli_epi32(_mm_loadu_si128((const __m128i*)(src+i+8)), 24);
+          __m128i a3 = _mm_srli_epi32(_mm_loadu_si128((const __m128i*)(src+i+12)), 24);
+          _mm_storeu_si128((__m128i*)(dst+i),
+                           _mm_packus_epi16(_mm_packs_epi32(a0, a1),
+                                            _mm_packs_epi32(a2, a3)));
+        }
+        for (; i<n; ++i)
+          dst[i] = a8_format::from_pixel(src[i]);
+      }
+    };
+
+    // Straight to premultiplied alpha (the inverse needs a division
+    // per channel and uses the generic loop)
+    template<>
+    struct sse2_converter<bgra8_format, bgra8_straight_format> {
+      enum { available = 1 };
+
+      static __m128i premultiply2(__m128i x) {
+        // The alpha lane is multiplied by 255, so it's kept
+        const __m128i keep_alpha = _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0);
+        __m128i f = _mm_or_si128(raster_details::alpha_sse2(x), keep_alpha);
+        return raster_details::mul255_sse2(x, f);
+      }
+
+      static void run(uint32_t* dst, const uint32_t* src, int n) {
+        const __m128i zero = _mm_setzero_si128();
+        int i = 0;
+        for (; i+4<=n; i+=4) {
+          __m128i x = _mm_loadu_si128((const __m128i*)(src+i));
+          __m128i lo = premultiply2(_mm_unpacklo_epi8(x, zero));
+          __m128i hi = premultiply2(_mm_unpackhi_epi8(x, zero));
+          _mm_storeu_si128((__m128i*)(dst+i), _mm_packus_epi16(lo, hi));
+        }
+        for (; i<n; ++i)
+          dst[i] = bgra8_straight_format::to_pixel(src[i]);
+      }
+    };
+
+#endif // UI_X86_SIMD
+
+  } // namespace convert_details
+
+  template<class Dst, class Src>
+  struct converter : convert_details::generic_converter<Dst, Src> {
+    typedef convert_details::generic_converter<Dst, Src> base;
+    typedef convert_details::sse2_converter<Dst, Src> sse2;
+
+    static typename base::row_fn row(simd_level level) {
+      if (sse2::available && level >= simd_sse2)
+        return &sse2::run;
+      return &base::scalar;
+    }
+  };
+
+  // The same format is copied as is
+  template<class Format>
+  struct converter<Format, Format> {
+    typedef typename Format::value_type value_type;
+    typedef void (*row_fn)(value_type* dst, const value_type* src, int n);
+
+    static void scalar(value_type* dst, const value_type* src, int n) {
+      std::memcpy(dst, src, n*sizeof(value_type));
+    }
+
+    static row_fn row(simd_level) {
+      return &scalar;
+    }
+  };
+
+  //////////////////////////////////////////////////////////////////////
+  // Fill and blend kernels of any format
+  //
+  // Blending is done with 32bpp premultiplied pixels: rows of other
+  // formats are converted to a small buffer on the stack, blended with
+  // the raster kernels of the current SIMD level, and converted back.
+  // The result is the same as blend_row<Op, Dst, Src>::scalar(), the
+  // reference loop that converts each pixel.
+
+  namespace convert_details {
+
+    template<class Format>
+    struct fill_row {
+      static void run(typename Format::value_type* dst, int n,
+                      typename Format::value_type value) {
+        for (int i=0; i<n; ++i)
+          dst[i] = value;
+      }
+    };
+
+    // 32bpp formats use the raster kernel, 8bpp memset()
+    template<> struct fill_row<bgra8_format> {
+      static void run(uint32_t* dst, int n, uint32_t value) { kernels().fill(dst, n, value); }
+    };
+    template<> struct fill_row<bgra8_straight_format> : fill_row<bgra8_format> { };
+    template<> struct fill_row<rgba8_format> : fill_row<bgra8_format> { };
+
+    template<> struct fill_row<a8_format> {
+      static void run(uint8_t* dst, int n, uint8_t value) { std::memset(dst, value, n); }
+    };
+
+    template<blend_op Op, class Dst, class Src>
+    struct blend_row {
+      static void scalar(typename Dst::value_type* dst,
+                         const typename Src::value_type* src, int n) {
+        for (int i=0; i<n; ++i)
+          dst[i] = Dst::from_pixel(
+            raster_details::blend_pixel<Op>(Src::to_pixel(src[i]), Dst::to_pixel(dst[i])));
+      }
+    };
+
+    // Pixels converted in each step of a staged blend
+    static const int stage_size = 256;
+
+    // Rows of a format as 32bpp premultiplied pixels: bgra8 rows are
+    // used directly, other formats go through the given buffer
+    template<class Format>
+    struct stage {
+      typedef typename Format::value_type value_type;
+      typename converter<bgra8_format, Format>::row_fn load;
+      typename converter<Format, bgra8_format>::row_fn store;
+
+      explicit stage(simd_level level)
+        : load(converter<bgra8_format, Format>::row(level))
+        , store(converter<Format, bgra8_format>::row(level)) { }
+
+      pixel* get(value_type* p, pixel* buf, int n) const { load(buf, p, n); return buf; }
+      const pixel* get(const value_type* p, pixel* buf, int n) const { load(buf, p, n); return buf; }
+      void put(value_type* p, const pixel* buf, int n) const { store(p, buf, n); }
+    };
+
+    template<>
+    struct stage<bgra8_format> {
+      explicit stage(simd_level) { }
+      pixel* get(pixel* p, pixel*, int) const { return p; }
+      const pixel* get(const pixel* p, pixel*, int) const { return p; }
+      void put(pixel*, const pixel*, int) const { }
+    };
+
+    template<class Dst, class Src>
+    struct blender {
+      stage<Dst> dst_stage;
+      stage<Src> src_stage;
+      raster_kernels::blend_fn blend;
+
+      blender(blend_op op, simd_level level)
+        : dst_stage(level)
+        , src_stage(level)
+        , blend(raster_kernels_for(level).blend[op]) { }
+
+      void run(typename Dst::value_type* dst, const typename Src::value_type* src, int n) const {
+        pixel dst_buf[stage_size], src_buf[stage_size];
+        for (int i=0; i<n; i+=stage_size) {
+          const int m = (n-i < stage_size ? n-i: stage_size);
+          pixel* d = dst_stage.get(dst+i, dst_buf, m);
+          blend(d, src_stage.get(src+i, src_buf, m), m);
+          dst_stage.put(dst+i, d, m);
+        }
+      }
+    };
+
+    template<class Format>
+    inline rect bounds(const basic_bitmap<Format>& bmp) {
+      return rect(0, 0, bmp.width(), bmp.height());
+    }
+
+    // Clips a blit of "src_rc" at (x, y), "d" is the destination area
+    // and "s" the source area of the same size
+    inline bool clip_blit(const rect& dst_bounds, int x, int y,
+                          const rect& src_bounds, const rect& src_rc,
+                          rect& d, rect& s) {
+      s = src_rc & src_bounds;
+      x += s.x - src_rc.x;
+      y += s.y - src_rc.y;
+      d = rect(x, y, s.w, s.h) & dst_bounds;
+      s.x += d.x - x;
+      s.y += d.y - y;
+      s.w = d.w;
+      s.h = d.h;
+      return !d.empty();
+    }
+
+  } // namespace convert_details
+
+  //////////////////////////////////////////////////////////////////////
+  // Drawing functions for bitmaps of any format
+  //
+  // Colors are given as premultiplied pixels and converted to the
+  // format of the bitmap once. The functions of ui/raster.h are used
+  // for bitmap (bgra8) to bitmap calls.
+
+  template<class Format>
+  inline void fill_rect(basic_bitmap<Format>& bmp, const rect& rc, pixel color) {
+    rect r = rc & convert_details::bounds(bmp);
+    if (r.empty())
+      return;
+
+    const typename Format::value_type value = Format::from_pixel(color);
+    for (int y=r.y; y<r.y2(); ++y)
+      convert_details::fill_row<Format>::run(bmp.span(r.x, y), r.w, value);
+  }
+
+  // Copies the "src_rc" area of "src" to (x, y) in "dst" converting
+  // the pixels to the format of "dst"
+  template<class Dst, class Src>
+  inline void blit(basic_bitmap<Dst>& dst, int x, int y,
+                   const basic_bitmap<Src>& src, const rect& src_rc) {
+    rect d, s;
+    if (!convert_details::clip_blit(convert_details::bounds(dst), x, y,
+                                    convert_details::bounds(src), src_rc, d, s))
+      return;
+
+    typename converter<Dst, Src>::row_fn convert =
+      converter<Dst, Src>::row(current_simd_level());
+    for (int v=0; v<d.h; ++v)
+      convert(dst.span(d.x, d.y+v), src.span(s.x, s.y+v), d.w);
+  }
+
+  // Composites the "src_rc" area of "src" at (x, y) in "dst"
+  template<class Dst, class Src>
+  inline void blit(basic_bitmap<Dst>& dst, int x, int y,
+                   const basic_bitmap<Src>& src, const rect& src_rc, blend_op op) {
+    rect d, s;
+    if (!convert_details::clip_blit(convert_details::bounds(dst), x, y,
+                                    convert_details::bounds(src), src_rc, d, s))
+      return;
+
+    const convert_details::blender<Dst, Src> blender(op, current_simd_level());
+    for (int v=0; v<d.h; ++v)
+      blender.run(dst.span(d.x, d.y+v), src.span(s.x, s.y+v), d.w);
+  }
+
+  template<class Dst, class Src>
+  inline void blit(basic_bitmap<Dst>& dst, int x, int y, const basic_bitmap<Src>& src,
+                   blend_op op = blend_src_over) {
+    blit(dst, x, y, src, convert_details::bounds(src), op);
+  }
+
+  //////////////////////////////////////////////////////////////////////
+  // pixel_buffer struct
+  //
+  // Pixels of a format known at runtime, for the boundaries of the
+  // library (e.g. the framebuffer of a 16-bit visual, or the pixels
+  // of a texture to upload). convert() selects the converter of the
+  // pair of formats once, all the rows are converted with it.
+
+  struct pixel_buffer {
+    pixel_format format;
+    int width;
+    int height;
+    int stride;                 // Bytes from one row to the next one
+    void* bits;
+
+    pixel_buffer(pixel_format format, int width, int height, int stride, void* bits)
+      : format(format), width(width), height(height), stride(stride), bits(bits) { }
+
+    template<class Format>
+    explicit pixel_buffer(basic_bitmap<Format>& bmp)
+      : format(Format::id)
+      , width(bmp.width())
+      , height(bmp.height())
+      , stride(bmp.stride())
+      , bits(bmp.row(0)) { }
+
+    uint8_t* row(int y) const {
+      return static_cast<uint8_t*>(bits) + std::ptrdiff_t(stride) * y;
+    }
+  };
+
+  namespace convert_details {
+
+    typedef void (*convert_fn)(const pixel_buffer& dst, const pixel_buffer& src,
+                               int w, int h, simd_level level);
+
+    template<class Dst, class Src>
+    void convert_buffer(const pixel_buffer& dst, const pixel_buffer& src,
+                        int w, int h, simd_level level) {
+      typedef typename Dst::value_type dst_type;
+      typedef typename Src::value_type src_type;
+      typename converter<Dst, Src>::row_fn convert = converter<Dst, Src>::row(level);
+      for (int y=0; y<h; ++y)
+        convert(reinterpret_cast<dst_type*>(dst.row(y)),
+                reinterpret_cast<const src_type*>(src.row(y)), w);
+    }
+
+    // Table of converters of all the pairs of formats
+    template<int D = 0, int S = 0>
+    struct convert_table {
+      static void fill(convert_fn (&table)[format_count][format_count]) {
+        table[D][S] = &convert_buffer<typename format_traits<pixel_format(D)>::type,
+                                      typename format_traits<pixel_format(S)>::type>;
+        convert_table<(S+1 < format_count ? D: D+1),
+                      (S+1 < format_count ? S+1: 0)>::fill(table);
+      }
+    };
+
+    template<>
+    struct convert_table<format_count, 0> {
+      static void fill(convert_fn (&)[format_count][format_count]) { }
+    };
+
+    struct convert_functions {
+      convert_fn table[format_count][format_count];
+      convert_functions() { convert_table<>::fill(table); }
+    };
+
+  } // namespace convert_details
+
+  // Converts the pixels of "src" to the format of "dst" (the common
+  // area of both buffers, from the top-left corner)
+  inline void convert(const pixel_buffer& dst, const pixel_buffer& src) {
+    static const convert_details::convert_functions functions;
+    const int w = std::min(dst.width, src.width);
+    const int h = std::min(dst.height, src.height);
+    if (w > 0 && h > 0)
+      functions.table[dst.format][src.format](dst, src, w, h, current_simd_level());
+  }
+
+} // namespace ui
+
+#endif // UI_CONVERT_HEADER_FILE_INCLUDED
@@ -0,0 +1,93 @@
+// ui - Basic User Interface library to do experiments          -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+#ifndef UI_CPU_HEADER_FILE_INCLUDED
+#define UI_CPU_HEADER_FILE_INCLUDED
+
+// UI_X86_SIMD is 1 when SSE2 is available at compile time (always on
+// x86-64), in that case the AVX2 kernels are compiled too and selected
+// at runtime if the CPU supports them.
+#if defined(__x86_64__) || defined(_M_X64) || \
+    (defined(__i386__) && defined(__SSE2__)) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define UI_X86_SIMD 1
+#else
+  #define UI_X86_SIMD 0
+#endif
+
+#if UI_X86_SIMD
+  #ifdef _MSC_VER
+    #include <intrin.h>
+    #define UI_TARGET_AVX2
+  #else
+    #include <cpuid.h>
+    #define UI_TARGET_AVX2 __attribute__((target("avx2")))
+  #endif
+#endif
+
+namespace ui {
+
+  enum simd_level {
+    simd_scalar,
+    simd_sse2,
+    simd_avx2
+  };
+
+  inline const char* simd_level_name(simd_level level) {
+    switch (level) {
+      case simd_sse2: return "sse2";
+      case simd_avx2: return "avx2";
+      default: return "scalar";
+    }
+  }
+
+  // Returns the best SIMD level supported by the CPU and the OS
+  inline simd_level detect_simd_level() {
+#if UI_X86_SIMD
+    unsigned int eax, ebx, ecx, edx;
+  #ifdef _MSC_VER
+    int regs[4];
+    __cpuid(regs, 0);
+    unsigned int max_leaf = regs[0];
+    __cpuid(regs, 1);
+    ecx = regs[2];
+  #else
+    unsigned int max_leaf = __get_cpuid_max(0, NULL);
+    __cpuid(1, eax, ebx, ecx, edx);
+  #endif
+
+    // AVX2 needs the OS to save YMM registers (OSXSAVE + XCR0 bits 1-2)
+    bool avx_os = false;
+    if ((ecx & (1 << 27)) && (ecx & (1 << 28))) {
+  #ifdef _MSC_VER
+      unsigned long long xcr0 = _xgetbv(0);
+  #else
+      unsigned int xlo, xhi;
+      __asm__ volatile ("xgetbv" : "=a"(xlo), "=d"(xhi) : "c"(0));
+      unsigned long long xcr0 = xlo | ((unsigned long long)xhi << 32);
+  #endif
+      avx_os = ((xcr0 & 6) == 6);
+    }
+
+    if (avx_os && max_leaf >= 7) {
+  #ifdef _MSC_VER
+      __cpuidex(regs, 7, 0);
+      ebx = regs[1];
+  #else
+      __cpuid_count(7, 0, eax, ebx, ecx, edx);
+  #endif
+      if (ebx & (1 << 5))
+        return simd_avx2;
+    }
+    return simd_sse2;
+#else
+    return simd_scalar;
+#endif
+  }
+
+} // namespace ui
+
+#endif // UI_CPU_HEADER_FILE_INCLUDED
@@ -0,0 +1,139 @@
+// ui - Basic User Interface library to do experiments          -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+#ifndef UI_DAMAGE_HEADER_FILE_INCLUDED
+#define UI_DAMAGE_HEADER_FILE_INCLUDED
+
+#include "ui/rect.h"
+
+#include <cstddef>
+#include <vector>
+
+namespace ui {
+
+  //////////////////////////////////////////////////////////////////////
+  // damage_region class
+  //
+  // Set of modified (dirty) rectangles of a bitmap that must be
+  // presented. Rectangles are clipped to the bitmap bounds and never
+  // overlap: a new rectangle is merged with the ones it touches, and
+  // with the ones that can be joined wasting few pixels (e.g. the
+  // glyphs of one line of text). When there are more than max_rects
+  // rectangles, the pair that wastes less area when merged is joined,
+  // so presenting the region needs a bounded number of copies.
+
+  class damage_region {
+    rect m_clip;
+    std::vector<rect> m_rects;
+    std::size_t m_max_rects;
+
+  public:
+    explicit damage_region(const rect& clip = rect(), std::size_t max_rects = 16)
+      : m_clip(clip)
+      , m_max_rects(max_rects > 0 ? max_rects: 1) {
+    }
+
+    const rect& clip() const { return m_clip; }
+    void set_clip(const rect& clip) { m_clip = clip; }
+
+    bool empty() const { return m_rects.empty(); }
+    std::size_t size() const { return m_rects.size(); }
+    std::size_t max_rects() const { return m_max_rects; }
+
+    const std::vector<rect>& rects() const {
+      return m_rects;
+    }
+
+    // Number of dirty pixels (rectangles don't overlap)
+    long long area() const {
+      long long a = 0;
+      for (std::size_t i=0; i<m_rects.size(); ++i)
+        a += m_rects[i].area();
+      return a;
+    }
+
+    rect bounds() const {
+      rect r;
+      for (std::size_t i=0; i<m_rects.size(); ++i)
+        r = r | m_rects[i];
+      return r;
+    }
+
+    bool intersects(const rect& rc) const {
+      for (std::size_t i=0; i<m_rects.size(); ++i)
+        if (m_rects[i].intersects(rc))
+          return true;
+      return false;
+    }
+
+    void add(const rect& rc) {
+      rect r = rc & m_clip;
+      if (r.empty())
+        return;
+
+      for (std::size_t i=0; i<m_rects.size(); ++i)
+        if (m_rects[i].contains(r))
+          return;
+
+      // Merge with the rectangles that intersect or can be coalesced
+      // with the new one (until there is nothing else to merge)
+      for (std::size_t i=0; i<m_rects.size(); ) {
+        if (m_rects[i].intersects(r) || waste(m_rects[i], r)*8 <= sum(m_rects[i], r)) {
+          r = r | m_rects[i];
+          m_rects.erase(m_rects.begin()+i);
+          i = 0;
+        }
+        else
+          ++i;
+      }
+      m_rects.push_back(r);
+
+      // Too many rectangles, join the pair that wastes less area
+      if (m_rects.size() > m_max_rects) {
+        std::size_t a = 0, b = 1;
+        long long best = -1;
+        for (std::size_t i=0; i<m_rects.size(); ++i)
+          for (std::size_t j=i+1; j<m_rects.size(); ++j) {
+            long long w = waste(m_rects[i], m_rects[j]);
+            if (best < 0 || w < best) {
+              best = w;
+              a = i;
+              b = j;
+            }
+          }
+
+        r = m_rects[a] | m_rects[b];
+        m_rects.erase(m_rects.begin()+b);
+        m_rects.erase(m_rects.begin()+a);
+        add(r);
+      }
+    }
+
+    // Marks the whole clipping rectangle as dirty
+    void add_all() {
+      m_rects.clear();
+      if (!m_clip.empty())
+        m_rects.push_back(m_clip);
+    }
+
+    void clear() {
+      m_rects.clear();
+    }
+
+  private:
+    static long long sum(const rect& a, const rect& b) {
+      return (long long)a.area() + b.area();
+    }
+
+    // Pixels of the bounding box of both rectangles that aren't dirty
+    static long long waste(const rect& a, const rect& b) {
+      return (long long)(a | b).area() - sum(a, b) + (a & b).area();
+    }
+  };
+
+} // namespace ui
+
+#endif // UI_DAMAGE_HEADER_FILE_INCLUDED
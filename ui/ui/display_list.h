@@ -0,0 +1,498 @@
+// ui - Basic User Interface library to do experiments          -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+#ifndef UI_DISPLAY_LIST_HEADER_FILE_INCLUDED
+#define UI_DISPLAY_LIST_HEADER_FILE_INCLUDED
+
+#include "ui/bitmap.h"
+#include "ui/damage.h"
+#include "ui/raster.h"
+#include "ui/rect.h"
+#include "ui/text.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace ui {
+
+  //////////////////////////////////////////////////////////////////////
+  // display_list class
+  //
+  // Recorded drawing commands that can be replayed any number of times
+  // (e.g. the content of a widget that doesn't change each frame).
+  // Commands are packed in one contiguous byte stream: a fixed header
+  // (type, size and bounds) followed by the arguments, and the bytes
+  // of the text for draw_text().
+  //
+  // optimize() reorders the commands to group the ones with the same
+  // state (type, color, font, source bitmap), so replay() uses the
+  // same glyph atlas or color for long runs, and merges adjacent
+  // fills of the same color in one rectangle. A command is only moved
+  // before commands that don't touch its bounds, so the result is the
+  // same pixels.
+  //
+  // Blit sources and fonts must be alive (and glyphs are loaded at
+  // record time) while the list is replayed.
+
+  class display_list {
+    enum command_type {
+      cmd_fill,
+      cmd_blend,
+      cmd_gradient,
+      cmd_copy,
+      cmd_blit,
+      cmd_line,
+      cmd_line_aa,
+      cmd_text
+    };
+
+    struct header {
+      int type;
+      int size;                 // Bytes of the whole command (multiple of 8)
+      rect bounds;              // Affected pixels
+    };
+
+    struct rect_args {          // fill/blend/gradient
+      rect rc;
+      pixel c0, c1;
+      int op;                   // blend_op or gradient_direction
+    };
+
+    struct blit_args {          // copy/blit
+      const bitmap* src;
+      rect src_rc;
+      int x, y;
+      int op;
+    };
+
+    struct line_args {          // line/line_aa
+      double x0, y0, x1, y1;
+      pixel color;
+    };
+
+    struct text_args {          // Followed by "length" bytes
+      font* fnt;
+      int x, y;
+      pixel color;
+      int length;
+    };
+
+    std::vector<uint8_t> m_stream;
+    std::size_t m_count;
+    rect m_bounds;
+
+  public:
+    display_list()
+      : m_count(0) {
+    }
+
+    bool empty() const { return m_count == 0; }
+
+    // Number of commands
+    std::size_t size() const { return m_count; }
+
+    // Size of the command stream in bytes
+    std::size_t bytes() const { return m_stream.size(); }
+
+    // Area affected by all the commands
+    const rect& bounds() const { return m_bounds; }
+
+    void clear() {
+      m_stream.clear();
+      m_count = 0;
+      m_bounds = rect();
+    }
+
+    void fill_rect(const rect& rc, pixel color) {
+      rect_args a = { rc, color, 0, 0 };
+      add(cmd_fill, rc, a);
+    }
+
+    void blend_rect(const rect& rc, pixel color, blend_op op = blend_src_over) {
+      rect_args a = { rc, color, 0, op };
+      add(cmd_blend, rc, a);
+    }
+
+    void fill_gradient(const rect& rc, pixel c0, pixel c1, gradient_direction dir) {
+      rect_args a = { rc, c0, c1, dir };
+      add(cmd_gradient, rc, a);
+    }
+
+    void blit(int x, int y, const bitmap& src, const rect& src_rc) {
+      blit_args a = { &src, src_rc, x, y, 0 };
+      add(cmd_copy, blit_bounds(x, y, src, src_rc), a);
+    }
+
+    void blit(int x, int y, const bitmap& src, const rect& src_rc, blend_op op) {
+      blit_args a = { &src, src_rc, x, y, op };
+      add(cmd_blit, blit_bounds(x, y, src, src_rc), a);
+    }
+
+    void blit(int x, int y, const bitmap& src, blend_op op = blend_src_over) {
+      blit(x, y, src, rect(0, 0, src.width(), src.height()), op);
+    }
+
+    void draw_line(int x0, int y0, int x1, int y1, pixel color) {
+      line_args a = { double(x0), double(y0), double(x1), double(y1), color };
+      add(cmd_line, rect(std::min(x0, x1), std::min(y0, y1),
+                         std::abs(x1-x0)+1, std::abs(y1-y0)+1), a);
+    }
+
+    void draw_line_aa(double x0, double y0, double x1, double y1, pixel color) {
+      line_args a = { x0, y0, x1, y1, color };
+      // With a margin for the rounded end points and the coverage of
+      // the neighbor pixels
+      const int left = int(std::floor(std::min(x0, x1))) - 2;
+      const int top = int(std::floor(std::min(y0, y1))) - 2;
+      const int right = int(std::ceil(std::max(x0, x1))) + 3;
+      const int bottom = int(std::ceil(std::max(y0, y1))) + 3;
+      add(cmd_line_aa, rect(left, top, right-left, bottom-top), a);
+    }
+
+    void draw_text(font& f, int x, int y, const std::string& text, pixel color) {
+      text_args a = { &f, x, y, color, int(text.size()) };
+      add(cmd_text, text_bounds(f, x, y, text), a, text.data(), text.size());
+    }
+
+    // Groups the commands by state and merges adjacent fills
+    void optimize() {
+      using std::size_t;
+
+      std::vector<size_t> order;    // Offsets of the commands in the new order
+                                    // (without the merged ones)
+      order.reserve(m_count);
+      for (size_t pos=0; pos<m_stream.size(); ) {
+        const header h = get<header>(pos);
+        place(order, pos);
+        pos += h.size;
+      }
+
+      std::vector<uint8_t> stream;
+      stream.reserve(m_stream.size());
+      for (size_t i=0; i<order.size(); ++i) {
+        const header h = get<header>(order[i]);
+        stream.insert(stream.end(),
+                      m_stream.begin()+order[i],
+                      m_stream.begin()+order[i]+h.size);
+      }
+      m_stream.swap(stream);
+      m_count = order.size();
+    }
+
+    // Executes all the commands
+    void replay(bitmap& target) const {
+      replay(target, rect(0, 0, target.width(), target.height()));
+    }
+
+    // Executes the commands that touch "clip", only modifying the
+    // pixels inside it (to redraw an invalidated area)
+    void replay(bitmap& target, const rect& clip) const {
+      const rect area = clip & rect(0, 0, target.width(), target.height());
+      if (area.empty() || !area.intersects(m_bounds))
+        return;
+
+      // A bitmap that wraps the clipped area (coordinates are
+      // translated to its origin)
+      bitmap view(area.w, area.h, target.span(area.x, area.y), target.stride());
+      const int ox = area.x, oy = area.y;
+
+      for (std::size_t pos=0; pos<m_stream.size(); ) {
+        const header h = get<header>(pos);
+        const std::size_t args = pos + sizeof(header);
+        pos += h.size;
+        if (!h.bounds.intersects(area))
+          continue;
+
+        switch (h.type) {
+          case cmd_fill: {
+            const rect_args a = get<rect_args>(args);
+            ui::fill_rect(view, offset(a.rc, ox, oy), a.c0);
+            break;
+          }
+          case cmd_blend: {
+            const rect_args a = get<rect_args>(args);
+            ui::blend_rect(view, offset(a.rc, ox, oy), a.c0, blend_op(a.op));
+            break;
+          }
+          case cmd_gradient: {
+            const rect_args a = get<rect_args>(args);
+            ui::fill_gradient(view, offset(a.rc, ox, oy), a.c0, a.c1,
+                              gradient_direction(a.op));
+            break;
+          }
+          case cmd_copy: {
+            const blit_args a = get<blit_args>(args);
+            ui::blit(view, a.x-ox, a.y-oy, *a.src, a.src_rc);
+            break;
+          }
+          case cmd_blit: {
+            const blit_args a = get<blit_args>(args);
+            ui::blit(view, a.x-ox, a.y-oy, *a.src, a.src_rc, blend_op(a.op));
+            break;
+          }
+          case cmd_line: {
+            const line_args a = get<line_args>(args);
+            ui::draw_line(view, int(a.x0)-ox, int(a.y0)-oy,
+                          int(a.x1)-ox, int(a.y1)-oy, a.color);
+            break;
+          }
+          case cmd_line_aa: {
+            const line_args a = get<line_args>(args);
+            raster_details::draw_line_aa(target, area, a.x0, a.y0, a.x1, a.y1, a.color);
+            break;
+          }
+          case cmd_text: {
+            const text_args a = get<text_args>(args);
+            const char* text = reinterpret_cast<const char*>(&m_stream[args + sizeof(text_args)]);
+            ui::draw_text(view, *a.fnt, a.x-ox, a.y-oy,
+                          std::string(text, a.length), a.color);
+            break;
+          }
+        }
+      }
+    }
+
+  private:
+    // How many commands optimize() looks back to find one with the
+    // same state
+    static const int max_lookback = 64;
+
+    template<class T>
+    T get(std::size_t pos) const {
+      T value;
+      std::memcpy(&value, &m_stream[pos], sizeof(T));
+      return value;
+    }
+
+    template<class T>
+    void set(std::size_t pos, const T& value) {
+      std::memcpy(&m_stream[pos], &value, sizeof(T));
+    }
+
+    template<class T>
+    void add(command_type type, const rect& bounds, const T& args,
+             const void* extra = NULL, std::size_t extra_size = 0) {
+      header h;
+      h.type = type;
+      h.size = int((sizeof(header) + sizeof(T) + extra_size + 7) & ~std::size_t(7));
+      h.bounds = bounds;
+
+      const std::size_t pos = m_stream.size();
+      m_stream.resize(pos + h.size, 0);
+      set(pos, h);
+      set(pos + sizeof(header), args);
+      if (extra_size)
+        std::memcpy(&m_stream[pos + sizeof(header) + sizeof(T)], extra, extra_size);
+
+      m_bounds = m_bounds | bounds;
+      ++m_count;
+    }
+
+    static rect offset(const rect& rc, int dx, int dy) {
+      return rect(rc.x-dx, rc.y-dy, rc.w, rc.h);
+    }
+
+    static rect blit_bounds(int x, int y, const bitmap& src, const rect& src_rc) {
+      rect s = src_rc & rect(0, 0, src.width(), src.height());
+      return rect(x + s.x - src_rc.x, y + s.y - src_rc.y, s.w, s.h);
+    }
+
+    // True if both commands use the same state (they are executed one
+    // after the other with the same color/font/source)
+    bool same_state(std::size_t a, std::size_t b) const {
+      const header ha = get<header>(a), hb = get<header>(b);
+      if (ha.type != hb.type)
+        return false;
+      const std::size_t aa = a + sizeof(header), ab = b + sizeof(header);
+      switch (ha.type) {
+        case cmd_fill:
+        case cmd_blend: {
+          const rect_args x = get<rect_args>(aa), y = get<rect_args>(ab);
+          return x.c0 == y.c0 && x.op == y.op;
+        }
+        case cmd_gradient:
+          return false;
+        case cmd_copy:
+        case cmd_blit: {
+          const blit_args x = get<blit_args>(aa), y = get<blit_args>(ab);
+          return x.src == y.src && x.op == y.op;
+        }
+        case cmd_line:
+        case cmd_line_aa:
+          return get<line_args>(aa).color == get<line_args>(ab).color;
+        case cmd_text: {
+          const text_args x = get<text_args>(aa), y = get<text_args>(ab);
+          return x.fnt == y.fnt && x.color == y.color;
+        }
+      }
+      return false;
+    }
+
+    // Adds the command at "pos" to the new order: merged with a
+    // previous command or after the last one with the same state if
+    // there is nothing in between that touches its bounds, in other
+    // case at the end
+    void place(std::vector<std::size_t>& order, std::size_t pos) {
+      const rect bounds = get<header>(pos).bounds;
+      const int n = int(order.size());
+      int after = -1;
+      for (int j=n-1; j>=0 && j>=n-max_lookback; --j) {
+        if (same_state(order[j], pos)) {
+          if (merge(order[j], pos))
+            return;
+          if (after < 0)
+            after = j;
+        }
+        if (get<header>(order[j]).bounds.intersects(bounds))
+          break;
+      }
+      if (after < 0)
+        order.push_back(pos);
+      else
+        order.insert(order.begin()+after+1, pos);
+    }
+
+    // Joins two fills of the same color that form a rectangle (the
+    // command at "b" is dropped)
+    bool merge(std::size_t a, std::size_t b) {
+      header ha = get<header>(a);
+      if (ha.type != cmd_fill && ha.type != cmd_blend)
+        return false;
+
+      rect_args ra = get<rect_args>(a + sizeof(header));
+      const rect_args rb = get<rect_args>(b + sizeof(header));
+      const rect& x = ra.rc;
+      const rect& y = rb.rc;
+      if (x.empty() || y.empty() || x.intersects(y))
+        return false;
+      if (!((x.y == y.y && x.h == y.h && (x.x2() == y.x || y.x2() == x.x)) ||
+            (x.x == y.x && x.w == y.w && (x.y2() == y.y || y.y2() == x.y))))
+        return false;
+
+      ra.rc = x | y;
+      ha.bounds = ra.rc;
+      set(a, ha);
+      set(a + sizeof(header), ra);
+      return true;
+    }
+  };
+
+  //////////////////////////////////////////////////////////////////////
+  // scene class
+  //
+  // Retained content of a window: a stack of layers (e.g. one per
+  // widget), each one with a display_list that is recorded again only
+  // when the widget changes. render() redraws only the damaged areas
+  // (the old and new bounds of the changed layers) replaying the
+  // layers that touch them, so a frame where nothing changed costs
+  // nothing.
+
+  class scene {
+    struct layer {
+      display_list list;
+      rect drawn;               // Bounds when it was rendered
+      bool dirty;
+      bool visible;
+    };
+
+    std::vector<layer*> m_layers;
+    damage_region m_damage, m_rendered;
+    pixel m_background;
+
+  public:
+    scene(int width, int height, pixel background = rgba(0, 0, 0))
+      : m_damage(rect(0, 0, width, height))
+      , m_rendered(m_damage.clip())
+      , m_background(background) {
+      m_damage.add_all();
+    }
+
+    ~scene() {
+      for (std::size_t i=0; i<m_layers.size(); ++i)
+        delete m_layers[i];
+    }
+
+    // Adds a layer over the others, returns its ID
+    int add_layer() {
+      layer* l = new layer;
+      l->dirty = false;
+      l->visible = true;
+      m_layers.push_back(l);
+      return int(m_layers.size()-1);
+    }
+
+    int layers() const { return int(m_layers.size()); }
+
+    // Returns the empty display list of the layer to record its new
+    // content
+    display_list& record(int id) {
+      layer* l = m_layers[id];
+      m_damage.add(l->drawn);
+      l->list.clear();
+      l->dirty = true;
+      return l->list;
+    }
+
+    const display_list& list(int id) const {
+      return m_layers[id]->list;
+    }
+
+    void set_visible(int id, bool visible) {
+      layer* l = m_layers[id];
+      if (l->visible != visible) {
+        l->visible = visible;
+        invalidate(id);
+      }
+    }
+
+    // Redraws the layer without recording it again (e.g. if a bitmap
+    // used in a blit changed)
+    void invalidate(int id) {
+      m_damage.add(m_layers[id]->list.bounds());
+    }
+
+    void invalidate(const rect& rc) {
+      m_damage.add(rc);
+    }
+
+    // Redraws the damaged areas, returns them (to invalidate them in
+    // the window)
+    const damage_region& render(bitmap& target) {
+      for (std::size_t i=0; i<m_layers.size(); ++i) {
+        layer* l = m_layers[i];
+        if (l->dirty) {
+          l->list.optimize();
+          l->drawn = l->list.bounds();
+          m_damage.add(l->drawn);
+          l->dirty = false;
+        }
+      }
+
+      const std::vector<rect>& rects = m_damage.rects();
+      for (std::size_t r=0; r<rects.size(); ++r) {
+        ui::fill_rect(target, rects[r], m_background);
+        for (std::size_t i=0; i<m_layers.size(); ++i)
+          if (m_layers[i]->visible)
+            m_layers[i]->list.replay(target, rects[r]);
+      }
+
+      std::swap(m_rendered, m_damage);
+      m_damage.clear();
+      return m_rendered;
+    }
+
+  private:
+    // Non-copyable
+    scene(const scene&);
+    scene& operator=(const scene&);
+  };
+
+} // namespace ui
+
+#endif // UI_DISPLAY_LIST_HEADER_FILE_INCLUDED
@@ -0,0 +1,152 @@
+// ui - Basic User Interface library to do experiments          -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+#ifndef UI_EVENT_HEADER_FILE_INCLUDED
+#define UI_EVENT_HEADER_FILE_INCLUDED
+
+#include "mt/futex.h"
+#include "chrono.h"
+
+#include <atomic>
+
+namespace ui {
+
+  //////////////////////////////////////////////////////////////////////
+  // event struct
+
+  enum event_type {
+    event_none,
+    event_key_down,             // key
+    event_key_up,               // key
+    event_mouse_move,           // x, y
+    event_mouse_down,           // x, y, button
+    event_mouse_up,             // x, y, button
+    event_resize,               // width, height
+    event_close,
+    event_user                  // Posted with window::post_event()
+  };
+
+  enum mouse_button {
+    button_none,
+    button_left,
+    button_middle,
+    button_right
+  };
+
+  struct event {
+    event_type type;
+    int key;                    // Virtual key code (win32) or keysym (X11)
+    int x, y;
+    int button;
+    int width, height;
+    long data;                  // Free for event_user
+
+    explicit event(event_type type = event_none)
+      : type(type), key(0), x(0), y(0), button(button_none)
+      , width(0), height(0), data(0) {
+    }
+  };
+
+  //////////////////////////////////////////////////////////////////////
+  // event_queue class
+  //
+  // Unbounded multiple-producer single-consumer queue of events. Any
+  // thread can push() (the UI thread translating native messages,
+  // workers with post_event()), only the owner of the window pops.
+  //
+  // It's the intrusive Vyukov MPSC queue: a push is one exchange() on
+  // the head and one store, so producers never wait for each other or
+  // for the consumer. The consumer sleeps in a futex on m_pushes, a
+  // counter incremented after each node is linked, so an idle window
+  // uses no CPU at all.
+
+  class event_queue {
+    struct node {
+      std::atomic<node*> next;
+      event ev;
+    };
+
+    std::atomic<node*> m_head;  // Last pushed node (producers)
+    node* m_tail;               // Stub/last popped node (consumer)
+    mt::futex::word m_pushes;
+    std::atomic<int> m_waiters;
+
+  public:
+    event_queue()
+      : m_pushes(0)
+      , m_waiters(0) {
+      node* stub = new node;
+      stub->next.store(NULL, std::memory_order_relaxed);
+      m_head.store(stub, std::memory_order_relaxed);
+      m_tail = stub;
+    }
+
+    ~event_queue() {
+      while (m_tail) {
+        node* next = m_tail->next.load(std::memory_order_relaxed);
+        delete m_tail;
+        m_tail = next;
+      }
+    }
+
+    void push(const event& ev) {
+      node* n = new node;
+      n->ev = ev;
+      n->next.store(NULL, std::memory_order_relaxed);
+      node* prev = m_head.exchange(n, std::memory_order_acq_rel);
+      prev->next.store(n, std::memory_order_release);
+
+      m_pushes.fetch_add(1, std::memory_order_seq_cst);
+      if (m_waiters.load(std::memory_order_seq_cst) > 0)
+        mt::futex::wake_one(m_pushes);
+    }
+
+    // Non-blocking pop. It can return false while a push() is in
+    // progress, but that push() will wake up wait_pop().
+    bool try_pop(event& ev) {
+      node* next = m_tail->next.load(std::memory_order_acquire);
+      if (!next)
+        return false;
+      ev = next->ev;
+      delete m_tail;
+      m_tail = next;
+      return true;
+    }
+
+    // Waits an event at most timeout_ms milliseconds (or forever if
+    // it's negative). Returns false on timeout.
+    bool wait_pop(event& ev, int timeout_ms = -1) {
+      Chrono chrono;
+      for (;;) {
+        int pushes = m_pushes.load(std::memory_order_seq_cst);
+        if (try_pop(ev))
+          return true;
+
+        int remaining = -1;
+        if (timeout_ms >= 0) {
+          remaining = timeout_ms - int(chrono.elapsed() * 1000.0);
+          if (remaining <= 0)
+            return try_pop(ev);
+        }
+
+        m_waiters.fetch_add(1, std::memory_order_seq_cst);
+        if (remaining < 0)
+          mt::futex::wait(m_pushes, pushes);
+        else
+          mt::futex::wait_for(m_pushes, pushes, remaining);
+        m_waiters.fetch_sub(1, std::memory_order_relaxed);
+      }
+    }
+
+  private:
+    // Non-copyable
+    event_queue(const event_queue&);
+    event_queue& operator=(const event_queue&);
+  };
+
+} // namespace ui
+
+#endif // UI_EVENT_HEADER_FILE_INCLUDED
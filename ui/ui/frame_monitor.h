@@ -0,0 +1,219 @@
+// ui - Basic User Interface library to do experiments          -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+#ifndef UI_FRAME_MONITOR_HEADER_FILE_INCLUDED
+#define UI_FRAME_MONITOR_HEADER_FILE_INCLUDED
+
+#include "ui/raster.h"
+
+#include "chrono.h"
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+
+namespace ui {
+
+  //////////////////////////////////////////////////////////////////////
+  // frame_sample struct
+  //
+  // Copy of the statistics of one frame. Times are in microseconds.
+
+  struct frame_sample {
+    static const int max_threads = 4;
+
+    long long frame;            // Frame number
+    int interval_us;            // Time since the end of the previous frame
+    int render_us;              // From begin_frame() to end_frame()
+    int present_us;             // Time presenting during the frame
+    int draw_calls;             // Calls to the drawing functions
+    long long pixels;           // Pixels touched by those calls
+    int busy_us[max_threads];   // Busy time of each thread added with add_thread()
+
+    frame_sample()
+      : frame(-1), interval_us(0), render_us(0), present_us(0)
+      , draw_calls(0), pixels(0) {
+      for (int i=0; i<max_threads; ++i)
+        busy_us[i] = 0;
+    }
+  };
+
+  //////////////////////////////////////////////////////////////////////
+  // frame_monitor class
+  //
+  // Per-frame statistics in a ring of frame_monitor::slots slots
+  // without locks. The render thread opens and closes frames
+  // (begin_frame()/end_frame()), other threads (e.g. the present
+  // thread of a swap_chain) add their busy time to the open frame
+  // with atomic adds, and any thread can read the closed frames with
+  // sample(). Draw calls and pixels come from the raster_counters,
+  // which are enabled while a frame_monitor exists.
+
+  class frame_monitor {
+  public:
+    static const int slots = 256;
+    static const int max_threads = frame_sample::max_threads;
+
+    frame_monitor()
+      : m_frame(0)
+      , m_threads(0)
+      , m_frame_start(0.0)
+      , m_frame_end(0.0)
+      , m_calls(0)
+      , m_pixels(0) {
+      for (int i=0; i<slots; ++i)
+        reset_slot(m_slots[i]);
+      raster_counters& c = draw_counters();
+      c.users.fetch_add(1, std::memory_order_relaxed);
+      m_calls = c.calls.load(std::memory_order_relaxed);
+      m_pixels = c.pixels.load(std::memory_order_relaxed);
+    }
+
+    ~frame_monitor() {
+      draw_counters().users.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // Adds a thread whose busy time is reported with add_busy(), it
+    // must be called before the thread starts reporting. Returns the
+    // index of the thread (or -1 if there are max_threads threads).
+    int add_thread(const std::string& name) {
+      const int i = m_threads.load(std::memory_order_relaxed);
+      if (i == max_threads)
+        return -1;
+      m_names[i] = name;
+      m_threads.store(i+1, std::memory_order_release);
+      return i;
+    }
+
+    int threads() const {
+      return m_threads.load(std::memory_order_acquire);
+    }
+
+    const std::string& thread_name(int i) const {
+      return m_names[i];
+    }
+
+    // The render thread starts to work in the open frame (if it isn't
+    // called, the whole time since the previous frame is render time)
+    void begin_frame() {
+      m_frame_start = m_clock.elapsed();
+    }
+
+    // Closes the open frame (render thread)
+    void end_frame() {
+      const double now = m_clock.elapsed();
+      const long long f = m_frame.load(std::memory_order_relaxed);
+      slot& s = m_slots[f % slots];
+
+      raster_counters& c = draw_counters();
+      const long long calls = c.calls.load(std::memory_order_relaxed);
+      const long long pixels = c.pixels.load(std::memory_order_relaxed);
+      s.interval_us.store(to_us(now - m_frame_end), std::memory_order_relaxed);
+      s.render_us.store(to_us(now - std::max(m_frame_start, m_frame_end)),
+                        std::memory_order_relaxed);
+      s.draw_calls.store(int(calls - m_calls), std::memory_order_relaxed);
+      s.pixels.store(pixels - m_pixels, std::memory_order_relaxed);
+      s.frame.store(f, std::memory_order_release);
+      m_calls = calls;
+      m_pixels = pixels;
+      m_frame_end = now;
+
+      // Opens the next frame in the oldest slot. The slot is marked as
+      // open before its fields are cleared, so a sample() that reads
+      // the cleared fields sees the mark in its second check.
+      reset_slot(m_slots[(f+1) % slots]);
+      m_frame.store(f+1, std::memory_order_release);
+    }
+
+    // Adds time spent presenting frames (any thread)
+    void add_present(double seconds) {
+      open_slot().present_us.fetch_add(to_us(seconds), std::memory_order_relaxed);
+    }
+
+    // Adds busy time of a thread returned by add_thread() (from that
+    // thread)
+    void add_busy(int thread, double seconds) {
+      if (thread >= 0 && thread < max_threads)
+        open_slot().busy_us[thread].fetch_add(to_us(seconds), std::memory_order_relaxed);
+    }
+
+    // Number of closed frames
+    long long frames() const {
+      return m_frame.load(std::memory_order_acquire);
+    }
+
+    // Copies the statistics of a closed frame, returns false if the
+    // frame isn't closed yet or its slot was reused
+    bool sample(long long frame, frame_sample& out) const {
+      if (frame < 0)
+        return false;
+      const slot& s = m_slots[frame % slots];
+      if (s.frame.load(std::memory_order_acquire) != frame)
+        return false;
+
+      out.frame = frame;
+      out.interval_us = s.interval_us.load(std::memory_order_relaxed);
+      out.render_us = s.render_us.load(std::memory_order_relaxed);
+      out.present_us = s.present_us.load(std::memory_order_relaxed);
+      out.draw_calls = s.draw_calls.load(std::memory_order_relaxed);
+      out.pixels = s.pixels.load(std::memory_order_relaxed);
+      for (int i=0; i<max_threads; ++i)
+        out.busy_us[i] = s.busy_us[i].load(std::memory_order_relaxed);
+
+      // The slot could be reused while we were reading it (the acquire
+      // fence pairs with the release fence of reset_slot())
+      std::atomic_thread_fence(std::memory_order_acquire);
+      return (s.frame.load(std::memory_order_relaxed) == frame);
+    }
+
+  private:
+    // Each field has one writer (the render thread) or is only
+    // modified with atomic adds
+    struct slot {
+      std::atomic<long long> frame; // Frame number when it's closed, -1 while open
+      std::atomic<int> interval_us, render_us, present_us, draw_calls;
+      std::atomic<long long> pixels;
+      std::atomic<int> busy_us[max_threads];
+    };
+
+    static int to_us(double seconds) {
+      return int(seconds * 1e6 + 0.5);
+    }
+
+    static void reset_slot(slot& s) {
+      s.frame.store(-1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      s.interval_us.store(0, std::memory_order_relaxed);
+      s.render_us.store(0, std::memory_order_relaxed);
+      s.present_us.store(0, std::memory_order_relaxed);
+      s.draw_calls.store(0, std::memory_order_relaxed);
+      s.pixels.store(0, std::memory_order_relaxed);
+      for (int i=0; i<max_threads; ++i)
+        s.busy_us[i].store(0, std::memory_order_relaxed);
+    }
+
+    slot& open_slot() {
+      return m_slots[m_frame.load(std::memory_order_acquire) % slots];
+    }
+
+    slot m_slots[slots];
+    std::atomic<long long> m_frame; // Open frame
+    std::atomic<int> m_threads;
+    std::string m_names[max_threads];
+
+    // Used by the render thread
+    Chrono m_clock;
+    double m_frame_start, m_frame_end;
+    long long m_calls, m_pixels; // raster_counters at the end of the previous frame
+
+    // Non-copyable
+    frame_monitor(const frame_monitor&);
+    frame_monitor& operator=(const frame_monitor&);
+  };
+
+} // namespace ui
+
+#endif // UI_FRAME_MONITOR_HEADER_FILE_INCLUDED
@@ -0,0 +1,320 @@
+// ui - Basic User Interface library to do experiments          -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+#ifndef UI_HUD_HEADER_FILE_INCLUDED
+#define UI_HUD_HEADER_FILE_INCLUDED
+
+#include "ui/bitmap.h"
+#include "ui/frame_monitor.h"
+#include "ui/raster.h"
+#include "ui/rect.h"
+#include "ui/text.h"
+
+#include "chrono.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace ui {
+
+  namespace hud_details {
+
+    const double text_period = 0.25; // Seconds between updates of the text
+
+    const pixel background = 0xff181818;
+    const pixel text_color = 0xffdcdcdc;
+    const pixel graph_background = 0xff282828;
+    const pixel budget_color = 0xff6a6a6a;
+    const pixel good_color = 0xff50c850;  // Under the budget
+    const pixel slow_color = 0xffe6c83c;  // Under 2 budgets
+    const pixel bad_color = 0xffe6463c;
+
+  } // namespace hud_details
+
+  //////////////////////////////////////////////////////////////////////
+  // hud class
+  //
+  // Performance overlay drawn in a corner of the frames: a graph with
+  // the time of the last frames (one column per frame, the line is the
+  // frame budget), the average and percentiles of the frame time, draw
+  // calls and pixels per frame, and the busy time of the render thread
+  // and of each thread of the frame_monitor.
+  //
+  // The overlay is kept in its own bitmap, drawn with its own font. The
+  // graph scrolls to add the new frames at most once per frame budget
+  // (frames faster than the budget are added together, so they don't
+  // pay for the scroll and the copy of the graph each), and the text is
+  // updated a few times per second, then the panel is copied to the
+  // frame, so the cost doesn't depend on the size of the frame. If
+  // nothing was drawn over the HUD since the previous draw(), only the
+  // modified parts of the panel are copied (the returned rectangle is
+  // the only damaged area). The drawing of the HUD isn't counted in the
+  // draw calls and pixels of the frames.
+
+  class hud {
+  public:
+    enum corner {
+      top_left,
+      top_right,
+      bottom_left,
+      bottom_right
+    };
+
+    static const int width = 216;
+    static const int height = 88;
+
+    explicit hud(corner c = top_right)
+      : m_corner(c)
+      , m_font(new builtin_glyph_source)
+      , m_panel(width, height)
+      , m_budget_ms(1000.0 / 60.0)
+      , m_graph_frame(0)
+      , m_text_frame(-1)
+      , m_dirty(0, 0, width, height)
+      , m_draws(0)
+      , m_draw_time(0.0)
+      , m_period_draws(0)
+      , m_period_time(0.0) {
+      m_sorted.reserve(graph_w);
+
+      // All the glyphs of the text are cached before the first frame
+      for (int cp=' '; cp<='~'; ++cp)
+        m_font.get(cp);
+
+      uncounted_draws uncounted;
+      fill_rect(m_panel, rect(0, 0, width, height), hud_details::background);
+      for (int x=graph_x; x<graph_x+graph_w; ++x)
+        draw_column(x, -1);
+    }
+
+    // Statistics shown by the HUD
+    frame_monitor& monitor() { return m_monitor; }
+    const frame_monitor& monitor() const { return m_monitor; }
+
+    corner position() const { return m_corner; }
+    void set_position(corner c) { m_corner = c; }
+
+    // Frame time of the line in the graph (the graph shows up to 2
+    // times this value)
+    void set_budget(double ms) {
+      m_budget_ms = std::max(ms, 0.1);
+    }
+
+    // Area of a target of the given size covered by the HUD
+    rect bounds(int target_width, int target_height) const {
+      const int x = (m_corner == top_left || m_corner == bottom_left ?
+                     margin: target_width - width - margin);
+      const int y = (m_corner == top_left || m_corner == top_right ?
+                     margin: target_height - height - margin);
+      return rect(x, y, width, height) & rect(0, 0, target_width, target_height);
+    }
+
+    // Updates the panel with the closed frames of the monitor and
+    // copies it to the target. "intact" means that the target still
+    // has the HUD of the previous draw() (nothing was drawn over it),
+    // so only the modified parts of the panel are copied. Returns the
+    // modified area of the target.
+    rect draw(bitmap& target, bool intact = false) {
+      Chrono chrono;
+      uncounted_draws uncounted;
+      const bool text = (m_text_frame < 0 ||
+                         m_text_clock.elapsed() >= hud_details::text_period);
+      if (text || 1000.0 * m_graph_clock.elapsed() >= m_budget_ms)
+        update_graph();
+      if (text)
+        update_text();
+
+      const rect rc = bounds(target.width(), target.height());
+      if (!intact || rc != m_target)
+        m_dirty = rect(0, 0, width, height);
+      m_target = rc;
+
+      // Area of the panel in the target
+      const int dx = rc.x - (m_corner == top_left || m_corner == bottom_left ? 0: width - rc.w);
+      const int dy = rc.y - (m_corner == top_left || m_corner == top_right ? 0: height - rc.h);
+      const rect r = m_dirty.offset(dx, dy) & rc;
+      m_dirty = rect();
+
+      // Copied row by row (not with blit()) so the copy isn't counted
+      // in the draw calls of the frame
+      for (int y=r.y; y<r.y2(); ++y)
+        std::memcpy(target.span(r.x, y), m_panel.span(r.x-dx, y-dy), r.w*sizeof(pixel));
+
+      const double t = chrono.elapsed();
+      m_draw_time += t;
+      m_period_time += t;
+      ++m_draws;
+      ++m_period_draws;
+      return r;
+    }
+
+    // The pixels under the HUD were modified, the next draw() copies
+    // the whole panel
+    void invalidate() {
+      m_dirty = rect(0, 0, width, height);
+    }
+
+    // Average time of draw() in milliseconds since the creation of
+    // the HUD or the last reset_cost()
+    double draw_ms() const {
+      return (m_draws > 0 ? 1000.0 * m_draw_time / m_draws: 0.0);
+    }
+
+    void reset_cost() {
+      m_draws = 0;
+      m_draw_time = 0.0;
+    }
+
+    // The panel as it was copied by the last draw()
+    const bitmap& panel() const { return m_panel; }
+
+  private:
+    static const int margin = 8;
+    static const int padding = 4;
+    static const int text_lines = 5;
+    static const int line_height = 9;
+    static const int graph_x = padding;
+    static const int graph_y = padding + text_lines*line_height + 3;
+    static const int graph_w = width - 2*padding;
+    static const int graph_h = height - graph_y - padding;
+
+    // Scrolls the graph to the left and draws a column per new frame
+    void update_graph() {
+      const long long last = m_monitor.frames();
+      const int n = int(std::min(last - m_graph_frame, (long long)graph_w));
+      if (n <= 0)
+        return;
+
+      for (int y=graph_y; y<graph_y+graph_h; ++y) {
+        pixel* row = m_panel.span(graph_x, y);
+        std::memmove(row, row+n, (graph_w-n)*sizeof(pixel));
+      }
+
+      frame_sample s;
+      for (int i=0; i<n; ++i) {
+        const long long frame = last-n+i;
+        draw_column(graph_x+graph_w-n+i,
+                    m_monitor.sample(frame, s) ? s.interval_us: -1);
+      }
+      m_graph_frame = last;
+      m_graph_clock.reset();
+      m_dirty = m_dirty | rect(graph_x, graph_y, graph_w, graph_h);
+    }
+
+    // Column of a frame that took "us" microseconds (-1 = unknown)
+    void draw_column(int x, int us) {
+      const double budget_us = 1000.0 * m_budget_ms;
+      const int budget_y = graph_h/2;
+      int bar = 0;
+      pixel color = hud_details::good_color;
+      if (us >= 0) {
+        bar = std::min(int(graph_h), std::max(1, int(us * double(budget_y) / budget_us + 0.5)));
+        color = (us <= budget_us ? hud_details::good_color:
+                 us <= 2*budget_us ? hud_details::slow_color: hud_details::bad_color);
+      }
+      for (int y=0; y<graph_h; ++y) {
+        pixel c = hud_details::graph_background;
+        if (y >= graph_h-bar)
+          c = color;
+        else if (y == graph_h-budget_y)
+          c = hud_details::budget_color;
+        m_panel.put_pixel(x, graph_y+y, c);
+      }
+    }
+
+    // Summary of the frames in the graph
+    void update_text() {
+      const long long last = m_monitor.frames();
+      const int nthreads = m_monitor.threads();
+      long long interval = 0, render = 0, present = 0, calls = 0, pixels = 0;
+      long long busy[frame_monitor::max_threads] = { 0 };
+
+      m_sorted.clear();
+      frame_sample s;
+      for (long long f=std::max(0LL, last-graph_w); f<last; ++f) {
+        if (!m_monitor.sample(f, s))
+          continue;
+        m_sorted.push_back(s.interval_us);
+        interval += s.interval_us;
+        render += s.render_us;
+        present += s.present_us;
+        calls += s.draw_calls;
+        pixels += s.pixels;
+        for (int t=0; t<nthreads; ++t)
+          busy[t] += s.busy_us[t];
+      }
+
+      char lines[text_lines][64];
+      for (int i=0; i<text_lines; ++i)
+        lines[i][0] = 0;
+
+      const int n = int(m_sorted.size());
+      if (n > 0) {
+        std::sort(m_sorted.begin(), m_sorted.end());
+        const double avg_ms = interval / 1000.0 / n;
+        std::snprintf(lines[0], 64, "%.2f ms  %.1f fps", avg_ms,
+                      avg_ms > 0.0 ? 1000.0 / avg_ms: 0.0);
+        std::snprintf(lines[1], 64, "p50 %.1f p95 %.1f p99 %.1f",
+                      m_sorted[n/2] / 1000.0,
+                      m_sorted[std::min(n-1, n*95/100)] / 1000.0,
+                      m_sorted[std::min(n-1, n*99/100)] / 1000.0);
+        std::snprintf(lines[2], 64, "calls %lld  pixels %.2fM",
+                      calls / n, pixels / 1e6 / n);
+
+        const double wall = std::max(1LL, interval);
+        int len = std::snprintf(lines[3], 64, "render %d%%", int(100.0 * render / wall + 0.5));
+        for (int t=0; t<nthreads && len < 64; ++t)
+          len += std::snprintf(lines[3]+len, 64-len, " %s %d%%",
+                               m_monitor.thread_name(t).c_str(),
+                               int(100.0 * busy[t] / wall + 0.5));
+
+        std::snprintf(lines[4], 64, "present %.2f  hud %.3f ms",
+                      present / 1000.0 / n,
+                      m_period_draws > 0 ? 1000.0 * m_period_time / m_period_draws: 0.0);
+      }
+      else
+        std::snprintf(lines[0], 64, "no frames");
+
+      fill_rect(m_panel, rect(0, 0, width, graph_y), hud_details::background);
+      m_dirty = m_dirty | rect(0, 0, width, graph_y);
+      for (int i=0; i<text_lines; ++i)
+        draw_text(m_panel, m_font, padding, padding + i*line_height, lines[i],
+                  hud_details::text_color);
+
+      m_text_frame = last;
+      m_text_clock.reset();
+      m_period_draws = 0;
+      m_period_time = 0.0;
+    }
+
+    corner m_corner;
+    frame_monitor m_monitor;
+    font m_font;
+    bitmap m_panel;
+    double m_budget_ms;
+    long long m_graph_frame;    // Next frame to add to the graph
+    long long m_text_frame;     // Frames in the last text update (-1 = never)
+    rect m_dirty;               // Area of the panel to copy in the next draw()
+    rect m_target;              // Where the panel was copied by the last draw()
+    Chrono m_graph_clock;       // Time since the last scroll of the graph
+    Chrono m_text_clock;
+    std::vector<int> m_sorted;  // Frame times to calculate percentiles
+    long long m_draws;          // Draws since the last reset_cost()
+    double m_draw_time;
+    long long m_period_draws;   // Draws since the last update of the text
+    double m_period_time;
+
+    // Non-copyable
+    hud(const hud&);
+    hud& operator=(const hud&);
+  };
+
+} // namespace ui
+
+#endif // UI_HUD_HEADER_FILE_INCLUDED
@@ -0,0 +1,707 @@
+// ui - Basic User Interface library to do experiments          -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+#ifndef UI_IMAGE_IO_HEADER_FILE_INCLUDED
+#define UI_IMAGE_IO_HEADER_FILE_INCLUDED
+
+#include "ui/bitmap.h"
+#include "ui/cpu.h"
+#include "ui/mapped_file.h"
+#include "ui/raster.h"
+
+#if UI_X86_SIMD
+  #include <immintrin.h>
+#endif
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace ui {
+
+  namespace image_io_details {
+
+    struct crc32_table {
+      uint32_t values[256];
+      crc32_table() {
+        for (uint32_t n=0; n<256; ++n) {
+          uint32_t c = n;
+          for (int k=0; k<8; ++k)
+            c = (c & 1 ? 0xedb88320 ^ (c >> 1): c >> 1);
+          values[n] = c;
+        }
+      }
+    };
+
+    inline uint32_t crc32(uint32_t crc, const uint8_t* data, std::size_t size) {
+      static const crc32_table table;
+      crc = ~crc;
+      for (std::size_t i=0; i<size; ++i)
+        crc = table.values[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+      return ~crc;
+    }
+
+    inline void put_u32be(std::vector<uint8_t>& out, uint32_t value) {
+      out.push_back(uint8_t(value >> 24));
+      out.push_back(uint8_t(value >> 16));
+      out.push_back(uint8_t(value >> 8));
+      out.push_back(uint8_t(value));
+    }
+
+    inline bool write_png_chunk(std::FILE* f, const char* type,
+                                const std::vector<uint8_t>& data) {
+      std::vector<uint8_t> chunk;
+      chunk.reserve(data.size() + 12);
+      put_u32be(chunk, uint32_t(data.size()));
+      chunk.insert(chunk.end(), type, type+4);
+      chunk.insert(chunk.end(), data.begin(), data.end());
+      put_u32be(chunk, crc32(0, &chunk[4], chunk.size()-4));
+      return std::fwrite(&chunk[0], 1, chunk.size(), f) == chunk.size();
+    }
+
+    inline void put_u16le(std::vector<uint8_t>& out, uint32_t value) {
+      out.push_back(uint8_t(value));
+      out.push_back(uint8_t(value >> 8));
+    }
+
+    inline void put_u32le(std::vector<uint8_t>& out, uint32_t value) {
+      put_u16le(out, value & 0xffff);
+      put_u16le(out, value >> 16);
+    }
+
+    inline uint32_t get_u16le(const uint8_t* p) {
+      return uint32_t(p[0]) | (uint32_t(p[1]) << 8);
+    }
+
+    inline uint32_t get_u32le(const uint8_t* p) {
+      return get_u16le(p) | (get_u16le(p+2) << 16);
+    }
+
+    inline uint32_t get_u32be(const uint8_t* p) {
+      return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) |
+             (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+    }
+
+    // Biggest width/height accepted by the loaders (so sizes in bytes
+    // fit in an int stride and a size_t)
+    const int max_image_side = 32768;
+
+    inline bool valid_image_size(long long w, long long h) {
+      return (w > 0 && h > 0 && w <= max_image_side && h <= max_image_side);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // 24bpp to 32bpp row conversion
+    //
+    // "rgb" is the order of the source bytes (PPM), in other case it's
+    // B, G, R (BMP). The result is opaque.
+
+    inline void rgb24_row_scalar(const uint8_t* src, pixel* dst, int n, bool rgb) {
+      const int r = (rgb ? 0: 2), b = 2-r;
+      for (int i=0; i<n; ++i, src+=3)
+        dst[i] = rgba(src[r], src[1], src[b]);
+    }
+
+#if UI_X86_SIMD
+    // 4 pixels per 16-byte load with a byte shuffle (SSSE3, which is
+    // available on every AVX2 CPU)
+    UI_TARGET_AVX2 inline void rgb24_row_avx2(const uint8_t* src, pixel* dst, int n, bool rgb) {
+      const __m128i mask = (rgb ?
+                            _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1):
+                            _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1));
+      const __m128i alpha = _mm_set1_epi32(int(0xff000000));
+      int i = 0;
+      // The last load reads 16 bytes from src+3*i, i.e. 4 bytes after
+      // the 4 pixels (so the loop stops 2 pixels before)
+      for (; i+6<=n; i+=4) {
+        __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 3*i));
+        p = _mm_or_si128(_mm_shuffle_epi8(p, mask), alpha);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), p);
+      }
+      rgb24_row_scalar(src + 3*i, dst + i, n-i, rgb);
+    }
+#endif
+
+    inline void rgb24_row(const uint8_t* src, pixel* dst, int n, bool rgb) {
+#if UI_X86_SIMD
+      if (current_simd_level() >= simd_avx2) {
+        rgb24_row_avx2(src, dst, n, rgb);
+        return;
+      }
+#endif
+      rgb24_row_scalar(src, dst, n, rgb);
+    }
+
+    // Makes the pixels of a 32bpp row opaque or premultiplies them,
+    // only writing the ones that change (so the untouched pages of a
+    // private mapping are never copied)
+    inline void fix_alpha_row(pixel* row, int n, bool has_alpha) {
+      for (int i=0; i<n; ++i) {
+        const pixel c = row[i];
+        if ((c >> 24) == 255)
+          continue;
+        row[i] = (has_alpha ? premultiply(c): c | 0xff000000);
+      }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // Decoders
+    //
+    // They return the new bitmap, or NULL if the file isn't valid.
+    // "data" is a private mapping of the whole file, a decoder can
+    // return a bitmap that wraps it (and sets "wraps" to true).
+
+    // Skips white spaces and comments of a PPM header and reads a
+    // decimal number
+    inline bool read_ppm_number(const uint8_t*& p, const uint8_t* end, int& value) {
+      for (;;) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+          ++p;
+        if (p < end && *p == '#') {
+          while (p < end && *p != '\n')
+            ++p;
+        }
+        else
+          break;
+      }
+      if (p == end || *p < '0' || *p > '9')
+        return false;
+      long long v = 0;
+      while (p < end && *p >= '0' && *p <= '9' && v <= max_image_side)
+        v = v*10 + (*p++ - '0');
+      value = int(v);
+      return true;
+    }
+
+    // Binary PPM (P6) with a maximum value up to 255
+    inline bitmap* decode_ppm(uint8_t* data, std::size_t size) {
+      const uint8_t* p = data + 2;
+      const uint8_t* end = data + size;
+      int w, h, maxval;
+      if (!read_ppm_number(p, end, w) ||
+          !read_ppm_number(p, end, h) ||
+          !read_ppm_number(p, end, maxval) ||
+          p == end ||               // One white space before the pixels
+          !valid_image_size(w, h) ||
+          maxval < 1 || maxval > 255)
+        return NULL;
+      ++p;
+
+      const std::size_t row_size = std::size_t(w)*3;
+      if (std::size_t(end - p) / row_size < std::size_t(h))
+        return NULL;
+
+      bitmap* bmp = new bitmap(w, h);
+      for (int y=0; y<h; ++y, p+=row_size) {
+        pixel* dst = bmp->row(y);
+        if (maxval == 255)
+          rgb24_row(p, dst, w, true);
+        else
+          for (int x=0; x<w; ++x)
+            dst[x] = rgba((p[3*x]*255 + maxval/2) / maxval,
+                          (p[3*x+1]*255 + maxval/2) / maxval,
+                          (p[3*x+2]*255 + maxval/2) / maxval);
+      }
+      return bmp;
+    }
+
+    // Uncompressed 24bpp and 32bpp BMP files (BITMAPINFOHEADER or a
+    // newer header). 32bpp files with an alpha mask have straight
+    // alpha (converted to premultiplied), in other case the 4th byte
+    // is ignored. A 32bpp file whose pixels are aligned in memory is
+    // used in place, without copying it.
+    inline bitmap* decode_bmp(uint8_t* data, std::size_t size, bool& wraps) {
+      if (size < 54)
+        return NULL;
+
+      const uint32_t offset = get_u32le(data+10);
+      const uint32_t header_size = get_u32le(data+14);
+      const long long w = int32_t(get_u32le(data+18));
+      long long h = int32_t(get_u32le(data+22));
+      const uint32_t bpp = get_u16le(data+28);
+      const uint32_t compression = get_u32le(data+30);
+      const bool top_down = (h < 0);
+      if (top_down)
+        h = -h;
+
+      if (header_size < 40 || !valid_image_size(w, h) ||
+          (bpp != 24 && bpp != 32))
+        return NULL;
+
+      bool has_alpha = false;
+      if (compression == 3 && bpp == 32) { // BI_BITFIELDS
+        if (size < 66 ||
+            get_u32le(data+54) != 0xff0000 ||
+            get_u32le(data+58) != 0xff00 ||
+            get_u32le(data+62) != 0xff)
+          return NULL;
+        has_alpha = (header_size >= 56 && size >= 70 &&
+                     get_u32le(data+66) == 0xff000000);
+      }
+      else if (compression != 0)  // BI_RGB
+        return NULL;
+
+      const std::size_t row_size = ((std::size_t(w)*bpp + 31) / 32) * 4;
+      if (offset > size || (size - offset) / row_size < std::size_t(h))
+        return NULL;
+
+      // Row "y" of the image
+      uint8_t* first = data + offset + (top_down ? 0: (h-1)*row_size);
+      const std::ptrdiff_t stride = (top_down ? 1: -1) * std::ptrdiff_t(row_size);
+
+      bitmap* bmp;
+      if (bpp == 32 && (std::size_t(data + offset) % sizeof(pixel)) == 0) {
+        bmp = new bitmap(int(w), int(h), first, int(stride));
+        wraps = true;
+        for (int y=0; y<h; ++y)
+          fix_alpha_row(bmp->row(y), int(w), has_alpha);
+      }
+      else {
+        bmp = new bitmap(int(w), int(h));
+        for (int y=0; y<h; ++y) {
+          const uint8_t* src = first + stride*y;
+          pixel* dst = bmp->row(y);
+          if (bpp == 24)
+            rgb24_row(src, dst, int(w), false);
+          else {
+            std::memcpy(dst, src, std::size_t(w)*sizeof(pixel));
+            fix_alpha_row(dst, int(w), has_alpha);
+          }
+        }
+      }
+      return bmp;
+    }
+
+    inline int qoi_hash(pixel c) {
+      return (get_r(c)*3 + get_g(c)*5 + get_b(c)*7 + get_a(c)*11) % 64;
+    }
+
+    // "Quite OK Image" format, decoded directly to the bitmap rows in
+    // one pass
+    inline bitmap* decode_qoi(const uint8_t* data, std::size_t size) {
+      if (size < 14+8)
+        return NULL;
+      const uint32_t w = get_u32be(data+4);
+      const uint32_t h = get_u32be(data+8);
+      if (!valid_image_size(w, h) || (data[12] != 3 && data[12] != 4))
+        return NULL;
+
+      bitmap* bmp = new bitmap(int(w), int(h));
+      pixel index[64];
+      std::memset(index, 0, sizeof(index));
+      pixel px = 0xff000000;        // Straight alpha
+      pixel premult = px;
+      int run = 0;
+
+      // The stream ends with 8 bytes of padding, so an op (5 bytes at
+      // most) that starts before them can be read without checks
+      const uint8_t* p = data + 14;
+      const uint8_t* end = data + size - 8;
+
+      for (uint32_t y=0; y<h; ++y) {
+        pixel* dst = bmp->row(y);
+        for (uint32_t x=0; x<w; ++x) {
+          if (run > 0)
+            --run;
+          else if (p < end) {
+            const int b1 = *p++;
+            if (b1 == 0xfe) {
+              px = rgba(p[0], p[1], p[2], get_a(px));
+              p += 3;
+            }
+            else if (b1 == 0xff) {
+              px = rgba(p[0], p[1], p[2], p[3]);
+              p += 4;
+            }
+            else {
+              switch (b1 & 0xc0) {
+                case 0x00:          // Index
+                  px = index[b1];
+                  break;
+                case 0x40:          // Small difference
+                  px = rgba((get_r(px) + ((b1 >> 4) & 3) - 2) & 0xff,
+                            (get_g(px) + ((b1 >> 2) & 3) - 2) & 0xff,
+                            (get_b(px) + (b1 & 3) - 2) & 0xff,
+                            get_a(px));
+                  break;
+                case 0x80: {        // Luma difference
+                  const int b2 = *p++;
+                  const int dg = (b1 & 0x3f) - 32;
+                  px = rgba((get_r(px) + dg - 8 + ((b2 >> 4) & 0xf)) & 0xff,
+                            (get_g(px) + dg) & 0xff,
+                            (get_b(px) + dg - 8 + (b2 & 0xf)) & 0xff,
+                            get_a(px));
+                  break;
+                }
+                default:            // Run
+                  run = b1 & 0x3f;
+                  break;
+              }
+            }
+            index[qoi_hash(px)] = px;
+            premult = (get_a(px) == 255 ? px: premultiply(px));
+          }
+          dst[x] = premult;
+        }
+      }
+      return bmp;
+    }
+
+
+  } // namespace image_io_details
+
+  //////////////////////////////////////////////////////////////////////
+  // Saving frames
+  //
+  // Frames are saved as opaque RGB (the alpha channel of a framebuffer
+  // is not meaningful). PNG files are written with uncompressed
+  // ("stored") deflate blocks, they are as big as a PPM but don't need
+  // zlib, and any viewer can open them.
+
+  // Saves the bitmap as a binary (P6) PPM file
+  inline bool save_ppm(const bitmap& bmp, const char* filename) {
+    std::FILE* f = std::fopen(filename, "wb");
+    if (!f)
+      return false;
+
+    const int w = bmp.width();
+    const int h = bmp.height();
+    bool ok = (std::fprintf(f, "P6\n%d %d\n255\n", w, h) > 0);
+
+    std::vector<uint8_t> line(w*3);
+    for (int y=0; y<h && ok; ++y) {
+      const pixel* src = bmp.row(y);
+      uint8_t* dst = &line[0];
+      for (int x=0; x<w; ++x, dst+=3) {
+        dst[0] = uint8_t(get_r(src[x]));
+        dst[1] = uint8_t(get_g(src[x]));
+        dst[2] = uint8_t(get_b(src[x]));
+      }
+      ok = (std::fwrite(&line[0], 1, line.size(), f) == line.size());
+    }
+
+    return (std::fclose(f) == 0 && ok);
+  }
+
+  // Saves the bitmap as a PNG file
+  inline bool save_png(const bitmap& bmp, const char* filename) {
+    using namespace image_io_details;
+
+    const int w = bmp.width();
+    const int h = bmp.height();
+
+    // Scanlines: filter type 0 (none) + RGB bytes
+    const std::size_t line_size = 1 + std::size_t(w)*3;
+    std::vector<uint8_t> raw(line_size * h);
+    for (int y=0; y<h; ++y) {
+      const pixel* src = bmp.row(y);
+      uint8_t* dst = &raw[line_size * y];
+      *dst++ = 0;
+      for (int x=0; x<w; ++x, dst+=3) {
+        dst[0] = uint8_t(get_r(src[x]));
+        dst[1] = uint8_t(get_g(src[x]));
+        dst[2] = uint8_t(get_b(src[x]));
+      }
+    }
+
+    // zlib stream with stored deflate blocks of up to 65535 bytes
+    std::vector<uint8_t> idat;
+    idat.reserve(raw.size() + raw.size()/65535*5 + 16);
+    idat.push_back(0x78);
+    idat.push_back(0x01);
+    std::size_t pos = 0;
+    do {
+      std::size_t len = raw.size() - pos;
+      if (len > 65535)
+        len = 65535;
+      idat.push_back(pos+len == raw.size() ? 1: 0); // BFINAL, BTYPE=00
+      idat.push_back(uint8_t(len));
+      idat.push_back(uint8_t(len >> 8));
+      idat.push_back(uint8_t(~len));
+      idat.push_back(uint8_t(~len >> 8));
+      idat.insert(idat.end(), raw.begin()+pos, raw.begin()+pos+len);
+      pos += len;
+    } while (pos < raw.size());
+
+    uint32_t s1 = 1, s2 = 0;     // Adler-32
+    for (std::size_t i=0; i<raw.size(); ) {
+      std::size_t n = raw.size() - i;
+      if (n > 5552)
+        n = 5552;
+      for (std::size_t end=i+n; i<end; ++i) {
+        s1 += raw[i];
+        s2 += s1;
+      }
+      s1 %= 65521;
+      s2 %= 65521;
+    }
+    put_u32be(idat, (s2 << 16) | s1);
+
+    std::vector<uint8_t> ihdr;
+    put_u32be(ihdr, w);
+    put_u32be(ihdr, h);
+    ihdr.push_back(8);          // Bit depth
+    ihdr.push_back(2);          // Color type: RGB
+    ihdr.push_back(0);          // Compression
+    ihdr.push_back(0);          // Filter
+    ihdr.push_back(0);          // Interlace
+
+    std::FILE* f = std::fopen(filename, "wb");
+    if (!f)
+      return false;
+
+    static const uint8_t signature[8] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+    bool ok =
+      std::fwrite(signature, 1, 8, f) == 8 &&
+      write_png_chunk(f, "IHDR", ihdr) &&
+      write_png_chunk(f, "IDAT", idat) &&
+      write_png_chunk(f, "IEND", std::vector<uint8_t>());
+
+    return (std::fclose(f) == 0 && ok);
+  }
+
+  // Saves the bitmap as a top-down 32bpp BMP file. The pixels start
+  // at a 64 bytes offset, so load_image() can use them in place.
+  inline bool save_bmp(const bitmap& bmp, const char* filename) {
+    using namespace image_io_details;
+
+    const int w = bmp.width();
+    const int h = bmp.height();
+    const uint32_t offset = 64;
+    const uint32_t data_size = uint32_t(w)*h*4;
+
+    std::vector<uint8_t> header;
+    header.push_back('B');
+    header.push_back('M');
+    put_u32le(header, offset + data_size);
+    put_u32le(header, 0);
+    put_u32le(header, offset);
+    put_u32le(header, 40);        // BITMAPINFOHEADER
+    put_u32le(header, w);
+    put_u32le(header, uint32_t(-h)); // Top-down
+    put_u16le(header, 1);         // Planes
+    put_u16le(header, 32);        // Bits per pixel
+    put_u32le(header, 0);         // BI_RGB
+    put_u32le(header, data_size);
+    put_u32le(header, 2835);      // 72 DPI
+    put_u32le(header, 2835);
+    put_u32le(header, 0);
+    put_u32le(header, 0);
+    header.resize(offset, 0);
+
+    std::FILE* f = std::fopen(filename, "wb");
+    if (!f)
+      return false;
+
+    bool ok = (std::fwrite(&header[0], 1, header.size(), f) == header.size());
+    std::vector<pixel> line(w);
+    for (int y=0; y<h && ok; ++y) {
+      const pixel* src = bmp.row(y);
+      for (int x=0; x<w; ++x)
+        line[x] = src[x] | 0xff000000;
+      ok = (std::fwrite(&line[0], sizeof(pixel), w, f) == std::size_t(w));
+    }
+
+    return (std::fclose(f) == 0 && ok);
+  }
+
+  // Saves the bitmap as a QOI file (RGB)
+  inline bool save_qoi(const bitmap& bmp, const char* filename) {
+    using namespace image_io_details;
+
+    const int w = bmp.width();
+    const int h = bmp.height();
+
+    std::vector<uint8_t> out;
+    out.reserve(14 + std::size_t(w)*h + 8);
+    out.insert(out.end(), "qoif", "qoif"+4);
+    put_u32be(out, w);
+    put_u32be(out, h);
+    out.push_back(3);             // RGB
+    out.push_back(0);             // sRGB
+
+    pixel index[64];
+    std::memset(index, 0, sizeof(index));
+    pixel prev = 0xff000000;
+    int run = 0;
+
+    for (int y=0; y<h; ++y) {
+      const pixel* src = bmp.row(y);
+      for (int x=0; x<w; ++x) {
+        const pixel px = src[x] | 0xff000000;
+        if (px == prev) {
+          if (++run == 62 || (y == h-1 && x == w-1)) {
+            out.push_back(uint8_t(0xc0 | (run-1)));
+            run = 0;
+          }
+          continue;
+        }
+        if (run > 0) {
+          out.push_back(uint8_t(0xc0 | (run-1)));
+          run = 0;
+        }
+
+        const int i = qoi_hash(px);
+        if (index[i] == px)
+          out.push_back(uint8_t(i));
+        else {
+          index[i] = px;
+          const int dr = int8_t(get_r(px) - get_r(prev));
+          const int dg = int8_t(get_g(px) - get_g(prev));
+          const int db = int8_t(get_b(px) - get_b(prev));
+          const int dr_dg = dr - dg, db_dg = db - dg;
+          if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+            out.push_back(uint8_t(0x40 | ((dr+2) << 4) | ((dg+2) << 2) | (db+2)));
+          else if (dg >= -32 && dg <= 31 &&
+                   dr_dg >= -8 && dr_dg <= 7 &&
+                   db_dg >= -8 && db_dg <= 7) {
+            out.push_back(uint8_t(0x80 | (dg+32)));
+            out.push_back(uint8_t(((dr_dg+8) << 4) | (db_dg+8)));
+          }
+          else {
+            out.push_back(0xfe);
+            out.push_back(uint8_t(get_r(px)));
+            out.push_back(uint8_t(get_g(px)));
+            out.push_back(uint8_t(get_b(px)));
+          }
+        }
+        prev = px;
+      }
+    }
+    out.insert(out.end(), 7, 0);
+    out.push_back(1);
+
+    std::FILE* f = std::fopen(filename, "wb");
+    if (!f)
+      return false;
+    bool ok = (std::fwrite(&out[0], 1, out.size(), f) == out.size());
+    return (std::fclose(f) == 0 && ok);
+  }
+
+  namespace image_io_details {
+
+    inline bool has_extension(const std::string& filename, const char* ext) {
+      const std::size_t n = filename.size(), m = std::strlen(ext);
+      if (n < m)
+        return false;
+      for (std::size_t i=0; i<m; ++i) {
+        char c = filename[n-m+i];
+        if (c >= 'A' && c <= 'Z')
+          c += 'a' - 'A';
+        if (c != ext[i])
+          return false;
+      }
+      return true;
+    }
+
+  } // namespace image_io_details
+
+  // Saves the bitmap as PNG, BMP or QOI depending on the extension of
+  // the filename, or as PPM in other case
+  inline bool save_image(const bitmap& bmp, const std::string& filename) {
+    using image_io_details::has_extension;
+    if (has_extension(filename, ".png"))
+      return save_png(bmp, filename.c_str());
+    else if (has_extension(filename, ".bmp"))
+      return save_bmp(bmp, filename.c_str());
+    else if (has_extension(filename, ".qoi"))
+      return save_qoi(bmp, filename.c_str());
+    else
+      return save_ppm(bmp, filename.c_str());
+  }
+
+  //////////////////////////////////////////////////////////////////////
+  // surface class
+  //
+  // A loaded image: a 32bpp premultiplied bitmap that can be drawn
+  // directly with blit(). Files are memory-mapped (no read() copies):
+  //   PPM (P6)  Converted row by row from the mapping.
+  //   BMP       24bpp is converted, 32bpp is used in place when the
+  //             pixels are aligned (the bitmap wraps the mapping,
+  //             bottom-up files with a negative stride), so loading
+  //             it costs only the page faults of the first access.
+  //   QOI       Decoded in one pass from the mapping to the bitmap.
+  //
+  // The format is detected from the first bytes, not the extension.
+
+  class surface {
+  public:
+    surface()
+      : m_file(NULL)
+      , m_bitmap(NULL) {
+    }
+
+    ~surface() {
+      reset();
+    }
+
+    bool empty() const { return m_bitmap == NULL; }
+    int width() const { return m_bitmap ? m_bitmap->width(): 0; }
+    int height() const { return m_bitmap ? m_bitmap->height(): 0; }
+
+    // True if the pixels are in the file mapping (zero-copy)
+    bool mapped() const { return m_file != NULL; }
+
+    // The bitmap can be modified (a mapped file is a private copy)
+    bitmap& get() { assert(m_bitmap); return *m_bitmap; }
+    const bitmap& get() const { assert(m_bitmap); return *m_bitmap; }
+
+    // Returns false if the file doesn't exist or the format isn't
+    // supported/valid (the surface is left empty)
+    bool load(const std::string& filename) {
+      using namespace image_io_details;
+      reset();
+
+      mapped_file* file = new mapped_file(filename);
+      uint8_t* data = file->data();
+      const std::size_t size = file->size();
+      bool wraps = false;
+
+      if (size >= 4 && std::memcmp(data, "qoif", 4) == 0)
+        m_bitmap = decode_qoi(data, size);
+      else if (size >= 2 && data[0] == 'B' && data[1] == 'M')
+        m_bitmap = decode_bmp(data, size, wraps);
+      else if (size >= 2 && data[0] == 'P' && data[1] == '6')
+        m_bitmap = decode_ppm(data, size);
+
+      if (m_bitmap && wraps)
+        m_file = file;
+      else
+        delete file;
+      return m_bitmap != NULL;
+    }
+
+    void reset() {
+      delete m_bitmap;
+      delete m_file;
+      m_bitmap = NULL;
+      m_file = NULL;
+    }
+
+  private:
+    mapped_file* m_file;          // Mapping wrapped by m_bitmap (or NULL)
+    bitmap* m_bitmap;
+
+    // Non-copyable
+    surface(const surface&);
+    surface& operator=(const surface&);
+  };
+
+  // Returns a new surface with the image, or NULL if it cannot be loaded
+  inline surface* load_image(const std::string& filename) {
+    surface* s = new surface;
+    if (!s->load(filename)) {
+      delete s;
+      return NULL;
+    }
+    return s;
+  }
+
+} // namespace ui
+
+#endif // UI_IMAGE_IO_HEADER_FILE_INCLUDED
@@ -0,0 +1,152 @@
+// ui - Basic User Interface library to do experiments          -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+#ifndef UI_MAPPED_FILE_HEADER_FILE_INCLUDED
+#define UI_MAPPED_FILE_HEADER_FILE_INCLUDED
+
+#include <cstddef>
+#include <string>
+#include <sys/stat.h>
+
+#if WIN32
+  #include <windows.h>
+#else
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <unistd.h>
+#endif
+
+#ifdef _MSC_VER
+  typedef unsigned __int8 uint8_t;
+#else
+  #include <stdint.h>
+#endif
+
+namespace ui {
+
+  //////////////////////////////////////////////////////////////////////
+  // file_stamp struct
+  //
+  // Modification time and size of a file, to know if it changed since
+  // it was loaded.
+
+  struct file_stamp {
+    long long mtime;            // Nanoseconds (or seconds where the OS has no more resolution)
+    long long size;
+
+    file_stamp() : mtime(-1), size(-1) { }
+
+    bool valid() const { return size >= 0; }
+
+    bool operator==(const file_stamp& other) const {
+      return mtime == other.mtime && size == other.size;
+    }
+
+    bool operator!=(const file_stamp& other) const {
+      return !operator==(other);
+    }
+  };
+
+  // Returns an invalid stamp if the file doesn't exist
+  inline file_stamp get_file_stamp(const std::string& filename) {
+    file_stamp st;
+#if WIN32
+    struct _stat64 s;
+    if (_stat64(filename.c_str(), &s) == 0) {
+      st.mtime = (long long)s.st_mtime;
+      st.size = (long long)s.st_size;
+    }
+#else
+    struct stat s;
+    if (stat(filename.c_str(), &s) == 0) {
+  #if defined(__APPLE__)
+      st.mtime = (long long)s.st_mtimespec.tv_sec*1000000000LL + s.st_mtimespec.tv_nsec;
+  #else
+      st.mtime = (long long)s.st_mtim.tv_sec*1000000000LL + s.st_mtim.tv_nsec;
+  #endif
+      st.size = (long long)s.st_size;
+    }
+#endif
+    return st;
+  }
+
+  //////////////////////////////////////////////////////////////////////
+  // mapped_file class
+  //
+  // Maps a whole file in memory. The mapping is private (copy-on-write):
+  // the content can be modified in memory (e.g. to convert pixels in
+  // place) without changing the file, and only the modified pages are
+  // copied by the OS.
+
+  class mapped_file {
+  public:
+    explicit mapped_file(const std::string& filename)
+      : m_data(NULL)
+      , m_size(0) {
+#if WIN32
+      HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                                NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+      if (file == INVALID_HANDLE_VALUE)
+        return;
+
+      LARGE_INTEGER size;
+      if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+        HANDLE mapping = CreateFileMapping(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+        if (mapping) {
+          m_data = static_cast<uint8_t*>(MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0));
+          if (m_data)
+            m_size = std::size_t(size.QuadPart);
+          CloseHandle(mapping);   // The view keeps the mapping alive
+        }
+      }
+      CloseHandle(file);
+#else
+      int fd = open(filename.c_str(), O_RDONLY);
+      if (fd < 0)
+        return;
+
+      struct stat s;
+      if (fstat(fd, &s) == 0 && s.st_size > 0) {
+        void* data = mmap(NULL, s.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+          m_data = static_cast<uint8_t*>(data);
+          m_size = std::size_t(s.st_size);
+          // The whole file will be read from the beginning
+          madvise(data, m_size, MADV_SEQUENTIAL);
+          madvise(data, m_size, MADV_WILLNEED);
+        }
+      }
+      close(fd);                // The mapping keeps the file open
+#endif
+    }
+
+    ~mapped_file() {
+      if (m_data) {
+#if WIN32
+        UnmapViewOfFile(m_data);
+#else
+        munmap(m_data, m_size);
+#endif
+      }
+    }
+
+    bool is_open() const { return m_data != NULL; }
+    uint8_t* data() { return m_data; }
+    const uint8_t* data() const { return m_data; }
+    std::size_t size() const { return m_size; }
+
+  private:
+    uint8_t* m_data;
+    std::size_t m_size;
+
+    // Non-copyable
+    mapped_file(const mapped_file&);
+    mapped_file& operator=(const mapped_file&);
+  };
+
+} // namespace ui
+
+#endif // UI_MAPPED_FILE_HEADER_FILE_INCLUDED
@@ -0,0 +1,301 @@
+// ui - Basic User Interface library to do experiments          -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+#ifndef UI_OFFSCREEN_HEADER_FILE_INCLUDED
+#define UI_OFFSCREEN_HEADER_FILE_INCLUDED
+
+#include "mt/thread.h"
+#include "ui/bitmap.h"
+#include "ui/console.h"
+#include "ui/damage.h"
+#include "ui/event.h"
+#include "ui/hud.h"
+#include "ui/image_io.h"
+#include "ui/raster.h"
+#include "ui/text.h"
+
+#if UI_HAVE_X11
+  #include "ui/x11.h"
+#endif
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace ui {
+
+  namespace offscreen {
+
+  //////////////////////////////////////////////////////////////////////
+  // offscreen_window class
+  //
+  // Portable backend that renders into an in-memory framebuffer. If
+  // the library was compiled with UI_HAVE_X11 and there is a display,
+  // frames are presented in a X11 window, in other case the window is
+  // headless (useful to run, test and benchmark rendering code on
+  // servers).
+  //
+  // Drawing functions mark the modified areas with invalidate() and
+  // present() copies only those areas to the X11 window.
+  //
+  // Events come from the X11 window and from post_event() (the only
+  // source in headless mode).
+  //
+  // present_frame() is called from the present thread of a swap_chain
+  // while the main thread handles events (X11 Expose events present
+  // the framebuffer too), so the presenter, the damage and the frame
+  // counter are protected by a mutex.
+  //
+  // Environment variables:
+  //   UI_HEADLESS=1        Don't try to open a X11 window
+  //   UI_DUMP=frame%03d.png
+  //                        Save each presented frame to a file (PNG or
+  //                        PPM depending on the extension), the frame
+  //                        number replaces one %d, %Nd or %0Nd
+
+  // Replaces the frame number in a UI_DUMP pattern ("%%" is a '%').
+  // It's not given to printf(), so it returns false if the pattern has
+  // other specifiers or more than one number.
+  inline bool dump_filename(const std::string& pattern, int frame, std::string& filename) {
+    filename.clear();
+    bool number = false;
+    for (std::size_t i=0; i<pattern.size(); ++i) {
+      if (pattern[i] != '%') {
+        filename += pattern[i];
+        continue;
+      }
+      if (++i < pattern.size() && pattern[i] == '%') {
+        filename += '%';
+        continue;
+      }
+
+      bool zeros = false;
+      int width = 0;
+      if (i < pattern.size() && pattern[i] == '0') {
+        zeros = true;
+        ++i;
+      }
+      while (i < pattern.size() && pattern[i] >= '0' && pattern[i] <= '9' && width <= 32)
+        width = width*10 + (pattern[i++] - '0');
+      if (number || width > 32 || i == pattern.size() || pattern[i] != 'd')
+        return false;
+
+      char buf[64];
+      std::snprintf(buf, sizeof(buf), zeros ? "%0*d": "%*d", width, frame);
+      filename += buf;
+      number = true;
+    }
+    return true;
+  }
+
+  class offscreen_window {
+    bitmap* m_bitmap;           // Owned only in headless mode
+#if UI_HAVE_X11
+    x11::x11_presenter* m_presenter;
+#endif
+    mt::mutex m_present_mutex;  // Used by present(), present_frame() and events
+    damage_region m_damage;
+    event_queue m_events;
+    std::string m_dump;
+    int m_frame;
+    font m_font;
+    console m_console;          // Text written with write()
+
+  public:
+
+    offscreen_window(int width, int height)
+      : m_bitmap(NULL)
+      , m_frame(0)
+      , m_font(new builtin_glyph_source)
+      , m_console(m_font, rect(0, 0, width, height)) {
+#if UI_HAVE_X11
+      m_presenter = NULL;
+      if (!std::getenv("UI_HEADLESS"))
+        m_presenter = x11::x11_presenter::open(width, height);
+      if (m_presenter)
+        m_bitmap = &m_presenter->framebuffer();
+      else
+#endif
+        m_bitmap = new bitmap(width, height);
+
+      if (const char* dump = std::getenv("UI_DUMP")) {
+        std::string filename;
+        if (dump_filename(dump, 0, filename))
+          m_dump = dump;
+        else
+          std::fprintf(stderr, "UI_DUMP: invalid pattern \"%s\" (use %%d, %%Nd or %%0Nd)\n", dump);
+      }
+
+      // Clear the whole bitmap with a white background
+      fill_rect(*m_bitmap, rect(0, 0, width, height), rgba(255, 255, 255));
+      m_damage.set_clip(rect(0, 0, width, height));
+      m_damage.add_all();
+    }
+
+    ~offscreen_window() {
+#if UI_HAVE_X11
+      if (m_presenter) {
+        delete m_presenter;
+        return;
+      }
+#endif
+      delete m_bitmap;
+    }
+
+    bool headless() const {
+#if UI_HAVE_X11
+      return m_presenter == NULL;
+#else
+      return true;
+#endif
+    }
+
+    size_t width() {
+      return m_bitmap->width();
+    }
+
+    size_t height() {
+      return m_bitmap->height();
+    }
+
+    bitmap& framebuffer() {
+      return *m_bitmap;
+    }
+
+    void invalidate(const rect& rc) {
+      mt::lock_guard<mt::mutex> lock(m_present_mutex);
+      m_damage.add(rc);
+    }
+
+    void invalidate() {
+      mt::lock_guard<mt::mutex> lock(m_present_mutex);
+      m_damage.add_all();
+    }
+
+    const damage_region& damage() const {
+      return m_damage;
+    }
+
+    // Presents the invalidated areas (the UI_DUMP files contain the
+    // whole frame anyway)
+    void present() {
+      mt::lock_guard<mt::mutex> lock(m_present_mutex);
+      present_damage();
+    }
+
+    // Returns the next event without blocking
+    bool poll_event(event& ev) {
+#if UI_HAVE_X11
+      if (m_presenter) {
+        mt::lock_guard<mt::mutex> lock(m_present_mutex);
+        event xev;
+        while (m_presenter->next_event(xev))
+          m_events.push(xev);
+      }
+#endif
+      return m_events.try_pop(ev);
+    }
+
+    // Waits for the next event (timeout in milliseconds, negative to
+    // wait forever), returns false on timeout. The presenter isn't
+    // locked while it sleeps (Xlib is initialized for threads).
+    bool wait_event(event& ev, int timeout_ms) {
+#if UI_HAVE_X11
+      if (m_presenter) {
+        Chrono chrono;
+        for (;;) {
+          if (poll_event(ev))
+            return true;
+
+          int remaining = -1;
+          if (timeout_ms >= 0) {
+            remaining = timeout_ms - int(chrono.elapsed() * 1000.0);
+            if (remaining <= 0)
+              return false;
+          }
+          m_presenter->wait(remaining);
+        }
+      }
+#endif
+      return m_events.wait_pop(ev, timeout_ms);
+    }
+
+    // Can be called from any thread
+    void post_event(const event& ev) {
+      m_events.push(ev);
+#if UI_HAVE_X11
+      if (m_presenter)
+        m_presenter->wakeup();
+#endif
+    }
+
+    // Copies a whole frame to the framebuffer and presents it (called
+    // from the present thread of a swap_chain) with the overlay over it
+    void present_frame(const bitmap& frame, hud* overlay = NULL) {
+      mt::lock_guard<mt::mutex> lock(m_present_mutex);
+      blit(*m_bitmap, 0, 0, frame, rect(0, 0, frame.width(), frame.height()));
+      if (overlay)
+        overlay->draw(*m_bitmap);
+      m_damage.add_all();
+      present_damage();
+    }
+
+    // In headless mode there is no keyboard, the frame is presented
+    // and the function returns immediately
+    void waitkey() {
+      present();
+#if UI_HAVE_X11
+      if (m_presenter) {
+        event ev;
+        while (!m_presenter->closed() && wait_event(ev, -1)) {
+          if (ev.type == event_key_down || ev.type == event_close)
+            break;
+        }
+      }
+#endif
+    }
+
+    void write(const std::string& text) {
+      m_console.write(text);
+      const rect rc = m_console.render(*m_bitmap);
+      mt::lock_guard<mt::mutex> lock(m_present_mutex);
+      m_damage.add(rc);
+    }
+
+    console& text_console() {
+      return m_console;
+    }
+
+  private:
+    // Called with m_present_mutex locked
+    void present_damage() {
+#if UI_HAVE_X11
+      if (m_presenter && !m_damage.empty())
+        m_presenter->present(m_damage.rects());
+#endif
+      m_damage.clear();
+
+      std::string filename;
+      if (!m_dump.empty() && dump_filename(m_dump, m_frame, filename))
+        save_image(*m_bitmap, filename);
+      ++m_frame;
+    }
+
+    // Non-copyable
+    offscreen_window(const offscreen_window&);
+    offscreen_window& operator=(const offscreen_window&);
+  };
+
+  } // namespace offscreen
+
+  typedef offscreen::offscreen_window window_impl;
+
+} // namespace ui
+
+#define ui_main() main()
+
+#endif // UI_OFFSCREEN_HEADER_FILE_INCLUDED
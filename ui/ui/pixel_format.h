@@ -0,0 +1,176 @@
+// ui - Basic User Interface library to do experiments          -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+#ifndef UI_PIXEL_FORMAT_HEADER_FILE_INCLUDED
+#define UI_PIXEL_FORMAT_HEADER_FILE_INCLUDED
+
+#ifdef _MSC_VER
+  typedef unsigned __int32 uint32_t;
+  typedef unsigned __int16 uint16_t;
+  typedef unsigned __int8 uint8_t;
+#else
+  #include <stdint.h>
+#endif
+
+namespace ui {
+
+  //////////////////////////////////////////////////////////////////////
+  // pixel type
+  //
+  // 32bpp pixels stored as 0xAARRGGBB, i.e. B, G, R, A bytes in memory
+  // on little-endian machines: the layout of a 32bpp BI_RGB DIB and of
+  // a 24/32 depth TrueColor XImage, so frames can be presented without
+  // conversions.
+
+  typedef uint32_t pixel;
+
+  inline pixel rgba(int r, int g, int b, int a = 255) {
+    return (pixel(a) << 24) | (pixel(r) << 16) | (pixel(g) << 8) | pixel(b);
+  }
+
+  inline int get_r(pixel c) { return (c >> 16) & 0xff; }
+  inline int get_g(pixel c) { return (c >> 8) & 0xff; }
+  inline int get_b(pixel c) { return c & 0xff; }
+  inline int get_a(pixel c) { return (c >> 24) & 0xff; }
+
+  //////////////////////////////////////////////////////////////////////
+  // Pixel formats
+  //
+  // Each format is a traits struct with the type of one pixel in
+  // memory and the conversions from/to a premultiplied "pixel". Code
+  // templated on formats (see ui/convert.h) gets one loop for each
+  // pair of formats, without any check of the format per pixel.
+
+  enum pixel_format {
+    format_bgra8,               // 0xAARRGGBB, premultiplied alpha (the "pixel" type)
+    format_bgra8_straight,      // 0xAARRGGBB, straight alpha
+    format_rgba8,               // R, G, B, A bytes, premultiplied alpha
+    format_rgb565,              // 16-bit RRRRRGGGGGGBBBBB, opaque
+    format_a8,                  // 8-bit alpha mask (white with that alpha)
+    format_count
+  };
+
+  inline const char* pixel_format_name(pixel_format format) {
+    switch (format) {
+      case format_bgra8: return "bgra8";
+      case format_bgra8_straight: return "bgra8_straight";
+      case format_rgba8: return "rgba8";
+      case format_rgb565: return "rgb565";
+      case format_a8: return "a8";
+      default: return "unknown";
+    }
+  }
+
+  namespace format_details {
+
+    // Returns round(x*a/255) for x, a in [0, 255]
+    inline uint32_t mul255(uint32_t x, uint32_t a) {
+      uint32_t t = x*a + 128;
+      return (t + (t >> 8)) >> 8;
+    }
+
+    // Returns round(x*255/a) limited to 255 (a > 0)
+    inline uint32_t div255(uint32_t x, uint32_t a) {
+      uint32_t c = (x*255 + a/2) / a;
+      return (c > 255 ? 255: c);
+    }
+
+  } // namespace format_details
+
+  struct bgra8_format {
+    typedef uint32_t value_type;
+    static const pixel_format id = format_bgra8;
+
+    static pixel to_pixel(value_type v) { return v; }
+    static value_type from_pixel(pixel c) { return c; }
+  };
+
+  struct bgra8_straight_format {
+    typedef uint32_t value_type;
+    static const pixel_format id = format_bgra8_straight;
+
+    static pixel to_pixel(value_type v) {
+      using format_details::mul255;
+      const uint32_t a = v >> 24;
+      return ((v & 0xff000000) |
+              (mul255((v >> 16) & 0xff, a) << 16) |
+              (mul255((v >> 8) & 0xff, a) << 8) |
+              mul255(v & 0xff, a));
+    }
+
+    static value_type from_pixel(pixel c) {
+      using format_details::div255;
+      const uint32_t a = c >> 24;
+      if (a == 0)
+        return 0;
+      return ((c & 0xff000000) |
+              (div255((c >> 16) & 0xff, a) << 16) |
+              (div255((c >> 8) & 0xff, a) << 8) |
+              div255(c & 0xff, a));
+    }
+  };
+
+  struct rgba8_format {
+    typedef uint32_t value_type;
+    static const pixel_format id = format_rgba8;
+
+    // R and B swapped (the same operation in both directions)
+    static pixel to_pixel(value_type v) {
+      return (v & 0xff00ff00) | ((v >> 16) & 0xff) | ((v & 0xff) << 16);
+    }
+
+    static value_type from_pixel(pixel c) {
+      return to_pixel(c);
+    }
+  };
+
+  struct rgb565_format {
+    typedef uint16_t value_type;
+    static const pixel_format id = format_rgb565;
+
+    // Channels are expanded replicating their high bits, so 0 and the
+    // maximum value are black and white
+    static pixel to_pixel(value_type v) {
+      const uint32_t r = (v >> 11) & 0x1f, g = (v >> 5) & 0x3f, b = v & 0x1f;
+      return (0xff000000 |
+              (((r << 3) | (r >> 2)) << 16) |
+              (((g << 2) | (g >> 4)) << 8) |
+              ((b << 3) | (b >> 2)));
+    }
+
+    // Alpha is dropped (the color is like composited over black)
+    static value_type from_pixel(pixel c) {
+      return value_type(((c >> 8) & 0xf800) | ((c >> 5) & 0x07e0) | ((c >> 3) & 0x001f));
+    }
+  };
+
+  struct a8_format {
+    typedef uint8_t value_type;
+    static const pixel_format id = format_a8;
+
+    static pixel to_pixel(value_type v) { return pixel(v) * 0x01010101; }
+    static value_type from_pixel(pixel c) { return value_type(c >> 24); }
+  };
+
+  // Traits of each pixel_format value
+  template<pixel_format F> struct format_traits;
+  template<> struct format_traits<format_bgra8>          { typedef bgra8_format type; };
+  template<> struct format_traits<format_bgra8_straight> { typedef bgra8_straight_format type; };
+  template<> struct format_traits<format_rgba8>          { typedef rgba8_format type; };
+  template<> struct format_traits<format_rgb565>         { typedef rgb565_format type; };
+  template<> struct format_traits<format_a8>             { typedef a8_format type; };
+
+  inline int bytes_per_pixel(pixel_format format) {
+    switch (format) {
+      case format_rgb565: return 2;
+      case format_a8: return 1;
+      default: return 4;
+    }
+  }
+
+} // namespace ui
+
+#endif // UI_PIXEL_FORMAT_HEADER_FILE_INCLUDED
@@ -0,0 +1,585 @@
+// ui - Basic User Interface library to do experiments          -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+#ifndef UI_RASTER_HEADER_FILE_INCLUDED
+#define UI_RASTER_HEADER_FILE_INCLUDED
+
+#include "ui/bitmap.h"
+#include "ui/cpu.h"
+#include "ui/rect.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace ui {
+
+  //////////////////////////////////////////////////////////////////////
+  // Porter-Duff compositing operators
+  //
+  // Blending works with premultiplied alpha (use premultiply() to
+  // convert a straight alpha color). Each channel of the result is
+  // src*Fa + dst*Fb, where x*f is rounded exactly as x*f/255, so all
+  // the kernels (scalar or SIMD) produce the same pixels.
+
+  enum blend_op {
+    blend_clear,                // 0
+    blend_src,                  // S
+    blend_dst,                  // D
+    blend_src_over,             // S + D*(1-Sa)
+    blend_dst_over,             // S*(1-Da) + D
+    blend_src_in,               // S*Da
+    blend_dst_in,               // D*Sa
+    blend_src_out,              // S*(1-Da)
+    blend_dst_out,              // D*(1-Sa)
+    blend_src_atop,             // S*Da + D*(1-Sa)
+    blend_dst_atop,             // S*(1-Da) + D*Sa
+    blend_xor,                  // S*(1-Da) + D*(1-Sa)
+    blend_op_count
+  };
+
+  namespace raster_details {
+
+    enum factor { f_zero, f_one, f_sa, f_inv_sa, f_da, f_inv_da };
+
+    template<blend_op Op> struct porter_duff;
+    template<> struct porter_duff<blend_clear>    { enum { fa = f_zero,   fb = f_zero }; };
+    template<> struct porter_duff<blend_src>      { enum { fa = f_one,    fb = f_zero }; };
+    template<> struct porter_duff<blend_dst>      { enum { fa = f_zero,   fb = f_one }; };
+    template<> struct porter_duff<blend_src_over> { enum { fa = f_one,    fb = f_inv_sa }; };
+    template<> struct porter_duff<blend_dst_over> { enum { fa = f_inv_da, fb = f_one }; };
+    template<> struct porter_duff<blend_src_in>   { enum { fa = f_da,     fb = f_zero }; };
+    template<> struct porter_duff<blend_dst_in>   { enum { fa = f_zero,   fb = f_sa }; };
+    template<> struct porter_duff<blend_src_out>  { enum { fa = f_inv_da, fb = f_zero }; };
+    template<> struct porter_duff<blend_dst_out>  { enum { fa = f_zero,   fb = f_inv_sa }; };
+    template<> struct porter_duff<blend_src_atop> { enum { fa = f_da,     fb = f_inv_sa }; };
+    template<> struct porter_duff<blend_dst_atop> { enum { fa = f_inv_da, fb = f_sa }; };
+    template<> struct porter_duff<blend_xor>      { enum { fa = f_inv_da, fb = f_inv_sa }; };
+
+    using format_details::mul255;
+
+    template<int F>
+    inline uint32_t factor_value(uint32_t sa, uint32_t da) {
+      switch (F) {
+        case f_sa: return sa;
+        case f_inv_sa: return 255-sa;
+        case f_da: return da;
+        case f_inv_da: return 255-da;
+        default: return 255;
+      }
+    }
+
+    template<int F>
+    inline uint32_t term(uint32_t x, uint32_t f) {
+      return (F == f_zero ? 0: F == f_one ? x: mul255(x, f));
+    }
+
+    template<blend_op Op>
+    inline pixel blend_pixel(pixel s, pixel d) {
+      typedef porter_duff<Op> pd;
+      const uint32_t sa = s >> 24, da = d >> 24;
+      const uint32_t fa = factor_value<pd::fa>(sa, da);
+      const uint32_t fb = factor_value<pd::fb>(sa, da);
+      pixel r = 0;
+      for (int shift=0; shift<32; shift+=8) {
+        uint32_t c = term<pd::fa>((s >> shift) & 0xff, fa) +
+                     term<pd::fb>((d >> shift) & 0xff, fb);
+        r |= (c > 255 ? 255: c) << shift;
+      }
+      return r;
+    }
+
+    // Composites the color (premultiplied) scaled by the coverage
+    // over the pixel
+    inline pixel blend_mask_pixel(pixel d, pixel color, uint32_t coverage) {
+      if (coverage == 255 && (color >> 24) == 255)
+        return color;
+
+      pixel s = 0;
+      for (int shift=0; shift<32; shift+=8)
+        s |= mul255((color >> shift) & 0xff, coverage) << shift;
+      return blend_pixel<blend_src_over>(s, d);
+    }
+
+    // Row after "row" in a bitmap of "stride" bytes per row
+    inline pixel* next_row(pixel* row, int stride) {
+      return reinterpret_cast<pixel*>(reinterpret_cast<uint8_t*>(row) + stride);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // Scalar kernels (reference implementation)
+
+    struct scalar_kernels {
+      static void fill(pixel* dst, int n, pixel color) {
+        for (int i=0; i<n; ++i)
+          dst[i] = color;
+      }
+
+      static void fill_stream(pixel* dst, int n, pixel color) {
+        fill(dst, n, color);
+      }
+
+      static void blend_mask(pixel* dst, int dst_stride,
+                             const uint8_t* mask, int mask_stride,
+                             pixel color, int w, int h) {
+        for (; h > 0; --h, dst=next_row(dst, dst_stride), mask+=mask_stride)
+          for (int i=0; i<w; ++i)
+            if (mask[i])
+              dst[i] = blend_mask_pixel(dst[i], color, mask[i]);
+      }
+
+      template<blend_op Op>
+      struct blend {
+        static void run(pixel* dst, const pixel* src, int n) {
+          for (int i=0; i<n; ++i)
+            dst[i] = blend_pixel<Op>(src[i], dst[i]);
+        }
+      };
+
+      template<blend_op Op>
+      struct blend_solid {
+        static void run(pixel* dst, pixel color, int n) {
+          for (int i=0; i<n; ++i)
+            dst[i] = blend_pixel<Op>(color, dst[i]);
+        }
+      };
+    };
+
+  } // namespace raster_details
+
+  //////////////////////////////////////////////////////////////////////
+  // raster_kernels
+  //
+  // Table of span functions for one SIMD level. Drawing functions use
+  // the table of the current level, selected at startup with the CPU
+  // features (or UI_SIMD=scalar/sse2/avx2 to force a lower level).
+
+  struct raster_kernels {
+    typedef void (*fill_fn)(pixel* dst, int n, pixel color);
+    typedef void (*blend_fn)(pixel* dst, const pixel* src, int n);
+    typedef void (*blend_solid_fn)(pixel* dst, pixel color, int n);
+    typedef void (*blend_mask_fn)(pixel* dst, int dst_stride,
+                                  const uint8_t* mask, int mask_stride,
+                                  pixel color, int w, int h);
+
+    simd_level level;
+    fill_fn fill;
+    fill_fn fill_stream;        // Non-temporal stores (for big areas)
+    blend_mask_fn blend_mask;   // Color with a w*h 8-bit coverage mask (src_over),
+                                // strides in bytes
+    blend_fn blend[blend_op_count];
+    blend_solid_fn blend_solid[blend_op_count];
+  };
+
+} // namespace ui
+
+#if UI_X86_SIMD
+  #include "ui/raster_x86.h"
+#endif
+
+namespace ui {
+
+  namespace raster_details {
+
+    template<class Kernels, int I = 0>
+    struct blend_table {
+      static void fill(raster_kernels& k) {
+        k.blend[I] = &Kernels::template blend<blend_op(I)>::run;
+        k.blend_solid[I] = &Kernels::template blend_solid<blend_op(I)>::run;
+        blend_table<Kernels, I+1>::fill(k);
+      }
+    };
+
+    template<class Kernels>
+    struct blend_table<Kernels, blend_op_count> {
+      static void fill(raster_kernels&) { }
+    };
+
+    template<class Kernels>
+    struct kernels_table : raster_kernels {
+      explicit kernels_table(simd_level l) {
+        level = l;
+        fill = &Kernels::fill;
+        fill_stream = &Kernels::fill_stream;
+        blend_mask = &Kernels::blend_mask;
+        blend_table<Kernels>::fill(*this);
+      }
+    };
+
+    inline simd_level initial_simd_level() {
+      simd_level level = detect_simd_level();
+      if (const char* env = std::getenv("UI_SIMD")) {
+        for (int i=simd_scalar; i<level; ++i)
+          if (std::strcmp(env, simd_level_name(simd_level(i))) == 0)
+            return simd_level(i);
+      }
+      return level;
+    }
+
+  } // namespace raster_details
+
+  // Returns the kernels of the given level (or of the best available
+  // level below it)
+  inline const raster_kernels& raster_kernels_for(simd_level level) {
+    using namespace raster_details;
+    static const kernels_table<scalar_kernels> scalar(simd_scalar);
+#if UI_X86_SIMD
+    static const kernels_table<sse2_kernels> sse2(simd_sse2);
+    static const kernels_table<avx2_kernels> avx2(simd_avx2);
+    static const simd_level best = detect_simd_level();
+    if (level > best)
+      level = best;
+    if (level == simd_avx2)
+      return avx2;
+    if (level == simd_sse2)
+      return sse2;
+#endif
+    return scalar;
+  }
+
+  namespace raster_details {
+
+    inline std::atomic<const raster_kernels*>& active_kernels() {
+      static std::atomic<const raster_kernels*> k(
+        &raster_kernels_for(initial_simd_level()));
+      return k;
+    }
+
+  } // namespace raster_details
+
+  inline const raster_kernels& kernels() {
+    return *raster_details::active_kernels().load(std::memory_order_relaxed);
+  }
+
+  inline simd_level current_simd_level() {
+    return kernels().level;
+  }
+
+  // Changes the kernels used by the drawing functions (mainly to test
+  // and benchmark each level)
+  inline void set_simd_level(simd_level level) {
+    raster_details::active_kernels().store(&raster_kernels_for(level),
+                                           std::memory_order_relaxed);
+  }
+
+  //////////////////////////////////////////////////////////////////////
+  // Colors
+
+  // Converts a straight alpha color to premultiplied alpha
+  inline pixel premultiply(pixel c) {
+    using raster_details::mul255;
+    uint32_t a = c >> 24;
+    return rgba(mul255(get_r(c), a), mul255(get_g(c), a), mul255(get_b(c), a), a);
+  }
+
+  //////////////////////////////////////////////////////////////////////
+  // Drawing functions
+  //
+  // All of them clip to the bitmap bounds.
+
+  namespace raster_details {
+
+    // Areas bigger than this are filled with non-temporal stores (they
+    // don't fit in the cache anyway)
+    static const int stream_threshold = 1024*1024;
+
+    inline rect bounds(const bitmap& bmp) {
+      return rect(0, 0, bmp.width(), bmp.height());
+    }
+
+  } // namespace raster_details
+
+  //////////////////////////////////////////////////////////////////////
+  // raster_counters struct
+  //
+  // Draw calls and pixels of the drawing functions (from any thread),
+  // read by the frame_monitor. Counting is enabled while there are
+  // users, in other case it costs one relaxed load per call. Draws of
+  // a thread inside an uncounted_draws scope aren't counted.
+
+  struct raster_counters {
+    std::atomic<int> users;
+    std::atomic<long long> calls;
+    std::atomic<long long> pixels;
+
+    raster_counters() : users(0), calls(0), pixels(0) { }
+  };
+
+  inline raster_counters& draw_counters() {
+    static raster_counters counters;
+    return counters;
+  }
+
+  namespace raster_details {
+
+    // Nested uncounted_draws scopes of the current thread
+    inline int& uncounted_depth() {
+      static thread_local int depth = 0;
+      return depth;
+    }
+
+    inline void count_draw(long long pixels) {
+      raster_counters& c = draw_counters();
+      if (c.users.load(std::memory_order_relaxed) > 0 &&
+          uncounted_depth() == 0) {
+        c.calls.fetch_add(1, std::memory_order_relaxed);
+        c.pixels.fetch_add(pixels, std::memory_order_relaxed);
+      }
+    }
+
+  } // namespace raster_details
+
+  // The drawing functions called by this thread in the scope of this
+  // object aren't counted in the draw_counters() (e.g. the drawing of
+  // overlays that aren't part of the measured frame)
+  class uncounted_draws {
+  public:
+    uncounted_draws() { ++raster_details::uncounted_depth(); }
+    ~uncounted_draws() { --raster_details::uncounted_depth(); }
+
+  private:
+    // Non-copyable
+    uncounted_draws(const uncounted_draws&);
+    uncounted_draws& operator=(const uncounted_draws&);
+  };
+
+  inline void fill_rect(bitmap& bmp, const rect& rc, pixel color) {
+    rect r = rc & raster_details::bounds(bmp);
+    if (r.empty())
+      return;
+    raster_details::count_draw(r.area());
+
+    const raster_kernels& k = kernels();
+    raster_kernels::fill_fn fill =
+      (r.area() >= raster_details::stream_threshold ? k.fill_stream: k.fill);
+    for (int y=r.y; y<r.y2(); ++y)
+      fill(bmp.span(r.x, y), r.w, color);
+  }
+
+  // Composites a solid (premultiplied) color over the rectangle
+  inline void blend_rect(bitmap& bmp, const rect& rc, pixel color,
+                         blend_op op = blend_src_over) {
+    rect r = rc & raster_details::bounds(bmp);
+    if (r.empty())
+      return;
+    raster_details::count_draw(r.area());
+
+    raster_kernels::blend_solid_fn blend = kernels().blend_solid[op];
+    for (int y=r.y; y<r.y2(); ++y)
+      blend(bmp.span(r.x, y), color, r.w);
+  }
+
+  enum gradient_direction {
+    gradient_horizontal,        // c0 at the left edge, c1 at the right edge
+    gradient_vertical           // c0 at the top edge, c1 at the bottom edge
+  };
+
+  // Fills the rectangle with a linear gradient between two colors (all
+  // channels, including alpha, are interpolated)
+  inline void fill_gradient(bitmap& bmp, const rect& rc, pixel c0, pixel c1,
+                            gradient_direction dir) {
+    rect r = rc & raster_details::bounds(bmp);
+    if (r.empty())
+      return;
+    raster_details::count_draw(r.area());
+
+    const int len = (dir == gradient_horizontal ? rc.w: rc.h);
+    const int first = (dir == gradient_horizontal ? r.x-rc.x: r.y-rc.y);
+    const int count = (dir == gradient_horizontal ? r.w: r.h);
+    const int den = (len > 1 ? len-1: 1);
+
+    std::vector<pixel> colors(count);
+    for (int i=0; i<count; ++i) {
+      int t = first+i;
+      pixel c = 0;
+      for (int shift=0; shift<32; shift+=8) {
+        int a = (c0 >> shift) & 0xff;
+        int b = (c1 >> shift) & 0xff;
+        c |= pixel((a*(den-t) + b*t + den/2) / den) << shift;
+      }
+      colors[i] = c;
+    }
+
+    if (dir == gradient_horizontal) {
+      for (int y=r.y; y<r.y2(); ++y)
+        std::memcpy(bmp.span(r.x, y), &colors[0], r.w*sizeof(pixel));
+    }
+    else {
+      raster_kernels::fill_fn fill = kernels().fill;
+      for (int y=r.y; y<r.y2(); ++y)
+        fill(bmp.span(r.x, y), r.w, colors[y-r.y]);
+    }
+  }
+
+  // Copies the "src_rc" area of "src" to (x, y) in "dst"
+  inline void blit(bitmap& dst, int x, int y, const bitmap& src, const rect& src_rc) {
+    rect s = src_rc & raster_details::bounds(src);
+    x += s.x - src_rc.x;
+    y += s.y - src_rc.y;
+    rect d = rect(x, y, s.w, s.h) & raster_details::bounds(dst);
+    if (d.empty())
+      return;
+
+    s.x += d.x - x;
+    s.y += d.y - y;
+    raster_details::count_draw(d.area());
+    for (int v=0; v<d.h; ++v)
+      std::memmove(dst.span(d.x, d.y+v), src.span(s.x, s.y+v), d.w*sizeof(pixel));
+  }
+
+  // Composites the "src_rc" area of "src" (premultiplied) at (x, y)
+  // in "dst" with the given operator
+  inline void blit(bitmap& dst, int x, int y, const bitmap& src, const rect& src_rc,
+                   blend_op op) {
+    rect s = src_rc & raster_details::bounds(src);
+    x += s.x - src_rc.x;
+    y += s.y - src_rc.y;
+    rect d = rect(x, y, s.w, s.h) & raster_details::bounds(dst);
+    if (d.empty())
+      return;
+
+    s.x += d.x - x;
+    s.y += d.y - y;
+    raster_details::count_draw(d.area());
+    raster_kernels::blend_fn blend = kernels().blend[op];
+    for (int v=0; v<d.h; ++v)
+      blend(dst.span(d.x, d.y+v), src.span(s.x, s.y+v), d.w);
+  }
+
+  inline void blit(bitmap& dst, int x, int y, const bitmap& src,
+                   blend_op op = blend_src_over) {
+    blit(dst, x, y, src, raster_details::bounds(src), op);
+  }
+
+  // Draws a 1 pixel width line with Bresenham's algorithm, both end
+  // points included
+  inline void draw_line(bitmap& bmp, int x0, int y0, int x1, int y1, pixel color) {
+    if (y0 == y1) {
+      if (x0 > x1) std::swap(x0, x1);
+      fill_rect(bmp, rect(x0, y0, x1-x0+1, 1), color);
+      return;
+    }
+
+    const int dx = std::abs(x1-x0), sx = (x0 < x1 ? 1: -1);
+    const int dy = -std::abs(y1-y0), sy = (y0 < y1 ? 1: -1);
+    const rect bounds = raster_details::bounds(bmp);
+    raster_details::count_draw(std::max(dx, -dy)+1);
+    int err = dx+dy;
+    while (true) {
+      if (bounds.contains(x0, y0))
+        bmp.put_pixel(x0, y0, color);
+      if (x0 == x1 && y0 == y1)
+        break;
+      // The line cannot come back to the bitmap
+      if ((sx > 0 ? x0 >= bounds.x2(): x0 < 0) ||
+          (sy > 0 ? y0 >= bounds.y2(): y0 < 0))
+        break;
+      int e2 = 2*err;
+      if (e2 >= dy) { err += dy; x0 += sx; }
+      if (e2 <= dx) { err += dx; y0 += sy; }
+    }
+  }
+
+  namespace raster_details {
+
+    // Composites the (premultiplied) color with the given coverage
+    inline void plot_aa(bitmap& bmp, const rect& clip, int x, int y,
+                        pixel color, double coverage) {
+      if (!clip.contains(x, y))
+        return;
+
+      uint32_t cov = uint32_t(coverage*255.0 + 0.5);
+      pixel c = 0;
+      for (int shift=0; shift<32; shift+=8)
+        c |= mul255((color >> shift) & 0xff, cov) << shift;
+      pixel* p = bmp.span(x, y);
+      *p = blend_pixel<blend_src_over>(c, *p);
+    }
+
+    // Wu's line touching only the pixels inside "clip" (which must be
+    // inside the bitmap), so a line can be drawn by parts with the same
+    // result (e.g. by tiles)
+    inline void draw_line_aa(bitmap& bmp, const rect& clip,
+                             double x0, double y0, double x1, double y1,
+                             pixel color) {
+      const bool steep = std::fabs(y1-y0) > std::fabs(x1-x0);
+      if (steep) {
+        std::swap(x0, y0);
+        std::swap(x1, y1);
+      }
+      if (x0 > x1) {
+        std::swap(x0, x1);
+        std::swap(y0, y1);
+      }
+
+      const double dx = x1-x0;
+      const double gradient = (dx == 0.0 ? 1.0: (y1-y0) / dx);
+
+#define UI_PLOT(px, py, c)                                        \
+      if (steep) plot_aa(bmp, clip, int(py), int(px), color, c); \
+      else       plot_aa(bmp, clip, int(px), int(py), color, c);
+
+      // First end point
+      double xend = std::floor(x0 + 0.5);
+      double yend = y0 + gradient*(xend-x0);
+      double xgap = 1.0 - (x0 + 0.5 - std::floor(x0 + 0.5));
+      const int xpx1 = int(xend);
+      double ypx1 = std::floor(yend);
+      double f = yend - ypx1;
+      UI_PLOT(xpx1, ypx1, (1.0-f)*xgap);
+      UI_PLOT(xpx1, ypx1+1, f*xgap);
+      const double ystart = yend;
+
+      // Second end point
+      xend = std::floor(x1 + 0.5);
+      yend = y1 + gradient*(xend-x1);
+      xgap = x1 + 0.5 - std::floor(x1 + 0.5);
+      const int xpx2 = int(xend);
+      double ypx2 = std::floor(yend);
+      f = yend - ypx2;
+      UI_PLOT(xpx2, ypx2, (1.0-f)*xgap);
+      UI_PLOT(xpx2, ypx2+1, f*xgap);
+
+      // Only the part of the line inside the clipping rectangle (the Y
+      // of each X is calculated from the start point instead of being
+      // accumulated, so it doesn't depend on the first visible X)
+      int xfirst = xpx1+1, xlast = xpx2;
+      if (steep) {
+        xfirst = std::max(xfirst, clip.y);
+        xlast = std::min(xlast, clip.y2());
+      }
+      else {
+        xfirst = std::max(xfirst, clip.x);
+        xlast = std::min(xlast, clip.x2());
+      }
+      for (int x=xfirst; x<xlast; ++x) {
+        double intery = ystart + gradient*(x-xpx1);
+        double iy = std::floor(intery);
+        f = intery - iy;
+        UI_PLOT(x, iy, 1.0-f);
+        UI_PLOT(x, iy+1, f);
+      }
+
+#undef UI_PLOT
+    }
+
+  } // namespace raster_details
+
+  // Draws an anti-aliased line with Xiaolin Wu's algorithm, the color
+  // (premultiplied) is composited over the bitmap
+  inline void draw_line_aa(bitmap& bmp, double x0, double y0, double x1, double y1,
+                           pixel color) {
+    raster_details::count_draw(2*int(std::max(std::fabs(x1-x0), std::fabs(y1-y0))+2));
+    raster_details::draw_line_aa(bmp, raster_details::bounds(bmp),
+                                 x0, y0, x1, y1, color);
+  }
+
+} // namespace ui
+
+#endif // UI_RASTER_HEADER_FILE_INCLUDED
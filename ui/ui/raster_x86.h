@@ -0,0 +1,350 @@
+// ui - Basic User Interface library to do experiments          -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+#ifndef UI_RASTER_X86_HEADER_FILE_INCLUDED
+#define UI_RASTER_X86_HEADER_FILE_INCLUDED
+
+// SSE2 and AVX2 span kernels, included from ui/raster.h. AVX2
+// functions are compiled with a target attribute (no -mavx2 flag is
+// needed) and are only called when the CPU supports them.
+
+#include <emmintrin.h>
+#include <immintrin.h>
+
+namespace ui {
+
+  namespace raster_details {
+
+    //////////////////////////////////////////////////////////////////////
+    // SSE2 (4 pixels per iteration)
+    //
+    // Channels are unpacked to 16-bit lanes (2 pixels per register), so
+    // x*f fits in a lane and mul255() can be done exactly.
+
+    inline __m128i mul255_sse2(__m128i x, __m128i f) {
+      __m128i t = _mm_add_epi16(_mm_mullo_epi16(x, f), _mm_set1_epi16(128));
+      return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+    }
+
+    // Broadcasts the alpha of each pixel to its 4 lanes
+    inline __m128i alpha_sse2(__m128i x) {
+      return _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, 0xff), 0xff);
+    }
+
+    template<int F>
+    inline __m128i factor_sse2(__m128i sa, __m128i da) {
+      const __m128i ff = _mm_set1_epi16(255);
+      switch (F) {
+        case f_sa: return sa;
+        case f_inv_sa: return _mm_xor_si128(sa, ff);
+        case f_da: return da;
+        case f_inv_da: return _mm_xor_si128(da, ff);
+        default: return ff;
+      }
+    }
+
+    template<int F>
+    inline __m128i term_sse2(__m128i x, __m128i f) {
+      return (F == f_zero ? _mm_setzero_si128():
+              F == f_one ? x: mul255_sse2(x, f));
+    }
+
+    template<blend_op Op>
+    inline __m128i blend4_sse2(__m128i s, __m128i d) {
+      typedef porter_duff<Op> pd;
+      const __m128i zero = _mm_setzero_si128();
+      __m128i slo = _mm_unpacklo_epi8(s, zero), shi = _mm_unpackhi_epi8(s, zero);
+      __m128i dlo = _mm_unpacklo_epi8(d, zero), dhi = _mm_unpackhi_epi8(d, zero);
+      __m128i salo = alpha_sse2(slo), sahi = alpha_sse2(shi);
+      __m128i dalo = alpha_sse2(dlo), dahi = alpha_sse2(dhi);
+
+      __m128i a = _mm_packus_epi16(term_sse2<pd::fa>(slo, factor_sse2<pd::fa>(salo, dalo)),
+                                   term_sse2<pd::fa>(shi, factor_sse2<pd::fa>(sahi, dahi)));
+      __m128i b = _mm_packus_epi16(term_sse2<pd::fb>(dlo, factor_sse2<pd::fb>(salo, dalo)),
+                                   term_sse2<pd::fb>(dhi, factor_sse2<pd::fb>(sahi, dahi)));
+      return _mm_adds_epu8(a, b);
+    }
+
+    // Composites the color scaled by the 4 coverage values of "m"
+    // (each one repeated in the 4 bytes of its pixel)
+    inline __m128i blend_mask4_sse2(__m128i d, __m128i m, __m128i color16) {
+      const __m128i zero = _mm_setzero_si128();
+      const __m128i ff = _mm_set1_epi16(255);
+      __m128i slo = mul255_sse2(color16, _mm_unpacklo_epi8(m, zero));
+      __m128i shi = mul255_sse2(color16, _mm_unpackhi_epi8(m, zero));
+      __m128i dlo = mul255_sse2(_mm_unpacklo_epi8(d, zero), _mm_xor_si128(alpha_sse2(slo), ff));
+      __m128i dhi = mul255_sse2(_mm_unpackhi_epi8(d, zero), _mm_xor_si128(alpha_sse2(shi), ff));
+      return _mm_adds_epu8(_mm_packus_epi16(slo, shi), _mm_packus_epi16(dlo, dhi));
+    }
+
+    struct sse2_kernels {
+      static void fill(pixel* dst, int n, pixel color) {
+        const __m128i c = _mm_set1_epi32(int(color));
+        int i = 0;
+        for (; i+16<=n; i+=16) {
+          _mm_storeu_si128((__m128i*)(dst+i), c);
+          _mm_storeu_si128((__m128i*)(dst+i+4), c);
+          _mm_storeu_si128((__m128i*)(dst+i+8), c);
+          _mm_storeu_si128((__m128i*)(dst+i+12), c);
+        }
+        for (; i+4<=n; i+=4)
+          _mm_storeu_si128((__m128i*)(dst+i), c);
+        for (; i<n; ++i)
+          dst[i] = color;
+      }
+
+      static void fill_stream(pixel* dst, int n, pixel color) {
+        const __m128i c = _mm_set1_epi32(int(color));
+        int i = 0;
+        for (; i<n && (reinterpret_cast<std::size_t>(dst+i) & 15); ++i)
+          dst[i] = color;
+        for (; i+4<=n; i+=4)
+          _mm_stream_si128((__m128i*)(dst+i), c);
+        for (; i<n; ++i)
+          dst[i] = color;
+        _mm_sfence();
+      }
+
+      static void blend_mask(pixel* dst, int dst_stride,
+                             const uint8_t* mask, int mask_stride,
+                             pixel color, int w, int h) {
+        const __m128i c = _mm_set1_epi32(int(color));
+        const __m128i color16 = _mm_unpacklo_epi8(c, _mm_setzero_si128());
+        const bool opaque = ((color >> 24) == 255);
+        for (; h > 0; --h, dst=next_row(dst, dst_stride), mask+=mask_stride)
+          blend_mask_row(dst, mask, color, w, c, color16, opaque);
+      }
+
+      // One row of blend_mask(). With an opaque color, the blocks with
+      // only 0 and 255 coverage (most of the blocks of a glyph) select
+      // the color or keep the pixel.
+      static inline void blend_mask_row(pixel* dst, const uint8_t* mask, pixel color, int n,
+                                        __m128i c, __m128i color16, bool opaque) {
+        int i = 0;
+        for (; i+4<=n; i+=4) {
+          uint32_t m4;
+          std::memcpy(&m4, mask+i, 4);
+          if (m4 == 0)
+            continue;
+          __m128i m = _mm_cvtsi32_si128(int(m4));
+          m = _mm_unpacklo_epi8(m, m);
+          m = _mm_unpacklo_epi16(m, m);
+          __m128i d = _mm_loadu_si128((const __m128i*)(dst+i));
+          if (opaque && m4 == ((m4 >> 7) & 0x01010101) * 255)
+            d = _mm_or_si128(_mm_and_si128(m, c), _mm_andnot_si128(m, d));
+          else
+            d = blend_mask4_sse2(d, m, color16);
+          _mm_storeu_si128((__m128i*)(dst+i), d);
+        }
+        for (; i<n; ++i)
+          if (mask[i])
+            dst[i] = blend_mask_pixel(dst[i], color, mask[i]);
+      }
+
+      template<blend_op Op>
+      struct blend {
+        static void run(pixel* dst, const pixel* src, int n) {
+          int i = 0;
+          for (; i+4<=n; i+=4) {
+            __m128i s = _mm_loadu_si128((const __m128i*)(src+i));
+            if (Op == blend_src_over) {
+              // Fast paths for opaque and fully transparent pixels
+              if (_mm_movemask_epi8(_mm_cmpeq_epi32(s, _mm_setzero_si128())) == 0xffff)
+                continue;
+              const __m128i amask = _mm_set1_epi32(int(0xff000000));
+              if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(s, amask), amask)) == 0xffff) {
+                _mm_storeu_si128((__m128i*)(dst+i), s);
+                continue;
+              }
+            }
+            __m128i d = _mm_loadu_si128((const __m128i*)(dst+i));
+            _mm_storeu_si128((__m128i*)(dst+i), blend4_sse2<Op>(s, d));
+          }
+          for (; i<n; ++i)
+            dst[i] = blend_pixel<Op>(src[i], dst[i]);
+        }
+      };
+
+      template<blend_op Op>
+      struct blend_solid {
+        static void run(pixel* dst, pixel color, int n) {
+          const __m128i s = _mm_set1_epi32(int(color));
+          int i = 0;
+          for (; i+4<=n; i+=4) {
+            __m128i d = _mm_loadu_si128((const __m128i*)(dst+i));
+            _mm_storeu_si128((__m128i*)(dst+i), blend4_sse2<Op>(s, d));
+          }
+          for (; i<n; ++i)
+            dst[i] = blend_pixel<Op>(color, dst[i]);
+        }
+      };
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    // AVX2 (8 pixels per iteration)
+    //
+    // Same algorithm as SSE2, unpack/pack work inside each 128-bit
+    // lane so the pixel order is preserved.
+
+    UI_TARGET_AVX2 inline __m256i mul255_avx2(__m256i x, __m256i f) {
+      __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(x, f), _mm256_set1_epi16(128));
+      return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+    }
+
+    UI_TARGET_AVX2 inline __m256i alpha_avx2(__m256i x) {
+      return _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(x, 0xff), 0xff);
+    }
+
+    template<int F>
+    UI_TARGET_AVX2 inline __m256i factor_avx2(__m256i sa, __m256i da) {
+      const __m256i ff = _mm256_set1_epi16(255);
+      switch (F) {
+        case f_sa: return sa;
+        case f_inv_sa: return _mm256_xor_si256(sa, ff);
+        case f_da: return da;
+        case f_inv_da: return _mm256_xor_si256(da, ff);
+        default: return ff;
+      }
+    }
+
+    template<int F>
+    UI_TARGET_AVX2 inline __m256i term_avx2(__m256i x, __m256i f) {
+      return (F == f_zero ? _mm256_setzero_si256():
+              F == f_one ? x: mul255_avx2(x, f));
+    }
+
+    template<blend_op Op>
+    UI_TARGET_AVX2 inline __m256i blend8_avx2(__m256i s, __m256i d) {
+      typedef porter_duff<Op> pd;
+      const __m256i zero = _mm256_setzero_si256();
+      __m256i slo = _mm256_unpacklo_epi8(s, zero), shi = _mm256_unpackhi_epi8(s, zero);
+      __m256i dlo = _mm256_unpacklo_epi8(d, zero), dhi = _mm256_unpackhi_epi8(d, zero);
+      __m256i salo = alpha_avx2(slo), sahi = alpha_avx2(shi);
+      __m256i dalo = alpha_avx2(dlo), dahi = alpha_avx2(dhi);
+
+      __m256i a = _mm256_packus_epi16(term_avx2<pd::fa>(slo, factor_avx2<pd::fa>(salo, dalo)),
+                                      term_avx2<pd::fa>(shi, factor_avx2<pd::fa>(sahi, dahi)));
+      __m256i b = _mm256_packus_epi16(term_avx2<pd::fb>(dlo, factor_avx2<pd::fb>(salo, dalo)),
+                                      term_avx2<pd::fb>(dhi, factor_avx2<pd::fb>(sahi, dahi)));
+      return _mm256_adds_epu8(a, b);
+    }
+
+    UI_TARGET_AVX2 inline __m256i blend_mask8_avx2(__m256i d, __m256i m, __m256i color16) {
+      const __m256i zero = _mm256_setzero_si256();
+      const __m256i ff = _mm256_set1_epi16(255);
+      __m256i slo = mul255_avx2(color16, _mm256_unpacklo_epi8(m, zero));
+      __m256i shi = mul255_avx2(color16, _mm256_unpackhi_epi8(m, zero));
+      __m256i dlo = mul255_avx2(_mm256_unpacklo_epi8(d, zero), _mm256_xor_si256(alpha_avx2(slo), ff));
+      __m256i dhi = mul255_avx2(_mm256_unpackhi_epi8(d, zero), _mm256_xor_si256(alpha_avx2(shi), ff));
+      return _mm256_adds_epu8(_mm256_packus_epi16(slo, shi), _mm256_packus_epi16(dlo, dhi));
+    }
+
+    struct avx2_kernels {
+      UI_TARGET_AVX2 static void fill(pixel* dst, int n, pixel color) {
+        const __m256i c = _mm256_set1_epi32(int(color));
+        int i = 0;
+        for (; i+32<=n; i+=32) {
+          _mm256_storeu_si256((__m256i*)(dst+i), c);
+          _mm256_storeu_si256((__m256i*)(dst+i+8), c);
+          _mm256_storeu_si256((__m256i*)(dst+i+16), c);
+          _mm256_storeu_si256((__m256i*)(dst+i+24), c);
+        }
+        for (; i+8<=n; i+=8)
+          _mm256_storeu_si256((__m256i*)(dst+i), c);
+        for (; i<n; ++i)
+          dst[i] = color;
+      }
+
+      UI_TARGET_AVX2 static void fill_stream(pixel* dst, int n, pixel color) {
+        const __m256i c = _mm256_set1_epi32(int(color));
+        int i = 0;
+        for (; i<n && (reinterpret_cast<std::size_t>(dst+i) & 31); ++i)
+          dst[i] = color;
+        for (; i+8<=n; i+=8)
+          _mm256_stream_si256((__m256i*)(dst+i), c);
+        for (; i<n; ++i)
+          dst[i] = color;
+        _mm_sfence();
+      }
+
+      UI_TARGET_AVX2 static void blend_mask(pixel* dst, int dst_stride,
+                                            const uint8_t* mask, int mask_stride,
+                                            pixel color, int w, int h) {
+        const __m256i c = _mm256_set1_epi32(int(color));
+        const __m256i color16 = _mm256_unpacklo_epi8(c, _mm256_setzero_si256());
+        const __m128i c4 = _mm256_castsi256_si128(c);
+        const __m128i color16_4 = _mm256_castsi256_si128(color16);
+        const bool opaque = ((color >> 24) == 255);
+        for (; h > 0; --h, dst=next_row(dst, dst_stride), mask+=mask_stride) {
+          int i = 0;
+          for (; i+8<=w; i+=8) {
+            uint64_t m8;
+            std::memcpy(&m8, mask+i, 8);
+            if (m8 == 0)
+              continue;
+            __m128i m = _mm_loadl_epi64((const __m128i*)(mask+i));
+            m = _mm_unpacklo_epi8(m, m);
+            __m256i mm = _mm256_inserti128_si256(
+              _mm256_castsi128_si256(_mm_unpacklo_epi16(m, m)),
+              _mm_unpackhi_epi16(m, m), 1);
+            __m256i d = _mm256_loadu_si256((const __m256i*)(dst+i));
+            // Only 0 and 255 coverage: selects the color or the pixel
+            if (opaque && m8 == ((m8 >> 7) & 0x0101010101010101ULL) * 255)
+              d = _mm256_blendv_epi8(d, c, mm);
+            else
+              d = blend_mask8_avx2(d, mm, color16);
+            _mm256_storeu_si256((__m256i*)(dst+i), d);
+          }
+          // Glyph rows are usually shorter than 8 pixels
+          if (i < w)
+            sse2_kernels::blend_mask_row(dst+i, mask+i, color, w-i, c4, color16_4, opaque);
+        }
+      }
+
+      template<blend_op Op>
+      struct blend {
+        UI_TARGET_AVX2 static void run(pixel* dst, const pixel* src, int n) {
+          int i = 0;
+          for (; i+8<=n; i+=8) {
+            __m256i s = _mm256_loadu_si256((const __m256i*)(src+i));
+            if (Op == blend_src_over) {
+              // Fast paths for opaque and fully transparent pixels
+              if (_mm256_testz_si256(s, s))
+                continue;
+              const __m256i amask = _mm256_set1_epi32(int(0xff000000));
+              if (_mm256_testc_si256(s, amask)) {
+                _mm256_storeu_si256((__m256i*)(dst+i), s);
+                continue;
+              }
+            }
+            __m256i d = _mm256_loadu_si256((const __m256i*)(dst+i));
+            _mm256_storeu_si256((__m256i*)(dst+i), blend8_avx2<Op>(s, d));
+          }
+          for (; i<n; ++i)
+            dst[i] = blend_pixel<Op>(src[i], dst[i]);
+        }
+      };
+
+      template<blend_op Op>
+      struct blend_solid {
+        UI_TARGET_AVX2 static void run(pixel* dst, pixel color, int n) {
+          const __m256i s = _mm256_set1_epi32(int(color));
+          int i = 0;
+          for (; i+8<=n; i+=8) {
+            __m256i d = _mm256_loadu_si256((const __m256i*)(dst+i));
+            _mm256_storeu_si256((__m256i*)(dst+i), blend8_avx2<Op>(s, d));
+          }
+          for (; i<n; ++i)
+            dst[i] = blend_pixel<Op>(color, dst[i]);
+        }
+      };
+    };
+
+  } // namespace raster_details
+
+} // namespace ui
+
+#endif // UI_RASTER_X86_HEADER_FILE_INCLUDED
@@ -0,0 +1,80 @@
+// ui - Basic User Interface library to do experiments          -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+#ifndef UI_RECT_HEADER_FILE_INCLUDED
+#define UI_RECT_HEADER_FILE_INCLUDED
+
+namespace ui {
+
+  //////////////////////////////////////////////////////////////////////
+  // rect class
+
+  struct rect {
+    int x, y, w, h;
+
+    rect() : x(0), y(0), w(0), h(0) { }
+    rect(int x, int y, int w, int h) : x(x), y(y), w(w), h(h) { }
+
+    int x2() const { return x+w; }  // Exclusive right edge
+    int y2() const { return y+h; }  // Exclusive bottom edge
+    int area() const { return empty() ? 0: w*h; }
+
+    bool empty() const {
+      return w <= 0 || h <= 0;
+    }
+
+    // Returns the rectangle moved by (dx, dy)
+    rect offset(int dx, int dy) const {
+      return rect(x+dx, y+dy, w, h);
+    }
+
+    bool contains(int px, int py) const {
+      return px >= x && px < x+w && py >= y && py < y+h;
+    }
+
+    bool contains(const rect& r) const {
+      return r.x >= x && r.y >= y && r.x2() <= x2() && r.y2() <= y2();
+    }
+
+    bool intersects(const rect& r) const {
+      return !empty() && !r.empty() &&
+             r.x < x2() && r.x2() > x && r.y < y2() && r.y2() > y;
+    }
+
+    // Returns the intersection (empty if they don't intersect)
+    rect operator&(const rect& r) const {
+      int x1 = (x > r.x ? x: r.x);
+      int y1 = (y > r.y ? y: r.y);
+      int xx = (x2() < r.x2() ? x2(): r.x2());
+      int yy = (y2() < r.y2() ? y2(): r.y2());
+      if (xx <= x1 || yy <= y1)
+        return rect();
+      return rect(x1, y1, xx-x1, yy-y1);
+    }
+
+    // Returns the bounding box of both rectangles
+    rect operator|(const rect& r) const {
+      if (empty()) return r;
+      if (r.empty()) return *this;
+      int x1 = (x < r.x ? x: r.x);
+      int y1 = (y < r.y ? y: r.y);
+      int xx = (x2() > r.x2() ? x2(): r.x2());
+      int yy = (y2() > r.y2() ? y2(): r.y2());
+      return rect(x1, y1, xx-x1, yy-y1);
+    }
+
+    bool operator==(const rect& r) const {
+      return x == r.x && y == r.y && w == r.w && h == r.h;
+    }
+
+    bool operator!=(const rect& r) const {
+      return !operator==(r);
+    }
+  };
+
+} // namespace ui
+
+#endif // UI_RECT_HEADER_FILE_INCLUDED
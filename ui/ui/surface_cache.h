@@ -0,0 +1,175 @@
+// ui - Basic User Interface library to do experiments          -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+#ifndef UI_SURFACE_CACHE_HEADER_FILE_INCLUDED
+#define UI_SURFACE_CACHE_HEADER_FILE_INCLUDED
+
+#include "ui/image_io.h"
+#include "ui/mapped_file.h"
+
+#include "mt/futex.h"
+#include "mt/thread.h"
+
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace ui {
+
+  //////////////////////////////////////////////////////////////////////
+  // surface_cache class
+  //
+  // Loaded images by path. get() returns the cached surface while the
+  // modification time and size of the file don't change (the cost of
+  // a hit is one stat() call), in other case the file is loaded again.
+  //
+  // preload() loads a list of files with several threads, so loading
+  // hundreds of assets at startup is limited by the disk and not by
+  // the decoders.
+  //
+  // A returned surface is owned by the cache, it's valid until the
+  // file is reloaded (by a get() after the file changed) or the cache
+  // is cleared. The cache can be used from several threads.
+
+  class surface_cache {
+    struct entry {
+      file_stamp stamp;
+      surface* surf;
+      entry() : surf(NULL) { }
+    };
+
+    typedef std::map<std::string, entry> entries;
+
+    entries m_entries;
+    mutable mt::mutex m_mutex;
+    std::atomic<int> m_hits, m_loads;
+
+  public:
+    surface_cache()
+      : m_hits(0)
+      , m_loads(0) {
+    }
+
+    ~surface_cache() {
+      clear();
+    }
+
+    // Returns NULL if the file cannot be loaded
+    surface* get(const std::string& filename) {
+      const file_stamp stamp = get_file_stamp(filename);
+      if (!stamp.valid())
+        return NULL;
+
+      {
+        mt::lock_guard<mt::mutex> lock(m_mutex);
+        entries::iterator it = m_entries.find(filename);
+        if (it != m_entries.end() && it->second.stamp == stamp) {
+          m_hits.fetch_add(1, std::memory_order_relaxed);
+          return it->second.surf;
+        }
+      }
+
+      // Decoded without the lock, so other threads can load other
+      // files at the same time
+      surface* surf = load_image(filename);
+      m_loads.fetch_add(1, std::memory_order_relaxed);
+      if (!surf)
+        return NULL;
+
+      mt::lock_guard<mt::mutex> lock(m_mutex);
+      entry& e = m_entries[filename];
+      if (e.surf && e.stamp == stamp) {
+        // Other thread loaded the same file
+        delete surf;
+        return e.surf;
+      }
+      delete e.surf;
+      e.stamp = stamp;
+      e.surf = surf;
+      return surf;
+    }
+
+    // Loads the given files (threads = 0 uses one thread per CPU).
+    // Returns the number of files that couldn't be loaded.
+    int preload(const std::vector<std::string>& filenames, int threads = 0) {
+      if (threads <= 0)
+        threads = mt::futex::details::number_of_cpus();
+      if (threads > int(filenames.size()))
+        threads = int(filenames.size());
+
+      preloader job(this, &filenames);
+      std::vector<mt::thread*> workers;
+      for (int i=1; i<threads; ++i)
+        workers.push_back(new mt::thread(preload_worker(&job)));
+      job.run();
+      for (std::size_t i=0; i<workers.size(); ++i) {
+        workers[i]->join();
+        delete workers[i];
+      }
+      return job.failed;
+    }
+
+    std::size_t size() const {
+      mt::lock_guard<mt::mutex> lock(m_mutex);
+      return m_entries.size();
+    }
+
+    // Calls to get() that returned a cached surface
+    int hits() const { return m_hits.load(std::memory_order_relaxed); }
+
+    // Files loaded (or that failed to load)
+    int loads() const { return m_loads.load(std::memory_order_relaxed); }
+
+    // Removes one file, e.g. to free its memory
+    void remove(const std::string& filename) {
+      mt::lock_guard<mt::mutex> lock(m_mutex);
+      entries::iterator it = m_entries.find(filename);
+      if (it != m_entries.end()) {
+        delete it->second.surf;
+        m_entries.erase(it);
+      }
+    }
+
+    void clear() {
+      mt::lock_guard<mt::mutex> lock(m_mutex);
+      for (entries::iterator it=m_entries.begin(); it!=m_entries.end(); ++it)
+        delete it->second.surf;
+      m_entries.clear();
+    }
+
+  private:
+    struct preloader {
+      surface_cache* cache;
+      const std::vector<std::string>* filenames;
+      std::atomic<int> next;
+      std::atomic<int> failed;
+
+      preloader(surface_cache* cache, const std::vector<std::string>* filenames)
+        : cache(cache), filenames(filenames), next(0), failed(0) { }
+
+      void run() {
+        int i;
+        while ((i = next.fetch_add(1, std::memory_order_relaxed)) < int(filenames->size()))
+          if (!cache->get((*filenames)[i]))
+            failed.fetch_add(1, std::memory_order_relaxed);
+      }
+    };
+
+    struct preload_worker {
+      preloader* job;
+      explicit preload_worker(preloader* job) : job(job) { }
+      void operator()() { job->run(); }
+    };
+
+    // Non-copyable
+    surface_cache(const surface_cache&);
+    surface_cache& operator=(const surface_cache&);
+  };
+
+} // namespace ui
+
+#endif // UI_SURFACE_CACHE_HEADER_FILE_INCLUDED
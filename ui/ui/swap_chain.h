@@ -0,0 +1,353 @@
+// ui - Basic User Interface library to do experiments          -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+#ifndef UI_SWAP_CHAIN_HEADER_FILE_INCLUDED
+#define UI_SWAP_CHAIN_HEADER_FILE_INCLUDED
+
+#include "ui/bitmap.h"
+#include "ui/frame_monitor.h"
+
+#include "mt/semaphore.h"
+#include "mt/thread.h"
+#include "chrono.h"
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+namespace ui {
+
+  //////////////////////////////////////////////////////////////////////
+  // present_target class
+  //
+  // Something that can show a frame (e.g. ui::window). present_frame()
+  // is called from the present thread of a swap_chain and must copy
+  // the frame before returning.
+
+  class present_target {
+  public:
+    virtual ~present_target() { }
+    virtual void present_frame(const bitmap& frame) = 0;
+  };
+
+  //////////////////////////////////////////////////////////////////////
+  // frame_stats struct
+  //
+  // Times between consecutive presents (measured with Chrono) of the
+  // last frame_stats::window frames.
+
+  struct frame_stats {
+    static const int window = 256;
+
+    int presented;              // Total presented frames
+    int dropped;                // Frames replaced by a newer one before being presented
+    double fps;
+    double avg_ms, min_ms, max_ms;
+    double p50_ms, p99_ms;      // Percentiles
+
+    frame_stats()
+      : presented(0), dropped(0), fps(0.0)
+      , avg_ms(0.0), min_ms(0.0), max_ms(0.0)
+      , p50_ms(0.0), p99_ms(0.0) {
+    }
+  };
+
+  //////////////////////////////////////////////////////////////////////
+  // swap_chain class
+  //
+  // The caller renders into a back buffer (acquire()) and hands it to
+  // a present thread (submit()), which shows it in the present_target
+  // while the next frame is being rendered in other buffer.
+  //
+  // Pacing modes:
+  //   pacing_immediate  Each frame is presented as soon as possible.
+  //                     acquire() blocks when all buffers are in use.
+  //   pacing_fixed_fps  Each frame is presented, one every 1/fps
+  //                     seconds, so the producer is throttled to fps.
+  //   pacing_latest     The producer never blocks: submit() replaces
+  //                     the pending frame (counted as dropped) and the
+  //                     present thread shows the newest one (at most
+  //                     fps frames per second if fps > 0). It always
+  //                     uses 3 buffers.
+  //
+  // Buffers are handed off without locks: free/submitted buffers go
+  // through SPSC rings guarded by counting semaphores, and
+  // pacing_latest swaps buffer indexes with an atomic exchange on a
+  // mailbox word.
+  //
+  // With a frame_monitor, submit() closes a frame of the monitor and
+  // the present thread adds its busy time (as the "present" thread).
+
+  class swap_chain {
+  public:
+    enum pacing {
+      pacing_immediate,
+      pacing_fixed_fps,
+      pacing_latest
+    };
+
+    static const int max_buffers = 3;
+
+    swap_chain(present_target* target, int width, int height,
+               int buffers = 2, pacing mode = pacing_immediate, double fps = 60.0)
+      : m_target(target)
+      , m_mode(mode)
+      , m_period(mode != pacing_immediate && fps > 0.0 ? 1.0 / fps: 0.0)
+      , m_nbuffers(mode == pacing_latest ? 3: std::max(1, std::min(buffers, int(max_buffers))))
+      , m_back(-1)
+      , m_free_count(0)
+      , m_submitted_count(0)
+      , m_free_head(0), m_free_tail(0)
+      , m_submitted_head(0), m_submitted_tail(0)
+      , m_mailbox(1)
+      , m_front(2)
+      , m_submits(0)
+      , m_dropped(0)
+      , m_quit(false)
+      , m_presented(0)
+      , m_last_present(-1.0)
+      , m_next_present(0.0)
+      , m_monitor(NULL)
+      , m_monitor_thread(-1) {
+      if (mode == pacing_fixed_fps && m_period == 0.0)
+        m_mode = pacing_immediate;
+
+      for (int i=0; i<m_nbuffers; ++i)
+        m_buffers.push_back(new bitmap(width, height));
+
+      if (m_mode == pacing_latest)
+        m_back = 0;             // Buffer 1 in the mailbox, 2 in the front
+      else
+        for (int i=0; i<m_nbuffers; ++i)
+          push_free(i);
+
+      m_thread = new mt::thread(present_thread(this));
+    }
+
+    ~swap_chain() {
+      m_quit = true;
+      m_submitted_count.release();
+      m_thread->join();
+      delete m_thread;
+      for (std::size_t i=0; i<m_buffers.size(); ++i)
+        delete m_buffers[i];
+    }
+
+    pacing mode() const { return m_mode; }
+    int buffers() const { return m_nbuffers; }
+
+    // Returns the buffer where the next frame must be rendered
+    bitmap& acquire() {
+      if (m_back < 0) {
+        m_free_count.acquire();
+        m_back = m_free_ring[advance(m_free_head)];
+      }
+      return *m_buffers[m_back];
+    }
+
+    // Hands the acquired buffer to the present thread
+    void submit() {
+      if (m_back < 0)
+        acquire();
+      ++m_submits;
+      if (frame_monitor* monitor = m_monitor.load(std::memory_order_relaxed))
+        monitor->end_frame();
+
+      if (m_mode == pacing_latest) {
+        int old = m_mailbox.exchange(m_back | new_frame, std::memory_order_acq_rel);
+        if (old & new_frame)
+          m_dropped.fetch_add(1, std::memory_order_relaxed);
+        m_back = old & ~new_frame;
+      }
+      else {
+        m_submitted_ring[advance(m_submitted_tail)] = m_back;
+        m_back = -1;
+      }
+      m_submitted_count.release();
+    }
+
+    // Waits until every submitted frame is presented (or dropped)
+    void wait_idle() {
+      while (m_presented.load(std::memory_order_acquire) +
+             m_dropped.load(std::memory_order_relaxed) < m_submits)
+        mt::this_thread::sleep_for(1);
+    }
+
+    // Reports the frames to the given monitor (or NULL), it must be
+    // called from the thread that submits the frames. The monitor must
+    // outlive the swap_chain or be detached.
+    void set_monitor(frame_monitor* monitor) {
+      if (monitor && monitor != m_monitor.load(std::memory_order_relaxed))
+        m_monitor_thread = monitor->add_thread("present");
+      m_monitor.store(monitor, std::memory_order_release);
+    }
+
+    frame_stats stats() const {
+      mt::lock_guard<mt::mutex> lock(m_stats_mutex);
+      frame_stats st;
+      st.presented = m_presented.load(std::memory_order_relaxed);
+      st.dropped = m_dropped.load(std::memory_order_relaxed);
+      if (m_intervals.empty())
+        return st;
+
+      std::vector<double> sorted(m_intervals);
+      std::sort(sorted.begin(), sorted.end());
+      double sum = 0.0;
+      for (std::size_t i=0; i<sorted.size(); ++i)
+        sum += sorted[i];
+
+      st.avg_ms = 1000.0 * sum / sorted.size();
+      st.min_ms = 1000.0 * sorted.front();
+      st.max_ms = 1000.0 * sorted.back();
+      st.p50_ms = 1000.0 * sorted[sorted.size()/2];
+      st.p99_ms = 1000.0 * sorted[std::min(sorted.size()-1, sorted.size()*99/100)];
+      st.fps = (sum > 0.0 ? sorted.size() / sum: 0.0);
+      return st;
+    }
+
+  private:
+    static const int new_frame = 4; // Bit of m_mailbox
+
+    struct present_thread {
+      swap_chain* chain;
+      explicit present_thread(swap_chain* chain) : chain(chain) { }
+      void operator()() { chain->present_loop(); }
+    };
+
+    // Returns the position "i" of a ring and moves it to the next one
+    // (max_buffers isn't a power of two, a free-running counter modulo
+    // max_buffers would jump when it overflows)
+    static unsigned advance(unsigned& i) {
+      const unsigned j = i;
+      if (++i == unsigned(max_buffers))
+        i = 0;
+      return j;
+    }
+
+    void push_free(int i) {
+      m_free_ring[advance(m_free_tail)] = i;
+      m_free_count.release();
+    }
+
+    void present_loop() {
+      for (;;) {
+        m_submitted_count.acquire();
+        if (m_quit)
+          break;
+
+        if (m_period > 0.0) {
+          wait_until(m_next_present);
+          if (m_quit)
+            break;
+        }
+
+        int i;
+        if (m_mode == pacing_latest) {
+          // Several submits can be signaled, only the newest frame is
+          // in the mailbox (taken after the pacing wait)
+          while (m_submitted_count.try_acquire())
+            ;
+          if (m_quit)
+            break;
+          if (!(m_mailbox.load(std::memory_order_acquire) & new_frame))
+            continue;
+          m_front = m_mailbox.exchange(m_front, std::memory_order_acq_rel) & ~new_frame;
+          i = m_front;
+        }
+        else
+          i = m_submitted_ring[advance(m_submitted_head)];
+
+        Chrono busy;
+        m_target->present_frame(*m_buffers[i]);
+        record_present();
+        if (frame_monitor* monitor = m_monitor.load(std::memory_order_acquire)) {
+          const double seconds = busy.elapsed();
+          monitor->add_present(seconds);
+          monitor->add_busy(m_monitor_thread, seconds);
+        }
+
+        if (m_mode != pacing_latest)
+          push_free(i);
+      }
+    }
+
+    // Sleeps (and spins the last millisecond) until the given time of
+    // m_clock
+    void wait_until(double t) {
+      for (;;) {
+        double remaining = t - m_clock.elapsed();
+        if (remaining <= 0.0)
+          break;
+        if (remaining > 0.002)
+          mt::this_thread::sleep_for(int(remaining * 1000.0) - 1);
+        else
+          mt::this_thread::yield();
+      }
+    }
+
+    void record_present() {
+      const double now = m_clock.elapsed();
+      {
+        mt::lock_guard<mt::mutex> lock(m_stats_mutex);
+        if (m_last_present >= 0.0) {
+          if (int(m_intervals.size()) == frame_stats::window)
+            m_intervals.erase(m_intervals.begin());
+          m_intervals.push_back(now - m_last_present);
+        }
+      }
+      m_last_present = now;
+      m_presented.fetch_add(1, std::memory_order_release);
+
+      // Next deadline, if we are late (more than a period) we don't
+      // try to catch up
+      m_next_present += m_period;
+      if (m_next_present < now)
+        m_next_present = now + m_period;
+    }
+
+    present_target* m_target;
+    pacing m_mode;
+    double m_period;            // Seconds between presents (0 = no pacing)
+    int m_nbuffers;
+    std::vector<bitmap*> m_buffers;
+    int m_back;                 // Buffer acquired by the producer (or -1)
+
+    // pacing_immediate/fixed_fps: SPSC rings of buffer indexes
+    mt::counting_semaphore<> m_free_count, m_submitted_count;
+    int m_free_ring[max_buffers], m_submitted_ring[max_buffers];
+    unsigned m_free_head, m_free_tail; // Producer pops, present thread pushes
+    unsigned m_submitted_head, m_submitted_tail;
+
+    // pacing_latest: buffer index (plus new_frame bit) waiting to be
+    // presented, and buffer being presented
+    std::atomic<int> m_mailbox;
+    int m_front;
+
+    int m_submits;
+    std::atomic<int> m_dropped;
+    std::atomic<bool> m_quit;
+
+    // Frame times (used by the present thread)
+    Chrono m_clock;
+    std::atomic<int> m_presented;
+    double m_last_present;
+    double m_next_present;
+    std::vector<double> m_intervals;
+    mutable mt::mutex m_stats_mutex;
+
+    std::atomic<frame_monitor*> m_monitor;
+    int m_monitor_thread;       // Index of the present thread in the monitor
+
+    mt::thread* m_thread;
+
+    // Non-copyable
+    swap_chain(const swap_chain&);
+    swap_chain& operator=(const swap_chain&);
+  };
+
+} // namespace ui
+
+#endif // UI_SWAP_CHAIN_HEADER_FILE_INCLUDED
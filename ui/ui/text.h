@@ -0,0 +1,454 @@
+// ui - Basic User Interface library to do experiments          -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+#ifndef UI_TEXT_HEADER_FILE_INCLUDED
+#define UI_TEXT_HEADER_FILE_INCLUDED
+
+#include "ui/bitmap.h"
+#include "ui/font.h"
+#include "ui/raster.h"
+#include "ui/rect.h"
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace ui {
+
+  //////////////////////////////////////////////////////////////////////
+  // glyph_source class
+  //
+  // Rasterizes glyphs of one font face and size into 8-bit coverage
+  // images. It's called only once per glyph, the result is cached in
+  // the glyph_atlas of a ui::font.
+
+  struct glyph_image {
+    int advance;                // Pen advance in pixels
+    int left, top;              // Position relative to the pen and the line top
+    int w, h;
+    std::vector<uint8_t> coverage; // w*h values (0 = transparent, 255 = opaque)
+
+    glyph_image() : advance(0), left(0), top(0), w(0), h(0) { }
+  };
+
+  struct kerning_pair {
+    int first, second;          // Code points
+    int amount;                 // Pixels added to the advance of "first"
+  };
+
+  class glyph_source {
+  public:
+    virtual ~glyph_source() { }
+    virtual int line_height() const = 0;
+
+    // Returns false if the font doesn't have the given code point
+    virtual bool rasterize(int codepoint, glyph_image& out) = 0;
+
+    virtual void get_kerning_pairs(std::vector<kerning_pair>&) { }
+  };
+
+  //////////////////////////////////////////////////////////////////////
+  // builtin_glyph_source class
+  //
+  // The built-in 8x8 font scaled to any size (in pixels). Scaled glyphs
+  // are anti-aliased with 4x4 supersampling, at size 8 they are the
+  // original bitmaps.
+
+  class builtin_glyph_source : public glyph_source {
+    int m_size;
+
+  public:
+    explicit builtin_glyph_source(int size = font8x8::glyph_height)
+      : m_size(size > 0 ? size: font8x8::glyph_height) {
+    }
+
+    int line_height() const {
+      return m_size;
+    }
+
+    bool rasterize(int codepoint, glyph_image& out) {
+      if (codepoint < font8x8::first_char || codepoint > font8x8::last_char)
+        return false;
+
+      const uint8_t* rows = font8x8::glyph(codepoint);
+      const int n = m_size;
+      const int ss = 4;         // Samples per axis
+
+      out.advance = out.w = out.h = n;
+      out.left = out.top = 0;
+      out.coverage.resize(n*n);
+
+      for (int v=0; v<n; ++v) {
+        for (int u=0; u<n; ++u) {
+          int count = 0;
+          for (int j=0; j<ss; ++j) {
+            int gy = (2*(v*ss+j)+1) * font8x8::glyph_height / (2*ss*n);
+            for (int i=0; i<ss; ++i) {
+              int gx = (2*(u*ss+i)+1) * font8x8::glyph_width / (2*ss*n);
+              count += (rows[gy] >> gx) & 1;
+            }
+          }
+          out.coverage[v*n+u] = uint8_t(count * 255 / (ss*ss));
+        }
+      }
+      return true;
+    }
+  };
+
+  //////////////////////////////////////////////////////////////////////
+  // glyph_atlas class
+  //
+  // 8-bit coverage texture where glyphs are packed in shelves (rows of
+  // glyphs). When it's full it grows in height (and in width for a
+  // glyph wider than the atlas), so glyph positions never change.
+
+  class glyph_atlas {
+    struct shelf {
+      int y, h, used;
+    };
+
+    int m_width, m_height;
+    std::vector<uint8_t> m_data;
+    std::vector<shelf> m_shelves;
+
+  public:
+    explicit glyph_atlas(int width = 256, int height = 256)
+      : m_width(width), m_height(height), m_data(width*height, 0) {
+    }
+
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+
+    const uint8_t* row(int y) const {
+      return &m_data[std::size_t(y) * m_width];
+    }
+
+    // Copies the w*h coverage values into the atlas and returns their
+    // position in (x, y)
+    void insert(int w, int h, const uint8_t* coverage, int& x, int& y) {
+      if (w > m_width)
+        grow_width(w);
+
+      // Find the best fitting shelf (less wasted height)
+      shelf* best = NULL;
+      for (std::size_t i=0; i<m_shelves.size(); ++i) {
+        shelf& s = m_shelves[i];
+        if (s.h >= h && s.used+w <= m_width && (!best || s.h < best->h))
+          best = &s;
+      }
+
+      if (!best) {
+        int top = (m_shelves.empty() ? 0: m_shelves.back().y + m_shelves.back().h);
+        while (top+h > m_height) {
+          m_height *= 2;
+          m_data.resize(std::size_t(m_width) * m_height, 0);
+        }
+        shelf s = { top, h, 0 };
+        m_shelves.push_back(s);
+        best = &m_shelves.back();
+      }
+
+      x = best->used;
+      y = best->y;
+      best->used += w;
+
+      for (int v=0; v<h; ++v)
+        std::memcpy(&m_data[std::size_t(y+v) * m_width + x], coverage + v*w, w);
+    }
+
+  private:
+    // Doubles the width until "w" fits, rows are copied to the same
+    // positions
+    void grow_width(int w) {
+      int width = (m_width > 0 ? m_width: 1);
+      while (width < w)
+        width *= 2;
+
+      std::vector<uint8_t> data(std::size_t(width) * m_height, 0);
+      for (int y=0; y<m_height; ++y)
+        std::memcpy(&data[std::size_t(y) * width], row(y), m_width);
+      m_data.swap(data);
+      m_width = width;
+    }
+  };
+
+  //////////////////////////////////////////////////////////////////////
+  // font class
+  //
+  // One face and size: glyphs are rasterized once (the first time they
+  // are used), trimmed to their bounding box and packed in the atlas.
+  // Advances and kerning are cached, so measuring a string is a table
+  // lookup per character. Glyphs up to 8x8 without partial coverage
+  // (e.g. the builtin 8x8 font) also keep a bit mask, so they can be
+  // drawn with an opaque color without blending.
+
+  class font {
+  public:
+    struct glyph {
+      int advance;
+      int left, top, w, h;      // Trimmed bounding box
+      int atlas_x, atlas_y;
+      uint64_t bits;            // Row v in byte v for glyphs up to 8x8 without
+                                // partial coverage, 0 for other glyphs
+    };
+
+    // The font takes the ownership of the source
+    explicit font(glyph_source* source)
+      : m_source(source)
+      , m_line_height(source->line_height()) {
+      for (int i=0; i<128; ++i)
+        m_ascii[i] = -1;
+
+      std::vector<kerning_pair> pairs;
+      m_source->get_kerning_pairs(pairs);
+      for (std::size_t i=0; i<pairs.size(); ++i)
+        m_kerning[pair_key(pairs[i].first, pairs[i].second)] = pairs[i].amount;
+    }
+
+    ~font() {
+      delete m_source;
+    }
+
+    int line_height() const {
+      return m_line_height;
+    }
+
+    const glyph_atlas& atlas() const {
+      return m_atlas;
+    }
+
+    const glyph& get(int codepoint) {
+      if (codepoint >= 0 && codepoint < 128) {
+        int i = m_ascii[codepoint];
+        if (i < 0)
+          i = m_ascii[codepoint] = load(codepoint);
+        return m_glyphs[i];
+      }
+
+      std::map<int, int>::iterator it = m_others.find(codepoint);
+      if (it != m_others.end())
+        return m_glyphs[it->second];
+      int i = load(codepoint);
+      m_others[codepoint] = i;
+      return m_glyphs[i];
+    }
+
+    int kerning(int first, int second) const {
+      if (m_kerning.empty())
+        return 0;
+      std::map<uint64_t, int>::const_iterator it = m_kerning.find(pair_key(first, second));
+      return (it != m_kerning.end() ? it->second: 0);
+    }
+
+    // Number of glyphs rasterized
+    int loaded_glyphs() const {
+      return int(m_glyphs.size());
+    }
+
+  private:
+    static uint64_t pair_key(int a, int b) {
+      return (uint64_t(uint32_t(a)) << 32) | uint32_t(b);
+    }
+
+    int load(int codepoint) {
+      glyph_image img;
+      if (!m_source->rasterize(codepoint, img) &&
+          !m_source->rasterize('?', img))
+        img = glyph_image();
+
+      // Trim transparent borders
+      int x1 = img.w, y1 = img.h, x2 = 0, y2 = 0;
+      for (int v=0; v<img.h; ++v)
+        for (int u=0; u<img.w; ++u)
+          if (img.coverage[v*img.w+u]) {
+            if (u < x1) x1 = u;
+            if (v < y1) y1 = v;
+            if (u >= x2) x2 = u+1;
+            if (v >= y2) y2 = v+1;
+          }
+
+      glyph g;
+      g.advance = img.advance;
+      g.atlas_x = g.atlas_y = 0;
+      g.bits = 0;
+      if (x2 > x1 && y2 > y1) {
+        g.left = img.left + x1;
+        g.top = img.top + y1;
+        g.w = x2-x1;
+        g.h = y2-y1;
+
+        std::vector<uint8_t> trimmed(g.w*g.h);
+        for (int v=0; v<g.h; ++v)
+          std::memcpy(&trimmed[v*g.w], &img.coverage[(y1+v)*img.w + x1], g.w);
+        m_atlas.insert(g.w, g.h, &trimmed[0], g.atlas_x, g.atlas_y);
+        g.bits = glyph_bits(g.w, g.h, trimmed);
+      }
+      else {
+        g.left = g.top = g.w = g.h = 0;
+      }
+
+      m_glyphs.push_back(g);
+      return int(m_glyphs.size()-1);
+    }
+
+    // Bit mask of a glyph up to 8x8 without partial coverage (wider
+    // glyphs are faster with the SIMD blocks of the blend_mask kernels)
+    static uint64_t glyph_bits(int w, int h, const std::vector<uint8_t>& coverage) {
+      if (w > 8 || h > 8)
+        return 0;
+
+      uint64_t bits = 0;
+      for (int v=0; v<h; ++v)
+        for (int u=0; u<w; ++u) {
+          const uint8_t c = coverage[v*w+u];
+          if (c != 0 && c != 255)
+            return 0;
+          if (c)
+            bits |= uint64_t(1) << (8*v + u);
+        }
+      return bits;
+    }
+
+    glyph_source* m_source;
+    int m_line_height;
+    glyph_atlas m_atlas;
+    std::vector<glyph> m_glyphs;
+    int m_ascii[128];           // Index in m_glyphs (or -1 if it isn't loaded)
+    std::map<int, int> m_others;
+    std::map<uint64_t, int> m_kerning;
+
+    // Non-copyable
+    font(const font&);
+    font& operator=(const font&);
+  };
+
+  //////////////////////////////////////////////////////////////////////
+  // Text functions
+  //
+  // Strings are UTF-8.
+
+  namespace text_details {
+
+    // Decodes the next code point of the UTF-8 string (invalid
+    // sequences are returned byte by byte)
+    inline int next_codepoint(const std::string& s, std::size_t& i) {
+      const unsigned char c = s[i++];
+      int n = (c >= 0xf0 ? 3: c >= 0xe0 ? 2: c >= 0xc0 ? 1: 0);
+      if (n == 0 || i+n > s.size())
+        return c;
+
+      int cp = c & (0x3f >> n);
+      for (int k=0; k<n; ++k) {
+        const unsigned char cc = s[i+k];
+        if ((cc & 0xc0) != 0x80)
+          return c;
+        cp = (cp << 6) | (cc & 0x3f);
+      }
+      i += n;
+      return cp;
+    }
+
+  } // namespace text_details
+
+  // Returns the width in pixels of the text
+  inline int measure_text(font& f, const std::string& text) {
+    int width = 0, prev = -1;
+    for (std::size_t i=0; i<text.size(); ) {
+      int cp = text_details::next_codepoint(text, i);
+      if (prev >= 0)
+        width += f.kerning(prev, cp);
+      width += f.get(cp).advance;
+      prev = cp;
+    }
+    return width;
+  }
+
+  // Returns the bounds of the pixels that draw_text() can modify (all
+  // glyphs are loaded, so the font can be read from other threads to
+  // draw this text)
+  inline rect text_bounds(font& f, int x, int y, const std::string& text) {
+    rect bounds;
+    int prev = -1;
+    for (std::size_t i=0; i<text.size(); ) {
+      int cp = text_details::next_codepoint(text, i);
+      if (prev >= 0)
+        x += f.kerning(prev, cp);
+      prev = cp;
+
+      const font::glyph& g = f.get(cp);
+      bounds = bounds | rect(x+g.left, y+g.top, g.w, g.h);
+      x += g.advance;
+    }
+    return bounds;
+  }
+
+  // Draws the text with its top-left corner at (x, y), blending the
+  // glyph coverage from the atlas with the (premultiplied) color.
+  // Glyphs without partial coverage are copied from their row masks
+  // when the color is opaque. Returns the bounds of the modified
+  // pixels.
+  inline rect draw_text(bitmap& bmp, font& f, int x, int y,
+                        const std::string& text, pixel color) {
+    const rect clip(0, 0, bmp.width(), bmp.height());
+    raster_kernels::blend_mask_fn blend_mask = kernels().blend_mask;
+    const bool opaque = ((color >> 24) == 255);
+    const glyph_atlas& atlas = f.atlas();
+    int x1 = clip.x2(), y1 = clip.y2(), x2 = 0, y2 = 0; // Bounds
+    long long pixels = 0;
+    int prev = -1;
+
+    for (std::size_t i=0; i<text.size(); ) {
+      int cp = text_details::next_codepoint(text, i);
+      if (prev >= 0)
+        x += f.kerning(prev, cp);
+      prev = cp;
+
+      const font::glyph& g = f.get(cp);
+      const rect gr(x+g.left, y+g.top, g.w, g.h);
+      const rect r = gr & clip;
+      x += g.advance;
+      if (r.empty())
+        continue;
+
+      const int u = r.x - gr.x, v = r.y - gr.y;
+      if (opaque && g.bits) {
+        // Clipped mask, row k of "r" in byte k (bits of the pixels
+        // outside "r" are shifted in the other bytes and cleared)
+        uint64_t bits = ((g.bits >> 8*v) >> u) &
+                        (((uint64_t(1) << r.w) - 1) * 0x0101010101010101ULL);
+        if (r.h < 8)
+          bits &= (uint64_t(1) << 8*r.h) - 1;
+        for (int k=0; k<8; ++k) {
+          const unsigned b = unsigned(bits >> 8*k) & 0xff;
+          if (!b)
+            continue;
+          pixel* dst = bmp.span(r.x, r.y+k);
+          for (int i=0; i<8; ++i)
+            if (b & (1 << i))
+              dst[i] = color;
+        }
+      }
+      else {
+        // The whole (clipped) glyph in one call
+        blend_mask(bmp.span(r.x, r.y), bmp.stride(),
+                   atlas.row(g.atlas_y+v) + g.atlas_x+u, atlas.width(),
+                   color, r.w, r.h);
+      }
+      x1 = std::min(x1, r.x);
+      y1 = std::min(y1, r.y);
+      x2 = std::max(x2, r.x2());
+      y2 = std::max(y2, r.y2());
+      pixels += r.w*r.h;
+    }
+    raster_details::count_draw(pixels);
+    return (x2 > x1 ? rect(x1, y1, x2-x1, y2-y1): rect());
+  }
+
+} // namespace ui
+
+#endif // UI_TEXT_HEADER_FILE_INCLUDED
@@ -0,0 +1,371 @@
+// ui - Basic User Interface library to do experiments          -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+#ifndef UI_TILED_HEADER_FILE_INCLUDED
+#define UI_TILED_HEADER_FILE_INCLUDED
+
+#include "ui/bitmap.h"
+#include "ui/damage.h"
+#include "ui/raster.h"
+#include "ui/rect.h"
+#include "ui/text.h"
+
+#include "mt/barrier.h"
+#include "mt/futex.h"
+#include "mt/thread.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <string>
+#include <vector>
+
+namespace ui {
+
+  //////////////////////////////////////////////////////////////////////
+  // tiled_renderer class
+  //
+  // Records drawing commands for a bitmap and executes them in
+  // parallel. The bitmap is split in tiles (64x64 pixels by default,
+  // 16KB, so a tile stays in the L1 cache while all its commands are
+  // drawn), each command is binned in the tiles that it touches, and
+  // flush() rasterizes the tiles in worker threads. Each tile executes
+  // its commands in the recording order, clipped to the tile, so the
+  // result is identical to calling the raster functions directly.
+  //
+  // The calling thread is one of the workers. Workers sleep in a
+  // barrier between frames.
+  //
+  // The source bitmaps of blit() (which cannot be the target) and the
+  // fonts of draw_text() must not change until flush() returns.
+
+  class tiled_renderer {
+    enum command_type {
+      cmd_fill,
+      cmd_blend,
+      cmd_gradient,
+      cmd_copy,
+      cmd_blit,
+      cmd_line,
+      cmd_line_aa,
+      cmd_text
+    };
+
+    struct command {
+      command_type type;
+      rect rc;                  // Area of fill/blend/gradient, source area of blit
+      int x, y;                 // Destination of blit/text
+      pixel c0, c1;
+      int op;                   // blend_op or gradient_direction
+      double x0, y0, x1, y1;    // Line points
+      const bitmap* src;
+      font* fnt;
+      std::string text;
+    };
+
+    struct worker {
+      tiled_renderer* renderer;
+      void operator()() { renderer->worker_loop(); }
+    };
+
+    bitmap& m_target;
+    int m_tile_size;
+    int m_cols, m_rows;
+    std::vector<command> m_commands;
+    std::vector<std::vector<int> > m_bins; // Command indices per tile
+    damage_region m_recording, m_damage;
+
+    int m_nthreads;
+    std::vector<mt::thread*> m_threads;
+    mt::barrier<> m_start, m_done;
+    std::atomic<int> m_next_tile;
+    bool m_quit;
+
+  public:
+    // threads = 0 uses one thread per CPU
+    explicit tiled_renderer(bitmap& target, int threads = 0, int tile_size = 64)
+      : m_target(target)
+      , m_tile_size(tile_size > 0 ? tile_size: 64)
+      , m_cols((target.width() + m_tile_size-1) / m_tile_size)
+      , m_rows((target.height() + m_tile_size-1) / m_tile_size)
+      , m_bins(m_cols*m_rows)
+      , m_recording(rect(0, 0, target.width(), target.height()))
+      , m_damage(m_recording.clip())
+      , m_nthreads(threads > 0 ? threads: mt::futex::details::number_of_cpus())
+      , m_start(m_nthreads)
+      , m_done(m_nthreads)
+      , m_next_tile(0)
+      , m_quit(false) {
+      for (int i=1; i<m_nthreads; ++i) {
+        worker w = { this };
+        m_threads.push_back(new mt::thread(w));
+      }
+    }
+
+    ~tiled_renderer() {
+      m_quit = true;
+      if (!m_threads.empty())
+        m_start.arrive_and_wait();
+      for (std::size_t i=0; i<m_threads.size(); ++i) {
+        m_threads[i]->join();
+        delete m_threads[i];
+      }
+    }
+
+    int threads() const { return m_nthreads; }
+    int tile_size() const { return m_tile_size; }
+    bitmap& target() { return m_target; }
+
+    // Recorded commands that weren't flushed yet
+    std::size_t pending() const {
+      return m_commands.size();
+    }
+
+    // Dirty rectangles of the last flush(), to invalidate them in the
+    // window
+    const damage_region& damage() const {
+      return m_damage;
+    }
+
+    void fill_rect(const rect& rc, pixel color) {
+      command& c = add(cmd_fill);
+      c.rc = rc;
+      c.c0 = color;
+      bin(rc);
+    }
+
+    void blend_rect(const rect& rc, pixel color, blend_op op = blend_src_over) {
+      command& c = add(cmd_blend);
+      c.rc = rc;
+      c.c0 = color;
+      c.op = op;
+      bin(rc);
+    }
+
+    void fill_gradient(const rect& rc, pixel c0, pixel c1, gradient_direction dir) {
+      command& c = add(cmd_gradient);
+      c.rc = rc;
+      c.c0 = c0;
+      c.c1 = c1;
+      c.op = dir;
+      bin(rc);
+    }
+
+    void blit(int x, int y, const bitmap& src, const rect& src_rc) {
+      command& c = add(cmd_copy);
+      c.x = x;
+      c.y = y;
+      c.src = &src;
+      c.rc = src_rc;
+      bin(blit_bounds(x, y, src, src_rc));
+    }
+
+    void blit(int x, int y, const bitmap& src, const rect& src_rc, blend_op op) {
+      command& c = add(cmd_blit);
+      c.x = x;
+      c.y = y;
+      c.src = &src;
+      c.rc = src_rc;
+      c.op = op;
+      bin(blit_bounds(x, y, src, src_rc));
+    }
+
+    void blit(int x, int y, const bitmap& src, blend_op op = blend_src_over) {
+      blit(x, y, src, rect(0, 0, src.width(), src.height()), op);
+    }
+
+    void draw_line(int x0, int y0, int x1, int y1, pixel color) {
+      command& c = add(cmd_line);
+      c.x0 = x0; c.y0 = y0;
+      c.x1 = x1; c.y1 = y1;
+      c.c0 = color;
+      bin_line(x0, y0, x1, y1);
+    }
+
+    void draw_line_aa(double x0, double y0, double x1, double y1, pixel color) {
+      command& c = add(cmd_line_aa);
+      c.x0 = x0; c.y0 = y0;
+      c.x1 = x1; c.y1 = y1;
+      c.c0 = color;
+      bin_line(x0, y0, x1, y1);
+    }
+
+    void draw_text(font& f, int x, int y, const std::string& text, pixel color) {
+      // text_bounds() loads all the glyphs here, so workers only read
+      // the font
+      rect bounds = text_bounds(f, x, y, text);
+      command& c = add(cmd_text);
+      c.fnt = &f;
+      c.x = x;
+      c.y = y;
+      c.text = text;
+      c.c0 = color;
+      bin(bounds);
+    }
+
+    // Draws all the recorded commands and waits for them
+    void flush() {
+      if (m_commands.empty()) {
+        m_damage.clear();
+        return;
+      }
+
+      m_next_tile.store(0, std::memory_order_relaxed);
+      if (!m_threads.empty()) {
+        m_start.arrive_and_wait();
+        render_tiles();
+        m_done.arrive_and_wait();
+      }
+      else
+        render_tiles();
+
+      for (std::size_t i=0; i<m_bins.size(); ++i)
+        m_bins[i].clear();
+      m_commands.clear();
+      std::swap(m_damage, m_recording);
+      m_recording.clear();
+    }
+
+  private:
+    command& add(command_type type) {
+      m_commands.push_back(command());
+      command& c = m_commands.back();
+      c.type = type;
+      c.x = c.y = 0;
+      c.c0 = c.c1 = 0;
+      c.op = 0;
+      c.x0 = c.y0 = c.x1 = c.y1 = 0.0;
+      c.src = NULL;
+      c.fnt = NULL;
+      return c;
+    }
+
+    // Adds the last command to the tiles that intersect "bounds"
+    void bin(const rect& bounds) {
+      const int index = int(m_commands.size()-1);
+      const rect r = bounds & m_recording.clip();
+      if (r.empty())
+        return;
+
+      m_recording.add(r);
+      const int ts = m_tile_size;
+      for (int ty=r.y/ts; ty<=(r.y2()-1)/ts; ++ty)
+        for (int tx=r.x/ts; tx<=(r.x2()-1)/ts; ++tx)
+          m_bins[ty*m_cols + tx].push_back(index);
+    }
+
+    // Bins the last command (a line) only in the tiles that the line
+    // crosses: the bounds are calculated for each column (or row for
+    // steep lines) of tiles, with a margin for rounded end points and
+    // anti-aliasing
+    void bin_line(double x0, double y0, double x1, double y1) {
+      const bool steep = std::fabs(y1-y0) > std::fabs(x1-x0);
+      if (steep) {
+        std::swap(x0, y0);
+        std::swap(x1, y1);
+      }
+      if (x0 > x1) {
+        std::swap(x0, x1);
+        std::swap(y0, y1);
+      }
+
+      const double slope = (x1 > x0 ? (y1-y0) / (x1-x0): 0.0);
+      const rect& clip = m_recording.clip();
+      const int ts = m_tile_size;
+      const int first = std::max(int(std::floor(x0)) - 1, 0);
+      const int last = std::min(int(std::ceil(x1)) + 2, steep ? clip.h: clip.w);
+
+      for (int a=first; a<last; a=(a/ts+1)*ts) {
+        const int b = std::min((a/ts+1)*ts, last);
+        const double ya = y0 + slope*(std::max(a, int(x0))-x0);
+        const double yb = y0 + slope*(std::min(b, int(x1)+1)-x0);
+        const int top = int(std::floor(std::min(ya, yb))) - 2;
+        const int bottom = int(std::ceil(std::max(ya, yb))) + 3;
+        if (steep)
+          bin(rect(top, a, bottom-top, b-a));
+        else
+          bin(rect(a, top, b-a, bottom-top));
+      }
+    }
+
+    static rect blit_bounds(int x, int y, const bitmap& src, const rect& src_rc) {
+      rect s = src_rc & rect(0, 0, src.width(), src.height());
+      return rect(x + s.x - src_rc.x, y + s.y - src_rc.y, s.w, s.h);
+    }
+
+    void worker_loop() {
+      for (;;) {
+        m_start.arrive_and_wait();
+        if (m_quit)
+          break;
+        render_tiles();
+        m_done.arrive_and_wait();
+      }
+    }
+
+    void render_tiles() {
+      const int ntiles = int(m_bins.size());
+      int i;
+      while ((i = m_next_tile.fetch_add(1, std::memory_order_relaxed)) < ntiles) {
+        if (!m_bins[i].empty())
+          render_tile(i);
+      }
+    }
+
+    // The commands are executed on a bitmap that wraps the tile pixels,
+    // with the coordinates translated to the tile origin (anti-aliased
+    // lines use a clipping rectangle to get exactly the same pixels)
+    void render_tile(int i) {
+      const int ts = m_tile_size;
+      const int tx = (i % m_cols) * ts;
+      const int ty = (i / m_cols) * ts;
+      const rect tile = rect(tx, ty, ts, ts) & m_recording.clip();
+      bitmap view(tile.w, tile.h, m_target.span(tx, ty), m_target.stride());
+
+      const std::vector<int>& bin = m_bins[i];
+      for (std::size_t j=0; j<bin.size(); ++j) {
+        const command& c = m_commands[bin[j]];
+        switch (c.type) {
+          case cmd_fill:
+            ui::fill_rect(view, rect(c.rc.x-tx, c.rc.y-ty, c.rc.w, c.rc.h), c.c0);
+            break;
+          case cmd_blend:
+            ui::blend_rect(view, rect(c.rc.x-tx, c.rc.y-ty, c.rc.w, c.rc.h),
+                           c.c0, blend_op(c.op));
+            break;
+          case cmd_gradient:
+            ui::fill_gradient(view, rect(c.rc.x-tx, c.rc.y-ty, c.rc.w, c.rc.h),
+                              c.c0, c.c1, gradient_direction(c.op));
+            break;
+          case cmd_copy:
+            ui::blit(view, c.x-tx, c.y-ty, *c.src, c.rc);
+            break;
+          case cmd_blit:
+            ui::blit(view, c.x-tx, c.y-ty, *c.src, c.rc, blend_op(c.op));
+            break;
+          case cmd_line:
+            ui::draw_line(view, int(c.x0)-tx, int(c.y0)-ty,
+                          int(c.x1)-tx, int(c.y1)-ty, c.c0);
+            break;
+          case cmd_line_aa:
+            raster_details::draw_line_aa(m_target, tile,
+                                         c.x0, c.y0, c.x1, c.y1, c.c0);
+            break;
+          case cmd_text:
+            ui::draw_text(view, *c.fnt, c.x-tx, c.y-ty, c.text, c.c0);
+            break;
+        }
+      }
+    }
+
+    // Non-copyable
+    tiled_renderer(const tiled_renderer&);
+    tiled_renderer& operator=(const tiled_renderer&);
+  };
+
+} // namespace ui
+
+#endif // UI_TILED_HEADER_FILE_INCLUDED
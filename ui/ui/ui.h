@@ -9,16 +9,41 @@
 
 #if WIN32
   #include "ui/win32.h"
+#else
+  #include "ui/offscreen.h"
 #endif
 
+#include "ui/bitmap.h"
+#include "ui/capture.h"
+#include "ui/console.h"
+#include "ui/damage.h"
+#include "ui/event.h"
+#include "ui/hud.h"
+#include "ui/image_io.h"
+#include "ui/surface_cache.h"
+#include "ui/swap_chain.h"
+
+#include <string>
+
 namespace ui {
 
   //////////////////////////////////////////////////////////////////////
   // window class
+  //
+  // It's a present_target, so a swap_chain can show frames in it from
+  // its present thread (don't use framebuffer() at the same time).
+  //
+  // With a hud, present() draws it over the framebuffer (if the
+  // damage doesn't touch the hud, only its modified parts) and closes
+  // a frame of its monitor, and frames of a swap_chain are shown with
+  // the hud over them (the swap_chain must use the monitor of the hud,
+  // see swap_chain::set_monitor()).
 
-  class window {
+  class window : public present_target {
   public:
-    window(int width, int height) {
+    window(int width, int height)
+      : m_capture(NULL)
+      , m_hud(NULL) {
       m_impl = new window_impl(width, height);
     }
 
@@ -34,17 +59,151 @@ namespace ui {
       return m_impl->height();
     }
 
+    // Direct access to the 32bpp pixels of the window, call
+    // invalidate() with the modified areas and present() to show them
+    bitmap& framebuffer() {
+      return m_impl->framebuffer();
+    }
+
+    void invalidate(const rect& rc) {
+      m_impl->invalidate(rc);
+    }
+
+    void invalidate(const damage_region& region) {
+      for (std::size_t i=0; i<region.size(); ++i)
+        m_impl->invalidate(region.rects()[i]);
+    }
+
+    // Invalidates the whole window
+    void invalidate() {
+      m_impl->invalidate();
+    }
+
+    // Dirty rectangles that will be copied by the next present()
+    const damage_region& damage() const {
+      return m_impl->damage();
+    }
+
+    // Shows the invalidated areas of the framebuffer, the cost is
+    // proportional to the number of dirty pixels
+    void present() {
+      if (m_hud) {
+        bitmap& fb = m_impl->framebuffer();
+        const bool intact = !m_impl->damage().intersects(m_hud->bounds(fb.width(), fb.height()));
+        m_impl->invalidate(m_hud->draw(fb, intact));
+      }
+
+      Chrono chrono;
+      capture(m_impl->framebuffer(), m_impl->damage());
+      m_impl->present();
+
+      if (m_hud) {
+        m_hud->monitor().add_present(chrono.elapsed());
+        m_hud->monitor().end_frame();
+      }
+    }
+
+    // Copies the frame to the window and shows it (the capture copies
+    // the frame in its writer thread meanwhile)
+    void present_frame(const bitmap& frame) {
+      mt::lock_guard<mt::mutex> lock(m_capture_mutex);
+      const bool captured = (m_capture && m_capture->start_capture(frame));
+      m_impl->present_frame(frame, m_hud);
+      if (captured)
+        m_capture->finish_capture();
+    }
+
+    // Records each presented frame in the given capture (NULL to stop
+    // recording). The capture must outlive the window or be detached.
+    // Frames presented from several threads (present() and the present
+    // thread of a swap_chain) are captured one at a time.
+    void set_capture(frame_capture* capture) {
+      mt::lock_guard<mt::mutex> lock(m_capture_mutex);
+      m_capture = capture;
+    }
+
+    // Shows the given HUD over the presented frames (NULL to hide it,
+    // the pixels under it are restored when the application draws
+    // them again). The hud must outlive the window or be detached.
+    void set_hud(hud* h) {
+      m_hud = h;
+      if (m_hud)
+        m_hud->invalidate();
+    }
+
+    hud* get_hud() const {
+      return m_hud;
+    }
+
+    // Saves the current content of the window as PNG or PPM
+    bool save(const std::string& filename) {
+      return save_image(m_impl->framebuffer(), filename);
+    }
+
     void waitkey() {
       m_impl->waitkey();
     }
 
+    // Returns true and the next event (key, mouse, resize, close or
+    // posted) if there is one, without blocking
+    bool poll_event(event& ev) {
+      return m_impl->poll_event(ev);
+    }
+
+    // Sleeps until there is an event or timeout_ms milliseconds elapse
+    // (a negative timeout waits forever). Returns false on timeout.
+    bool wait_event(event& ev, int timeout_ms = -1) {
+      return m_impl->wait_event(ev, timeout_ms);
+    }
+
+    // Queues an event for wait_event()/poll_event(), it can be called
+    // from any thread (e.g. to wake up the UI loop from a worker)
+    void post_event(const event& ev) {
+      m_impl->post_event(ev);
+    }
+
+    // Writes text at the end of the text console of the window, it
+    // scrolls when the text reaches the bottom (present() draws the
+    // whole hud again only if the text damage touches it)
     window& operator<<(const std::string& text) {
+      update_console_overlay();
       m_impl->write(text);
       return *this;
     }
 
+    // Text written with operator<< (and its scrollback)
+    console& text_console() {
+      return m_impl->text_console();
+    }
+
+    // Scrolls the text console (positive to see older lines) and
+    // invalidates the modified area
+    void scroll_text(int rows) {
+      console& c = m_impl->text_console();
+      update_console_overlay();
+      c.scroll(rows);
+      invalidate(c.render(framebuffer()));
+    }
+
   private:
+    // The console must not scroll the pixels of the hud with the text
+    void update_console_overlay() {
+      bitmap& fb = m_impl->framebuffer();
+      m_impl->text_console().set_overlay(m_hud ? m_hud->bounds(fb.width(), fb.height()): rect());
+    }
+
+    // frame_capture::capture() must be called from one thread at a
+    // time, only the damaged area of the framebuffer is copied
+    void capture(const bitmap& frame, const damage_region& damage) {
+      mt::lock_guard<mt::mutex> lock(m_capture_mutex);
+      if (m_capture)
+        m_capture->capture(frame, damage);
+    }
+
     window_impl* m_impl;
+    mt::mutex m_capture_mutex;
+    frame_capture* m_capture;
+    hud* m_hud;
 
     // Non-copyable
     window(const window&);
@@ -11,8 +11,16 @@
 #define _WIN32_WINNT 0x0400             // From Windows 2000
 #endif
 
+#include "mt/semaphore.h"
 #include "mt/thread.h"
+#include "ui/bitmap.h"
+#include "ui/console.h"
+#include "ui/damage.h"
+#include "ui/event.h"
+#include "ui/hud.h"
+#include "ui/text.h"
 #include <exception>
+#include <vector>
 #include <windows.h>
 
 namespace ui {
@@ -86,42 +94,75 @@ namespace ui {
 
   };
 
+  //////////////////////////////////////////////////////////////////////
+  // dib_format struct
+  //
+  // Bits per pixel and channel masks of the DIB section of a pixel
+  // format. Only formats that GDI can draw without a palette have one.
+
+  template<class Format> struct dib_format;
+
+  template<> struct dib_format<bgra8_format> {
+    enum { bit_count = 32, compression = BI_RGB };
+    static DWORD mask(int) { return 0; }
+  };
+
+  template<> struct dib_format<rgb565_format> {
+    enum { bit_count = 16, compression = BI_BITFIELDS };
+    static DWORD mask(int i) {
+      static const DWORD masks[3] = { 0xf800, 0x07e0, 0x001f };
+      return masks[i];
+    }
+  };
+
   //////////////////////////////////////////////////////////////////////
   // win32_bitmap class
+  //
+  // DIB section with pixels of the given format, the window uses a
+  // bgra8 one (the format of the frames) so presenting doesn't need a
+  // conversion.
 
+  template<class Format>
   class win32_bitmap {
+    typedef dib_format<Format> dib;
+
     HBITMAP m_hbitmap;
     HDC m_hdc;
+    basic_bitmap<Format>* m_pixels;
 
   public:
 
     win32_bitmap(int width, int height) {
       assert(width > 0 && height > 0);
 
-      BITMAPINFOHEADER bhdr;
+      // BITMAPINFO with the 3 masks of BI_BITFIELDS
+      struct {
+        BITMAPINFOHEADER header;
+        DWORD masks[3];
+      } binf;
+
+      BITMAPINFOHEADER& bhdr = binf.header;
       bhdr.biSize = sizeof(BITMAPINFOHEADER);
       bhdr.biWidth = width;
       bhdr.biHeight = -height;
       bhdr.biPlanes = 1;
-      bhdr.biBitCount = 32;     // 32 bpp
-      bhdr.biCompression = BI_RGB;
+      bhdr.biBitCount = dib::bit_count;
+      bhdr.biCompression = dib::compression;
       bhdr.biSizeImage = 0;
       bhdr.biXPelsPerMeter = 0;
       bhdr.biYPelsPerMeter = 0;
       bhdr.biClrUsed = 0;
       bhdr.biClrImportant = 0;
-
-      BITMAPINFO binf;
-      RGBQUAD dummy = { 0, 0, 0, 0 };
-      binf.bmiColors[0] = dummy;
-      binf.bmiHeader = bhdr;
+      for (int i=0; i<3; ++i)
+        binf.masks[i] = dib::mask(i);
 
       char* bits = NULL;
 
       HDC hdc = GetDC(GetDesktopWindow());
-      m_hbitmap = CreateDIBSection(hdc, &binf, DIB_RGB_COLORS,
-                                  reinterpret_cast<void**>(&bits),
-                                  NULL, 0);
+      m_hbitmap = CreateDIBSection(hdc, reinterpret_cast<BITMAPINFO*>(&binf),
+                                   DIB_RGB_COLORS,
+                                   reinterpret_cast<void**>(&bits),
+                                   NULL, 0);
 
       if (m_hbitmap == NULL)
         throw std::exception(); // TODO throw ui_exception
@@ -129,6 +170,10 @@ namespace ui {
       m_hdc = CreateCompatibleDC(hdc);
       SelectObject(m_hdc, m_hbitmap);
 
+      // Rows of a DIB are aligned to 4 bytes
+      const int stride = ((width*dib::bit_count + 31) / 32) * 4;
+      m_pixels = new basic_bitmap<Format>(width, height, bits, stride);
+
       // Clear the whole bitmap with a white background
       {
         HGDIOBJ oldPen   = SelectObject(m_hdc, ::CreatePen(PS_NULL, 0, 0));
@@ -142,6 +187,7 @@ namespace ui {
     }
 
     ~win32_bitmap() {
+      delete m_pixels;
       ::DeleteDC(m_hdc);
       ::DeleteObject(m_hbitmap);
     }
@@ -154,6 +200,99 @@ namespace ui {
       return m_hdc;
     }
 
+    // Pixels of the DIB section (call GdiFlush() before accessing them
+    // if GDI was used to draw)
+    basic_bitmap<Format>& pixels() {
+      return *m_pixels;
+    }
+
+  };
+
+  //////////////////////////////////////////////////////////////////////
+  // gdi_glyph_source class
+  //
+  // Rasterizes anti-aliased glyphs of a GDI font with
+  // GetGlyphOutline(GGO_GRAY8_BITMAP).
+
+  class gdi_glyph_source : public glyph_source {
+    HDC m_hdc;
+    HFONT m_hfont;
+    HGDIOBJ m_old_font;
+    TEXTMETRICW m_tm;
+
+  public:
+
+    gdi_glyph_source(const char* face, int size) {
+      m_hdc = CreateCompatibleDC(NULL);
+      m_hfont = CreateFontA(-size, 0, 0, 0, FW_NORMAL, FALSE, FALSE, FALSE,
+                            DEFAULT_CHARSET, OUT_DEFAULT_PRECIS,
+                            CLIP_DEFAULT_PRECIS, ANTIALIASED_QUALITY,
+                            DEFAULT_PITCH, face);
+      if (m_hfont == NULL)
+        throw std::exception(); // TODO throw ui_exception
+
+      m_old_font = SelectObject(m_hdc, m_hfont);
+      GetTextMetricsW(m_hdc, &m_tm);
+    }
+
+    ~gdi_glyph_source() {
+      SelectObject(m_hdc, m_old_font);
+      DeleteObject(m_hfont);
+      DeleteDC(m_hdc);
+    }
+
+    int line_height() const {
+      return m_tm.tmHeight;
+    }
+
+    bool rasterize(int codepoint, glyph_image& out) {
+      WORD index;
+      WCHAR chr = WCHAR(codepoint);
+      if (codepoint > 0xffff ||
+          GetGlyphIndicesW(m_hdc, &chr, 1, &index, GGI_MARK_NONEXISTING_GLYPHS) == GDI_ERROR ||
+          index == 0xffff)
+        return false;
+
+      const MAT2 identity = { { 0, 1 }, { 0, 0 }, { 0, 0 }, { 0, 1 } };
+      GLYPHMETRICS gm;
+      DWORD size = GetGlyphOutlineW(m_hdc, chr, GGO_GRAY8_BITMAP, &gm, 0, NULL, &identity);
+      if (size == GDI_ERROR)
+        return false;
+
+      out.advance = gm.gmCellIncX;
+      out.left = gm.gmptGlyphOrigin.x;
+      out.top = m_tm.tmAscent - gm.gmptGlyphOrigin.y;
+      out.w = out.h = 0;
+      out.coverage.clear();
+      if (size == 0)            // Blank glyph (e.g. space)
+        return true;
+
+      std::vector<BYTE> buf(size);
+      GetGlyphOutlineW(m_hdc, chr, GGO_GRAY8_BITMAP, &gm, size, &buf[0], &identity);
+
+      // Rows are DWORD aligned, and values go from 0 to 64
+      const int pitch = (gm.gmBlackBoxX + 3) & ~3;
+      out.w = gm.gmBlackBoxX;
+      out.h = gm.gmBlackBoxY;
+      out.coverage.resize(out.w * out.h);
+      for (int v=0; v<out.h; ++v)
+        for (int u=0; u<out.w; ++u)
+          out.coverage[v*out.w+u] = uint8_t(buf[v*pitch+u] * 255 / 64);
+      return true;
+    }
+
+    void get_kerning_pairs(std::vector<kerning_pair>& pairs) {
+      DWORD n = GetKerningPairsW(m_hdc, 0, NULL);
+      if (n == 0)
+        return;
+
+      std::vector<KERNINGPAIR> kp(n);
+      n = GetKerningPairsW(m_hdc, n, &kp[0]);
+      for (DWORD i=0; i<n; ++i) {
+        kerning_pair p = { kp[i].wFirst, kp[i].wSecond, kp[i].iKernAmount };
+        pairs.push_back(p);
+      }
+    }
   };
 
   //////////////////////////////////////////////////////////////////////
@@ -162,11 +301,15 @@ namespace ui {
   class win32_window {
     HWND m_handle;
     mt::thread* m_thread;
-    bool m_destroy;
-    bool m_keypressed;
-    bool m_closed;
-    win32_bitmap m_bitmap;
-    int m_textx, m_texty;
+    DWORD m_thread_id;
+    mt::binary_semaphore m_created; // Released when m_handle is ready
+    std::atomic<bool> m_closed;
+    event_queue m_events;
+    win32_bitmap<bgra8_format> m_bitmap;
+    mt::mutex m_paint_mutex;    // Used by WM_PAINT and present_frame()
+    damage_region m_damage;
+    font m_font;
+    console m_console;          // Text written with write()
 
     struct create_window_wrapper {
       win32_window* m_wnd;
@@ -180,28 +323,30 @@ namespace ui {
       }
 
       void operator()() {
-        m_wnd->m_handle = win32_details::create_window(m_wnd, m_width, m_height);
+        HWND hwnd = win32_details::create_window(m_wnd, m_width, m_height);
+        m_wnd->m_handle = hwnd;
+        m_wnd->m_thread_id = ::GetCurrentThreadId();
+        m_wnd->m_created.release();
+        if (!hwnd)
+          return;
 
         MSG msg;
 
+        ::ShowWindow(hwnd, SW_SHOWNORMAL);
+        ::UpdateWindow(hwnd);
 
-        ::ShowWindow(m_wnd->m_handle, SW_SHOWNORMAL);
-        ::UpdateWindow(m_wnd->m_handle);
-
-        // Message loop while:
-        // 1) the window is not destroyed
-        // 2) the window is visible
-        // 3) the Windows message queue is still alive
-        while (!m_wnd->m_destroy &&
-               ::IsWindowVisible(m_wnd->m_handle) &&
-               ::GetMessage(&msg, m_wnd->m_handle, 0, 0)) {
+        // Message loop until the window is destroyed (WM_QUIT) or the
+        // win32_window destructor asks us to finish (quit_message)
+        while (::GetMessage(&msg, NULL, 0, 0) > 0) {
+          if (msg.hwnd == NULL && msg.message == quit_message)
+            break;
           ::TranslateMessage(&msg);
           ::DispatchMessage(&msg);
         }
 
-        // Destroy the window
-        ::DestroyWindow(m_wnd->m_handle);
-        m_wnd->m_handle = NULL;
+        // Destroy the window (if the user didn't close it)
+        if (::IsWindow(hwnd))
+          ::DestroyWindow(hwnd);
       }
 
     };
@@ -209,38 +354,60 @@ namespace ui {
     friend struct create_window_wrapper;
     friend class win32_details;
 
+    // Thread message posted by the destructor to finish the message loop
+    static const UINT quit_message = WM_APP + 1;
+
   public:
 
     win32_window(int width, int height)
-      : m_bitmap(width, height)
-      , m_textx(0)
-      , m_texty(0) {
+      : m_handle(NULL)
+      , m_thread_id(0)
+      , m_created(0)
+      , m_closed(false)
+      , m_bitmap(width, height)
+      , m_damage(rect(0, 0, width, height))
+      , m_font(new gdi_glyph_source("Segoe UI", 16))
+      , m_console(m_font, rect(0, 0, width, height)) {
       win32_details::register_window_class<win32_window>();
 
-      m_destroy = false;
-      m_keypressed = false;
-      m_closed = false;
       m_thread = new mt::thread(create_window_wrapper(this, width, height));
 
-      // TODO wait m_handle != NULL (use a notification, avoid 100% CPU wait)
-      while (m_handle == NULL)
-        ;
+      // Sleep until the UI thread creates the window
+      m_created.acquire();
     }
 
     ~win32_window() {
       if (m_thread) {
-        m_destroy = true;
+        ::PostThreadMessage(m_thread_id, quit_message, 0, 0);
         m_thread->join();
         delete m_thread;
       }
     }
 
+    // Returns the next event without blocking
+    bool poll_event(event& ev) {
+      return m_events.try_pop(ev);
+    }
+
+    // Waits for the next event (timeout in milliseconds, negative to
+    // wait forever), returns false on timeout
+    bool wait_event(event& ev, int timeout_ms) {
+      return m_events.wait_pop(ev, timeout_ms);
+    }
+
+    // Can be called from any thread
+    void post_event(const event& ev) {
+      m_events.push(ev);
+    }
+
+    // Sleeps until a key is pressed or the window is closed (other
+    // events are discarded)
     void waitkey() {
-      // // do something
-      while (!m_keypressed && !m_closed) // TODO avoid 100% CPU wait
-        // wait_message();
-        ;
-      m_keypressed = false;
+      event ev;
+      while (!m_closed && wait_event(ev, -1)) {
+        if (ev.type == event_key_down || ev.type == event_close)
+          break;
+      }
     }
 
     size_t width() {
@@ -255,23 +422,63 @@ namespace ui {
       return rc.bottom - rc.top;
     }
 
-    void write(const std::string& text) {
-      HDC hdc = m_bitmap.hdc();
+    bitmap& framebuffer() {
+      ::GdiFlush();
+      return m_bitmap.pixels();
+    }
 
-      // Draw the text in the bitmap
-      TextOut(hdc, m_textx, m_texty, text.c_str(), static_cast<int>(text.size()));
+    void invalidate(const rect& rc) {
+      m_damage.add(rc);
+    }
+
+    void invalidate() {
+      m_damage.add_all();
+    }
 
-      // Calculate the size of the string
-      RECT rc = { 0, 0, 32000, 0 };
-      DrawText(hdc, text.c_str(), static_cast<int>(text.size()), &rc, DT_CALCRECT);
+    const damage_region& damage() const {
+      return m_damage;
+    }
 
-      m_textx += (rc.right - rc.left); // X = X + Text Width
-      if (m_textx > width()) {
-        m_texty += (rc.bottom - rc.top);
-        m_textx = 0;
+    // Invalidates the damaged rectangles of the window, WM_PAINT
+    // copies only them from the bitmap
+    void present() {
+      const std::vector<rect>& rects = m_damage.rects();
+      for (std::size_t i=0; i<rects.size(); ++i) {
+        RECT rc = { rects[i].x, rects[i].y, rects[i].x2(), rects[i].y2() };
+        ::InvalidateRect(m_handle, &rc, FALSE);
       }
+      m_damage.clear();
+    }
+
+    // Copies a whole frame to the bitmap and draws it directly in the
+    // window (called from the present thread of a swap_chain, so it
+    // doesn't wait for WM_PAINT) with the overlay over it
+    void present_frame(const bitmap& frame, hud* overlay = NULL) {
+      mt::lock_guard<mt::mutex> lock(m_paint_mutex);
+      ::GdiFlush();
+      blit(m_bitmap.pixels(), 0, 0, frame, rect(0, 0, frame.width(), frame.height()));
+      if (overlay)
+        overlay->draw(m_bitmap.pixels());
+
+      HDC window_hdc = ::GetDC(m_handle);
+      BitBlt(window_hdc, 0, 0, frame.width(), frame.height(),
+             m_bitmap.hdc(), 0, 0, SRCCOPY);
+      ::ReleaseDC(m_handle, window_hdc);
+    }
+
+    void write(const std::string& text) {
+      // Draw the text in the bitmap with the cached glyphs
+      ::GdiFlush();
+      m_console.write(text);
+      rect rc = m_console.render(m_bitmap.pixels());
+
+      // Repaint only the modified pixels
+      m_damage.add(rc);
+      present();
+    }
 
-      ::InvalidateRect(m_handle, NULL, FALSE);
+    console& text_console() {
+      return m_console;
     }
 
   private:
@@ -282,20 +489,78 @@ namespace ui {
       switch (msg) {
 
         case WM_KEYDOWN:
-          m_keypressed = true;
+        case WM_KEYUP: {
+          event ev(msg == WM_KEYDOWN ? event_key_down: event_key_up);
+          ev.key = int(wparam);
+          m_events.push(ev);
+          break;
+        }
+
+        case WM_MOUSEMOVE:
+        case WM_LBUTTONDOWN:
+        case WM_LBUTTONUP:
+        case WM_MBUTTONDOWN:
+        case WM_MBUTTONUP:
+        case WM_RBUTTONDOWN:
+        case WM_RBUTTONUP: {
+          event ev(msg == WM_MOUSEMOVE ? event_mouse_move:
+                   msg == WM_LBUTTONDOWN ||
+                   msg == WM_MBUTTONDOWN ||
+                   msg == WM_RBUTTONDOWN ? event_mouse_down: event_mouse_up);
+          ev.x = (short)LOWORD(lparam);
+          ev.y = (short)HIWORD(lparam);
+          if (msg == WM_LBUTTONDOWN || msg == WM_LBUTTONUP) ev.button = button_left;
+          if (msg == WM_MBUTTONDOWN || msg == WM_MBUTTONUP) ev.button = button_middle;
+          if (msg == WM_RBUTTONDOWN || msg == WM_RBUTTONUP) ev.button = button_right;
+          m_events.push(ev);
+          break;
+        }
+
+        case WM_SIZE:
+          if (wparam != SIZE_MINIMIZED) {
+            event ev(event_resize);
+            ev.width = LOWORD(lparam);
+            ev.height = HIWORD(lparam);
+            m_events.push(ev);
+          }
           break;
 
         case WM_CLOSE:
           m_closed = true;
+          m_events.push(event(event_close));
+          break;             // DefWindowProc() destroys the window
+
+        case WM_DESTROY:
+          ::PostQuitMessage(0);
           break;
 
         case WM_PAINT:
           {
+            // Get the rectangles of the update region before
+            // BeginPaint() validates it (ps.rcPaint is just the bounding
+            // box of all of them)
+            HRGN region = ::CreateRectRgn(0, 0, 0, 0);
+            ::GetUpdateRgn(m_handle, region, FALSE);
+
+            mt::lock_guard<mt::mutex> lock(m_paint_mutex);
             PAINTSTRUCT ps;
             HDC window_hdc = ::BeginPaint(m_handle, &ps);
             HDC bitmap_hdc = m_bitmap.hdc();
 
-            if (!::IsRectEmpty(&ps.rcPaint)) {
+            std::vector<char> buf(::GetRegionData(region, 0, NULL));
+            RGNDATA* data = (RGNDATA*)(buf.empty() ? NULL: &buf[0]);
+            if (data && ::GetRegionData(region, DWORD(buf.size()), data)) {
+              const RECT* rcs = (const RECT*)data->Buffer;
+              for (DWORD i=0; i<data->rdh.nCount; ++i)
+                BitBlt(window_hdc,
+                       rcs[i].left, rcs[i].top, // X, Y (dst)
+                       rcs[i].right - rcs[i].left, // Width
+                       rcs[i].bottom - rcs[i].top, // Height
+                       bitmap_hdc,
+                       rcs[i].left, rcs[i].top, // X, Y (src)
+                       SRCCOPY);
+            }
+            else if (!::IsRectEmpty(&ps.rcPaint)) {
               BitBlt(window_hdc,
                      ps.rcPaint.left, ps.rcPaint.top, // X, Y (dst)
                      ps.rcPaint.right - ps.rcPaint.left, // Width
@@ -306,6 +571,7 @@ namespace ui {
             }
 
             ::EndPaint(m_handle, &ps);
+            ::DeleteObject(region);
 
             result = TRUE;
           }
@@ -0,0 +1,340 @@
+// ui - Basic User Interface library to do experiments          -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+#ifndef UI_X11_HEADER_FILE_INCLUDED
+#define UI_X11_HEADER_FILE_INCLUDED
+
+#include "ui/bitmap.h"
+#include "ui/event.h"
+#include "ui/rect.h"
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <vector>
+
+namespace ui {
+
+  namespace x11 {
+
+  //////////////////////////////////////////////////////////////////////
+  // x11_presenter class
+  //
+  // Shows a framebuffer in a X11 window. When the X server supports
+  // MIT-SHM (it's a local display) the framebuffer pixels live in a
+  // shared memory segment and XShmPutImage() presents them without
+  // copying them through the X11 socket, in other case the frame is
+  // sent with XPutImage().
+  //
+  // X11 events are translated to ui::event. wait() sleeps in poll() on
+  // the X11 connection and on a pipe that wakeup() writes, so other
+  // threads can interrupt it (e.g. when they post a ui::event). Xlib is
+  // initialized with XInitThreads() before the display is opened, the
+  // owner must serialize present() and next_event() anyway.
+
+  class x11_presenter {
+    Display* m_display;
+    Window m_window;
+    GC m_gc;
+    Atom m_wm_delete;
+    XImage* m_image;
+    XShmSegmentInfo m_shm;
+    bool m_use_shm;
+    bitmap* m_bitmap;
+    bool m_closed;
+    int m_width, m_height;
+    int m_wakeup[2];            // Self-pipe to interrupt wait()
+
+    static bool& shm_failed() {
+      static bool failed = false;
+      return failed;
+    }
+
+    static int shm_error_handler(Display*, XErrorEvent*) {
+      shm_failed() = true;
+      return 0;
+    }
+
+    x11_presenter(Display* display)
+      : m_display(display)
+      , m_window(0)
+      , m_gc(0)
+      , m_image(NULL)
+      , m_use_shm(false)
+      , m_bitmap(NULL)
+      , m_closed(false)
+      , m_width(0)
+      , m_height(0) {
+      m_wakeup[0] = m_wakeup[1] = -1;
+    }
+
+    // Tries to create a shared memory XImage of the given size
+    bool create_shm_image(Visual* visual, int depth, int width, int height) {
+      if (!XShmQueryExtension(m_display))
+        return false;
+
+      m_image = XShmCreateImage(m_display, visual, depth, ZPixmap, NULL,
+                                &m_shm, width, height);
+      if (!m_image)
+        return false;
+
+      m_shm.shmid = shmget(IPC_PRIVATE, m_image->bytes_per_line * height,
+                           IPC_CREAT | 0600);
+      if (m_shm.shmid < 0) {
+        XDestroyImage(m_image);
+        m_image = NULL;
+        return false;
+      }
+
+      m_shm.shmaddr = m_image->data = (char*)shmat(m_shm.shmid, NULL, 0);
+      m_shm.readOnly = False;
+
+      // XShmAttach() fails asynchronously (e.g. with a remote display),
+      // so we sync to catch the error here
+      shm_failed() = false;
+      XErrorHandler old_handler = XSetErrorHandler(&shm_error_handler);
+      bool ok = (m_shm.shmaddr != (char*)-1 &&
+                 XShmAttach(m_display, &m_shm));
+      XSync(m_display, False);
+      XSetErrorHandler(old_handler);
+
+      // Removed when the last process detaches it
+      shmctl(m_shm.shmid, IPC_RMID, NULL);
+
+      if (!ok || shm_failed()) {
+        if (m_shm.shmaddr != (char*)-1)
+          shmdt(m_shm.shmaddr);
+        m_image->data = NULL;
+        XDestroyImage(m_image);
+        m_image = NULL;
+        return false;
+      }
+      return true;
+    }
+
+  public:
+
+    // Returns NULL if there is no X11 display, or its visual is not a
+    // 24/32 bits TrueColor one compatible with ui::pixel
+    static x11_presenter* open(int width, int height) {
+      // The window is presented from the present thread of a swap_chain
+      // while other thread handles the events
+      static const Status threads = XInitThreads();
+      (void)threads;
+
+      Display* display = XOpenDisplay(NULL);
+      if (!display)
+        return NULL;
+
+      int screen = DefaultScreen(display);
+      Visual* visual = DefaultVisual(display, screen);
+      int depth = DefaultDepth(display, screen);
+      if (depth < 24 ||
+          visual->red_mask != 0xff0000 ||
+          visual->green_mask != 0xff00 ||
+          visual->blue_mask != 0xff) {
+        XCloseDisplay(display);
+        return NULL;
+      }
+
+      x11_presenter* p = new x11_presenter(display);
+      p->m_width = width;
+      p->m_height = height;
+      if (pipe(p->m_wakeup) != 0) {
+        delete p;
+        return NULL;
+      }
+      for (int i=0; i<2; ++i)
+        fcntl(p->m_wakeup[i], F_SETFL, fcntl(p->m_wakeup[i], F_GETFL) | O_NONBLOCK);
+
+      if (p->create_shm_image(visual, depth, width, height)) {
+        p->m_use_shm = true;
+        p->m_bitmap = new bitmap(width, height, p->m_image->data,
+                                 p->m_image->bytes_per_line);
+      }
+      else {
+        // The XImage uses the memory of an owned bitmap
+        p->m_bitmap = new bitmap(width, height);
+        p->m_image = XCreateImage(display, visual, depth, ZPixmap, 0,
+                                  reinterpret_cast<char*>(p->m_bitmap->row(0)),
+                                  width, height, 32, p->m_bitmap->stride());
+        if (!p->m_image || p->m_image->bits_per_pixel != 32) {
+          delete p;
+          return NULL;
+        }
+      }
+
+      p->m_window = XCreateSimpleWindow(display, RootWindow(display, screen),
+                                        0, 0, width, height, 0,
+                                        BlackPixel(display, screen),
+                                        WhitePixel(display, screen));
+      p->m_gc = XCreateGC(display, p->m_window, 0, NULL);
+      p->m_wm_delete = XInternAtom(display, "WM_DELETE_WINDOW", False);
+      XSetWMProtocols(display, p->m_window, &p->m_wm_delete, 1);
+      XSelectInput(display, p->m_window,
+                   ExposureMask | KeyPressMask | KeyReleaseMask |
+                   ButtonPressMask | ButtonReleaseMask | PointerMotionMask |
+                   StructureNotifyMask);
+      XMapWindow(display, p->m_window);
+      XFlush(display);
+      return p;
+    }
+
+    ~x11_presenter() {
+      if (m_image) {
+        if (m_use_shm) {
+          XShmDetach(m_display, &m_shm);
+          XDestroyImage(m_image);
+          shmdt(m_shm.shmaddr);
+        }
+        else {
+          m_image->data = NULL;  // Owned by m_bitmap
+          XDestroyImage(m_image);
+        }
+      }
+      delete m_bitmap;
+      if (m_gc)
+        XFreeGC(m_display, m_gc);
+      if (m_window)
+        XDestroyWindow(m_display, m_window);
+      XCloseDisplay(m_display);
+      for (int i=0; i<2; ++i)
+        if (m_wakeup[i] >= 0)
+          close(m_wakeup[i]);
+    }
+
+    bitmap& framebuffer() {
+      return *m_bitmap;
+    }
+
+    bool closed() const {
+      return m_closed;
+    }
+
+    // Copies the framebuffer to the window, when this function returns
+    // the framebuffer can be modified again
+    void present() {
+      present(rect(0, 0, m_bitmap->width(), m_bitmap->height()));
+    }
+
+    // Copies only the given rectangles of the framebuffer
+    void present(const std::vector<rect>& rects) {
+      for (std::size_t i=0; i<rects.size(); ++i)
+        put_image(rects[i]);
+      XSync(m_display, False);
+    }
+
+    void present(const rect& rc) {
+      put_image(rc);
+      XSync(m_display, False);
+    }
+
+    // Translates the next pending X11 event, returns false if there
+    // are no more events in the queue (Expose events are handled here
+    // presenting the whole framebuffer)
+    bool next_event(event& ev) {
+      XEvent xev;
+      while (XPending(m_display)) {
+        XNextEvent(m_display, &xev);
+        switch (xev.type) {
+          case Expose:
+            if (xev.xexpose.count == 0)
+              present();
+            break;
+          case KeyPress:
+          case KeyRelease:
+            ev = event(xev.type == KeyPress ? event_key_down: event_key_up);
+            ev.key = int(XLookupKeysym(&xev.xkey, 0));
+            return true;
+          case ButtonPress:
+          case ButtonRelease:
+            if (xev.xbutton.button > Button3) // Wheel
+              break;
+            ev = event(xev.type == ButtonPress ? event_mouse_down: event_mouse_up);
+            ev.x = xev.xbutton.x;
+            ev.y = xev.xbutton.y;
+            ev.button = (xev.xbutton.button == Button1 ? button_left:
+                         xev.xbutton.button == Button2 ? button_middle: button_right);
+            return true;
+          case MotionNotify:
+            ev = event(event_mouse_move);
+            ev.x = xev.xmotion.x;
+            ev.y = xev.xmotion.y;
+            return true;
+          case ConfigureNotify:
+            if (xev.xconfigure.width == m_width &&
+                xev.xconfigure.height == m_height)
+              break;
+            m_width = xev.xconfigure.width;
+            m_height = xev.xconfigure.height;
+            ev = event(event_resize);
+            ev.width = m_width;
+            ev.height = m_height;
+            return true;
+          case ClientMessage:
+            if (Atom(xev.xclient.data.l[0]) == m_wm_delete) {
+              m_closed = true;
+              ev = event(event_close);
+              return true;
+            }
+            break;
+        }
+      }
+      return false;
+    }
+
+    // Sleeps until there is a X11 event, wakeup() is called or the
+    // timeout (milliseconds, negative = infinite) elapses
+    void wait(int timeout_ms) {
+      if (XPending(m_display))
+        return;
+
+      pollfd fds[2];
+      fds[0].fd = ConnectionNumber(m_display);
+      fds[1].fd = m_wakeup[0];
+      fds[0].events = fds[1].events = POLLIN;
+      fds[0].revents = fds[1].revents = 0;
+      if (poll(fds, 2, timeout_ms) > 0 && (fds[1].revents & POLLIN)) {
+        char buf[64];
+        while (read(m_wakeup[0], buf, sizeof(buf)) > 0)
+          ;
+      }
+    }
+
+    // Can be called from any thread
+    void wakeup() {
+      char c = 0;
+      if (write(m_wakeup[1], &c, 1) < 0) {
+        // The pipe is full, wait() will wake up anyway
+      }
+    }
+
+  private:
+    void put_image(const rect& rc) {
+      if (m_use_shm)
+        XShmPutImage(m_display, m_window, m_gc, m_image,
+                     rc.x, rc.y, rc.x, rc.y, rc.w, rc.h, False);
+      else
+        XPutImage(m_display, m_window, m_gc, m_image,
+                  rc.x, rc.y, rc.x, rc.y, rc.w, rc.h);
+    }
+
+    // Non-copyable
+    x11_presenter(const x11_presenter&);
+    x11_presenter& operator=(const x11_presenter&);
+  };
+
+  } // namespace x11
+
+} // namespace ui
+
+#endif // UI_X11_HEADER_FILE_INCLUDED
@@ -0,0 +1,251 @@
+// ui - Basic User Interface library to do experiments          -*- C++ -*-
+// Copyright (C) 2010, 2012 David Capello
+//
+// Distributed under the terms of the New BSD License,
+// see LICENSE.md for more details.
+
+#ifndef UI_YUV_HEADER_FILE_INCLUDED
+#define UI_YUV_HEADER_FILE_INCLUDED
+
+#include "ui/bitmap.h"
+#include "ui/cpu.h"
+#include "ui/raster.h"
+
+#if UI_X86_SIMD
+  #include <emmintrin.h>
+  #include <immintrin.h>
+#endif
+
+namespace ui {
+
+  //////////////////////////////////////////////////////////////////////
+  // BGRA to YUV 4:2:0 conversion
+  //
+  // BT.601 with limited range (Y in 16..235, U/V in 16..240), the
+  // default of video players for Y4M files. Chroma is calculated from
+  // the average color of each 2x2 block (centered chroma, "C420jpeg"
+  // in Y4M terms). Alpha is ignored.
+  //
+  // All the math is done in 16-bit unsigned integers (the sums never
+  // overflow once 128<<8 is added to U/V), so the SIMD kernels give
+  // exactly the same bytes as the scalar ones.
+
+  namespace yuv_details {
+
+    inline uint8_t to_y(int r, int g, int b) {
+      return uint8_t(((66*r + 129*g + 25*b + 128) >> 8) + 16);
+    }
+
+    inline uint8_t to_u(int r, int g, int b) {
+      return uint8_t((-38*r - 74*g + 112*b + 128 + (128<<8)) >> 8);
+    }
+
+    inline uint8_t to_v(int r, int g, int b) {
+      return uint8_t((112*r - 94*g - 18*b + 128 + (128<<8)) >> 8);
+    }
+
+    // Converts "n" pixels to luma
+    typedef void (*y_row_fn)(const pixel* src, uint8_t* y, int n);
+
+    // Converts two rows of "n" pixels to (n+1)/2 chroma samples (when
+    // "n" is odd the last column is repeated). row1 can be row0 for
+    // the last row of an odd height.
+    typedef void (*uv_row_fn)(const pixel* row0, const pixel* row1,
+                              uint8_t* u, uint8_t* v, int n);
+
+    struct scalar_yuv {
+      static void y_row(const pixel* src, uint8_t* y, int n) {
+        for (int i=0; i<n; ++i)
+          y[i] = to_y(get_r(src[i]), get_g(src[i]), get_b(src[i]));
+      }
+
+      static void uv_row(const pixel* row0, const pixel* row1,
+                         uint8_t* u, uint8_t* v, int n) {
+        for (int i=0; i<n; i+=2) {
+          const int j = (i+1 < n ? i+1: i);
+          const pixel a = row0[i], b = row0[j], c = row1[i], d = row1[j];
+          const int r = (get_r(a) + get_r(b) + get_r(c) + get_r(d) + 2) >> 2;
+          const int g = (get_g(a) + get_g(b) + get_g(c) + get_g(d) + 2) >> 2;
+          const int bl = (get_b(a) + get_b(b) + get_b(c) + get_b(d) + 2) >> 2;
+          u[i/2] = to_u(r, g, bl);
+          v[i/2] = to_v(r, g, bl);
+        }
+      }
+    };
+
+#if UI_X86_SIMD
+
+    // Splits 8 pixels in 16-bit lanes of R, G and B
+    inline void channels_sse2(const pixel* src, __m128i& r, __m128i& g, __m128i& b) {
+      const __m128i ff = _mm_set1_epi32(0xff);
+      __m128i p0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+      __m128i p1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src+4));
+      b = _mm_packs_epi32(_mm_and_si128(p0, ff), _mm_and_si128(p1, ff));
+      g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 8), ff),
+                          _mm_and_si128(_mm_srli_epi32(p1, 8), ff));
+      r = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 16), ff),
+                          _mm_and_si128(_mm_srli_epi32(p1, 16), ff));
+    }
+
+    // Weighted sum of the channels (mod 2^16) plus a bias, >> 8
+    inline __m128i dot_sse2(__m128i r, __m128i g, __m128i b,
+                            int kr, int kg, int kb, int bias) {
+      __m128i t = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(short(kr))),
+                                _mm_mullo_epi16(g, _mm_set1_epi16(short(kg))));
+      t = _mm_add_epi16(t, _mm_mullo_epi16(b, _mm_set1_epi16(short(kb))));
+      return _mm_srli_epi16(_mm_add_epi16(t, _mm_set1_epi16(short(bias))), 8);
+    }
+
+    inline __m128i luma8_sse2(const pixel* src) {
+      __m128i r, g, b;
+      channels_sse2(src, r, g, b);
+      return _mm_add_epi16(dot_sse2(r, g, b, 66, 129, 25, 128), _mm_set1_epi16(16));
+    }
+
+    // Average of the 2x2 blocks of 8 columns (4 results, 32-bit lanes)
+    inline __m128i average4_sse2(__m128i c0, __m128i c1) {
+      __m128i sum = _mm_madd_epi16(_mm_add_epi16(c0, c1), _mm_set1_epi16(1));
+      return _mm_srli_epi32(_mm_add_epi32(sum, _mm_set1_epi32(2)), 2);
+    }
+
+    struct sse2_yuv {
+      static void y_row(const pixel* src, uint8_t* y, int n) {
+        int i = 0;
+        for (; i+16<=n; i+=16) {
+          __m128i y8 = _mm_packus_epi16(luma8_sse2(src+i), luma8_sse2(src+i+8));
+          _mm_storeu_si128(reinterpret_cast<__m128i*>(y+i), y8);
+        }
+        scalar_yuv::y_row(src+i, y+i, n-i);
+      }
+
+      // 16 columns (8 chroma samples) per iteration
+      static void uv_row(const pixel* row0, const pixel* row1,
+                         uint8_t* u, uint8_t* v, int n) {
+        int i = 0;
+        for (; i+16<=n; i+=16) {
+          __m128i r0, g0, b0, r1, g1, b1;
+          __m128i r, g, b;
+
+          channels_sse2(row0+i, r0, g0, b0);
+          channels_sse2(row1+i, r1, g1, b1);
+          __m128i ra = average4_sse2(r0, r1);
+          __m128i ga = average4_sse2(g0, g1);
+          __m128i ba = average4_sse2(b0, b1);
+
+          channels_sse2(row0+i+8, r0, g0, b0);
+          channels_sse2(row1+i+8, r1, g1, b1);
+          r = _mm_packs_epi32(ra, average4_sse2(r0, r1));
+          g = _mm_packs_epi32(ga, average4_sse2(g0, g1));
+          b = _mm_packs_epi32(ba, average4_sse2(b0, b1));
+
+          __m128i u8 = dot_sse2(r, g, b, -38, -74, 112, 128 + (128<<8));
+          __m128i v8 = dot_sse2(r, g, b, 112, -94, -18, 128 + (128<<8));
+          _mm_storel_epi64(reinterpret_cast<__m128i*>(u+i/2), _mm_packus_epi16(u8, u8));
+          _mm_storel_epi64(reinterpret_cast<__m128i*>(v+i/2), _mm_packus_epi16(v8, v8));
+        }
+        scalar_yuv::uv_row(row0+i, row1+i, u+i/2, v+i/2, n-i);
+      }
+    };
+
+    // Splits 16 pixels in 16-bit lanes of R, G and B. The lanes are
+    // in the order of _mm256_packs_epi32(): pixels 0-3, 8-11, 4-7,
+    // 12-15 (it doesn't matter while all the channels are the same)
+    UI_TARGET_AVX2 inline void channels_avx2(const pixel* src, __m256i& r, __m256i& g, __m256i& b) {
+      const __m256i ff = _mm256_set1_epi32(0xff);
+      __m256i p0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+      __m256i p1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src+8));
+      b = _mm256_packs_epi32(_mm256_and_si256(p0, ff), _mm256_and_si256(p1, ff));
+      g = _mm256_packs_epi32(_mm256_and_si256(_mm256_srli_epi32(p0, 8), ff),
+                             _mm256_and_si256(_mm256_srli_epi32(p1, 8), ff));
+      r = _mm256_packs_epi32(_mm256_and_si256(_mm256_srli_epi32(p0, 16), ff),
+                             _mm256_and_si256(_mm256_srli_epi32(p1, 16), ff));
+    }
+
+    UI_TARGET_AVX2 inline __m256i luma16_avx2(const pixel* src) {
+      __m256i r, g, b;
+      channels_avx2(src, r, g, b);
+      __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(r, _mm256_set1_epi16(66)),
+                                   _mm256_mullo_epi16(g, _mm256_set1_epi16(129)));
+      t = _mm256_add_epi16(t, _mm256_mullo_epi16(b, _mm256_set1_epi16(25)));
+      t = _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_set1_epi16(128)), 8);
+      t = _mm256_add_epi16(t, _mm256_set1_epi16(16));
+      return _mm256_permute4x64_epi64(t, 0xd8); // Pixels 0-15 in order
+    }
+
+    // Luma is 2/3 of the output, chroma uses the SSE2 kernel
+    struct avx2_yuv {
+      UI_TARGET_AVX2 static void y_row(const pixel* src, uint8_t* y, int n) {
+        int i = 0;
+        for (; i+32<=n; i+=32) {
+          __m256i y8 = _mm256_packus_epi16(luma16_avx2(src+i), luma16_avx2(src+i+16));
+          y8 = _mm256_permute4x64_epi64(y8, 0xd8);
+          _mm256_storeu_si256(reinterpret_cast<__m256i*>(y+i), y8);
+        }
+        sse2_yuv::y_row(src+i, y+i, n-i);
+      }
+
+      static void uv_row(const pixel* row0, const pixel* row1,
+                         uint8_t* u, uint8_t* v, int n) {
+        sse2_yuv::uv_row(row0, row1, u, v, n);
+      }
+    };
+
+#endif // UI_X86_SIMD
+
+  } // namespace yuv_details
+
+  struct yuv_kernels {
+    yuv_details::y_row_fn y_row;
+    yuv_details::uv_row_fn uv_row;
+  };
+
+  // Returns the conversion kernels of the given level (or of the best
+  // available level below it)
+  inline yuv_kernels yuv_kernels_for(simd_level level) {
+    using namespace yuv_details;
+    yuv_kernels k = { &scalar_yuv::y_row, &scalar_yuv::uv_row };
+#if UI_X86_SIMD
+    static const simd_level best = detect_simd_level();
+    if (level > best)
+      level = best;
+    if (level == simd_avx2) {
+      k.y_row = &avx2_yuv::y_row;
+      k.uv_row = &avx2_yuv::uv_row;
+    }
+    else if (level == simd_sse2) {
+      k.y_row = &sse2_yuv::y_row;
+      k.uv_row = &sse2_yuv::uv_row;
+    }
+#endif
+    return k;
+  }
+
+  // Size in bytes of a I420 frame (Y plane, then U and V planes of
+  // ((w+1)/2)*((h+1)/2) samples)
+  inline std::size_t yuv420_size(int width, int height) {
+    return std::size_t(width)*height + 2*std::size_t((width+1)/2)*((height+1)/2);
+  }
+
+  // Converts the bitmap to a I420 frame of yuv420_size() bytes, using
+  // the kernels of the current SIMD level (see set_simd_level())
+  inline void bgra_to_yuv420(const bitmap& src, uint8_t* dst) {
+    const yuv_kernels k = yuv_kernels_for(current_simd_level());
+    const int w = src.width(), h = src.height();
+    const int cw = (w+1)/2, ch = (h+1)/2;
+    uint8_t* y = dst;
+    uint8_t* u = y + std::size_t(w)*h;
+    uint8_t* v = u + std::size_t(cw)*ch;
+
+    for (int j=0; j<h; ++j)
+      k.y_row(src.row(j), y + std::size_t(w)*j, w);
+
+    for (int j=0; j<ch; ++j) {
+      const int y0 = j*2, y1 = std::min(y0+1, h-1);
+      k.uv_row(src.row(y0), src.row(y1),
+               u + std::size_t(cw)*j, v + std::size_t(cw)*j, w);
+    }
+  }
+
+} // namespace ui
+
+#endif // UI_YUV_HEADER_FILE_INCLUDED